@@ -0,0 +1,163 @@
+//  Stochastic enzyme kinetics: benchmark helpers
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_BENCHMARK
+#define SEK_BENCHMARK
+
+#include <chrono> // steady_clock, duration
+#include <string>
+#include <vector>
+#include <utility> // pair
+#include <ostream>
+#include <fstream> // ofstream
+#include <iostream> // cout, cerr
+#include <cstdio> // snprintf
+#include <cstdlib> // atoi
+#include <stdexcept> // runtime_error
+#include <ctime> // time, gmtime, strftime
+#include <algorithm> // max
+
+// Every benchmark program prints a JSON document with one record per measurement:
+//	{"suite": ..., "date": ..., "results": [{"name": ..., "params": {...}, "metrics": {...}}, ...]}
+// so that the results of different releases can be compared by a script.
+// Usage: <program> [output.json] [repetitions]
+
+namespace bench
+{
+	struct record
+	{
+		std::string name;
+		std::vector<std::pair<std::string, double>> params, metrics;
+	};
+
+	template <typename F>
+	double seconds_per_call(F&& f, double min_time = .2, std::size_t min_calls = 1)
+	// call f() repeatedly for at least min_time seconds (and min_calls times)
+	// return the average duration of a call in seconds
+	{
+		using clock = std::chrono::steady_clock;
+
+		std::size_t calls = 0;
+		auto start = clock::now();
+		double elapsed = 0;
+		do
+		{
+			f();
+			++calls;
+			elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		}
+		while (elapsed < min_time || calls < min_calls);
+		return elapsed / calls;
+	}
+
+	class report
+	// collect the records of a benchmark suite and write them as JSON
+	{
+		std::string suite;
+		std::vector<record> records;
+
+		static std::string number(double v)
+		{
+			char buf[32];
+			std::snprintf(buf, sizeof(buf), "%.6g", v);
+			return buf;
+		}
+
+		static void write_pairs(std::ostream& out, const std::vector<std::pair<std::string, double>>& pairs)
+		{
+			out << '{';
+			for (std::size_t i = 0; i < pairs.size(); ++i)
+				out << (i ? ", " : "") << '"' << pairs[i].first << "\": " << number(pairs[i].second);
+			out << '}';
+		}
+
+	public:
+
+		std::size_t repetitions = 1; // each measurement is the best of this number of repetitions
+		std::string path; // output file (standard output if empty)
+
+		report(std::string suite, int argc, char** argv)
+			: suite(std::move(suite))
+		// constructor
+		//	suite: name of the benchmark suite
+		//	argc, argv: command line arguments of the program (see above)
+		{
+			if (argc > 2)
+				repetitions = std::max(1, std::atoi(argv[2]));
+			if (argc > 1)
+				path = argv[1];
+		}
+
+		template <typename F>
+		double best(F&& f)
+		// return the minimum of `repetitions` measurements f()
+		{
+			double b = f();
+			for (std::size_t i = 1; i < repetitions; ++i)
+			{
+				double v = f();
+				b = v < b ? v : b;
+			}
+			return b;
+		}
+
+		void add(record r)
+		// add a record and print a one-line summary on the standard error
+		{
+			std::cerr << r.name;
+			for (const auto& [k, v] : r.params)
+				std::cerr << ' ' << k << '=' << number(v);
+			std::cerr << ':';
+			for (const auto& [k, v] : r.metrics)
+				std::cerr << ' ' << k << '=' << number(v);
+			std::cerr << '\n';
+			records.push_back(std::move(r));
+		}
+
+		void write(std::ostream& out) const
+		{
+			char date[32];
+			std::time_t now = std::time(nullptr);
+			std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+			out << "{\n  \"suite\": \"" << suite << "\",\n  \"date\": \"" << date << "\",\n  \"results\": [\n";
+			for (std::size_t i = 0; i < records.size(); ++i)
+			{
+				out << "    {\"name\": \"" << records[i].name << "\", \"params\": ";
+				write_pairs(out, records[i].params);
+				out << ", \"metrics\": ";
+				write_pairs(out, records[i].metrics);
+				out << (i+1 < records.size() ? "},\n" : "}\n");
+			}
+			out << "  ]\n}\n";
+		}
+
+		void write() const
+		// write to the output file (or standard output)
+		{
+			if (path.empty())
+			{
+				write(std::cout);
+				return;
+			}
+			std::ofstream out(path);
+			if (!out)
+				throw std::runtime_error("Cannot open the output file '" + path + "'.");
+			write(out);
+		}
+	};
+} // namespace bench
+
+#endif // SEK_BENCHMARK
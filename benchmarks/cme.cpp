@@ -0,0 +1,152 @@
+//  Stochastic enzyme kinetics: chemical master equation benchmarks
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/*
+
+Compilation (GCC/MinGW):
+g++ benchmarks/cme.cpp -o bench_cme -std=c++20 -Wall -Wextra -pedantic -O3 -march=native -fmax-errors=1 -pthread
+
+Usage:
+bench_cme [output.json] [repetitions]
+
+*/
+
+#include <string>
+#include <valarray>
+#include <thread> // hardware_concurrency
+#include <cstddef> // size_t
+
+#include "benchmark.hpp"
+#include "../include/sck/runge_kutta.hpp"
+#include "../include/sck/cme.hpp"
+#include "../include/sck/mixed.hpp"
+
+using model = cme::goldbeter_koshland<>;
+
+model make_model(long long ET, long long ST)
+// reduced Goldbeter-Koshland CME with the substrate initially unphosphorylated
+{
+	model sys(10, 8.3, 1.7, 10, 8.3, 1.7, ET, ET, ST);
+	sys.p = 0;
+	sys.p[sys.get_index({ST, 0, 0})] = 1;
+	sys.reduce_state_space();
+	return sys;
+}
+
+void bench_derivative(bench::report& rep, long long ET, long long ST)
+// evaluations of the right-hand side per second, with and without the assembled matrix, vs threads
+{
+	model sys = make_model(ET, ST);
+	const std::size_t n = sys.size();
+	const std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::valarray<double> dp(n);
+
+	for (bool assembled : {false, true})
+	{
+		if (assembled)
+			sys.assemble_generator();
+		else
+			sys.clear_generator();
+		for (std::size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+		{
+			sys.set_threads(n_threads);
+			double evals = rep.best([&]
+			{
+				return 1 / bench::seconds_per_call([&] { sys.derivative(sys.p, dp); }, .2, 10);
+			});
+			rep.add({"cme_rhs", {{"ET", double(ET)}, {"ST", double(ST)}, {"states", double(n)},
+				{"assembled", double(assembled)}, {"threads", double(n_threads)}},
+				{{"evals_per_s", evals}, {"states_per_s", evals * n}}});
+		}
+	}
+	sys.set_threads(1);
+}
+
+template <std::size_t Stages, typename T>
+std::size_t stages(const runge_kutta::runge_kutta<Stages, T>&) noexcept
+{
+	return Stages;
+}
+
+template <typename Integ>
+void bench_integrator(bench::report& rep, const std::string& name, long long ET, long long ST)
+// steps per second and memory per state of a fixed-step integrator (assembled matrix, 1 thread)
+{
+	Integ integ;
+	model sys = make_model(ET, ST);
+	const std::size_t n = sys.size();
+	const std::size_t n_stages = stages(integ);
+	const double dt = 1e-4;
+
+	double steps = rep.best([&]
+	{
+		return 1 / bench::seconds_per_call([&] { sys.step(integ, dt); }, .2, 5);
+	});
+	// the integrator keeps one buffer per stage plus the intermediate state
+	double bytes = double(sys.memory_usage() + (n_stages+1) * n * sizeof(double)) / n;
+	rep.add({"cme_step_" + name, {{"ET", double(ET)}, {"ST", double(ST)}, {"states", double(n)}, {"stages", double(n_stages)}},
+		{{"steps_per_s", steps}, {"rhs_evals_per_s", steps * n_stages}, {"bytes_per_state", bytes}}});
+}
+
+void bench_mixed(bench::report& rep, long long ET, long long ST)
+// RK4 steps per second with the probabilities and stages stored in double and in float
+// (see `mixed::compact_cme`), with and without the assembled matrix
+{
+	runge_kutta::rk4<> integ;
+	model sys = make_model(ET, ST);
+	const std::size_t n = sys.size();
+	const double dt = 1e-4;
+
+	for (bool assembled : {false, true})
+	{
+		if (assembled)
+			sys.assemble_generator();
+		else
+			sys.clear_generator();
+		double steps_double = rep.best([&]
+		{
+			return 1 / bench::seconds_per_call([&] { sys.step(integ, dt); }, .2, 5);
+		});
+		mixed::compact_cme compact(sys, integ);
+		double steps_float = rep.best([&]
+		{
+			return 1 / bench::seconds_per_call([&] { compact.step(dt); }, .2, 5);
+		});
+		rep.add({"cme_step_mixed", {{"ET", double(ET)}, {"ST", double(ST)}, {"states", double(n)}, {"assembled", double(assembled)}},
+			{{"steps_per_s_double", steps_double}, {"steps_per_s_float", steps_float}, {"speedup", steps_float / steps_double}}});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	bench::report rep("cme", argc, argv);
+
+	for (long long ST : {20, 60, 120})
+	{
+		long long ET = ST / 4;
+		bench_derivative(rep, ET, ST);
+		bench_integrator<runge_kutta::euler<>>(rep, "euler", ET, ST);
+		bench_integrator<runge_kutta::midpoint<>>(rep, "midpoint", ET, ST);
+		bench_integrator<runge_kutta::ralston2<>>(rep, "ralston2", ET, ST);
+		bench_integrator<runge_kutta::rk4<>>(rep, "rk4", ET, ST);
+		bench_integrator<runge_kutta::ralston4<>>(rep, "ralston4", ET, ST);
+		bench_integrator<runge_kutta::butcher6<>>(rep, "butcher6", ET, ST);
+		bench_integrator<runge_kutta::verner8<>>(rep, "verner8", ET, ST);
+		bench_mixed(rep, ET, ST);
+	}
+
+	rep.write();
+}
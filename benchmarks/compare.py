@@ -0,0 +1,54 @@
+'''
+    Stochastic enzyme kinetics: compare two benchmark results
+    Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+# Usage: python compare.py baseline.json current.json [threshold]
+# Prints the relative change of every metric which is present in both files, and exits with
+# status 1 if a throughput metric (*_per_s) decreased, or a memory metric (bytes_*) increased,
+# by more than the threshold (default 0.1, i.e. 10%).
+
+import json
+import sys
+
+def load(path):
+	with open(path) as f:
+		results = json.load(f)['results']
+	return {(r['name'], tuple(sorted(r['params'].items()))): r['metrics'] for r in results}
+
+baseline = load(sys.argv[1])
+current = load(sys.argv[2])
+threshold = float(sys.argv[3]) if len(sys.argv) > 3 else .1
+
+regressions = 0
+for key, metrics in current.items():
+	if key not in baseline:
+		continue
+	name, params = key
+	for metric, value in metrics.items():
+		old = baseline[key].get(metric)
+		if not old:
+			continue
+		change = value / old - 1
+		worse = -change if metric.endswith('_per_s') else change if metric.startswith('bytes_') else 0
+		flag = ''
+		if worse > threshold:
+			flag = '  <-- regression'
+			regressions += 1
+		print(f"{name} {dict(params)} {metric}: {old:.6g} -> {value:.6g} ({change:+.1%}){flag}")
+
+print(f"{regressions} regression(s) above {threshold:.0%}")
+sys.exit(1 if regressions else 0)
@@ -0,0 +1,147 @@
+//  Stochastic enzyme kinetics: Gillespie algorithm benchmarks
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/*
+
+Compilation (GCC/MinGW):
+g++ benchmarks/gillespie.cpp -o bench_gillespie -std=c++20 -Wall -Wextra -pedantic -O3 -march=native -fmax-errors=1 -pthread
+
+Usage:
+bench_gillespie [output.json] [repetitions]
+
+*/
+
+#include <string>
+#include <thread> // hardware_concurrency
+#include <cstddef> // size_t
+
+#include "benchmark.hpp"
+#include "../include/sck/gillespie.hpp"
+#include "../include/sck/next_reaction.hpp"
+#include "../include/sck/lockstep.hpp"
+
+template <typename Engine, typename Reset>
+double events_per_second(Engine& engine, Reset&& reset, std::size_t n_events)
+// events per second of engine.step(), restarting with reset() when no reaction is possible
+{
+	double s = bench::seconds_per_call([&]
+	{
+		for (std::size_t i = 0; i < n_events; ++i)
+			if (!engine.step())
+				reset();
+	});
+	return n_events / s;
+}
+
+template <typename Model>
+void bench_ssa(bench::report& rep, const std::string& name, Model model, long long ET, long long ST, std::size_t n_events = 1'000'000)
+// direct method and Next Reaction Method on the same model
+{
+	auto reset = [](auto& m)
+	{
+		m.x = 0;
+		m.t = 0;
+	};
+	reset(model);
+	double direct = rep.best([&]
+	{
+		return events_per_second(model, [&] { reset(model); }, n_events);
+	});
+
+	gillespie::next_reaction<Model> nrm(model);
+	reset(nrm.model);
+	double next = rep.best([&]
+	{
+		return events_per_second(nrm, [&] { reset(nrm.model); }, n_events);
+	});
+
+	rep.add({"ssa_" + name, {{"ET", double(ET)}, {"ST", double(ST)}},
+		{{"direct_events_per_s", direct}, {"nrm_events_per_s", next}}});
+}
+
+void bench_ensemble(bench::report& rep, long long ET, long long ST, std::size_t n_trajectories = 2'000)
+// trajectories per second of `parallel_ensemble` vs number of threads
+{
+	double kf = 10, kb = 9, kcat = 1;
+	gillespie::single_substrate sys(kf, kb, kcat, ET, ST);
+	const std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	double t1 = 0;
+	for (std::size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+	{
+		parallel::thread_pool pool(n_threads);
+		double traj = rep.best([&]
+		{
+			double s = bench::seconds_per_call([&]
+			{
+				gillespie::ensemble_stats<2> stats({1, 2, 4}, {std::size_t(ET+1), std::size_t(ST+1)});
+				gillespie::parallel_ensemble(pool, sys, stats, 0, n_trajectories, 1);
+			});
+			return n_trajectories / s;
+		});
+		if (n_threads == 1)
+			t1 = traj;
+		rep.add({"ensemble_single_substrate", {{"ET", double(ET)}, {"ST", double(ST)}, {"threads", double(n_threads)}},
+			{{"trajectories_per_s", traj}, {"speedup", traj / t1}}});
+	}
+}
+
+template <typename Model>
+void bench_lockstep(bench::report& rep, const std::string& name, const Model& model, const physics::vec<long long, Model::num_species>& x0,
+	long long ET, long long ST, std::size_t n_trajectories = 2'000)
+// trajectories per second on one thread of the scalar and the lockstep ensembles
+{
+	parallel::thread_pool pool(1);
+	auto run = [&](auto&& ensemble)
+	{
+		return rep.best([&]
+		{
+			double s = bench::seconds_per_call([&]
+			{
+				gillespie::ensemble_stats<Model::num_species> stats({1, 2, 4});
+				ensemble(stats);
+			});
+			return n_trajectories / s;
+		});
+	};
+	double scalar = run([&](auto& stats) { gillespie::parallel_ensemble(pool, model, stats, x0, n_trajectories, 1); });
+	double lanes4 = run([&](auto& stats) { gillespie::parallel_lockstep_ensemble<4>(pool, model, stats, x0, n_trajectories, 1); });
+	double lanes8 = run([&](auto& stats) { gillespie::parallel_lockstep_ensemble<8>(pool, model, stats, x0, n_trajectories, 1); });
+	rep.add({"lockstep_" + name, {{"ET", double(ET)}, {"ST", double(ST)}},
+		{{"scalar_trajectories_per_s", scalar}, {"lanes4_trajectories_per_s", lanes4}, {"lanes8_trajectories_per_s", lanes8}}});
+}
+
+int main(int argc, char** argv)
+{
+	bench::report rep("gillespie", argc, argv);
+
+	for (long long ST : {10, 100, 1000})
+	{
+		long long ET = 10;
+		bench_ssa(rep, "single_substrate", gillespie::single_substrate(10., 9., 1., ET, ST), ET, ST);
+		bench_ssa(rep, "single_substrate_tqssa", gillespie::single_substrate_tqssa(1., 1., ET, ST), ET, ST);
+		bench_ssa(rep, "goldbeter_koshland", gillespie::goldbeter_koshland(10., 8.3, 1.7, 10., 8.3, 1.7, ET, ET, ST), ET, ST);
+	}
+	for (long long ST : {10, 100})
+		bench_ensemble(rep, 10, ST);
+	for (long long ST : {10, 100})
+	{
+		bench_lockstep(rep, "single_substrate_tqssa", gillespie::single_substrate_tqssa(1., 1., 10, ST), {0}, 10, ST);
+		bench_lockstep(rep, "single_substrate", gillespie::single_substrate(10., 9., 1., 10, ST), {0, 0}, 10, ST);
+	}
+
+	rep.write();
+}
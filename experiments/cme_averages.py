@@ -41,13 +41,12 @@ c['sQSSA'] = cme.single_substrate_sqssa(kM=kM, kcat=kcat, ET=ET, ST=ST)
 avePs = {}
 msqPs = {}
 ts = {}
-marginal_axes = {'Exact': (int(c['Exact'].species.C)+1), 'tQSSA': (), 'sQSSA': ()}
 max_t = 9
 possible_Ps = np.arange(0, ST+1)
 
 for s in sim:
-	prob, ts[s] = c[s].simulate(dt=1e-4, t_final=max_t, n_sampling=100)
-	marginal_prob = np.sum(prob, axis=marginal_axes[s])
+	marginals, ts[s] = c[s].simulate_marginals(dt=1e-4, t_final=max_t, n_sampling=100)
+	marginal_prob = marginals[int(c[s].species.P)]
 	avePs[s] = np.tensordot(marginal_prob, possible_Ps, axes=1)
 	msqPs[s] = np.tensordot(marginal_prob, possible_Ps**2, axes=1)
 
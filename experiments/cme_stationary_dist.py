@@ -53,15 +53,13 @@ for s in sim:
 init_conditions['tQSSA'][ST//2] = 1
 init_conditions['sQSSA'][ST//2] = 1
 
-max_t = 10
 ave = {}
 msq = {}
 possible_SP_hats = np.arange(0, ST+1)
 
 for s in sim:
 	c[s].p = init_conditions[s]
-	c[s].t = 0
-	c[s].simulate(dt=1e-3, t_final=max_t, noreturn=True)
+	c[s].stationary()
 	SP_hat_dists[s] = c[s].p
 	ave[s] = np.dot(c[s].p, possible_SP_hats)
 	msq[s] = np.dot(c[s].p, possible_SP_hats**2)
@@ -44,16 +44,14 @@ init_conditions = {'Exact': [0, 0], 'tQSSA': [0], 'sQSSA': [0]}
 max_t = 9
 
 ndiv = max_t*50 + 1
-bins = np.linspace(0, max_t, ndiv)
+t = np.linspace(0, max_t, ndiv)
 
 for s in sim:
 	for _ in range(n_simulations):
 		g[s].x = init_conditions[s]
 		g[s].t = 0
-		x, t = g[s].simulate(t_final=max_t)
-		dprods = np.diff(x[:,g[s].species.P])
-		dhist, _ = np.histogram(t[1:], bins, weights=dprods)
-		hists[s].append(np.cumsum(dhist))
+		x, _ = g[s].sample(t_grid=t)
+		hists[s].append(x[:,g[s].species.P])
 	hists[s] = np.array(hists[s])
 
 avePs = {}
@@ -62,8 +60,6 @@ for s in sim:
 	avePs[s] = np.sum(hists[s], axis=0) / hists[s].shape[0]
 	msqPs[s] = np.sum(hists[s]**2, axis=0) / hists[s].shape[0]
 
-t = (bins[1:] + bins[:-1])/2
-
 for s in sim:
 	error = np.sqrt(np.maximum(msqPs[s] - avePs[s]**2, 0))
 
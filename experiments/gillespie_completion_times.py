@@ -41,19 +41,12 @@ g['sQSSA'] = gillespie.single_substrate_sqssa(kM=kM, kcat=kcat, ET=ET, ST=ST)
 n_simulations = 20000
 max_t = 20
 
-completion_times = {
-	'Exact': np.empty((n_simulations,)),
-	'tQSSA': np.empty((n_simulations,)),
-	'sQSSA': np.empty((n_simulations,))
-}
+completion_times = {}
 init_conditions = {'Exact': [0, 0], 'tQSSA': [0], 'sQSSA': [0]}
+final_states = {'Exact': [0, ST], 'tQSSA': [ST], 'sQSSA': [ST]}
 
 for s in sim:
-	for i in range(n_simulations):
-		g[s].x = init_conditions[s]
-		g[s].t = 0
-		g[s].simulate(t_final=max_t, noreturn=True)
-		completion_times[s][i] = g[s].t
+	completion_times[s] = g[s].hitting_times(x0=init_conditions[s], target=final_states[s], n_trajectories=n_simulations, t_final=max_t)
 
 for s in sim:
 	print(s, np.mean(completion_times[s]), '+/-', np.std(completion_times[s]))
@@ -0,0 +1,155 @@
+//  Stochastic enzyme kinetics: binary checkpoints
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_CHECKPOINT
+#define SEK_CHECKPOINT
+
+#include <cstdint> // uint32_t, uint64_t
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <cstring> // memcmp
+#include <string>
+#include <stdexcept> // runtime_error
+#include <type_traits> // is_trivially_copyable_v
+
+// A checkpoint is a header followed by the raw values of the saved object, in native byte order:
+//	char magic[8] = "SEKCKPT", uint32 version, uint32 kind
+// Arrays are stored as a uint64 number of elements followed by the elements, so that a whole
+// probability vector is written with a single call. Floating-point values are stored bitwise,
+// so a restored simulation continues exactly as the original one.
+
+namespace checkpoint
+{
+	enum class kind : std::uint32_t {cme = 1, gillespie = 2, integrator = 3};
+
+	inline constexpr std::uint32_t version = 1;
+	inline constexpr char magic[8] = "SEKCKPT";
+
+	class writer
+	// stream a checkpoint into an output stream (opened in binary mode)
+	{
+		std::ostream& out;
+
+	public:
+
+		writer(std::ostream& out, kind k)
+			: out(out)
+		// constructor: write the header
+		//	out: output stream
+		//	k: kind of the saved object
+		{
+			out.write(magic, sizeof(magic));
+			write(version);
+			write(std::uint32_t(k));
+		}
+
+		template <typename V>
+		requires std::is_trivially_copyable_v<V>
+		void write(const V& v)
+		// write a single value
+		{
+			write(&v, 1, false);
+		}
+
+		template <typename V>
+		requires std::is_trivially_copyable_v<V>
+		void write(const V* data, std::size_t n, bool with_size = true)
+		// write n contiguous values (preceded by their number, if with_size is true)
+		{
+			if (with_size)
+				write(std::uint64_t(n));
+			out.write(reinterpret_cast<const char*>(data), n * sizeof(V));
+			if (!out)
+				throw std::runtime_error("Cannot write the checkpoint.");
+		}
+
+		template <typename V>
+		void write(const std::vector<V>& v)
+		{
+			write(v.data(), v.size());
+		}
+	};
+
+	class reader
+	// read a checkpoint from an input stream (opened in binary mode)
+	// All the functions throw std::runtime_error if the checkpoint is truncated or does not match.
+	{
+		std::istream& in;
+
+	public:
+
+		reader(std::istream& in, kind k)
+			: in(in)
+		// constructor: read and check the header
+		//	in: input stream
+		//	k: expected kind of the saved object
+		{
+			char m[sizeof(magic)];
+			in.read(m, sizeof(m));
+			if (!in || std::memcmp(m, magic, sizeof(magic)) != 0)
+				throw std::runtime_error("The stream does not contain a checkpoint.");
+			if (read<std::uint32_t>() != version)
+				throw std::runtime_error("Unsupported checkpoint version.");
+			if (read<std::uint32_t>() != std::uint32_t(k))
+				throw std::runtime_error("The checkpoint contains a different kind of object.");
+		}
+
+		void expect(bool condition, const std::string& what) const
+		// throw if condition is false, with a message about what does not match
+		{
+			if (!condition)
+				throw std::runtime_error("The checkpoint does not match: " + what + ".");
+		}
+
+		template <typename V>
+		requires std::is_trivially_copyable_v<V>
+		V read()
+		// read a single value
+		{
+			V v;
+			read(&v, 1, false);
+			return v;
+		}
+
+		template <typename V>
+		requires std::is_trivially_copyable_v<V>
+		void read(V* data, std::size_t n, bool with_size = true)
+		// read n contiguous values (checking their number, if with_size is true)
+		{
+			if (with_size)
+				expect(read<std::uint64_t>() == n, "array size");
+			in.read(reinterpret_cast<char*>(data), n * sizeof(V));
+			if (!in)
+				throw std::runtime_error("The checkpoint is truncated.");
+		}
+
+		std::uint64_t size()
+		// read the number of elements of the next array (then call read with with_size = false)
+		{
+			return read<std::uint64_t>();
+		}
+
+		template <typename V>
+		void read(std::vector<V>& v)
+		{
+			v.resize(size());
+			read(v.data(), v.size(), false);
+		}
+	};
+} // namespace checkpoint
+
+#endif // SEK_CHECKPOINT
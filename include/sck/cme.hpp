@@ -18,15 +18,29 @@
 #define SEK_CME
 
 #include <valarray>
-#include <concepts> // floating_point
-#include <stdexcept> // out_of_range
+#include <concepts> // floating_point, invocable
+#include <stdexcept> // out_of_range, domain_error, invalid_argument
 #include <array>
-#include <algorithm> // max, min
+#include <algorithm> // max, min, upper_bound, fill, copy, sort, unique, set_difference, inplace_merge
 #include <vector>
-#include <cmath> // sqrt
+#include <cmath> // sqrt, abs, exp, ceil
 #include <string>
+#include <utility> // pair, swap
+#include <memory> // shared_ptr, make_shared, unique_ptr
+#include <iterator> // back_inserter
+#include <type_traits> // is_void_v, is_same_v, conditional_t, remove_cvref_t, invoke_result_t, is_invocable_r_v
+#include <cstdint> // uint8_t, uint64_t
+#include <istream>
+#include <ostream>
 
 #include "tensor.hpp"
+#include "sparse.hpp"
+#include "krylov.hpp"
+#include "thread_pool.hpp"
+#include "checkpoint.hpp"
+#include "network.hpp"
+#include "lookup.hpp"
+#include "counters.hpp"
 
 namespace cme
 {
@@ -37,30 +51,132 @@ namespace cme
 		std::vector<T> t;
 	};
 
-	template <std::size_t N_s, std::size_t N_r, std::floating_point T = double>
+	enum class storage
+	// probabilities allocated by the constructor of a CME system
+	{
+		full, // the whole box, with probability 1 at the state with zero population numbers
+		none // no probabilities (as after `release_state`), e.g. for the models of `distributed::slab_cme`
+	};
+
+	template <std::size_t N_s, std::size_t N_r, std::floating_point T = double, typename Model = void>
 	requires (N_r > 0 && N_s > 0)
 	// N_s: number of substances (chemical species)
 	// N_r: number of reaction channels
 	// T: underlying floating-point type
+	// Model: the derived class, if its propensity functions are final (they are called without
+	//	virtual dispatch, so that they can be inlined in the inner loops), or void
 	class cme
 	// General chemical master equation (CME) solver
 	{
-		static constexpr std::size_t moments_max_order = 3;
-
 		std::array<long long, N_s> n_max;
-		mutable physics::vec<long long, N_s> x;
-		mutable std::array<std::array<T, moments_max_order+1>, N_s> m;
+		mutable std::array<std::valarray<T>, N_s> marg; // marginal distributions (the moments are computed from them)
 		std::valarray<T> dp;
+		// reduced state space: the stored states are runs of consecutive states of the box.
+		// The k-th run starts at box index run_box[k] and at state index run_start[k].
+		// Both are empty if the whole box is stored.
+		std::vector<std::size_t> run_box, run_start;
+		mutable std::valarray<T> diag; // diagonal of the transition-rate matrix (empty if not computed yet)
+		sparse::csr_matrix<T> generator; // assembled transition-rate matrix (empty if not assembled)
+		std::shared_ptr<parallel::thread_pool> pool; // threads for the time derivative (null for serial)
 		mutable bool calculated_stats = false;
 
-		long long n_elems() const noexcept
+		std::size_t box_elems() const noexcept
+		// number of states inside the box defined by n_max
 		{
-			long long n = 1;
+			std::size_t n = 1;
 			for (std::size_t i = 0; i < N_s; ++i)
 				n *= n_max[i];
 			return n;
 		}
 
+		std::size_t n_elems() const noexcept
+		// number of stored states
+		{
+			return reduced() ? run_start.back() : box_elems();
+		}
+
+		std::size_t box_index(const std::array<long long, N_s>& y) const noexcept
+		// get box index from population numbers y
+		{
+			long long index = 0;
+			for (std::size_t i = 0; i < N_s; ++i)
+				index = index*n_max[i] + y[i];
+			return index;
+		}
+
+		std::array<long long, N_s> box_pop(std::size_t index) const noexcept
+		// get population numbers from box index
+		{
+			std::array<long long, N_s> y;
+			for (std::size_t i = N_s; i --> 0; )
+			{
+				y[i] = index % n_max[i];
+				index /= n_max[i];
+			}
+			return y;
+		}
+
+		std::size_t box_to_state(std::size_t b) const noexcept
+		// get the state index of the box index b (n_elems() if it is not stored)
+		{
+			if (!reduced())
+				return b;
+			auto it = std::upper_bound(run_box.begin(), run_box.end(), b);
+			if (it == run_box.begin())
+				return n_elems();
+			std::size_t k = it - run_box.begin() - 1;
+			std::size_t i = run_start[k] + (b - run_box[k]);
+			return i < run_start[k+1] ? i : n_elems();
+		}
+
+		std::size_t state_to_box(std::size_t i) const noexcept
+		// get the box index of the state index i
+		{
+			if (!reduced())
+				return i;
+			std::size_t k = std::upper_bound(run_start.begin(), run_start.end()-1, i) - run_start.begin() - 1;
+			return run_box[k] + (i - run_start[k]);
+		}
+
+		template <typename F>
+		void for_each_state(F&& f) const
+		// call f(i, y) for every stored state, where i is the state index and y the population numbers
+		{
+			physics::vec<long long, N_s> y;
+			if (!reduced())
+			{
+				std::size_t n = n_elems();
+				y = 0;
+				for (std::size_t i = 0; i < n; ++i)
+				{
+					f(i, static_cast<const physics::vec<long long, N_s>&>(y));
+					next_pop(y);
+				}
+				return;
+			}
+			for (std::size_t k = 0; k < run_box.size(); ++k)
+			{
+				static_cast<std::array<long long, N_s>&>(y) = box_pop(run_box[k]);
+				for (std::size_t i = run_start[k]; i < run_start[k+1]; ++i)
+				{
+					f(i, static_cast<const physics::vec<long long, N_s>&>(y));
+					next_pop(y);
+				}
+			}
+		}
+
+		void next_pop(physics::vec<long long, N_s>& y) const noexcept
+		// advance the population numbers y to the next state in row-major order
+		{
+			++y[N_s-1];
+			for (std::size_t j = N_s; j --> 1; )
+				if (y[j] == n_max[j])
+				{
+					y[j] = 0;
+					++y[j-1];
+				}
+		}
+
 		bool out_of_bounds(const physics::vec<long long, N_s>& y) const noexcept
 		{
 			for (std::size_t i = 0; i < N_s; ++i)
@@ -69,38 +185,183 @@ namespace cme
 			return false;
 		}
 
-		void calc_moments() const noexcept
-		// compute moments up to prefixed order
+		const std::conditional_t<std::is_void_v<Model>, cme, Model>& derived() const noexcept
+		// this object as the derived class (if known)
 		{
+			return static_cast<const std::conditional_t<std::is_void_v<Model>, cme, Model>&>(*this);
+		}
+
+		T rate(const physics::vec<long long, N_s>& y, std::size_t r_i) const
+		// propensity function of the reaction channel r_i at the population numbers y,
+		// statically dispatched to the model when it is known
+		{
+			if constexpr (std::is_void_v<Model>)
+				return a(y, r_i);
+			else
+				return static_cast<const Model&>(*this).Model::a(y, r_i);
+		}
+
+		template <typename P, typename D>
+		void derivative_range(const P* p, D* dp, std::size_t begin, std::size_t end) const
+		// compute the time derivative dp of the probabilities p for the states in [begin, end)
+		// without using the assembled transition-rate matrix, when the whole box is stored.
+		// The states are visited in contiguous runs along the last species, so that the
+		// bounds are checked once per run and the products with p are vectorizable loops.
+		// If dp is stored with another precision, each run is accumulated with T before being stored.
+		{
+			using std::size_t;
+
+			constexpr size_t last = N_s-1;
+			const long long n_last = n_max[last];
+			std::array<long long, N_r> offset; // index difference between a state and its source state
+			for (size_t r_i = 0; r_i < N_r; ++r_i)
+				offset[r_i] = get_offset(nu[r_i]);
+			std::vector<T> w(n_last); // propensities along a run
+			std::vector<T> acc(std::is_same_v<D, T> ? 0 : n_last); // derivative along a run (mixed precision)
+
+			physics::vec<long long, N_s> y;
+			static_cast<std::array<long long, N_s>&>(y) = box_pop(begin);
+			for (size_t i = begin; i < end; )
+			{
+				const long long y0 = y[last];
+				const long long len = std::min<long long>(end - i, n_last - y0);
+				T* out;
+				if constexpr (std::is_same_v<D, T>)
+					out = dp + i;
+				else
+					out = acc.data();
+				const P* p_run = p + i;
+
+				for (long long l = 0; l < len; ++l)
+					out[l] = 0;
+				for (size_t r_i = 0; r_i < N_r; ++r_i)
+				{
+					// propensity function tabulated along the last species (see `lookup::propensity_table`)
+					const T* column = nullptr;
+					if constexpr (N_s == 1 && requires (const Model& m) { m.propensity_column(r_i); })
+						column = static_cast<const Model&>(*this).propensity_column(r_i);
+
+					// probability flowing in from the source states y - nu
+					physics::vec<long long, N_s> z = y - nu[r_i];
+					bool in_bounds = true;
+					for (size_t s = 0; s < last; ++s)
+						if (z[s] < 0 || z[s] >= n_max[s])
+							in_bounds = false;
+					if (in_bounds)
+					{
+						const long long z0 = z[last];
+						const long long lo = std::max(0LL, -z0), hi = std::min(len, n_last - z0);
+						const long long src = (long long)i - offset[r_i]; // index of the source of y
+						if (column)
+							for (long long l = lo; l < hi; ++l)
+								out[l] += column[z0 + l] * p[src + l];
+						else
+						{
+							for (long long l = lo; l < hi; ++l)
+							{
+								z[last] = z0 + l;
+								w[l] = rate(z, r_i);
+							}
+							for (long long l = lo; l < hi; ++l)
+								out[l] += w[l] * p[src + l];
+						}
+					}
+					// probability flowing out of the states y
+					const T* w_out = column ? column + y0 : w.data();
+					if (!column)
+					{
+						z = y;
+						for (long long l = 0; l < len; ++l)
+						{
+							z[last] = y0 + l;
+							w[l] = rate(z, r_i);
+						}
+					}
+					for (long long l = 0; l < len; ++l)
+						out[l] -= w_out[l] * p_run[l];
+				}
+				if constexpr (!std::is_same_v<D, T>)
+					for (long long l = 0; l < len; ++l)
+						dp[i + l] = D(out[l]);
+				i += len;
+				y[last] = y0 + len - 1;
+				next_pop(y);
+			}
+		}
+
+		template <typename P, typename D>
+		void derivative_reduced_range(const P* p, D* dp, std::size_t begin, std::size_t end) const
+		// compute the time derivative dp of the probabilities p for the states in [begin, end)
+		// without using the assembled transition-rate matrix, when the state space is reduced.
+		// The states are looked up one by one, so it is much slower than the assembled matrix.
+		{
+			using std::size_t;
+
+			const size_t n = n_elems();
+			for (size_t i = begin; i < end; ++i)
+			{
+				physics::vec<long long, N_s> y;
+				static_cast<std::array<long long, N_s>&>(y) = get_pop(i);
+				T out = 0;
+				for (size_t r_i = 0; r_i < N_r; ++r_i)
+				{
+					physics::vec<long long, N_s> z = y - nu[r_i];
+					if (!out_of_bounds(z))
+					{
+						size_t j = box_to_state(box_index(z));
+						if (j < n)
+							out += rate(z, r_i) * p[j];
+					}
+					out -= rate(y, r_i) * p[i];
+				}
+				dp[i] = D(out);
+			}
+		}
+
+		void calc_marginals() const
+		// compute the marginal distributions of all the species in a single pass over p
+		{
+			using std::size_t;
+
 			if (calculated_stats)
 				return;
-			using std::size_t;
-			size_t n = n_elems();
 			for (size_t j = 0; j < N_s; ++j)
 			{
-				m[j][0] = 1;
-				for (size_t i = 1; i <= moments_max_order; ++i)
-					m[j][i] = 0;
+				if (marg[j].size() != size_t(n_max[j]))
+					marg[j].resize(n_max[j]);
+				marg[j] = 0;
 			}
-			x = 0;
-			for (size_t pop_i = 0; pop_i < n; ++pop_i)
+			if (reduced())
+				for_each_state([this](size_t pop_i, const physics::vec<long long, N_s>& y)
+				{
+					for (size_t j = 0; j < N_s; ++j)
+						marg[j][y[j]] += p[pop_i];
+				});
+			else
 			{
-				for (size_t j = 0; j < N_s; ++j)
+				// the states along the last axis are contiguous: the other species are constant
+				// within each line, so they get the sum of the line
+				const size_t n = n_elems(), line = n_max[N_s-1];
+				std::valarray<T>& last = marg[N_s-1];
+				physics::vec<long long, N_s> y;
+				y = 0;
+				for (size_t o = 0; o < n; o += line)
 				{
-					long long xn = 1;
-					for (size_t i = 1; i <= moments_max_order; ++i)
+					T line_sum = 0;
+					for (size_t i = 0; i < line; ++i)
 					{
-						xn *= x[j];
-						m[j][i] += p[pop_i] * xn;
+						last[i] += p[o+i];
+						line_sum += p[o+i];
 					}
-				}
-				++x[N_s-1];
-				for (size_t j = N_s; j --> 1; )
-					if (x[j] == n_max[j])
+					for (size_t j = 0; j+1 < N_s; ++j)
+						marg[j][y[j]] += line_sum;
+					for (size_t j = N_s-1; j --> 0; )
 					{
-						x[j] = 0;
-						++x[j-1];
+						if (++y[j] < n_max[j])
+							break;
+						y[j] = 0;
 					}
+				}
 			}
 			calculated_stats = true;
 		}
@@ -114,15 +375,17 @@ namespace cme
 		std::valarray<T> p;
 		T t = 0;
 
-		cme(const std::array<long long, N_s>& n_max)
+		cme(const std::array<long long, N_s>& n_max, storage st = storage::full)
 			: n_max(n_max)
 		// constructor
 		//	n_max: max population numbers (we must consider a finite number of possible states to make the problem computable)
-		//	dt: integration time step
+		//	st: probabilities to allocate (see `storage`)
 		{
 			for (std::size_t i = 0; i < N_s; ++i)
 				if (n_max[i] <= 0)
 					throw std::out_of_range("The maximum population numbers must be greater than 0.");
+			if (st == storage::none)
+				return;
 			p.resize(n_elems(), 0);
 			dp.resize(n_elems());
 			p[0] = 1;
@@ -135,25 +398,387 @@ namespace cme
 			return n_max[i];
 		}
 
+		const std::array<physics::vec<long long, N_s>, N_r>& stoichiometry() const noexcept
+		// return the stoichiometric vectors of the reaction channels
+		{
+			return nu;
+		}
+
+		long long get_offset(const std::array<long long, N_s>& dy) const noexcept
+		// get the index difference corresponding to a difference dy in population numbers
+		{
+			long long offset = 0;
+			for (std::size_t i = 0; i < N_s; ++i)
+				offset = offset*n_max[i] + dy[i];
+			return offset;
+		}
+
+		void set_threads(std::size_t n_threads)
+		// set the number of threads used to compute the time derivative (0 for the number of hardware threads)
+		{
+			if (n_threads == 1)
+				pool.reset();
+			else
+				pool = std::make_shared<parallel::thread_pool>(n_threads);
+		}
+
+		std::size_t get_threads() const noexcept
+		// get the number of threads used to compute the time derivative
+		{
+			return pool ? pool->size() : 1;
+		}
+
+		void derivative(const std::valarray<T>& p, std::valarray<T>& dp) const
+		// compute the time derivative dp of the probabilities p as dictated by the CME.
+		// The state space is split into chunks which are computed in parallel.
+		{
+			derivative(&p[0], &dp[0]);
+		}
+
+		template <typename P, typename D>
+		void derivative(const P* p, D* dp) const
+		// same as above for size() probabilities stored in arrays, possibly with another precision
+		// than T (e.g. float, see `mixed::compact_cme`): the derivative is accumulated with T
+		{
+			instrument::scoped_timer timer(instrument::timer::cme_derivative);
+			instrument::add(instrument::counter::rhs_evaluations);
+			constexpr std::size_t chunk = 1 << 14;
+			std::size_t n = n_elems();
+			if (pool)
+				pool->parallel_for(n, chunk, [&](std::size_t, std::size_t begin, std::size_t end)
+				{
+					if (assembled())
+						generator.multiply(p, dp, begin, end);
+					else if (reduced())
+						derivative_reduced_range(p, dp, begin, end);
+					else
+						derivative_range(p, dp, begin, end);
+				});
+			else if (assembled())
+				generator.multiply(p, dp);
+			else if (reduced())
+				derivative_reduced_range(p, dp, 0, n);
+			else
+				derivative_range(p, dp, 0, n);
+		}
+
 		std::size_t get_index(const std::array<long long, N_s>& y) const noexcept
 		// get index from population numbers y
+		// if the state space is reduced and y is not stored, return the number of stored states
 		{
-			long long index = 0;
-			for (std::size_t i = 0; i < N_s; ++i)
-				index = index*n_max[i] + y[i];
-			return index;
+			return box_to_state(box_index(y));
 		}
 
 		std::array<long long, N_s> get_pop(std::size_t index) const noexcept
 		// get population numbers from index
 		{
-			std::array<long long, N_s> y;
-			for (std::size_t i = N_s; i --> 0; )
+			return box_pop(state_to_box(index));
+		}
+
+		std::size_t size() const noexcept
+		// return the number of stored states
+		{
+			return n_elems();
+		}
+
+		std::size_t box_size() const noexcept
+		// return the number of states inside the box defined by the max population numbers
+		{
+			return box_elems();
+		}
+
+		bool reduced() const noexcept
+		// return whether the state space is reduced
+		{
+			return !run_start.empty();
+		}
+
+		virtual bool reachable(const physics::vec<long long, N_s>&) const
+		// return whether population numbers satisfy the constraints of the model
+		// (e.g. conservation laws), so that they must be stored in a reduced state space
+		{
+			return true;
+		}
+
+		void reduce_state_space()
+		// store only the states of the box for which `reachable` returns true, so that memory
+		// and computational time scale with the number of reachable states.
+		// The probabilities of the other states are discarded and the transition-rate matrix
+		// is assembled (see `assemble_generator`).
+		// Python bindings and probabilities stored with `simulate` use the stored states
+		// (see `expand` to get the probabilities of the whole box).
+		{
+			using std::size_t;
+
+			if (reduced())
+				return;
+			size_t n = box_elems(), m = 0;
+			bool prev = false;
+			physics::vec<long long, N_s> y = 0;
+			std::vector<size_t> r_box, r_start;
+			for (size_t b = 0; b < n; ++b)
 			{
-				y[i] = index % n_max[i];
-				index /= n_max[i];
+				bool keep = reachable(y);
+				if (keep)
+				{
+					if (!prev)
+					{
+						r_box.push_back(b);
+						r_start.push_back(m);
+					}
+					p[m++] = p[b]; // m <= b, so compaction can be done in-place
+				}
+				prev = keep;
+				next_pop(y);
 			}
-			return y;
+			if (m == 0)
+				throw std::domain_error("No state satisfies the constraints of the model.");
+			r_start.push_back(m);
+			run_box = std::move(r_box);
+			run_start = std::move(r_start);
+			p = std::valarray<T>(&p[0], m);
+			dp.resize(m);
+			calculated_stats = false;
+			assemble_generator();
+		}
+
+		T fsp_update(T tol, std::size_t depth = 1)
+		// Finite State Projection: replace the stored states with the active set made of the states
+		// with probability >= tol and of the states reached from them by up to `depth` reactions
+		// (within the box and satisfying `reachable`), so that the support can move and memory and
+		// computational time follow it. The probability of the discarded states is lost, as well as the
+		// probability which flows out of the stored states during the integration, so that 1 - sum(p)
+		// is a bound on the 1-norm of the error of p (if it was normalized at the start).
+		// B. Munsky, M. Khammash, "The finite state projection algorithm for the solution of the chemical master equation", J. Chem. Phys., 2006
+		// The transition-rate matrix is assembled again if it was assembled.
+		//	tol: probability threshold of the states that are kept with their neighbours
+		//	depth: number of reactions which can occur from the kept states before the probability
+		//		flows out of the active set (it should be larger than the expected number of reactions
+		//		per state between two updates)
+		// return the probability of the discarded states
+		{
+			using std::size_t;
+
+			const size_t n = n_elems();
+			std::vector<size_t> boxes, layer, next;
+			for_each_state([&](size_t pop_i, const physics::vec<long long, N_s>&)
+			{
+				if (p[pop_i] >= tol)
+					layer.push_back(state_to_box(pop_i));
+			});
+			boxes = layer;
+			for (size_t d = 0; d < depth && !layer.empty(); ++d)
+			{
+				next.clear();
+				for (size_t b : layer)
+				{
+					physics::vec<long long, N_s> y;
+					static_cast<std::array<long long, N_s>&>(y) = box_pop(b);
+					for (size_t r_i = 0; r_i < N_r; ++r_i)
+					{
+						physics::vec<long long, N_s> z = y + nu[r_i];
+						if (!out_of_bounds(z) && rate(y, r_i) > 0 && reachable(z))
+							next.push_back(box_index(z));
+					}
+				}
+				std::sort(next.begin(), next.end());
+				next.erase(std::unique(next.begin(), next.end()), next.end());
+				layer.clear();
+				std::set_difference(next.begin(), next.end(), boxes.begin(), boxes.end(), std::back_inserter(layer));
+				boxes.insert(boxes.end(), layer.begin(), layer.end());
+				std::inplace_merge(boxes.begin(), boxes.end() - layer.size(), boxes.end());
+			}
+			if (boxes.empty())
+				throw std::domain_error("No state has a probability above the tolerance.");
+
+			const size_t m = boxes.size();
+			std::valarray<T> p_new(m);
+			std::vector<size_t> r_box, r_start;
+			T kept = 0;
+			for (size_t i = 0; i < m; ++i)
+			{
+				if (i == 0 || boxes[i] != boxes[i-1] + 1)
+				{
+					r_box.push_back(boxes[i]);
+					r_start.push_back(i);
+				}
+				size_t j = box_to_state(boxes[i]);
+				p_new[i] = j < n ? p[j] : 0;
+				kept += p_new[i];
+			}
+			r_start.push_back(m);
+			T lost = p.sum() - kept;
+
+			const bool was_assembled = assembled();
+			run_box = std::move(r_box);
+			run_start = std::move(r_start);
+			p = std::move(p_new);
+			dp.resize(m);
+			calculated_stats = false;
+			if (was_assembled)
+				assemble_generator();
+			else
+				clear_generator(); // drop the diagonal of the previous states
+			return lost;
+		}
+
+		void fsp_start(const std::array<long long, N_s>& y0)
+		// start a Finite State Projection (see `fsp_update`) from the state y0 with probability 1,
+		// storing only that state
+		{
+			physics::vec<long long, N_s> y;
+			static_cast<std::array<long long, N_s>&>(y) = y0;
+			if (out_of_bounds(y))
+				throw std::out_of_range("The initial state is out of bounds.");
+			p.resize(1);
+			p[0] = 1;
+			run_box = {box_index(y0)};
+			run_start = {0, 1};
+			dp.resize(1);
+			calculated_stats = false;
+			if (assembled())
+				assemble_generator();
+			else
+				clear_generator(); // drop the diagonal of the previous states
+		}
+
+		T lost_mass() const
+		// return the probability which is not stored, i.e. 1 - sum(p): bound on the 1-norm of the
+		// error of a Finite State Projection
+		{
+			return 1 - p.sum();
+		}
+
+		void expand(const T* in, T* out) const
+		// copy the probabilities of the stored states `in` to the probabilities of the whole box `out`
+		// (the states which are not stored have zero probability)
+		{
+			std::fill(out, out + box_elems(), T(0));
+			for (std::size_t k = 0; k < run_box.size(); ++k)
+				std::copy(in + run_start[k], in + run_start[k+1], out + run_box[k]);
+			if (!reduced())
+				std::copy(in, in + box_elems(), out);
+		}
+
+		void compress(const T* in, T* out) const
+		// copy the probabilities of the whole box `in` to the probabilities of the stored states `out`
+		{
+			for (std::size_t k = 0; k < run_box.size(); ++k)
+				std::copy(in + run_box[k], in + run_box[k] + (run_start[k+1] - run_start[k]), out + run_start[k]);
+			if (!reduced())
+				std::copy(in, in + box_elems(), out);
+		}
+
+		void assemble_generator()
+		// assemble the transition-rate matrix of the CME once in sparse (CSR) format,
+		// so that the following steps compute the time derivative as a sparse matrix-vector
+		// product instead of evaluating the propensity functions for every state.
+		// It must be called again if the parameters of the propensity functions change.
+		{
+			using std::size_t;
+
+			diag = std::valarray<T>(); // recomputed by `diagonal` with the current rates
+			size_t n = n_elems();
+			std::array<std::pair<size_t, T>, N_r+1> row; // (column, value) pairs of the current row
+
+			generator.reset(n, n, n*(N_r+1));
+			for_each_state([&](size_t pop_i, const physics::vec<long long, N_s>& y)
+			{
+				size_t len = 0;
+				T diag = 0;
+				for (size_t r_i = 0; r_i < N_r; ++r_i)
+				{
+					physics::vec<long long, N_s> z = y - nu[r_i];
+					if (!out_of_bounds(z))
+					{
+						size_t j = box_to_state(box_index(z));
+						T w = j < n ? rate(z, r_i) : 0;
+						if (w != 0)
+							row[len++] = {j, w};
+					}
+					diag -= rate(y, r_i);
+				}
+				row[len++] = {pop_i, diag};
+				for (size_t k = 1; k < len; ++k) // insertion sort by column (rows are short)
+					for (size_t j = k; j > 0 && row[j].first < row[j-1].first; --j)
+						std::swap(row[j], row[j-1]);
+				for (size_t k = 0; k < len; ++k)
+				{
+					if (k > 0 && row[k].first == row[k-1].first)
+						generator.val.back() += row[k].second; // same source state from different channels
+					else
+						generator.push_back(row[k].first, row[k].second);
+				}
+				generator.end_row();
+			});
+		}
+
+		const std::valarray<T>& diagonal() const
+		// return the diagonal of the transition-rate matrix, i.e. minus the total propensity of each state.
+		// It is cached while the matrix is assembled (until `assemble_generator` or `clear_generator`),
+		// otherwise it is computed with the current rates, as the time derivative is
+		{
+			if (!assembled() || diag.size() != n_elems())
+			{
+				if (diag.size() != n_elems())
+					diag.resize(n_elems());
+				for_each_state([this](std::size_t i, const physics::vec<long long, N_s>& y)
+				{
+					T d = 0;
+					for (std::size_t r_i = 0; r_i < N_r; ++r_i)
+						d -= rate(y, r_i);
+					diag[i] = d;
+				});
+			}
+			return diag;
+		}
+
+		void clear_generator() noexcept
+		// release the assembled transition-rate matrix and go back to evaluating the propensity functions
+		{
+			generator.clear();
+			diag = std::valarray<T>();
+		}
+
+		bool assembled() const noexcept
+		// return whether the transition-rate matrix is assembled
+		{
+			return !generator.empty();
+		}
+
+		const sparse::csr_matrix<T>& generator_matrix() const noexcept
+		// return the assembled transition-rate matrix (empty if not assembled)
+		{
+			return generator;
+		}
+
+		void release_state() noexcept
+		// free the probabilities and the derivative buffer, when the state is stored elsewhere
+		// (e.g. by `distributed::slab_cme`), which only uses the propensity functions afterwards
+		{
+			p = std::valarray<T>();
+			dp = std::valarray<T>();
+			calculated_stats = false;
+		}
+
+		void invalidate_stats() noexcept
+		// discard the cached marginal distributions (call it after changing p directly)
+		{
+			calculated_stats = false;
+		}
+
+		std::size_t memory_usage() const noexcept
+		// return the number of bytes allocated by the solver for the probabilities, its buffers,
+		// the assembled transition-rate matrix and the reduced state space (integrators excluded)
+		{
+			std::size_t bytes = (p.size() + dp.size() + diag.size()) * sizeof(T);
+			bytes += generator.row_ptr.capacity() * sizeof(std::size_t);
+			bytes += generator.col.capacity() * sizeof(typename decltype(generator.col)::value_type);
+			bytes += generator.val.capacity() * sizeof(T);
+			bytes += (run_box.capacity() + run_start.capacity()) * sizeof(std::size_t);
+			for (const auto& m : marg)
+				bytes += m.size() * sizeof(T);
+			return bytes;
 		}
 
 		template <typename Integ>
@@ -165,124 +790,411 @@ namespace cme
 			using std::size_t;
 
 			calculated_stats = false;
+			if constexpr (requires (Model& m) { m.tabulate(); })
+				static_cast<Model&>(*this).tabulate();
+
+			auto g = [this](const std::valarray<T>& p, std::valarray<T>& dp)
+			// this lambda function calculates the time derivative of the probabilities
+			// associated to each possible state, as dictated by the CME, directly into the
+			// buffers of the integrator
+			{
+				derivative(p, dp);
+			};
+			if constexpr (requires { integ.step(p, dt, g, dp); })
+				integ.step(p, dt, g, diagonal()); // implicit integrators precondition with the diagonal
+			else if constexpr (requires { integ.step(p, dt, g); })
+				integ.step(p, dt, g);
+			else
+			{
+				auto f = [this](const std::valarray<T>& p) -> const std::valarray<T>&
+				// same as g, for integrators that take the derivative as a return value
+				{
+					derivative(p, dp);
+					return dp;
+				};
+				integ.step(p, dt, f);
+			}
+			t += dt;
+		}
+
+		template <typename Integ>
+		[[maybe_unused]] std::size_t simulate(Integ& integ, T dt, T t_final)
+		// simulate until t >= t_final
+		// dt is the integration step
+		// return the number of steps
+		{
+			instrument::scoped_timer timer(instrument::timer::cme_simulate);
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+				step(integ, dt);
+			return i;
+		}
+
+		template <typename Integ>
+		[[maybe_unused]] std::size_t simulate(Integ& integ, list_of_states<T>& states, T dt, T t_final, std::size_t n_sampling = 1)
+		// simulate until t >= t_final, and save the states inside a list (initial and final states are included)
+		// dt is the integration step
+		// n_sampling is the number of integration steps for each sampling point
+		// return the number of steps
+		{
+			using std::ceil;
+
+			instrument::scoped_timer timer(instrument::timer::cme_simulate);
+			const std::size_t n_states = states.t.size();
+			if (dt > 0 && t <= t_final)
+			{
+				// reserve the expected number of frames
+				std::size_t n_frames = std::size_t(ceil((t_final - t) / dt)) / n_sampling + 2;
+				states.p.reserve(states.p.size() + n_frames*n_elems());
+				states.t.reserve(states.t.size() + n_frames);
+			}
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+			{
+				if (i % n_sampling == 0)
+				{
+					states.p.insert(states.p.end(), std::begin(p), std::end(p));
+					states.t.push_back(t);
+				}
+				step(integ, dt);
+			}
+			states.p.insert(states.p.end(), std::begin(p), std::end(p));
+			states.t.push_back(t);
+			instrument::add(instrument::counter::bytes_sampled, (states.t.size() - n_states) * (n_elems() + 1) * sizeof(T));
+			return i;
+		}
+
+		template <typename Integ, typename Obs>
+		requires std::invocable<Obs&, const std::conditional_t<std::is_void_v<Model>, cme, Model>&>
+		[[maybe_unused]] std::size_t simulate(Integ& integ, T dt, T t_final, Obs&& obs, std::size_t n_sampling = 1)
+		// simulate until t >= t_final, and call obs(*this) at the sampling points (initial and final
+		// states are included), so that only the requested observables (e.g. `marginal`, `mean`)
+		// are extracted instead of storing the states (obs gets the derived class, if known)
+		// dt is the integration step
+		// n_sampling is the number of integration steps for each sampling point
+		// return the number of steps
+		{
+			instrument::scoped_timer timer(instrument::timer::cme_simulate);
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+			{
+				if (i % n_sampling == 0)
+					obs(derived());
+				step(integ, dt);
+			}
+			obs(derived());
+			return i;
+		}
+
+		template <typename Integ>
+		[[maybe_unused]] std::size_t simulate_fsp(Integ& integ, T dt, T t_final, T tol, std::size_t n_update = 10, std::size_t depth = 1)
+		// simulate until t >= t_final with a Finite State Projection, updating the active set
+		// every n_update steps (see `fsp_update`)
+		// dt is the integration step
+		// tol is the probability threshold of the active set
+		// depth is the number of reactions from the kept states included in the active set
+		// return the number of steps
+		{
+			if (n_update == 0)
+				throw std::invalid_argument("The number of steps between the updates of the active set must be positive.");
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+			{
+				if (i % n_update == 0)
+					fsp_update(tol, depth);
+				step(integ, dt);
+			}
+			return i;
+		}
+
+		template <typename Integ>
+		[[maybe_unused]] std::size_t integrate(Integ& integ, T t_final)
+		// integrate until t_final with an adaptive integrator (e.g. `runge_kutta::dormand_prince`)
+		// return the number of accepted steps
+		{
+			instrument::scoped_timer timer(instrument::timer::cme_simulate);
+			calculated_stats = false;
+			return integ.integrate(p, t, t_final, [this](const std::valarray<T>& p, std::valarray<T>& dp)
+			{
+				derivative(p, dp);
+			});
+		}
+
+		template <typename Integ>
+		[[maybe_unused]] std::size_t integrate(Integ& integ, list_of_states<T>& states, const std::vector<T>& t_grid)
+		// integrate until the last time of t_grid with an adaptive integrator, and save the states at
+		// the times of t_grid inside a list (the times must be sorted in non-decreasing order).
+		// The states between the steps of the integrator are interpolated using its dense output, and
+		// the times of t_grid which precede the current time get the current state.
+		// return the number of accepted steps
+		{
+			using std::size_t;
+
+			for (size_t k = 1; k < t_grid.size(); ++k)
+				if (t_grid[k] < t_grid[k-1])
+					throw std::invalid_argument("The time grid must be sorted in non-decreasing order.");
+			instrument::scoped_timer timer(instrument::timer::cme_simulate);
+			const size_t n = n_elems();
+			states.p.reserve(states.p.size() + t_grid.size()*n);
+			states.t.reserve(states.t.size() + t_grid.size());
+			instrument::add(instrument::counter::bytes_sampled, t_grid.size() * (n + 1) * sizeof(T));
+
+			size_t k = 0;
+			for (; k < t_grid.size() && t_grid[k] <= t; ++k)
+			{
+				states.p.insert(states.p.end(), std::begin(p), std::end(p));
+				states.t.push_back(t_grid[k]);
+			}
+			if (k == t_grid.size())
+				return 0;
+			calculated_stats = false;
+			return integ.integrate(p, t, t_grid.back(),
+				[this](const std::valarray<T>& p, std::valarray<T>& dp)
+				{
+					derivative(p, dp);
+				},
+				[&](const auto& integ)
+				{
+					for (; k < t_grid.size() && (t_grid[k] <= integ.dense_output_end() || t >= t_grid.back()); ++k)
+					{
+						states.p.resize(states.p.size() + n);
+						integ.dense_output(t_grid[k], states.p.data() + states.p.size() - n);
+						states.t.push_back(t_grid[k]);
+					}
+				});
+		}
+
+		T propagate(T dt, T tol = 1e-10)
+		// advance the probabilities by dt with the matrix exponential p <- exp(A dt) p, where A is the
+		// transition-rate matrix, using uniformization:
+		//	exp(A dt) = sum_k Poisson(k; lambda dt) P^k,  P = I + A / lambda,  lambda = max_i |A_ii|.
+		// The series is truncated when the remaining Poisson tail is below the tolerance, and since P
+		// does not increase the 1-norm of p, that tail bounds the 1-norm of the error.
+		// Long intervals are split so that lambda dt <= 100 in each sub-interval (the tolerance is shared
+		// between them).
+		//	dt: time interval
+		//	tol: tolerance on the 1-norm of the error
+		// return the error bound
+		{
+			using std::size_t;
+			using std::abs;
+			using std::ceil;
+			using std::exp;
+			using std::sqrt;
+
+			if (dt <= 0)
+				return 0;
+			const size_t n = n_elems();
+			const std::valarray<T>& d = diagonal();
+			T lambda = 0;
+			for (size_t i = 0; i < n; ++i)
+				lambda = std::max(lambda, abs(d[i]));
+			calculated_stats = false;
+			if (lambda == 0)
+			{
+				t += dt;
+				return 0;
+			}
+
+			constexpr T max_rate = 100;
+			const size_t n_sub = size_t(ceil(lambda * dt / max_rate));
+			const T h = dt / n_sub, rate = lambda * h, tol_sub = tol / n_sub;
+			const size_t k_max = size_t(rate + 10*sqrt(rate) + 50);
+
+			std::valarray<T> v(n), acc(n);
+			T err = 0;
+			for (size_t s = 0; s < n_sub; ++s)
+			{
+				v = p;
+				T w = exp(-rate), cum = w;
+				acc = w * v;
+				for (size_t k = 1; k <= k_max && 1 - cum > tol_sub; ++k)
+				{
+					// v <- P v = v + A v / lambda
+					derivative(v, dp);
+					for (size_t i = 0; i < n; ++i)
+						v[i] += dp[i] / lambda;
+					w *= rate / k;
+					cum += w;
+					for (size_t i = 0; i < n; ++i)
+						acc[i] += w * v[i];
+				}
+				err += std::max(T(0), 1 - cum);
+				p = acc;
+			}
+			t += dt;
+			return err;
+		}
+
+		T propagate(list_of_states<T>& states, const std::vector<T>& t_grid, T tol = 1e-10)
+		// advance the probabilities to each time of t_grid with the matrix exponential (see above)
+		// and save the states at those times inside a list (the times must be sorted in non-decreasing
+		// order, and those that precede the current time get the current state).
+		// tol is the tolerance on the 1-norm of the error at each time of the grid.
+		// return the error bound at the last time
+		{
+			for (std::size_t k = 1; k < t_grid.size(); ++k)
+				if (t_grid[k] < t_grid[k-1])
+					throw std::invalid_argument("The time grid must be sorted in non-decreasing order.");
+			states.p.reserve(states.p.size() + t_grid.size()*n_elems());
+			states.t.reserve(states.t.size() + t_grid.size());
+			instrument::add(instrument::counter::bytes_sampled, t_grid.size() * (n_elems() + 1) * sizeof(T));
+			T err = 0;
+			for (T t_s : t_grid)
+			{
+				if (t_s > t)
+				{
+					err += propagate(t_s - t, tol / t_grid.size());
+					t = t_s; // avoid the accumulation of rounding errors
+				}
+				states.p.insert(states.p.end(), std::begin(p), std::end(p));
+				states.t.push_back(t_s);
+			}
+			return err;
+		}
+
+		krylov::result<T> stationary(T tol = 1e-10, std::size_t max_iter = 10000, std::size_t restart = 50)
+		// replace the probabilities with the stationary distribution, i.e. the solution of A p = 0
+		// with sum(p) = 1, where A is the transition-rate matrix (which is assembled if it is not).
+		// The constraint is imposed by solving (A + u 1^T) p = u with GMRES, where u is the current
+		// distribution, which is also the initial guess.
+		// The system is non-singular if the chain is irreducible inside the stored states.
+		//	tol: tolerance on the relative residual
+		//	max_iter: max number of matrix-vector products
+		//	restart: dimension of the Krylov subspace before restarting
+		// return the convergence information of the solver
+		{
+			using std::size_t;
+
+			const size_t n = n_elems();
+			if (!assembled())
+				assemble_generator();
+			T p_sum = p.sum();
+			if (!(p_sum > 0))
+				throw std::domain_error("The initial distribution must have positive total probability.");
+			std::valarray<T> u = p / p_sum;
+			p = u;
+
+			const std::valarray<T>& d = diagonal();
+			std::valarray<T> inv_diag(n);
+			for (size_t i = 0; i < n; ++i)
+				inv_diag[i] = d[i] + u[i] != 0 ? 1 / (d[i] + u[i]) : 1;
+
+			krylov::gmres<T> solver;
+			solver.tol = tol;
+			solver.max_iter = max_iter;
+			solver.restart = restart;
+			krylov::result<T> res = solver.solve(
+				[&](const std::valarray<T>& v, std::valarray<T>& out)
+				{
+					derivative(v, out);
+					T v_sum = v.sum();
+					for (size_t i = 0; i < n; ++i)
+						out[i] += u[i] * v_sum;
+				},
+				u, p,
+				[&](const std::valarray<T>& v, std::valarray<T>& out)
+				{
+					for (size_t i = 0; i < n; ++i)
+						out[i] = inv_diag[i] * v[i];
+				});
+			p /= p.sum();
+			calculated_stats = false;
+			return res;
+		}
 
-			auto f = [this](const std::valarray<T>& p) -> const std::valarray<T>&
-			// this lambda function calculates the time derivative of the probabilities
-			// associated to each possible state, as dictated by the CME.
-			{
-				size_t n = n_elems();
-				x = 0;
-				for (size_t pop_i = 0; pop_i < n; ++pop_i)
-				{
-					dp[pop_i] = 0;
-					for (size_t r_i = 0; r_i < N_r; ++r_i)
-					{
-						if (!out_of_bounds(x - nu[r_i]))
-							dp[pop_i] += a(x - nu[r_i], r_i) * p[get_index(x - nu[r_i])];
-						dp[pop_i] -= a(x, r_i) * p[pop_i];
-					}
-					++x[N_s-1];
-					for (size_t j = N_s; j --> 1; )
-						if (x[j] == n_max[j])
-						{
-							x[j] = 0;
-							++x[j-1];
-						}
-				}
-				return dp;
-			};
-			integ.step(p, dt, f);
-			t += dt;
+		void save(std::ostream& out) const
+		// write a checkpoint of the probabilities, the time and the state space
+		// (the parameters of the model are not saved: it must be restored into an equal model)
+		{
+			checkpoint::writer w(out, checkpoint::kind::cme);
+			w.write(std::uint64_t(N_s));
+			w.write(std::uint64_t(N_r));
+			w.write(std::uint64_t(sizeof(T)));
+			w.write(n_max.data(), N_s);
+			w.write(t);
+			w.write(run_box);
+			w.write(run_start);
+			w.write(std::uint8_t(assembled()));
+			w.write(&p[0], p.size());
 		}
 
-		template <typename Integ>
-		[[maybe_unused]] std::size_t simulate(Integ& integ, T dt, T t_final)
-		// simulate until t >= t_final
-		// dt is the integration step
-		// return the number of steps
+		void load(std::istream& in)
+		// restore a checkpoint written by `save` (the state space and the assembled matrix are restored
+		// as well, so the following steps are bitwise equal to the ones of the saved object)
 		{
-			std::size_t i;
-			for (i = 0; t <= t_final; ++i)
-				step(integ, dt);
-			return i;
+			checkpoint::reader r(in, checkpoint::kind::cme);
+			r.expect(r.read<std::uint64_t>() == N_s, "number of species");
+			r.expect(r.read<std::uint64_t>() == N_r, "number of reaction channels");
+			r.expect(r.read<std::uint64_t>() == sizeof(T), "floating-point type");
+			std::array<long long, N_s> n_max_saved;
+			r.read(n_max_saved.data(), N_s);
+			r.expect(n_max_saved == n_max, "max population numbers");
+			T t_saved = r.read<T>();
+			std::vector<std::size_t> r_box, r_start;
+			r.read(r_box);
+			r.read(r_start);
+			r.expect(r_box.size()+1 == r_start.size() || (r_box.empty() && r_start.empty()), "reduced state space");
+			bool was_assembled = r.read<std::uint8_t>();
+			std::size_t n = r_start.empty() ? box_elems() : r_start.back();
+			std::valarray<T> p_saved(n);
+			r.read(&p_saved[0], n);
+
+			run_box = std::move(r_box);
+			run_start = std::move(r_start);
+			p = std::move(p_saved);
+			t = t_saved;
+			dp.resize(n);
+			calculated_stats = false;
+			if (was_assembled)
+				assemble_generator();
+			else
+				clear_generator();
 		}
 
-		template <typename Integ>
-		[[maybe_unused]] std::size_t simulate(Integ& integ, list_of_states<T>& states, T dt, T t_final, std::size_t n_sampling = 1)
-		// simulate until t >= t_final, and save the states inside a list (initial and final states are included)
-		// dt is the integration step
-		// n_sampling is the number of integration steps for each sampling point
-		// return the number of steps
+		const std::valarray<T>& marginal(std::size_t s_i) const
+		// return the marginal distribution of the s_i-th variable (substance), i.e. the probabilities
+		// of its population numbers from 0 to n_max[s_i]-1
 		{
-			std::size_t i;
-			for (i = 0; t <= t_final; ++i)
-			{
-				if (i % n_sampling == 0)
-				{
-					for (const auto& prob : p)
-						states.p.push_back(prob);
-					states.t.push_back(t);
-				}
-				step(integ, dt);
-			}
-			for (const auto& prob : p)
-				states.p.push_back(prob);
-			states.t.push_back(t);
-			return i;
+			if (s_i >= N_s)
+				throw std::out_of_range("Unknown substance with index " + std::to_string(s_i) + ".");
+			calc_marginals();
+			return marg[s_i];
 		}
 
 		T mean(std::size_t s_i) const
 		// return the mean of the s_i-th variable (substance)
 		{
-			if (s_i >= N_s)
-				throw std::out_of_range("Unknown substance with index " + std::to_string(s_i) + ".");
-			calc_moments();
-			return m[s_i][1];
+			return nth_moment(s_i, 1);
 		}
 
 		T msq(std::size_t s_i) const
 		// return the mean square of the s_i-th variable (substance)
 		{
-			if (s_i >= N_s)
-				throw std::out_of_range("Unknown substance with index " + std::to_string(s_i) + ".");
-			calc_moments();
-			return m[s_i][2];
+			return nth_moment(s_i, 2);
 		}
 
 		T sd(std::size_t s_i) const
 		{
 			using std::sqrt;
-			if (s_i >= N_s)
-				throw std::out_of_range("Unknown substance with index " + std::to_string(s_i) + ".");
-			calc_moments();
-			T arg = m[s_i][2] - m[s_i][1]*m[s_i][1];
+			T m1 = mean(s_i);
+			T arg = msq(s_i) - m1*m1;
 			return arg > 0 ? sqrt(arg) : 0;
 		}
 
 		T nth_moment(std::size_t s_i, std::size_t n) const
 		// return the n-th moment of the s_i-th variable (substance)
+		// The marginal distributions are computed once after each change of p, then the moments
+		// of any order only take O(n_max[s_i]) operations.
 		{
-			using std::pow;
-			if (s_i >= N_s)
-				throw std::out_of_range("Unknown substance with index " + std::to_string(s_i) + ".");
-			if (n <= moments_max_order)
-			{
-				calc_moments();
-				return m[s_i][n];
-			}
-			size_t n_ = n_elems();
+			const std::valarray<T>& pm = marginal(s_i);
 			T mom = 0;
-			x = 0;
-			for (size_t pop_i = 0; pop_i < n_; ++pop_i)
+			for (std::size_t x = 0; x < pm.size(); ++x)
 			{
-				mom += p[pop_i] * pow(x[s_i], n);
-				++x[N_s-1];
-				for (size_t j = N_s; j --> 1; )
-					if (x[j] == n_max[j])
-					{
-						x[j] = 0;
-						++x[j-1];
-					}
+				T xn = 1;
+				for (std::size_t k = 0; k < n; ++k)
+					xn *= x;
+				mom += pm[x] * xn;
 			}
 			return mom;
 		}
@@ -294,10 +1206,10 @@ namespace cme
 	};
 
 	template <std::floating_point T = double>
-	class single_substrate : public cme<2, 3, T>
+	class single_substrate : public cme<2, 3, T, single_substrate<T>>
 	// Chemical master equation applied to single-substrate enzyme kinetics
 	{
-		using base = cme<2, 3, T>;
+		using base = cme<2, 3, T, single_substrate<T>>;
 
 		using base::nu;
 
@@ -309,12 +1221,13 @@ namespace cme
 		std::array<T, num_rc> kappa;
 		long long ET, ST;
 
-		single_substrate(T kf, T kb, T kcat, long long ET, long long ST) noexcept
-			: base({ET+1, ST+1}), kappa{kf, kb, kcat}, ET(ET), ST(ST)
+		single_substrate(T kf, T kb, T kcat, long long ET, long long ST, storage st = storage::full) noexcept
+			: base({ET+1, ST+1}, st), kappa{kf, kb, kcat}, ET(ET), ST(ST)
 		// constructor
 		//	kf, kb, kcat: the set of the three rate constants associated to the three reactions
 		//	ET: total enzyme concentration constant (it is conserved)
 		//	ST: total substrate/product concentration constant (it is conserved)
+		//	st: probabilities to allocate (see `cme::storage`)
 		{
 			// stoichiometric vectors
 			//          C, P
@@ -342,16 +1255,42 @@ namespace cme
 					throw std::out_of_range("Reaction channel index out of bounds.");
 			}
 		}
+
+		bool reachable(const physics::vec<long long, num_species>& y) const final override
+		// the substrate is conserved
+		{
+			return y[C] + y[P] <= ST;
+		}
 	};
 
 	template <std::floating_point T = double>
-	class single_substrate_tqssa : public cme<1, 1, T>
+	class single_substrate_tqssa : public cme<1, 1, T, single_substrate_tqssa<T>>
 	// Chemical master equation applied to tQSSA (total quasi-steady state approximation)
 	{
-		using base = cme<1, 1, T>;
+		using base = cme<1, 1, T, single_substrate_tqssa<T>>;
 
 		using base::nu;
 
+		T direct(const physics::vec<long long, 1>& y, std::size_t i) const
+		// propensity functions computed without the table
+		{
+			using std::sqrt;
+
+			switch (i)
+			{
+				case 0:
+				{
+					long long S_hat = ST - y[P];
+					long long c = 2*ET*S_hat;
+					T b = ET + S_hat + kM;
+					T Delta = b*b - 2*c;
+					return kcat*c / (b + sqrt(Delta));
+				}
+				default:
+					throw std::out_of_range("Reaction channel index out of bounds.");
+			}
+		}
+
 	public:
 
 		enum species : std::size_t {P, num_species};
@@ -359,24 +1298,68 @@ namespace cme
 
 		T kcat, kM;
 		long long ET, ST;
+		lookup::propensity_table<1, 4, T> table; // propensity functions for each population number
 
-		single_substrate_tqssa(T kM, T kcat, long long ET, long long ST) noexcept
-			: base({ST+1}), kcat(kcat), kM(kM), ET(ET), ST(ST)
+		single_substrate_tqssa(T kM, T kcat, long long ET, long long ST, storage st = storage::full) noexcept
+			: base({ST+1}, st), kcat(kcat), kM(kM), ET(ET), ST(ST)
 		// constructor
 		//	kM: Michaelis-Menten constant ( (kb+kcat) / kf )
 		//	kcat: catalysis rate constant
 		//	ET: total enzyme concentration constant (it is conserved)
 		//	ST: total substrate/product concentration constant (it is conserved)
+		//	st: probabilities to allocate (see `cme::storage`)
 		{
 			// stoichiometric vectors
 			//       P
 			nu[0] = {1};
+
+			tabulate();
+		}
+
+		std::array<T, 4> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kcat, kM, T(ET), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for P = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a)
+				{
+					for (std::size_t i = 0; i < num_rc; ++i)
+						a[i] = direct({y}, i);
+				});
 		}
 
 		T a(const physics::vec<long long, num_species>& y, std::size_t i) const final override
 		// propensity functions
 		//	y: population numbers
 		//	i: reaction channel index
+		{
+			const T* col = table.column(i, parameters());
+			return col && y[P] >= 0 && y[P] <= ST ? col[y[P]] : direct(y, i);
+		}
+
+		const T* propensity_column(std::size_t i) const noexcept
+		// tabulated propensity function of the reaction channel i for P = 0, ..., ST
+		// (nullptr if not tabulated), used to compute the time derivative
+		{
+			return table.column(i, parameters());
+		}
+	};
+
+	template <std::floating_point T = double>
+	class single_substrate_sqssa : public cme<1, 1, T, single_substrate_sqssa<T>>
+	// Chemical master equation applied to sQSSA (standard quasi-steady state approximation)
+	{
+		using base = cme<1, 1, T, single_substrate_sqssa<T>>;
+
+		using base::nu;
+
+		T direct(const physics::vec<long long, 1>& y, std::size_t i) const
+		// propensity functions computed without the table
 		{
 			using std::sqrt;
 
@@ -384,25 +1367,13 @@ namespace cme
 			{
 				case 0:
 				{
-					long long S_hat = ST - y[P];
-					long long c = 2*ET*S_hat;
-					T b = ET + S_hat + kM;
-					T Delta = b*b - 2*c;
-					return kcat*c / (b + sqrt(Delta));
+					long long S = ST - y[P];
+					return kcat*(ET*S) / (S + kM);
 				}
 				default:
 					throw std::out_of_range("Reaction channel index out of bounds.");
 			}
 		}
-	};
-
-	template <std::floating_point T = double>
-	class single_substrate_sqssa : public cme<1, 1, T>
-	// Chemical master equation applied to sQSSA (standard quasi-steady state approximation)
-	{
-		using base = cme<1, 1, T>;
-
-		using base::nu;
 
 	public:
 
@@ -411,18 +1382,39 @@ namespace cme
 
 		T kcat, kM;
 		long long ET, ST;
+		lookup::propensity_table<1, 4, T> table; // propensity functions for each population number
 
-		single_substrate_sqssa(T kM, T kcat, long long ET, long long ST) noexcept
-			: base({ST+1}), kcat(kcat), kM(kM), ET(ET), ST(ST)
+		single_substrate_sqssa(T kM, T kcat, long long ET, long long ST, storage st = storage::full) noexcept
+			: base({ST+1}, st), kcat(kcat), kM(kM), ET(ET), ST(ST)
 		// constructor
 		//	kM: Michaelis-Menten constant ( (kb+kcat) / kf )
 		//	kcat: catalysis rate constant
 		//	ET: total enzyme concentration constant (it is conserved)
 		//	ST: total substrate/product concentration constant (it is conserved)
+		//	st: probabilities to allocate (see `cme::storage`)
 		{
 			// stoichiometric vectors
 			//       P
 			nu[0] = {1};
+
+			tabulate();
+		}
+
+		std::array<T, 4> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kcat, kM, T(ET), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for P = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a)
+				{
+					for (std::size_t i = 0; i < num_rc; ++i)
+						a[i] = direct({y}, i);
+				});
 		}
 
 		T a(const physics::vec<long long, num_species>& y, std::size_t i) const final override
@@ -430,26 +1422,23 @@ namespace cme
 		//	y: population numbers
 		//	i: reaction channel index
 		{
-			using std::sqrt;
+			const T* col = table.column(i, parameters());
+			return col && y[P] >= 0 && y[P] <= ST ? col[y[P]] : direct(y, i);
+		}
 
-			switch (i)
-			{
-				case 0:
-				{
-					long long S = ST - y[P];
-					return kcat*(ET*S) / (S + kM);
-				}
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
-			}
+		const T* propensity_column(std::size_t i) const noexcept
+		// tabulated propensity function of the reaction channel i for P = 0, ..., ST
+		// (nullptr if not tabulated), used to compute the time derivative
+		{
+			return table.column(i, parameters());
 		}
 	};
 
 	template <std::floating_point T = double>
-	class goldbeter_koshland : public cme<3, 6, T>
+	class goldbeter_koshland : public cme<3, 6, T, goldbeter_koshland<T>>
 	// Chemical master equation applied to Goldbeter-Koshland switch
 	{
-		using base = cme<3, 6, T>;
+		using base = cme<3, 6, T, goldbeter_koshland<T>>;
 
 		using base::nu;
 
@@ -461,13 +1450,14 @@ namespace cme
 		std::array<T, num_rc> kappa;
 		long long ET, DT, ST;
 
-		goldbeter_koshland(T kfe, T kbe, T ke, T kfd, T kbd, T kd, long long ET, long long DT, long long ST) noexcept
-			: base({ST+1, ET+1, DT+1}), kappa{kfe, kbe, ke, kfd, kbd, kd}, ET(ET), DT(DT), ST(ST)
+		goldbeter_koshland(T kfe, T kbe, T ke, T kfd, T kbd, T kd, long long ET, long long DT, long long ST, storage st = storage::full) noexcept
+			: base({ST+1, ET+1, DT+1}, st), kappa{kfe, kbe, ke, kfd, kbd, kd}, ET(ET), DT(DT), ST(ST)
 		// constructor
 		//	kfe, kbe, ke, kfd, kbd, kd: the set of the six rate constants associated to the six reactions
 		//	ET: total kinase concentration constant (it is conserved)
 		//	DT: total phosphatase concentration constant (it is conserved)
 		//	ST: total substrate concentration constant (it is conserved)
+		//	st: probabilities to allocate (see `cme::storage`)
 		{
 			// stoichiometric vectors
 			//        SP,  C, CP
@@ -504,16 +1494,47 @@ namespace cme
 					throw std::out_of_range("Reaction channel index out of bounds.");
 			}
 		}
+
+		bool reachable(const physics::vec<long long, num_species>& y) const final override
+		// the substrate is conserved
+		{
+			return y[SP] + y[C] + y[CP] <= ST;
+		}
 	};
 
 	template <std::floating_point T = double>
-	class goldbeter_koshland_tqssa : public cme<1, 2, T>
+	class goldbeter_koshland_tqssa : public cme<1, 2, T, goldbeter_koshland_tqssa<T>>
 	// Chemical master equation applied to Goldbeter-Koshland switch tQSSA
 	{
-		using base = cme<1, 2, T>;
+		using base = cme<1, 2, T, goldbeter_koshland_tqssa<T>>;
 
 		using base::nu;
 
+		T direct(const physics::vec<long long, 1>& y, std::size_t i) const
+		// propensity functions computed without the table
+		{
+			switch (i)
+			{
+				case e:
+				{
+					long long S_hat = ST - y[SP_hat];
+					long long c = 2*ET*S_hat;
+					T b = ET + S_hat + kME;
+					T Delta = b*b - 2*c;
+					return ke*c / (b + sqrt(Delta));
+				}
+				case d:
+				{
+					long long c = 2*DT*y[SP_hat];
+					T b = DT + y[SP_hat] + kMD;
+					T Delta = b*b - 2*c;
+					return kd*c / (b + sqrt(Delta));
+				}
+				default:
+					throw std::out_of_range("Reaction channel index out of bounds.");
+			}
+		}
+
 	public:
 
 		enum species : std::size_t {SP_hat, num_species};
@@ -521,57 +1542,84 @@ namespace cme
 
 		T kME, ke, kMD, kd;
 		long long ET, DT, ST;
+		lookup::propensity_table<2, 7, T> table; // propensity functions for each population number
 
-		goldbeter_koshland_tqssa(T kME, T ke, T kMD, T kd, long long ET, long long DT, long long ST) noexcept
-			: base({ST+1}), kME(kME), ke(ke), kMD(kMD), kd(kd), ET(ET), DT(DT), ST(ST)
+		goldbeter_koshland_tqssa(T kME, T ke, T kMD, T kd, long long ET, long long DT, long long ST, storage st = storage::full) noexcept
+			: base({ST+1}, st), kME(kME), ke(ke), kMD(kMD), kd(kd), ET(ET), DT(DT), ST(ST)
 		// constructor
 		//	kME, ke: phosphorylation constants (Michaelis-Menten + catalysis)
 		//	kMD, kd: dephosphorylation constants (Michaelis-Menten + catalysis)
 		//	ET: total kinase concentration constant (it is conserved)
 		//	DT: total phosphatase concentration constant (it is conserved)
 		//	ST: total substrate concentration constant (it is conserved)
+		//	st: probabilities to allocate (see `cme::storage`)
 		{
 			// stoichiometric vectors
 			//      SP_hat
 			nu[e]  = { 1};
 			nu[d]  = {-1};
+
+			tabulate();
+		}
+
+		std::array<T, 7> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kME, ke, kMD, kd, T(ET), T(DT), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for SP_hat = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a)
+				{
+					for (std::size_t i = 0; i < num_rc; ++i)
+						a[i] = direct({y}, i);
+				});
 		}
 
 		T a(const physics::vec<long long, num_species>& y, std::size_t i) const final override
 		// propensity functions
 		//	y: population numbers
 		//	i: reaction channel index
+		{
+			const T* col = table.column(i, parameters());
+			return col && y[SP_hat] >= 0 && y[SP_hat] <= ST ? col[y[SP_hat]] : direct(y, i);
+		}
+
+		const T* propensity_column(std::size_t i) const noexcept
+		// tabulated propensity function of the reaction channel i for SP_hat = 0, ..., ST
+		// (nullptr if not tabulated), used to compute the time derivative
+		{
+			return table.column(i, parameters());
+		}
+	};
+
+	template <std::floating_point T = double>
+	class goldbeter_koshland_sqssa : public cme<1, 2, T, goldbeter_koshland_sqssa<T>>
+	// Chemical master equation applied to Goldbeter-Koshland switch sQSSA
+	{
+		using base = cme<1, 2, T, goldbeter_koshland_sqssa<T>>;
+
+		using base::nu;
+
+		T direct(const physics::vec<long long, 1>& y, std::size_t i) const
+		// propensity functions computed without the table
 		{
 			switch (i)
 			{
 				case e:
 				{
-					long long S_hat = ST - y[SP_hat];
-					long long c = 2*ET*S_hat;
-					T b = ET + S_hat + kME;
-					T Delta = b*b - 2*c;
-					return ke*c / (b + sqrt(Delta));
+					long long S = ST - y[SP];
+					return ke*(ET*S) / (S + kME);
 				}
 				case d:
-				{
-					long long c = 2*DT*y[SP_hat];
-					T b = DT + y[SP_hat] + kMD;
-					T Delta = b*b - 2*c;
-					return kd*c / (b + sqrt(Delta));
-				}
+					return kd*(DT*y[SP]) / (y[SP] + kMD);
 				default:
 					throw std::out_of_range("Reaction channel index out of bounds.");
 			}
 		}
-	};
-
-	template <std::floating_point T = double>
-	class goldbeter_koshland_sqssa : public cme<1, 2, T>
-	// Chemical master equation applied to Goldbeter-Koshland switch sQSSA
-	{
-		using base = cme<1, 2, T>;
-
-		using base::nu;
 
 	public:
 
@@ -580,20 +1628,41 @@ namespace cme
 
 		T kME, ke, kMD, kd;
 		long long ET, DT, ST;
+		lookup::propensity_table<2, 7, T> table; // propensity functions for each population number
 
-		goldbeter_koshland_sqssa(T kME, T ke, T kMD, T kd, long long ET, long long DT, long long ST) noexcept
-			: base({ST+1}), kME(kME), ke(ke), kMD(kMD), kd(kd), ET(ET), DT(DT), ST(ST)
+		goldbeter_koshland_sqssa(T kME, T ke, T kMD, T kd, long long ET, long long DT, long long ST, storage st = storage::full) noexcept
+			: base({ST+1}, st), kME(kME), ke(ke), kMD(kMD), kd(kd), ET(ET), DT(DT), ST(ST)
 		// constructor
 		//	kME, ke: phosphorylation constants (Michaelis-Menten + catalysis)
 		//	kMD, kd: dephosphorylation constants (Michaelis-Menten + catalysis)
 		//	ET: total kinase concentration constant (it is conserved)
 		//	DT: total phosphatase concentration constant (it is conserved)
 		//	ST: total substrate concentration constant (it is conserved)
+		//	st: probabilities to allocate (see `cme::storage`)
 		{
 			// stoichiometric vectors
 			//        SP
 			nu[e]  = { 1};
 			nu[d]  = {-1};
+
+			tabulate();
+		}
+
+		std::array<T, 7> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kME, ke, kMD, kd, T(ET), T(DT), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for SP = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a)
+				{
+					for (std::size_t i = 0; i < num_rc; ++i)
+						a[i] = direct({y}, i);
+				});
 		}
 
 		T a(const physics::vec<long long, num_species>& y, std::size_t i) const final override
@@ -601,20 +1670,107 @@ namespace cme
 		//	y: population numbers
 		//	i: reaction channel index
 		{
-			switch (i)
+			const T* col = table.column(i, parameters());
+			return col && y[SP] >= 0 && y[SP] <= ST ? col[y[SP]] : direct(y, i);
+		}
+
+		const T* propensity_column(std::size_t i) const noexcept
+		// tabulated propensity function of the reaction channel i for SP = 0, ..., ST
+		// (nullptr if not tabulated), used to compute the time derivative
+		{
+			return table.column(i, parameters());
+		}
+	};
+	template <std::size_t N_s, std::size_t N_r, std::floating_point T = double>
+	class reaction_network : public cme<N_s, N_r, T, reaction_network<N_s, N_r, T>>
+	// Chemical master equation applied to a reaction network defined at runtime (see `network::description`)
+	{
+		using base = cme<N_s, N_r, T, reaction_network<N_s, N_r, T>>;
+
+		using base::nu;
+
+	public:
+
+		static constexpr std::size_t num_species = N_s, num_rc = N_r;
+
+		network::kernel_table<N_s, N_r, T> kernels;
+
+		reaction_network(const network::description<T>& d, const std::array<long long, N_s>& n_max, storage st = storage::full)
+			: base(n_max, st), kernels(d)
+		// constructor
+		//	d: description of the network (it must have N_s species and N_r reactions)
+		//	n_max: number of population numbers stored for each species (from 0 to n_max-1)
+		//	st: probabilities to allocate (see `cme::storage`)
+		{
+			nu = kernels.stoichiometry();
+		}
+
+		T a(const physics::vec<long long, num_species>& y, std::size_t i) const final override
+		// propensity functions
+		//	y: population numbers
+		//	i: reaction channel index
+		{
+			if (i >= num_rc)
+				throw std::out_of_range("Reaction channel index out of bounds.");
+			return kernels.compatible(y) ? kernels.propensity(y, i) : 0;
+		}
+
+		bool reachable(const physics::vec<long long, num_species>& y) const final override
+		// the constraints of the network are satisfied
+		{
+			return kernels.compatible(y);
+		}
+	};
+
+	template <typename Make, typename Assign, typename Integ, typename Obs,
+		typename Model = std::remove_cvref_t<std::invoke_result_t<Make&, std::size_t>>>
+	requires std::is_invocable_r_v<bool, Assign&, std::size_t, Model&> && std::invocable<Obs&, std::size_t, const Model&>
+	void parallel_sweep(parallel::thread_pool& pool, std::size_t n_points, Make&& make, Assign&& assign, const Integ& integ,
+		decltype(Model::t) dt, decltype(Model::t) t_final, Obs&& obs, std::size_t n_sampling = 1)
+	// integrate the CME of each of the models make(0), ..., make(n_points-1) (e.g. a grid of parameters)
+	// until t >= t_final, and call obs(k, model) at the sampling points of make(k) (see `simulate`).
+	// The points are distributed over the threads of pool, each one integrated by a single thread with its
+	// own copy of integ. Each thread keeps one model: assign(k, model) sets the parameters of make(k) in place
+	// and returns true, or returns false without changes if make(k) has a different shape, which is then made
+	// (e.g. assign(k, model) for single_substrate_tqssa sets kM, kcat and ET, and fails if ST changes).
+	// A reused model is reset to the probabilities and the time of the model made by the thread, and its
+	// lookup tables and transition-rate matrix (if assembled) are rebuilt, without reallocating the
+	// probabilities, the derivative buffer and the marginals.
+	// make, assign and obs must be thread-safe (obs is called concurrently for different k).
+	{
+		using T = decltype(Model::t);
+
+		std::vector<Integ> integs(pool.size(), integ);
+		std::vector<std::unique_ptr<Model>> models(pool.size());
+		std::vector<std::valarray<T>> p0(pool.size()); // initial probabilities of models[id]
+		std::vector<T> t0(pool.size());
+
+		pool.parallel_for(n_points, 1, [&](std::size_t id, std::size_t begin, std::size_t end)
+		{
+			std::unique_ptr<Model>& model = models[id];
+			for (std::size_t k = begin; k < end; ++k)
 			{
-				case e:
+				if (model && assign(k, *model))
 				{
-					long long S = ST - y[SP];
-					return ke*(ET*S) / (S + kME);
+					model->p = p0[id]; // same size: copied in place
+					model->t = t0[id];
+					model->invalidate_stats();
+					if constexpr (requires (Model& m) { m.tabulate(); })
+						model->tabulate();
+					if (model->assembled())
+						model->assemble_generator();
 				}
-				case d:
-					return kd*(DT*y[SP]) / (y[SP] + kMD);
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
+				else
+				{
+					model.reset(); // free the previous shape first
+					model.reset(new Model(make(k))); // no copy of the probabilities
+					p0[id] = model->p;
+					t0[id] = model->t;
+				}
+				model->simulate(integs[id], dt, t_final, [&](const Model& m) { obs(k, m); }, n_sampling);
 			}
-		}
-	};
+		});
+	}
 } // namespace cme
 
 #endif // SEK_CME
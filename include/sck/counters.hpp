@@ -0,0 +1,269 @@
+//  Stochastic enzyme kinetics: hot-path instrumentation
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_COUNTERS
+#define SEK_COUNTERS
+
+#include <array>
+#include <cstdint> // uint64_t
+
+#ifdef SEK_INSTRUMENT
+#include <vector>
+#include <algorithm> // find
+#include <atomic>
+#include <mutex> // mutex, lock_guard
+#include <chrono> // steady_clock, nanoseconds, duration_cast
+#endif
+
+// The simulators and integrators count their events (SSA steps, evaluations of the CME time derivative,
+// Runge-Kutta stages, bytes sampled into `list_of_states`, ...) and time their main loops, if SEK_INSTRUMENT
+// is defined. Otherwise every function of this file is empty and inlined away, so instrumentation costs
+// nothing unless it is compiled in. Each thread increments its own counters (without atomic
+// read-modify-write operations), and `snapshot` sums the counters of all threads, including the
+// terminated ones. The timers are inclusive: e.g. the time of `cme::simulate` includes its derivatives.
+
+namespace instrument
+{
+	enum class counter : std::size_t
+	{
+		ssa_steps, // reactions performed by the exact stochastic simulation algorithms
+		null_steps, // SSA steps without a reaction (zero total propensity or reaction after t_final)
+		propensity_evaluations, // SSA steps computing all the propensity functions
+		channel_evaluations, // propensity functions of single channels recomputed by the Next Reaction Method
+		table_lookups, // SSA steps reading tabulated cumulative propensity functions
+		selection_comparisons, // comparisons of the cumulative-sum search of the reaction channel
+		rhs_evaluations, // evaluations of the CME time derivative
+		stage_evaluations, // stages of the explicit Runge-Kutta methods
+		function_steps, // Runge-Kutta steps through the std::function interface
+		bytes_sampled, // bytes copied into `list_of_states` (states and times)
+		num_counters
+	};
+
+	enum class timer : std::size_t
+	{
+		gillespie_sample, // `gillespie::sample` (trajectories on a time grid)
+		gillespie_simulate, // `gillespie::simulate` with a list of states
+		cme_simulate, // `cme::simulate` and `cme::integrate`
+		cme_derivative, // `cme::derivative`
+		runge_kutta_step, // `runge_kutta::step`
+		num_timers
+	};
+
+	inline constexpr std::size_t num_counters = std::size_t(counter::num_counters);
+	inline constexpr std::size_t num_timers = std::size_t(timer::num_timers);
+	inline constexpr std::size_t max_channels = 64; // the firings of the channels >= max_channels-1 are counted together
+
+	inline constexpr std::array<const char*, num_counters> counter_names{
+		"ssa_steps", "null_steps", "propensity_evaluations", "channel_evaluations", "table_lookups", "selection_comparisons",
+		"rhs_evaluations", "stage_evaluations", "function_steps", "bytes_sampled"
+	};
+	inline constexpr std::array<const char*, num_timers> timer_names{
+		"gillespie::sample", "gillespie::simulate", "cme::simulate", "cme::derivative", "runge_kutta::step"
+	};
+
+#ifdef SEK_INSTRUMENT
+	inline constexpr bool enabled = true;
+#else
+	inline constexpr bool enabled = false;
+#endif
+
+	struct report
+	// values of the counters and timers summed over all threads
+	{
+		std::array<std::uint64_t, num_counters> counts{};
+		std::array<std::uint64_t, max_channels> firings{}; // reactions performed by each channel
+		std::array<std::uint64_t, num_timers> calls{}; // number of timed scopes
+		std::array<std::uint64_t, num_timers> ns{}; // total time in nanoseconds
+
+		std::uint64_t operator[](counter c) const noexcept
+		{
+			return counts[std::size_t(c)];
+		}
+
+		std::uint64_t n_calls(timer id) const noexcept
+		{
+			return calls[std::size_t(id)];
+		}
+
+		double seconds(timer id) const noexcept
+		{
+			return ns[std::size_t(id)] * 1e-9;
+		}
+	};
+
+#ifdef SEK_INSTRUMENT
+	namespace detail
+	{
+		struct block
+		// counters of a thread (written only by that thread, read by `snapshot`)
+		{
+			std::array<std::atomic<std::uint64_t>, num_counters> counts{};
+			std::array<std::atomic<std::uint64_t>, max_channels> firings{};
+			std::array<std::atomic<std::uint64_t>, num_timers> calls{}, ns{};
+
+			static void bump(std::atomic<std::uint64_t>& c, std::uint64_t v) noexcept
+			// add v to a counter owned by the calling thread (a plain load and store)
+			{
+				c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+			}
+
+			void add_to(report& r) const noexcept
+			{
+				for (std::size_t i = 0; i < num_counters; ++i)
+					r.counts[i] += counts[i].load(std::memory_order_relaxed);
+				for (std::size_t i = 0; i < max_channels; ++i)
+					r.firings[i] += firings[i].load(std::memory_order_relaxed);
+				for (std::size_t i = 0; i < num_timers; ++i)
+				{
+					r.calls[i] += calls[i].load(std::memory_order_relaxed);
+					r.ns[i] += ns[i].load(std::memory_order_relaxed);
+				}
+			}
+
+			void clear() noexcept
+			{
+				for (auto& c : counts)
+					c.store(0, std::memory_order_relaxed);
+				for (auto& c : firings)
+					c.store(0, std::memory_order_relaxed);
+				for (std::size_t i = 0; i < num_timers; ++i)
+				{
+					calls[i].store(0, std::memory_order_relaxed);
+					ns[i].store(0, std::memory_order_relaxed);
+				}
+			}
+		};
+
+		struct registry
+		// the counters of the running threads and the totals of the terminated ones
+		{
+			std::mutex mutex;
+			std::vector<block*> live;
+			report retired;
+
+			static registry& get()
+			{
+				static registry r;
+				return r;
+			}
+		};
+
+		struct local_block
+		// registers the counters of a thread while it runs
+		{
+			block b;
+
+			local_block()
+			{
+				registry& r = registry::get();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				r.live.push_back(&b);
+			}
+
+			~local_block()
+			{
+				registry& r = registry::get();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				b.add_to(r.retired);
+				r.live.erase(std::find(r.live.begin(), r.live.end(), &b));
+			}
+		};
+
+		inline block& local()
+		{
+			thread_local local_block lb;
+			return lb.b;
+		}
+	} // namespace detail
+#endif // SEK_INSTRUMENT
+
+	inline void add([[maybe_unused]] counter c, [[maybe_unused]] std::uint64_t v = 1) noexcept
+	// add v to a counter of the calling thread
+	{
+#ifdef SEK_INSTRUMENT
+		detail::block::bump(detail::local().counts[std::size_t(c)], v);
+#endif
+	}
+
+	inline void fire([[maybe_unused]] std::size_t channel) noexcept
+	// count a reaction of a channel (and an SSA step)
+	{
+#ifdef SEK_INSTRUMENT
+		detail::block& b = detail::local();
+		detail::block::bump(b.counts[std::size_t(counter::ssa_steps)], 1);
+		detail::block::bump(b.firings[channel < max_channels ? channel : max_channels-1], 1);
+#endif
+	}
+
+	class scoped_timer
+	// measure the time from the construction to the destruction of this object
+	{
+#ifdef SEK_INSTRUMENT
+		timer id;
+		std::chrono::steady_clock::time_point start;
+#endif
+
+	public:
+
+		explicit scoped_timer([[maybe_unused]] timer id) noexcept
+#ifdef SEK_INSTRUMENT
+			: id(id), start(std::chrono::steady_clock::now())
+#endif
+		{}
+
+		scoped_timer(const scoped_timer&) = delete;
+		scoped_timer& operator=(const scoped_timer&) = delete;
+
+		~scoped_timer()
+		{
+#ifdef SEK_INSTRUMENT
+			auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+			detail::block& b = detail::local();
+			detail::block::bump(b.calls[std::size_t(id)], 1);
+			detail::block::bump(b.ns[std::size_t(id)], elapsed.count());
+#endif
+		}
+	};
+
+	inline report snapshot()
+	// return the counters and timers summed over all threads (all zero if SEK_INSTRUMENT is not defined).
+	// The counters of the threads which are running a simulation may be slightly behind.
+	{
+		report r;
+#ifdef SEK_INSTRUMENT
+		detail::registry& reg = detail::registry::get();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		r = reg.retired;
+		for (const detail::block* b : reg.live)
+			b->add_to(r);
+#endif
+		return r;
+	}
+
+	inline void reset()
+	// set all the counters and timers to zero (no simulation must be running, or its events may be kept)
+	{
+#ifdef SEK_INSTRUMENT
+		detail::registry& reg = detail::registry::get();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.retired = report{};
+		for (detail::block* b : reg.live)
+			b->clear();
+#endif
+	}
+} // namespace instrument
+
+#endif // SEK_COUNTERS
@@ -0,0 +1,399 @@
+//  Stochastic enzyme kinetics: distributed-memory chemical master equation solver
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_DISTRIBUTED
+#define SEK_DISTRIBUTED
+
+#include <array>
+#include <vector>
+#include <valarray>
+#include <algorithm> // max, copy
+#include <concepts> // floating_point, invocable
+#include <stdexcept> // invalid_argument, out_of_range
+#include <cmath> // sqrt
+#include <string> // to_string
+#include <iterator> // begin, end
+
+#ifdef SEK_MPI
+#include <mpi.h>
+#endif
+
+#include "tensor.hpp"
+
+// If SEK_MPI is defined, the ranks are the processes of an MPI communicator (the program must call
+// MPI_Init and MPI_Finalize, and is compiled with e.g. `mpicxx -DSEK_MPI`); otherwise there is a
+// single rank, so the same code can be used and tested without MPI.
+
+namespace distributed
+{
+	class communicator
+	// group of ranks of a distributed computation (no ownership of the MPI communicator)
+	{
+#ifdef SEK_MPI
+		MPI_Comm comm;
+
+		template <std::floating_point T>
+		static MPI_Datatype type() noexcept
+		{
+			if constexpr (sizeof(T) == sizeof(float))
+				return MPI_FLOAT;
+			else if constexpr (sizeof(T) == sizeof(double))
+				return MPI_DOUBLE;
+			else
+				return MPI_LONG_DOUBLE;
+		}
+#endif
+
+	public:
+
+#ifdef SEK_MPI
+		explicit communicator(MPI_Comm comm = MPI_COMM_WORLD) noexcept
+			: comm(comm)
+		{}
+#endif
+
+		int rank() const noexcept
+		{
+#ifdef SEK_MPI
+			int r;
+			MPI_Comm_rank(comm, &r);
+			return r;
+#else
+			return 0;
+#endif
+		}
+
+		int size() const noexcept
+		{
+#ifdef SEK_MPI
+			int n;
+			MPI_Comm_size(comm, &n);
+			return n;
+#else
+			return 1;
+#endif
+		}
+
+		template <std::floating_point T>
+		void sum([[maybe_unused]] T* data, [[maybe_unused]] std::size_t n) const noexcept
+		// replace data[0:n] with its sum over all the ranks
+		{
+#ifdef SEK_MPI
+			MPI_Allreduce(MPI_IN_PLACE, data, int(n), type<T>(), MPI_SUM, comm);
+#endif
+		}
+
+		template <std::floating_point T>
+		T sum(T v) const noexcept
+		// return the sum of v over all the ranks
+		{
+			sum(&v, 1);
+			return v;
+		}
+
+		template <std::floating_point T>
+		void exchange([[maybe_unused]] const T* to_prev, [[maybe_unused]] std::size_t n_to_prev,
+			[[maybe_unused]] const T* to_next, [[maybe_unused]] std::size_t n_to_next,
+			[[maybe_unused]] T* from_prev, [[maybe_unused]] std::size_t n_from_prev,
+			[[maybe_unused]] T* from_next, [[maybe_unused]] std::size_t n_from_next) const noexcept
+		// send to_prev to the previous rank and to_next to the next one, and receive from_prev from the
+		// previous rank and from_next from the next one (the first and the last rank skip the missing neighbor)
+		{
+#ifdef SEK_MPI
+			int r = rank(), n = size();
+			int prev = r > 0 ? r-1 : MPI_PROC_NULL, next = r+1 < n ? r+1 : MPI_PROC_NULL;
+			MPI_Sendrecv(to_next, int(n_to_next), type<T>(), next, 0,
+				from_prev, int(n_from_prev), type<T>(), prev, 0, comm, MPI_STATUS_IGNORE);
+			MPI_Sendrecv(to_prev, int(n_to_prev), type<T>(), prev, 1,
+				from_next, int(n_from_next), type<T>(), next, 1, comm, MPI_STATUS_IGNORE);
+#endif
+		}
+
+		template <std::floating_point T>
+		void gather(const T* local, std::size_t n_local, T* out, [[maybe_unused]] const std::vector<std::size_t>& counts) const
+		// concatenate the local arrays of all the ranks (counts[r] elements from rank r) into out on rank 0
+		{
+#ifdef SEK_MPI
+			std::vector<int> cnt(counts.size()), displ(counts.size());
+			for (std::size_t r = 0, d = 0; r < counts.size(); d += counts[r++])
+			{
+				cnt[r] = int(counts[r]);
+				displ[r] = int(d);
+			}
+			MPI_Gatherv(local, int(n_local), type<T>(), out, cnt.data(), displ.data(), type<T>(), 0, comm);
+#else
+			std::copy(local, local + n_local, out);
+#endif
+		}
+	};
+
+	template <typename System>
+	class slab_cme
+	// CME of a system (see `cme::cme`) whose box of states is decomposed into slabs along the first
+	// species, so that each rank stores and integrates only the probabilities of its slab. Before every
+	// evaluation of the time derivative, the halos (the states of the neighboring slabs which are
+	// sources of reactions, i.e. at the index offsets of the stoichiometric vectors) are exchanged with
+	// the neighboring ranks. Normalization and moments are reduced over all the ranks.
+	// The derivative is computed as `cme::derivative` on the whole box (without assembled matrix), so
+	// with any number of ranks the results are the same as the serial solver.
+	{
+	public:
+
+		using T = decltype(System::t);
+		static constexpr std::size_t N_s = System::num_species;
+		static constexpr std::size_t N_r = System::num_rc;
+
+	private:
+
+		const System& sys;
+		communicator comm;
+		std::array<long long, N_s> n_max;
+		std::vector<std::size_t> counts; // number of states of each rank
+		std::size_t begin, end; // box indices of the states of this rank
+		std::size_t h_lo, h_hi; // halo widths below and above the slab
+		std::array<long long, N_r> offset; // index difference between a state and its source state
+		std::valarray<T> ext; // halo below, slab, halo above
+
+		std::array<long long, N_s> pop(std::size_t index) const noexcept
+		// population numbers of a box index
+		{
+			std::array<long long, N_s> y;
+			for (std::size_t i = N_s; i --> 0; )
+			{
+				y[i] = index % n_max[i];
+				index /= n_max[i];
+			}
+			return y;
+		}
+
+		T rate(const physics::vec<long long, N_s>& y, std::size_t r_i) const
+		{
+			return sys.System::a(y, r_i);
+		}
+
+		void partition()
+		// assign the slab and the halos of this rank
+		{
+			if (sys.reduced())
+				throw std::invalid_argument("The distributed CME needs the whole box of states.");
+			for (std::size_t s = 0; s < N_s; ++s)
+				n_max[s] = sys.get_shape_index(s);
+			const std::size_t n_ranks = comm.size(), r = comm.rank();
+			const std::size_t planes = n_max[0], plane = sys.box_size() / planes;
+			if (planes < n_ranks)
+				throw std::invalid_argument("The first species has fewer population numbers than ranks.");
+			counts.resize(n_ranks);
+			for (std::size_t q = 0; q < n_ranks; ++q)
+				counts[q] = (planes*(q+1)/n_ranks - planes*q/n_ranks) * plane;
+			begin = planes*r/n_ranks * plane;
+			end = planes*(r+1)/n_ranks * plane;
+
+			h_lo = h_hi = 0;
+			const auto& nu = sys.stoichiometry();
+			for (std::size_t r_i = 0; r_i < N_r; ++r_i)
+			{
+				offset[r_i] = sys.get_offset(nu[r_i]);
+				h_lo = std::max<long long>(h_lo, offset[r_i]);
+				h_hi = std::max<long long>(h_hi, -offset[r_i]);
+			}
+			for (std::size_t q = 0; q < n_ranks; ++q)
+				if (counts[q] < std::max(h_lo, h_hi) && n_ranks > 1)
+					throw std::invalid_argument("Too many ranks: every slab must be at least as large as the halos ("
+						+ std::to_string(std::max(h_lo, h_hi)) + " states).");
+			p.resize(end - begin);
+			ext.resize(h_lo + p.size() + h_hi, 0);
+		}
+
+	public:
+
+		std::valarray<T> p; // probabilities of the states of this rank (box indices [begin, end))
+		T t = 0;
+
+		explicit slab_cme(System& sys, communicator comm = communicator())
+			: sys(sys), comm(comm), t(sys.t)
+		// constructor: take the slab of this rank from the probabilities of sys, whose state space
+		// must be the whole box, and release them (sys must outlive this object).
+		// Every rank stores the whole box until then: use the other constructor if it does not fit.
+		{
+			partition();
+			std::copy(std::begin(sys.p) + begin, std::begin(sys.p) + end, std::begin(p));
+			sys.release_state();
+		}
+
+		template <typename Init>
+		requires std::invocable<Init&, const std::array<long long, N_s>&>
+		slab_cme(const System& sys, Init&& init, communicator comm = communicator())
+			: sys(sys), comm(comm), t(sys.t)
+		// constructor: compute the probabilities of the slab of this rank, so that no rank stores the
+		// whole box (sys should be constructed without probabilities, see `cme::storage`, and must
+		// outlive this object)
+		//	init(y): initial probability of the state with population numbers y
+		{
+			partition();
+			for (std::size_t i = 0; i < p.size(); ++i)
+				p[i] = init(pop(begin + i));
+		}
+
+		std::size_t slab_begin() const noexcept
+		{
+			return begin;
+		}
+
+		std::size_t slab_end() const noexcept
+		{
+			return end;
+		}
+
+		void derivative(const std::valarray<T>& q, std::valarray<T>& dq)
+		// compute the time derivative dq of the probabilities q of this slab (collective)
+		{
+			using std::size_t;
+
+			const size_t n = q.size();
+			std::copy(std::begin(q), std::end(q), std::begin(ext) + h_lo);
+			T* e = &ext[0];
+			comm.exchange(e + h_lo, std::min(h_hi, n), e + h_lo + n - std::min(h_lo, n), std::min(h_lo, n),
+				e, h_lo, e + h_lo + n, h_hi);
+
+			const T* x = e + h_lo;
+			const auto& nu = sys.stoichiometry();
+			physics::vec<long long, N_s> y;
+			static_cast<std::array<long long, N_s>&>(y) = pop(begin);
+			for (size_t i = 0; i < n; ++i)
+			{
+				T out = 0;
+				for (size_t r_i = 0; r_i < N_r; ++r_i)
+				{
+					// probability flowing in from the source state y - nu
+					physics::vec<long long, N_s> z = y - nu[r_i];
+					bool in_bounds = true;
+					for (size_t s = 0; s < N_s; ++s)
+						if (z[s] < 0 || z[s] >= n_max[s])
+							in_bounds = false;
+					if (in_bounds)
+						out += rate(z, r_i) * x[(long long)i - offset[r_i]];
+					// probability flowing out of the state y
+					out -= rate(y, r_i) * x[i];
+				}
+				dq[i] = out;
+
+				++y[N_s-1];
+				for (size_t j = N_s; j --> 1; )
+					if (y[j] == n_max[j])
+					{
+						y[j] = 0;
+						++y[j-1];
+					}
+			}
+		}
+
+		template <typename Integ>
+		void step(Integ& integ, T dt)
+		// a single step integrating the chemical master equation (collective)
+		{
+			integ.step(p, dt, [this](const std::valarray<T>& q, std::valarray<T>& dq)
+			{
+				derivative(q, dq);
+			});
+			t += dt;
+		}
+
+		template <typename Integ>
+		std::size_t simulate(Integ& integ, T dt, T t_final)
+		// simulate until t >= t_final (collective)
+		// return the number of steps
+		{
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+				step(integ, dt);
+			return i;
+		}
+
+		T total() const
+		// return the total probability (collective)
+		{
+			return comm.sum(T(p.sum()));
+		}
+
+		void normalize()
+		// divide the probabilities by their total (collective)
+		{
+			p /= total();
+		}
+
+		std::valarray<T> marginal(std::size_t s_i) const
+		// return the marginal distribution of the species s_i (collective)
+		{
+			if (s_i >= N_s)
+				throw std::out_of_range("Species index out of bounds.");
+			std::size_t inner = 1;
+			for (std::size_t s = s_i+1; s < N_s; ++s)
+				inner *= n_max[s];
+			std::valarray<T> m(T(0), n_max[s_i]);
+			for (std::size_t i = 0; i < p.size(); ++i)
+				m[(begin + i) / inner % n_max[s_i]] += p[i];
+			comm.sum(&m[0], m.size());
+			return m;
+		}
+
+		T nth_moment(std::size_t s_i, std::size_t n) const
+		// return the n-th raw moment of the population of species s_i (collective)
+		{
+			std::valarray<T> pm = marginal(s_i);
+			T mom = 0;
+			for (std::size_t x = 0; x < pm.size(); ++x)
+			{
+				T xn = 1;
+				for (std::size_t k = 0; k < n; ++k)
+					xn *= x;
+				mom += pm[x] * xn;
+			}
+			return mom;
+		}
+
+		T mean(std::size_t s_i) const
+		// return the mean population of species s_i (collective)
+		{
+			return nth_moment(s_i, 1);
+		}
+
+		T msq(std::size_t s_i) const
+		// return the mean square population of species s_i (collective)
+		{
+			return nth_moment(s_i, 2);
+		}
+
+		T sd(std::size_t s_i) const
+		// return the standard deviation of the population of species s_i (collective)
+		{
+			using std::sqrt;
+
+			T m = mean(s_i);
+			T arg = msq(s_i) - m*m;
+			return arg > 0 ? sqrt(arg) : 0;
+		}
+
+		std::valarray<T> gather() const
+		// return the probabilities of the whole box on rank 0 (empty on the other ranks) (collective)
+		{
+			std::valarray<T> all(comm.rank() == 0 ? sys.box_size() : 0);
+			comm.gather(&p[0], p.size(), comm.rank() == 0 ? &all[0] : nullptr, counts);
+			return all;
+		}
+	};
+} // namespace distributed
+
+#endif // SEK_DISTRIBUTED
@@ -17,17 +17,27 @@
 #ifndef SEK_GILLESPIE
 #define SEK_GILLESPIE
 
-#include <random> // uniform_real_distribution, mt19937_64
 #include <valarray>
-#include <concepts> // floating_point
+#include <concepts> // floating_point, predicate, invocable
 #include <functional> // function
-#include <stdexcept> // domain_error, out_of_range
+#include <stdexcept> // domain_error, out_of_range, invalid_argument
 #include <string> // string, to_string
 #include <vector>
 #include <array>
 #include <cmath> // log, sqrt
+#include <limits> // numeric_limits
+#include <cstdint> // uint32_t, uint64_t
+#include <type_traits> // type_identity_t, is_void_v, remove_cvref_t, invoke_result_t
+#include <istream>
+#include <ostream>
 
 #include "tensor.hpp"
+#include "random.hpp"
+#include "thread_pool.hpp"
+#include "checkpoint.hpp"
+#include "network.hpp"
+#include "lookup.hpp"
+#include "counters.hpp"
 
 namespace gillespie
 {
@@ -38,16 +48,182 @@ namespace gillespie
 		std::vector<T> t;
 	};
 
-	template <std::size_t N_s, std::size_t N_r, std::floating_point T = double>
+	template <std::size_t N_s, std::floating_point T = double>
+	struct ensemble_stats
+	// statistics of an ensemble of trajectories sampled on a fixed time grid.
+	// Sums are accumulated with integers, so the result does not depend on
+	// the order in which the trajectories are added.
+	{
+		std::vector<T> t; // sampling times (non-decreasing)
+		std::array<std::size_t, N_s> n_bins; // histogram size for each species (0 for no histogram)
+		std::size_t n = 0; // number of trajectories
+		std::vector<long long> sum, sum_sq; // sums of populations and their squares (time-major)
+		std::array<std::vector<long long>, N_s> hist; // population histograms (time-major)
+
+		ensemble_stats(const std::vector<T>& t, const std::array<std::size_t, N_s>& n_bins = {})
+			: t(t), n_bins(n_bins), sum(t.size()*N_s, 0), sum_sq(t.size()*N_s, 0)
+		// constructor
+		//	t: sampling times
+		//	n_bins: number of bins for each species histogram, i.e. populations in [0, n_bins)
+		//	are counted and the others are ignored
+		{
+			for (std::size_t i = 1; i < t.size(); ++i)
+				if (t[i] < t[i-1])
+					throw std::invalid_argument("Sampling times must be in non-decreasing order.");
+			for (std::size_t s = 0; s < N_s; ++s)
+				hist[s].resize(t.size()*n_bins[s], 0);
+		}
+
+		void add(std::size_t k, const physics::vec<long long, N_s>& x)
+		// accumulate the state x sampled at the k-th time
+		{
+			for (std::size_t s = 0; s < N_s; ++s)
+			{
+				sum[k*N_s + s] += x[s];
+				sum_sq[k*N_s + s] += x[s]*x[s];
+				if (x[s] >= 0 && std::size_t(x[s]) < n_bins[s])
+					++hist[s][k*n_bins[s] + x[s]];
+			}
+		}
+
+		void merge(const ensemble_stats& other)
+		// merge the statistics of another ensemble sampled on the same grid
+		{
+			if (other.t != t || other.n_bins != n_bins)
+				throw std::invalid_argument("Cannot merge ensembles with different time grids or histograms.");
+			n += other.n;
+			for (std::size_t i = 0; i < sum.size(); ++i)
+			{
+				sum[i] += other.sum[i];
+				sum_sq[i] += other.sum_sq[i];
+			}
+			for (std::size_t s = 0; s < N_s; ++s)
+				for (std::size_t i = 0; i < hist[s].size(); ++i)
+					hist[s][i] += other.hist[s][i];
+		}
+
+		T mean(std::size_t k, std::size_t s) const
+		// return the mean population of species s at the k-th time
+		{
+			return n ? T(sum[k*N_s + s]) / n : 0;
+		}
+
+		T msq(std::size_t k, std::size_t s) const
+		// return the mean square population of species s at the k-th time
+		{
+			return n ? T(sum_sq[k*N_s + s]) / n : 0;
+		}
+
+		T sd(std::size_t k, std::size_t s) const
+		// return the standard deviation of the population of species s at the k-th time
+		{
+			using std::sqrt;
+			T m = mean(k, s);
+			T arg = msq(k, s) - m*m;
+			return arg > 0 ? sqrt(arg) : 0;
+		}
+	};
+
+	template <std::size_t N_s, std::size_t N_r, std::floating_point T = double, typename Model = void>
 	requires (N_r > 0 && N_s > 0)
 	// N_s: number of substances (chemical species)
 	// N_r: number of reaction channels
 	// T: underlying floating-point type
+	// Model: the derived class, if it defines `propensities(y, a)` which computes all the propensity
+	//	functions at once (it is called without virtual dispatch, so that it can be inlined), or void
+	// If SEK_DEBUG is defined, every step checks that the state is compatible with the constants
+	// of motion of the model (see `compatible`).
 	class gillespie
 	// Gillespie general algorithm
 	{
-		std::mt19937_64 gen; // random number generator (64-bit Mersenne Twister)
-		std::uniform_real_distribution<T> u_dist = std::uniform_real_distribution<T>(0, 1);
+		prng::philox4x32 gen; // random number generator (counter-based)
+
+		T uniform() noexcept
+		// uniform random number in [0, 1) made of the next two words of gen
+		{
+			std::uint32_t lo = gen();
+			std::uint32_t hi = gen();
+			return prng::canonical<T>(lo, hi);
+		}
+
+		void tabulate_model()
+		// rebuild the lookup table of the model, if it has one and its parameters have changed
+		{
+			if constexpr (requires (Model& m) { m.tabulate(); })
+				static_cast<Model&>(*this).tabulate();
+		}
+
+		bool step_unchecked(T t_final)
+		// same as `step`, reading the lookup table of the model without comparing its parameters:
+		// the simulation loops call tabulate_model once, instead of at every reaction
+		{
+			using std::log;
+
+#ifdef SEK_DEBUG
+			check_state();
+#endif
+			std::array<T, N_r> a_r{}; // not computed if the propensities are tabulated
+			const T* cum = nullptr; // cumulative propensity functions, if the model tabulates them
+			if constexpr (requires (const Model& m) { m.cumulative_propensities(x); })
+				cum = static_cast<const Model&>(*this).cumulative_propensities(x);
+
+			T a_tot = 0;
+			if (cum)
+			{
+				instrument::add(instrument::counter::table_lookups);
+				a_tot = cum[N_r-1];
+			}
+			else
+			{
+				instrument::add(instrument::counter::propensity_evaluations);
+				calc_propensities(a_r);
+				for (std::size_t i = 0; i < N_r; ++i)
+					a_tot += a_r[i];
+			}
+
+			if (a_tot == 0)
+			{
+				instrument::add(instrument::counter::null_steps);
+				return false; // no reaction is possible
+			}
+
+			T r1 = uniform();
+			T r2 = uniform();
+
+			T tau = -log(r1)/a_tot;
+
+			if (t + tau > t_final && t_final > 0)
+			{
+				instrument::add(instrument::counter::null_steps);
+				return false; // reaction would be performed after t_final
+			}
+
+			std::size_t j;
+
+			if (cum)
+			{
+				for (j = 0; j < N_r-1; ++j)
+					if (cum[j] > r2*a_tot)
+						break;
+			}
+			else
+			{
+				T a_accum = 0;
+				for (j = 0; j < N_r-1; ++j)
+				{
+					a_accum += a_r[j];
+					if (a_accum > r2*a_tot)
+						break;
+				}
+			}
+			instrument::add(instrument::counter::selection_comparisons, j + (j < N_r-1));
+			instrument::fire(j);
+
+			t += tau;
+			x += nu[j];
+
+			return true;
+		}
 
 	protected:
 
@@ -71,52 +247,97 @@ namespace gillespie
 			return 10'000'000;
 		}
 
+		const std::array<physics::vec<long long, N_s>, N_r>& stoichiometry() const noexcept
+		// return the stoichiometric vectors of the reaction channels
+		{
+			return nu;
+		}
+
+		void seed(std::uint64_t seed, std::uint64_t stream = 0) noexcept
+		// select the random sequence identified by (seed, stream) and rewind it.
+		// Different streams with the same seed are statistically independent.
+		{
+			gen.seed(seed, stream);
+		}
+
+		void save(std::ostream& out) const
+		// write a checkpoint of the state, the time and the random number generator
+		// (the parameters of the model are not saved: it must be restored into an equal model)
+		{
+			checkpoint::writer w(out, checkpoint::kind::gillespie);
+			w.write(std::uint64_t(N_s));
+			w.write(std::uint64_t(N_r));
+			w.write(std::uint64_t(sizeof(T)));
+			w.write(x.data(), N_s);
+			w.write(t);
+			const auto s = gen.state();
+			w.write(s.data(), s.size());
+		}
+
+		void load(std::istream& in)
+		// restore a checkpoint written by `save`, so that the simulation continues with the same
+		// random sequence as the saved object
+		{
+			checkpoint::reader r(in, checkpoint::kind::gillespie);
+			r.expect(r.read<std::uint64_t>() == N_s, "number of species");
+			r.expect(r.read<std::uint64_t>() == N_r, "number of reaction channels");
+			r.expect(r.read<std::uint64_t>() == sizeof(T), "floating-point type");
+			physics::vec<long long, N_s> x_saved;
+			r.read(x_saved.data(), N_s);
+			T t_saved = r.read<T>();
+			prng::philox4x32::state_type s;
+			r.read(s.data(), s.size());
+			x = x_saved;
+			t = t_saved;
+			gen.state(s);
+		}
+
+		void calc_propensities(std::array<T, N_r>& a_r) const
+		// calculate all the propensity functions at the current population numbers x
+		{
+			if constexpr (std::is_void_v<Model>)
+			{
+				for (std::size_t i = 0; i < N_r; ++i)
+					a_r[i] = a(i);
+			}
+			else
+				static_cast<const Model&>(*this).propensities(x, a_r);
+		}
+
 		T total_propensity() const
 		// return the total propensity, i.e., the sum of all propensity functions
 		// calculated at the current population numbers x.
 		{
+			std::array<T, N_r> a_r;
+			calc_propensities(a_r);
+
 			T a_tot = 0;
 
 			for (std::size_t i = 0; i < N_r; ++i)
-				a_tot += a(i);
+				a_tot += a_r[i];
 
 			return a_tot;
 		}
 
+		void check_state() const
+		// throw if the current state is incompatible with the constants of motion of the model
+		{
+			if (!compatible(x))
+			{
+				std::string state;
+				for (std::size_t i = 0; i < N_s; ++i)
+					state += (i ? ", " : "") + std::to_string(x[i]);
+				throw std::domain_error("Current state " + state + " is incompatible with constants of motion.");
+			}
+		}
+
 		bool step(T t_final = 0)
 		// a single step of the stochastic simulation algorithm (Gillespie)
 		// return whether a reaction has been performed successfully before time t_final or not
 		// set t_final to 0 or negative number for infinity
 		{
-			using std::log;
-
-			T a_tot = total_propensity();
-
-			if (a_tot == 0)
-				return false; // no reaction is possible
-
-			T r1 = u_dist(gen);
-			T r2 = u_dist(gen);
-
-			T tau = -log(r1)/a_tot;
-
-			if (t + tau > t_final && t_final > 0)
-				return false; // reaction would be performed after t_final
-
-			std::size_t j;
-
-			T a_accum = 0;
-			for (j = 0; j < N_r-1; ++j)
-			{
-				a_accum += a(j);
-				if (a_accum > r2*a_tot)
-					break;
-			}
-
-			t += tau;
-			x += nu[j];
-
-			return true;
+			tabulate_model();
+			return step_unchecked(t_final);
 		}
 
 		void simulate(T t_final = 0, std::size_t max_steps = default_max_steps())
@@ -124,8 +345,9 @@ namespace gillespie
 		// set t_final to 0 or negative number for infinity
 		// if the total propensity gets to zero, the simulation will be terminated
 		{
+			tabulate_model();
 			for (std::size_t i = 0; i < max_steps && (t <= t_final || t_final <= 0); ++i)
-				if (!step(t_final))
+				if (!step_unchecked(t_final))
 					break;
 		}
 
@@ -135,6 +357,9 @@ namespace gillespie
 		// n_sampling is the number of Gillespie algorithm steps for each sampling point
 		// if the total propensity gets to zero, the simulation will be terminated
 		{
+			instrument::scoped_timer timer(instrument::timer::gillespie_simulate);
+			std::size_t n_states = states.t.size();
+			tabulate_model();
 			for (std::size_t i = 0; i < max_steps && (t <= t_final || t_final <= 0); ++i)
 			{
 				if (i % n_sampling == 0)
@@ -142,23 +367,180 @@ namespace gillespie
 					states.x.push_back(x);
 					states.t.push_back(t);
 				}
-				if (!step(t_final))
+				if (!step_unchecked(t_final))
 					break;
 			}
 			states.x.push_back(x);
 			states.t.push_back(t);
+			instrument::add(instrument::counter::bytes_sampled, (states.t.size() - n_states) * (sizeof(x) + sizeof(T)));
+		}
+
+		template <typename Obs>
+		requires std::invocable<Obs&, T, const physics::vec<long long, N_s>&>
+		void simulate(Obs&& obs, T t_final = 0, std::size_t max_steps = default_max_steps(), std::size_t n_sampling = 1)
+		// same as above, calling obs(t, x) at the sampling points instead of saving the states,
+		// e.g. with `gillespie::async_states` to process them on another thread
+		{
+			tabulate_model();
+			for (std::size_t i = 0; i < max_steps && (t <= t_final || t_final <= 0); ++i)
+			{
+				if (i % n_sampling == 0)
+					obs(t, static_cast<const physics::vec<long long, N_s>&>(x));
+				if (!step_unchecked(t_final))
+					break;
+			}
+			obs(t, static_cast<const physics::vec<long long, N_s>&>(x));
+		}
+
+		template <typename Obs>
+		std::size_t sample(const std::vector<T>& t_grid, Obs&& obs, std::size_t max_steps = default_max_steps())
+		// simulate from the current state until the last time of t_grid, and call obs(k, x) with
+		// the state x at each time t_grid[k] (piecewise-constant in time), without storing the steps.
+		// The times must be in non-decreasing order; those that precede the current time get the
+		// current state. If max_steps steps are performed or the total propensity gets to zero,
+		// the remaining times get the last state.
+		// return the number of steps
+		{
+			instrument::scoped_timer timer(instrument::timer::gillespie_sample);
+			const std::size_t n_t = t_grid.size();
+			std::size_t k = 0, i = 0;
+
+			tabulate_model();
+			for (; k < n_t && t_grid[k] <= t; ++k)
+				obs(k, static_cast<const physics::vec<long long, N_s>&>(x));
+			for (; i < max_steps && k < n_t; ++i)
+			{
+				physics::vec<long long, N_s> x_prev = x;
+				bool reacted = step_unchecked(t_grid[n_t-1]);
+				for (; k < n_t && (t_grid[k] < t || !reacted); ++k)
+					obs(k, static_cast<const physics::vec<long long, N_s>&>(reacted ? x_prev : x));
+				if (!reacted)
+					break;
+			}
+			for (; k < n_t; ++k)
+				obs(k, static_cast<const physics::vec<long long, N_s>&>(x));
+			return i;
+		}
+
+		void simulate(list_of_states<N_s, T>& states, const std::vector<T>& t_grid, std::size_t max_steps = default_max_steps())
+		// simulate from the current state until the last time of t_grid, and save the states at the
+		// times of t_grid inside a list (see `sample`), so that memory scales with the grid size
+		{
+			for (std::size_t k = 1; k < t_grid.size(); ++k)
+				if (t_grid[k] < t_grid[k-1])
+					throw std::invalid_argument("Sampling times must be in non-decreasing order.");
+			states.x.reserve(states.x.size() + t_grid.size());
+			states.t.reserve(states.t.size() + t_grid.size());
+			sample(t_grid, [&](std::size_t k, const physics::vec<long long, N_s>& y)
+			{
+				states.x.push_back(y);
+				states.t.push_back(t_grid[k]);
+			}, max_steps);
+			instrument::add(instrument::counter::bytes_sampled, t_grid.size() * (sizeof(x) + sizeof(T)));
+		}
+
+		void trajectory(ensemble_stats<N_s, T>& stats, const physics::vec<long long, N_s>& x0, std::size_t max_steps = default_max_steps())
+		// simulate a trajectory starting from state x0 at time 0 and accumulate its states
+		// at the sampling times of stats (piecewise-constant in time).
+		// max_steps is the maximum number of steps: if it is reached, the remaining
+		// sampling points get the last state.
+		{
+			x = x0;
+			t = 0;
+			sample(stats.t, [&stats](std::size_t k, const physics::vec<long long, N_s>& y)
+			{
+				stats.add(k, y);
+			}, max_steps);
+			++stats.n;
+		}
+
+		void ensemble(ensemble_stats<N_s, T>& stats, const physics::vec<long long, N_s>& x0, std::size_t n_trajectories, std::size_t max_steps = default_max_steps())
+		// simulate n_trajectories independent trajectories starting from state x0 at time 0
+		// and accumulate them inside stats (see `trajectory`).
+		// The trajectories use consecutive numbers of the current random sequence.
+		// At the end x and t hold the final state of the last trajectory.
+		{
+			for (std::size_t traj = 0; traj < n_trajectories; ++traj)
+				trajectory(stats, x0, max_steps);
+		}
+
+		template <typename Pred>
+		requires std::predicate<Pred&, const physics::vec<long long, N_s>&>
+		bool simulate_until(Pred&& pred, T t_final = 0, std::size_t max_steps = default_max_steps())
+		// simulate until pred(x) is true, for at most max_steps steps or until t >= t_final
+		// set t_final to 0 or negative number for infinity
+		// return whether the condition has been reached: in this case t is the first hitting time
+		// (the predicate is also checked on the current state)
+		{
+			tabulate_model();
+			for (std::size_t i = 0; ; ++i)
+			{
+				if (pred(static_cast<const physics::vec<long long, N_s>&>(x)))
+					return true;
+				if (i >= max_steps || !step_unchecked(t_final))
+					return false;
+			}
+		}
+
+		bool simulate_until(const physics::vec<long long, N_s>& target, T t_final = 0, std::size_t max_steps = default_max_steps())
+		// simulate until the state is equal to target (see above)
+		{
+			return simulate_until([&target](const physics::vec<long long, N_s>& y)
+			{
+				return y == target;
+			}, t_final, max_steps);
+		}
+
+		template <typename Pred>
+		requires std::predicate<Pred&, const physics::vec<long long, N_s>&>
+		void hitting_times(std::vector<T>& times, const physics::vec<long long, N_s>& x0, std::size_t n_trajectories,
+			Pred&& pred, T t_final = 0, std::size_t max_steps = default_max_steps())
+		// simulate n_trajectories independent trajectories starting from state x0 at time 0, each one
+		// until pred(x) is true (see `simulate_until`), and append the hitting times to times.
+		// Trajectories which do not reach the condition get infinity.
+		// The trajectories use consecutive numbers of the current random sequence.
+		{
+			times.reserve(times.size() + n_trajectories);
+			for (std::size_t traj = 0; traj < n_trajectories; ++traj)
+			{
+				x = x0;
+				t = 0;
+				times.push_back(simulate_until(pred, t_final, max_steps) ? t : std::numeric_limits<T>::infinity());
+			}
 		}
 
 		virtual T a(std::size_t i) const = 0;
 		// propensity functions
 		//	i: reaction channel index
+
+		virtual bool compatible(const physics::vec<long long, N_s>&) const
+		// return whether population numbers are compatible with the constants of motion of the model
+		{
+			return true;
+		}
+
+	protected:
+
+		T propensity(std::size_t i) const
+		// propensity function of the i-th reaction channel at the current population numbers,
+		// computed with `Model::propensities` (models use it to implement `a`)
+		{
+			if (i >= N_r)
+				throw std::out_of_range("Reaction channel index out of bounds.");
+#ifdef SEK_DEBUG
+			check_state();
+#endif
+			std::array<T, N_r> a_r;
+			static_cast<const Model&>(*this).propensities(x, a_r);
+			return a_r[i];
+		}
 	};
 
 	template <std::floating_point T = double>
-	class single_substrate : public gillespie<2, 3, T>
+	class single_substrate : public gillespie<2, 3, T, single_substrate<T>>
 	// Gillespie algorithm applied to single-substrate enzyme kinetics
 	{
-		using base = gillespie<2, 3, T>;
+		using base = gillespie<2, 3, T, single_substrate<T>>;
 
 		using base::nu;
 
@@ -187,36 +569,93 @@ namespace gillespie
 			nu[cat] = {-1, 1};
 		}
 
+		struct kernel_type
+		// parameters and propensity functions, without the virtual members of the model
+		// (trivially copyable, e.g. for the device trajectories of `offload::ensemble`)
+		{
+			std::array<T, num_rc> kappa;
+			long long ET, ST;
+
+			T propensity(const physics::vec<long long, num_species>& y, std::size_t i) const noexcept
+			// propensity function of the i-th reaction channel
+			{
+				switch (i)
+				{
+					case f:  return kappa[f] * ((ET - y[C]) * (ST - y[C] - y[P]));
+					case b:  return kappa[b] * y[C];
+					default: return kappa[cat] * y[C];
+				}
+			}
+
+			void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+			{
+				physics::for_each_index<num_rc>([&](std::size_t i) { a[i] = propensity(y, i); }); // unrolled: no switch
+			}
+		};
+
+		kernel_type kernel() const noexcept
+		{
+			return {kappa, ET, ST};
+		}
+
+		void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			kernel().propensities(y, a);
+		}
+
+		T channel_propensity(const physics::vec<long long, num_species>& y, std::size_t i) const noexcept
+		// propensity function of the i-th reaction channel (used by the Next Reaction Method)
+		{
+			return kernel().propensity(y, i);
+		}
+
+		static constexpr std::array<std::array<bool, num_species>, num_rc> depends_on() noexcept
+		// species read by each propensity function (used to build the reaction dependency graph)
+		{
+			//          C,    P
+			return {{
+				{ true,  true}, // f
+				{ true, false}, // b
+				{ true, false}  // cat
+			}};
+		}
+
 		T a(std::size_t i) const final override
 		// propensity functions
 		//	i: reaction channel index
 		{
-			if (x[C] > ET || x[C] + x[P] > ST)
-				throw std::domain_error("Current state "
-					+ std::to_string(x[C]) + ", " + std::to_string(x[P])
-					+ " is incompatible with constants of motion.");
-			switch (i)
-			{
-				case f:
-					return kappa[f] * ((ET - x[C]) * (ST - x[C] - x[P]));
-				case b:
-					return kappa[b] * x[C];
-				case cat:
-					return kappa[cat] * x[C];
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
-			}
+			return base::propensity(i);
+		}
+
+		bool compatible(const physics::vec<long long, num_species>& y) const final override
+		{
+			return y[C] <= ET && y[C] + y[P] <= ST;
 		}
 	};
 
 	template <std::floating_point T = double>
-	class single_substrate_tqssa : public gillespie<1, 1, T>
+	class single_substrate_tqssa : public gillespie<1, 1, T, single_substrate_tqssa<T>>
 	// Gillespie algorithm applied to tQSSA (total quasi-steady state approximation)
 	{
-		using base = gillespie<1, 1, T>;
+		using base = gillespie<1, 1, T, single_substrate_tqssa<T>>;
 
 		using base::nu;
 
+		void direct(const physics::vec<long long, 1>& y, std::array<T, 1>& a) const noexcept
+		// propensity functions computed without the table
+		{
+			using std::sqrt;
+
+			long long S_hat = ST - y[P];
+			long long c = 2*ET*S_hat;
+			T b = ET + S_hat + kM;
+			T Delta = b*b - 2*c;
+			a[f] = kcat*c / (b + sqrt(Delta));
+		}
+
 	public:
 
 		enum species : std::size_t {P, num_species};
@@ -227,6 +666,7 @@ namespace gillespie
 
 		T kcat, kM;
 		long long ET, ST;
+		lookup::propensity_table<1, 4, T> table; // propensity functions for each population number
 
 		single_substrate_tqssa(T kM, T kcat, long long ET, long long ST) noexcept
 			: kcat(kcat), kM(kM), ET(ET), ST(ST)
@@ -239,43 +679,68 @@ namespace gillespie
 			// stoichiometric vectors
 			//       P
 			nu[0] = {1};
+
+			tabulate();
+		}
+
+		std::array<T, 4> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kcat, kM, T(ET), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for P = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a) { direct({y}, a); });
+		}
+
+		void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			if (!table.propensities(y[P], parameters(), a))
+				direct(y, a);
+		}
+
+		const T* cumulative_propensities(const physics::vec<long long, num_species>& y) const noexcept
+		// tabulated cumulative sums of the propensity functions (nullptr if not tabulated),
+		// which is up to date with the parameters after `tabulate`
+		{
+			return table.cumulative(y[P]);
 		}
 
 		T a(std::size_t i) const final override
 		// propensity functions
 		//	i: reaction channel index
 		{
-			using std::sqrt;
+			return base::propensity(i);
+		}
 
-			if (x[P] > ST)
-				throw std::domain_error("Current state "
-					+ std::to_string(x[P])
-					+ " is incompatible with constants of motion.");
-			switch (i)
-			{
-				case 0:
-				{
-					long long S_hat = ST - x[P];
-					long long c = 2*ET*S_hat;
-					T b = ET + S_hat + kM;
-					T Delta = b*b - 2*c;
-					return kcat*c / (b + sqrt(Delta));
-				}
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
-			}
+		bool compatible(const physics::vec<long long, num_species>& y) const final override
+		{
+			return y[P] <= ST;
 		}
 	};
 
 	template <std::floating_point T = double>
-	class single_substrate_sqssa : public gillespie<1, 1, T>
+	class single_substrate_sqssa : public gillespie<1, 1, T, single_substrate_sqssa<T>>
 	// Gillespie algorithm applied to sQSSA (standard quasi-steady state approximation)
 	// untested
 	{
-		using base = gillespie<1, 1, T>;
+		using base = gillespie<1, 1, T, single_substrate_sqssa<T>>;
 
 		using base::nu;
 
+		void direct(const physics::vec<long long, 1>& y, std::array<T, 1>& a) const noexcept
+		// propensity functions computed without the table
+		{
+			long long S = ST - y[P];
+			a[f] = kcat*(ET*S) / (S + kM);
+		}
+
 	public:
 
 		enum species : std::size_t {P, num_species};
@@ -286,6 +751,7 @@ namespace gillespie
 
 		T kcat, kM;
 		long long ET, ST;
+		lookup::propensity_table<1, 4, T> table; // propensity functions for each population number
 
 		single_substrate_sqssa(T kM, T kcat, long long ET, long long ST) noexcept
 			: kcat(kcat), kM(kM), ET(ET), ST(ST)
@@ -298,36 +764,57 @@ namespace gillespie
 			// stoichiometric vectors
 			//       P
 			nu[0] = {1};
+
+			tabulate();
+		}
+
+		std::array<T, 4> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kcat, kM, T(ET), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for P = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a) { direct({y}, a); });
+		}
+
+		void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			if (!table.propensities(y[P], parameters(), a))
+				direct(y, a);
+		}
+
+		const T* cumulative_propensities(const physics::vec<long long, num_species>& y) const noexcept
+		// tabulated cumulative sums of the propensity functions (nullptr if not tabulated),
+		// which is up to date with the parameters after `tabulate`
+		{
+			return table.cumulative(y[P]);
 		}
 
 		T a(std::size_t i) const final override
 		// propensity functions
 		//	i: reaction channel index
 		{
-			using std::sqrt;
+			return base::propensity(i);
+		}
 
-			if (x[P] > ST)
-				throw std::domain_error("Current state "
-					+ std::to_string(x[P])
-					+ " is incompatible with constants of motion.");
-			switch (i)
-			{
-				case 0:
-				{
-					long long S = ST - x[P];
-					return kcat*(ET*S) / (S + kM);
-				}
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
-			}
+		bool compatible(const physics::vec<long long, num_species>& y) const final override
+		{
+			return y[P] <= ST;
 		}
 	};
 
 	template <std::floating_point T = double>
-	class goldbeter_koshland : public gillespie<3, 6, T>
+	class goldbeter_koshland : public gillespie<3, 6, T, goldbeter_koshland<T>>
 	// Gillespie algorithm applied to Goldbeter-Koshland switch
 	{
-		using base = gillespie<3, 6, T>;
+		using base = gillespie<3, 6, T, goldbeter_koshland<T>>;
 
 		using base::nu;
 
@@ -360,42 +847,104 @@ namespace gillespie
 			nu[d]  = { 0,  0, -1};
 		}
 
+		struct kernel_type
+		// parameters and propensity functions, without the virtual members of the model
+		// (trivially copyable, e.g. for the device trajectories of `offload::ensemble`)
+		{
+			std::array<T, num_rc> kappa;
+			long long ET, DT, ST;
+
+			T propensity(const physics::vec<long long, num_species>& y, std::size_t i) const noexcept
+			// propensity function of the i-th reaction channel
+			{
+				switch (i)
+				{
+					case fe: return kappa[fe] * ((ET - y[C]) * (ST - y[SP] - y[C] - y[CP]));
+					case be: return kappa[be] * y[C];
+					case e:  return kappa[e] * y[C];
+					case fd: return kappa[fd] * ((DT - y[CP]) * y[SP]);
+					case bd: return kappa[bd] * y[CP];
+					default: return kappa[d] * y[CP];
+				}
+			}
+
+			void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+			{
+				physics::for_each_index<num_rc>([&](std::size_t i) { a[i] = propensity(y, i); }); // unrolled: no switch
+			}
+		};
+
+		kernel_type kernel() const noexcept
+		{
+			return {kappa, ET, DT, ST};
+		}
+
+		void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			kernel().propensities(y, a);
+		}
+
+		T channel_propensity(const physics::vec<long long, num_species>& y, std::size_t i) const noexcept
+		// propensity function of the i-th reaction channel (used by the Next Reaction Method)
+		{
+			return kernel().propensity(y, i);
+		}
+
+		static constexpr std::array<std::array<bool, num_species>, num_rc> depends_on() noexcept
+		// species read by each propensity function (used to build the reaction dependency graph)
+		{
+			//         SP,     C,    CP
+			return {{
+				{ true,  true,  true}, // fe
+				{false,  true, false}, // be
+				{false,  true, false}, // e
+				{ true, false,  true}, // fd
+				{false, false,  true}, // bd
+				{false, false,  true}  // d
+			}};
+		}
+
 		T a(std::size_t i) const final override
 		// propensity functions
 		//	i: reaction channel index
 		{
-			if (x[C] > ET || x[CP] > DT || x[SP] + x[C] + x[CP] > ST)
-				throw std::domain_error("Current state "
-					+ std::to_string(x[SP]) + ", " + std::to_string(x[C]) + ", " + std::to_string(x[CP])
-					+ " is incompatible with constants of motion.");
-			switch (i)
-			{
-				case fe:
-					return kappa[fe] * ((ET - x[C]) * (ST - x[SP] - x[C] - x[CP]));
-				case be:
-					return kappa[be] * x[C];
-				case e:
-					return kappa[e] * x[C];
-				case fd:
-					return kappa[fd] * ((DT - x[CP]) * x[SP]);
-				case bd:
-					return kappa[bd] * x[CP];
-				case d:
-					return kappa[d] * x[CP];
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
-			}
+			return base::propensity(i);
+		}
+
+		bool compatible(const physics::vec<long long, num_species>& y) const final override
+		{
+			return y[C] <= ET && y[CP] <= DT && y[SP] + y[C] + y[CP] <= ST;
 		}
 	};
 
 	template <std::floating_point T = double>
-	class goldbeter_koshland_tqssa : public gillespie<1, 2, T>
+	class goldbeter_koshland_tqssa : public gillespie<1, 2, T, goldbeter_koshland_tqssa<T>>
 	// Gillespie algorithm applied to Goldbeter-Koshland switch tQSSA
 	{
-		using base = gillespie<1, 2, T>;
+		using base = gillespie<1, 2, T, goldbeter_koshland_tqssa<T>>;
 
 		using base::nu;
 
+		void direct(const physics::vec<long long, 1>& y, std::array<T, 2>& a) const noexcept
+		// propensity functions computed without the table
+		{
+			using std::sqrt;
+
+			long long S_hat = ST - y[SP_hat];
+			long long c = 2*ET*S_hat;
+			T b = ET + S_hat + kME;
+			T Delta = b*b - 2*c;
+			a[e] = ke*c / (b + sqrt(Delta));
+
+			c = 2*DT*y[SP_hat];
+			b = DT + y[SP_hat] + kMD;
+			Delta = b*b - 2*c;
+			a[d] = kd*c / (b + sqrt(Delta));
+		}
+
 	public:
 
 		enum species : std::size_t {SP_hat, num_species};
@@ -406,6 +955,7 @@ namespace gillespie
 
 		T kME, ke, kMD, kd;
 		long long ET, DT, ST;
+		lookup::propensity_table<2, 7, T> table; // propensity functions for each population number
 
 		goldbeter_koshland_tqssa(T kME, T ke, T kMD, T kd, long long ET, long long DT, long long ST) noexcept
 			: kME(kME), ke(ke), kMD(kMD), kd(kd), ET(ET), DT(DT), ST(ST)
@@ -420,47 +970,68 @@ namespace gillespie
 			//      SP_hat
 			nu[e]  = { 1};
 			nu[d]  = {-1};
+
+			tabulate();
+		}
+
+		std::array<T, 7> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kME, ke, kMD, kd, T(ET), T(DT), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for SP_hat = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a) { direct({y}, a); });
+		}
+
+		void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			if (!table.propensities(y[SP_hat], parameters(), a))
+				direct(y, a);
+		}
+
+		const T* cumulative_propensities(const physics::vec<long long, num_species>& y) const noexcept
+		// tabulated cumulative sums of the propensity functions (nullptr if not tabulated),
+		// which is up to date with the parameters after `tabulate`
+		{
+			return table.cumulative(y[SP_hat]);
 		}
 
 		T a(std::size_t i) const final override
 		// propensity functions
 		//	i: reaction channel index
 		{
-			if (x[SP_hat] > ST)
-				throw std::domain_error("Current state "
-					+ std::to_string(x[SP_hat])
-					+ " is incompatible with constants of motion.");
-			switch (i)
-			{
-				case e:
-				{
-					long long S_hat = ST - x[SP_hat];
-					long long c = 2*ET*S_hat;
-					T b = ET + S_hat + kME;
-					T Delta = b*b - 2*c;
-					return ke*c / (b + sqrt(Delta));
-				}
-				case d:
-				{
-					long long c = 2*DT*x[SP_hat];
-					T b = DT + x[SP_hat] + kMD;
-					T Delta = b*b - 2*c;
-					return kd*c / (b + sqrt(Delta));
-				}
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
-			}
+			return base::propensity(i);
+		}
+
+		bool compatible(const physics::vec<long long, num_species>& y) const final override
+		{
+			return y[SP_hat] <= ST;
 		}
 	};
 
 	template <std::floating_point T = double>
-	class goldbeter_koshland_sqssa : public gillespie<1, 2, T>
+	class goldbeter_koshland_sqssa : public gillespie<1, 2, T, goldbeter_koshland_sqssa<T>>
 	// Gillespie algorithm applied to Goldbeter-Koshland switch sQSSA
 	{
-		using base = gillespie<1, 2, T>;
+		using base = gillespie<1, 2, T, goldbeter_koshland_sqssa<T>>;
 
 		using base::nu;
 
+		void direct(const physics::vec<long long, 1>& y, std::array<T, 2>& a) const noexcept
+		// propensity functions computed without the table
+		{
+			long long S = ST - y[SP];
+			a[e] = ke*(ET*S) / (S + kME);
+			a[d] = kd*(DT*y[SP]) / (y[SP] + kMD);
+		}
+
 	public:
 
 		enum species : std::size_t {SP, num_species};
@@ -471,6 +1042,7 @@ namespace gillespie
 
 		T kME, ke, kMD, kd;
 		long long ET, DT, ST;
+		lookup::propensity_table<2, 7, T> table; // propensity functions for each population number
 
 		goldbeter_koshland_sqssa(T kME, T ke, T kMD, T kd, long long ET, long long DT, long long ST) noexcept
 			: kME(kME), ke(ke), kMD(kMD), kd(kd), ET(ET), DT(DT), ST(ST)
@@ -485,30 +1057,193 @@ namespace gillespie
 			//        SP
 			nu[e]  = { 1};
 			nu[d]  = {-1};
+
+			tabulate();
+		}
+
+		std::array<T, 7> parameters() const noexcept
+		// parameters of the propensity functions (see `table`)
+		{
+			return {kME, ke, kMD, kd, T(ET), T(DT), T(ST)};
+		}
+
+		void tabulate()
+		// tabulate the propensity functions for SP = 0, ..., ST, if the parameters have changed
+		{
+			if (!table.valid(parameters()))
+				table.build(ST+1, parameters(), [this](long long y, std::array<T, num_rc>& a) { direct({y}, a); });
+		}
+
+		void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			if (!table.propensities(y[SP], parameters(), a))
+				direct(y, a);
+		}
+
+		const T* cumulative_propensities(const physics::vec<long long, num_species>& y) const noexcept
+		// tabulated cumulative sums of the propensity functions (nullptr if not tabulated),
+		// which is up to date with the parameters after `tabulate`
+		{
+			return table.cumulative(y[SP]);
+		}
+
+		T a(std::size_t i) const final override
+		// propensity functions
+		//	i: reaction channel index
+		{
+			return base::propensity(i);
+		}
+
+		bool compatible(const physics::vec<long long, num_species>& y) const final override
+		{
+			return y[SP] <= ST;
+		}
+	};
+
+	template <std::size_t N_s, std::size_t N_r, std::floating_point T = double>
+	class reaction_network : public gillespie<N_s, N_r, T, reaction_network<N_s, N_r, T>>
+	// Gillespie algorithm applied to a reaction network defined at runtime (see `network::description`)
+	{
+		using base = gillespie<N_s, N_r, T, reaction_network<N_s, N_r, T>>;
+
+		using base::nu;
+
+	public:
+
+		static constexpr std::size_t num_species = N_s, num_rc = N_r;
+
+		using base::x;
+		using base::t;
+
+		network::kernel_table<N_s, N_r, T> kernels;
+
+		explicit reaction_network(const network::description<T>& d)
+			: kernels(d)
+		// constructor
+		//	d: description of the network (it must have N_s species and N_r reactions)
+		{
+			nu = kernels.stoichiometry();
+		}
+
+		void propensities(const physics::vec<long long, num_species>& y, std::array<T, num_rc>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			kernels.propensities(y, a);
+		}
+
+		T channel_propensity(const physics::vec<long long, num_species>& y, std::size_t i) const noexcept
+		// propensity function of the i-th reaction channel (used by the Next Reaction Method)
+		{
+			return kernels.propensity(y, i);
+		}
+
+		const std::array<std::array<bool, num_species>, num_rc>& depends_on() const noexcept
+		// species read by each propensity function (used to build the reaction dependency graph)
+		{
+			return kernels.depends_on();
 		}
 
 		T a(std::size_t i) const final override
 		// propensity functions
 		//	i: reaction channel index
 		{
-			if (x[SP] > ST)
-				throw std::domain_error("Current state "
-					+ std::to_string(x[SP])
-					+ " is incompatible with constants of motion.");
-			switch (i)
+			return base::propensity(i);
+		}
+
+		bool compatible(const physics::vec<long long, num_species>& y) const final override
+		{
+			return kernels.compatible(y);
+		}
+	};
+
+	template <typename Model, std::size_t N_s, std::floating_point T>
+	void parallel_ensemble(parallel::thread_pool& pool, const Model& model, ensemble_stats<N_s, T>& stats,
+		const std::type_identity_t<physics::vec<long long, N_s>>& x0, std::size_t n_trajectories, std::uint64_t seed,
+		std::size_t max_steps = Model::default_max_steps())
+	// simulate n_trajectories independent trajectories of a copy of model on the threads of pool
+	// and accumulate them inside stats (see `gillespie::trajectory`).
+	// The i-th trajectory uses the random stream (seed, i), so the statistics are bitwise
+	// identical whatever the number of threads; model itself is not modified.
+	{
+		std::vector<Model> models(pool.size(), model);
+		std::vector<ensemble_stats<N_s, T>> partial(pool.size(), ensemble_stats<N_s, T>(stats.t, stats.n_bins));
+
+		pool.parallel_for(n_trajectories, 16, [&](std::size_t id, std::size_t begin, std::size_t end)
+		{
+			for (std::size_t i = begin; i < end; ++i)
 			{
-				case e:
+				models[id].seed(seed, i);
+				models[id].trajectory(partial[id], x0, max_steps);
+			}
+		});
+
+		for (const auto& p : partial)
+			stats.merge(p);
+	}
+
+	template <typename Make, std::size_t N_s, std::floating_point T,
+		typename Model = std::remove_cvref_t<std::invoke_result_t<Make&, std::size_t>>>
+	void parallel_sweep(parallel::thread_pool& pool, std::size_t n_points, Make&& make, std::vector<ensemble_stats<N_s, T>>& stats,
+		const std::type_identity_t<physics::vec<long long, N_s>>& x0, std::size_t n_trajectories, std::uint64_t seed,
+		std::size_t max_steps = Model::default_max_steps())
+	// simulate n_trajectories trajectories of each of the models make(0), ..., make(n_points-1)
+	// (e.g. a grid of parameters) and accumulate the ones of make(k) inside stats[k] (see `ensemble`).
+	// The points are distributed over the threads of pool, each one simulated by a single thread,
+	// so make must be thread-safe. The i-th trajectory of every point uses the random stream (seed, i):
+	// the statistics are bitwise identical whatever the number of threads, and the points share
+	// their random numbers (which reduces the variance of the differences between them).
+	{
+		if (stats.size() != n_points)
+			throw std::invalid_argument("There must be one ensemble for each point of the sweep.");
+
+		pool.parallel_for(n_points, 1, [&](std::size_t, std::size_t begin, std::size_t end)
+		{
+			for (std::size_t k = begin; k < end; ++k)
+			{
+				Model model = make(k);
+				for (std::size_t i = 0; i < n_trajectories; ++i)
 				{
-					long long S = ST - x[SP];
-					return ke*(ET*S) / (S + kME);
+					model.seed(seed, i);
+					model.trajectory(stats[k], x0, max_steps);
 				}
-				case d:
-					return kd*(DT*x[SP]) / (x[SP] + kMD);
-				default:
-					throw std::out_of_range("Reaction channel index out of bounds.");
 			}
-		}
-	};
+		});
+	}
+
+	template <typename Model, typename Pred>
+	requires std::predicate<const Pred&, const physics::vec<long long, Model::num_species>&>
+	std::vector<decltype(Model::t)> parallel_hitting_times(parallel::thread_pool& pool, const Model& model,
+		const physics::vec<long long, Model::num_species>& x0, std::size_t n_trajectories, std::uint64_t seed,
+		const Pred& pred, decltype(Model::t) t_final = 0, std::size_t max_steps = Model::default_max_steps())
+	// simulate n_trajectories independent trajectories of a copy of model on the threads of pool,
+	// each one until pred(x) is true, and return the hitting times (see `gillespie::hitting_times`).
+	// The i-th trajectory uses the random stream (seed, i), so the times are bitwise identical
+	// whatever the number of threads; model itself is not modified and pred must be thread-safe.
+	{
+		using T = decltype(Model::t);
+
+		std::vector<Model> models(pool.size(), model);
+		std::vector<T> times(n_trajectories);
+
+		pool.parallel_for(n_trajectories, 16, [&](std::size_t id, std::size_t begin, std::size_t end)
+		{
+			Model& m = models[id];
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				m.seed(seed, i);
+				m.x = x0;
+				m.t = 0;
+				times[i] = m.simulate_until(pred, t_final, max_steps) ? m.t : std::numeric_limits<T>::infinity();
+			}
+		});
+
+		return times;
+	}
 } // namespace gillespie
 
 #endif // SEK_GILLESPIE
@@ -0,0 +1,193 @@
+//  Stochastic enzyme kinetics: implicit Runge-Kutta methods for stiff linear systems
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_IMPLICIT
+#define SEK_IMPLICIT
+
+#include <concepts> // floating_point, invocable
+#include <valarray>
+#include <array>
+#include <stdexcept> // runtime_error
+
+#include "krylov.hpp"
+
+namespace implicit
+{
+	template <std::size_t Stages, std::floating_point T = double>
+	class sdirk
+	// all singly diagonally implicit Runge-Kutta (SDIRK) methods inherit from this class
+	// `Stages` is the number of stages of the method (number of linear systems per step).
+	// The methods are specialized to linear systems dx/dt = A x (like the CME), so that the Jacobian
+	// is A itself and the derivative f(v) = A v is also the matrix-vector product used to solve
+	// the stage equations (I - dt*gamma*A) k_i = A (x + dt*sum_{j<i} a_ij k_j) with BiCGSTAB.
+	// For linear systems they coincide with the Rosenbrock methods with the same coefficients.
+	{
+		std::valarray<T> k[Stages], y, rhs, inv_diag;
+
+		void combine(T* out, const T* x, std::size_t n, std::size_t row, T dt) const noexcept
+		// out = x + dt * sum_{j<row} a[row][j] k[j] (or the weights b if row == Stages)
+		{
+			for (std::size_t e = 0; e < n; ++e)
+			{
+				T sum = 0;
+				for (std::size_t j = 0; j < row && j < Stages; ++j)
+					sum += pars[row*Stages + j] * k[j][e] * dt;
+				out[e] = sum + x[e];
+			}
+		}
+
+		template <typename F, typename Precond>
+		void solve_stages(std::valarray<T>& x, T dt, F& f, Precond&& precond)
+		{
+			using std::size_t;
+
+			const size_t n = x.size();
+			for (size_t i = 0; i < Stages; ++i)
+				if (k[i].size() != n)
+					k[i].resize(n);
+			if (y.size() != n)
+				y.resize(n);
+			if (rhs.size() != n)
+				rhs.resize(n);
+
+			const T h_gamma = dt * gamma;
+			auto matvec = [&](const std::valarray<T>& v, std::valarray<T>& out)
+			// out = (I - dt*gamma*A) v
+			{
+				f(v, out);
+				for (size_t e = 0; e < n; ++e)
+					out[e] = v[e] - h_gamma * out[e];
+			};
+			for (size_t i = 0; i < Stages; ++i)
+			{
+				combine(&y[0], &x[0], n, i, dt);
+				f(static_cast<const std::valarray<T>&>(y), rhs);
+				k[i] = rhs; // explicit estimate as initial guess
+				krylov::result<T> res = solver.solve(matvec, rhs, k[i], precond);
+				n_iterations += res.iterations;
+				if (!res.converged)
+					throw std::runtime_error("The linear solver of the implicit integrator did not converge.");
+			}
+			combine(&x[0], &x[0], n, Stages, dt);
+		}
+
+	public:
+
+		// parameters of the method: the Stages x Stages lower triangular matrix a (row-major,
+		// the diagonal elements are all equal to gamma) followed by the weights b
+		const std::array<T, Stages*Stages + Stages> pars;
+		const T gamma;
+
+		krylov::bicgstab<T> solver; // linear solver (its tolerance and max iterations can be changed)
+		std::size_t n_iterations = 0; // total number of matrix-vector products of the linear solver
+
+		template <typename ... Ts>
+		requires (sizeof...(Ts) == Stages*Stages + Stages)
+		sdirk(Ts ... pars) : pars{T(pars)...}, gamma(this->pars[0])
+		// constructor:
+		//	pars... is a variadic argument which contains the parameters for the SDIRK method.
+		{
+			solver.tol = 1e-12;
+		}
+
+		virtual ~sdirk() = default;
+
+		template <typename F>
+		requires std::invocable<F&, const std::valarray<T>&, std::valarray<T>&>
+		void step(std::valarray<T>& x, T dt, F&& f)
+		//	x is the system state
+		//	dt is the integration step
+		//	f(x, dxdt) is the function that writes the derivative A x into dxdt
+		{
+			solve_stages(x, dt, f, krylov::identity{});
+		}
+
+		template <typename F>
+		requires std::invocable<F&, const std::valarray<T>&, std::valarray<T>&>
+		void step(std::valarray<T>& x, T dt, F&& f, const std::valarray<T>& diag)
+		//	x is the system state
+		//	dt is the integration step
+		//	f(x, dxdt) is the function that writes the derivative A x into dxdt
+		//	diag is the diagonal of A, used to precondition the linear systems (Jacobi)
+		{
+			const std::size_t n = x.size();
+			if (inv_diag.size() != n)
+				inv_diag.resize(n);
+			for (std::size_t e = 0; e < n; ++e)
+				inv_diag[e] = 1 / (1 - dt * gamma * diag[e]);
+			solve_stages(x, dt, f, [this](const std::valarray<T>& v, std::valarray<T>& out)
+			{
+				for (std::size_t e = 0; e < v.size(); ++e)
+					out[e] = inv_diag[e] * v[e];
+			});
+		}
+	};
+
+	template <std::floating_point T = double>
+	struct backward_euler : sdirk<1, T>
+	// backward Euler method (1st order, 1 stage, L-stable)
+	{
+		backward_euler() : sdirk<1, T>{1, 1}
+		{}
+	};
+
+	backward_euler() -> backward_euler<>;
+
+	template <std::floating_point T = double>
+	struct sdirk2 : sdirk<2, T>
+	// Alexander method (2nd order, 2 stages, L-stable)
+	// R. Alexander, "Diagonally Implicit Runge-Kutta Methods for Stiff O.D.E.'s", SIAM J. Numer. Anal., 1977
+	{
+		sdirk2() : sdirk<2, T>
+			{
+				g, 0,
+				1-g, g,
+				1-g, g
+			}
+		{}
+
+		private:
+
+			static constexpr long double g = 1 - .70710678118654752440084436210485L; // 1 - 1/sqrt(2)
+	};
+
+	sdirk2() -> sdirk2<>;
+
+	template <std::floating_point T = double>
+	struct sdirk3 : sdirk<3, T>
+	// Alexander method (3rd order, 3 stages, L-stable)
+	// R. Alexander, "Diagonally Implicit Runge-Kutta Methods for Stiff O.D.E.'s", SIAM J. Numer. Anal., 1977
+	{
+		sdirk3() : sdirk<3, T>
+			{
+				g, 0, 0,
+				(1-g)/2, g, 0,
+				b1, b2, g,
+				b1, b2, g
+			}
+		{}
+
+		private:
+
+			static constexpr long double g = .43586652150845899941601945L; // root of x^3 - 3x^2 + 3x/2 - 1/6 in (1/6, 1/2)
+			static constexpr long double b1 = -(6*g*g - 16*g + 1) / 4;
+			static constexpr long double b2 = (6*g*g - 20*g + 5) / 4;
+	};
+
+	sdirk3() -> sdirk3<>;
+} // namespace implicit
+
+#endif // SEK_IMPLICIT
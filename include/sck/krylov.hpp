@@ -0,0 +1,276 @@
+//  Stochastic enzyme kinetics: Krylov subspace solvers for sparse linear systems
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_KRYLOV
+#define SEK_KRYLOV
+
+#include <concepts> // floating_point, invocable
+#include <valarray>
+#include <vector>
+#include <cmath> // sqrt, abs, hypot
+
+// The solvers are matrix-free: the matrix A is given as a function matvec(v, out) which writes A v into out,
+// and the (right) preconditioner M as a function precond(v, out) which writes an approximation of M^-1 v into out.
+// The workspace of each solver is kept between calls, so no memory is allocated after the first solve.
+
+namespace krylov
+{
+	template <std::floating_point T = double>
+	struct result
+	{
+		std::size_t iterations = 0; // number of matrix-vector products
+		T residual = 0; // final residual norm relative to the norm of the right-hand side
+		bool converged = false;
+	};
+
+	struct identity
+	// no preconditioning
+	{
+		template <typename V>
+		void operator()(const V& v, V& out) const
+		{
+			out = v;
+		}
+	};
+
+	template <std::floating_point T>
+	T dot(const std::valarray<T>& a, const std::valarray<T>& b) noexcept
+	{
+		T sum = 0;
+		for (std::size_t i = 0; i < a.size(); ++i)
+			sum += a[i] * b[i];
+		return sum;
+	}
+
+	template <std::floating_point T>
+	T norm(const std::valarray<T>& a) noexcept
+	{
+		using std::sqrt;
+		return sqrt(dot(a, a));
+	}
+
+	template <std::floating_point T = double>
+	class bicgstab
+	// stabilized biconjugate gradient method for non-symmetric systems
+	// H. A. van der Vorst, "Bi-CGSTAB: A Fast and Smoothly Converging Variant of Bi-CG for the Solution of Nonsymmetric Linear Systems", SIAM J. Sci. Stat. Comput., 1992
+	{
+		std::valarray<T> r, r0, p, v, s, t, p_hat, s_hat;
+
+	public:
+
+		T tol = 1e-10; // relative residual tolerance
+		std::size_t max_iter = 1000; // max number of matrix-vector products
+
+		template <typename MatVec, typename Precond = identity>
+		result<T> solve(MatVec&& matvec, const std::valarray<T>& b, std::valarray<T>& x, Precond&& precond = {})
+		// solve A x = b, where x contains the initial guess
+		{
+			using std::abs;
+
+			const std::size_t n = b.size();
+			for (auto* buf : {&r, &r0, &p, &v, &s, &t, &p_hat, &s_hat})
+				if (buf->size() != n)
+					buf->resize(n);
+
+			result<T> res;
+			const T b_norm = norm(b);
+			if (b_norm == 0)
+			{
+				x = 0;
+				res.converged = true;
+				return res;
+			}
+
+			matvec(static_cast<const std::valarray<T>&>(x), r);
+			++res.iterations;
+			r = b - r;
+			res.residual = norm(r) / b_norm;
+			r0 = r;
+			p = 0;
+			v = 0;
+			T rho = 1, alpha = 1, omega = 1;
+			while (res.residual > tol && res.iterations < max_iter)
+			{
+				T rho_new = dot(r0, r);
+				if (rho_new == 0 || omega == 0)
+				{
+					// breakdown: restart from the current residual
+					r0 = r;
+					p = 0;
+					v = 0;
+					rho = alpha = omega = 1;
+					rho_new = dot(r0, r);
+				}
+				T beta = (rho_new / rho) * (alpha / omega);
+				rho = rho_new;
+				for (std::size_t i = 0; i < n; ++i)
+					p[i] = r[i] + beta * (p[i] - omega * v[i]);
+				precond(static_cast<const std::valarray<T>&>(p), p_hat);
+				matvec(static_cast<const std::valarray<T>&>(p_hat), v);
+				++res.iterations;
+				T r0v = dot(r0, v);
+				if (r0v == 0)
+					break;
+				alpha = rho / r0v;
+				for (std::size_t i = 0; i < n; ++i)
+					s[i] = r[i] - alpha * v[i];
+				if (norm(s) / b_norm <= tol)
+				{
+					for (std::size_t i = 0; i < n; ++i)
+						x[i] += alpha * p_hat[i];
+					r = s;
+					res.residual = norm(r) / b_norm;
+					break;
+				}
+				precond(static_cast<const std::valarray<T>&>(s), s_hat);
+				matvec(static_cast<const std::valarray<T>&>(s_hat), t);
+				++res.iterations;
+				T tt = dot(t, t);
+				omega = tt != 0 ? dot(t, s) / tt : 0;
+				for (std::size_t i = 0; i < n; ++i)
+				{
+					x[i] += alpha * p_hat[i] + omega * s_hat[i];
+					r[i] = s[i] - omega * t[i];
+				}
+				res.residual = norm(r) / b_norm;
+			}
+			res.converged = res.residual <= tol;
+			return res;
+		}
+	};
+
+	template <std::floating_point T = double>
+	class gmres
+	// restarted generalized minimal residual method
+	// Y. Saad, M. H. Schultz, "GMRES: A Generalized Minimal Residual Algorithm for Solving Nonsymmetric Linear Systems", SIAM J. Sci. Stat. Comput., 1986
+	{
+		std::vector<std::valarray<T>> V; // orthonormal basis of the Krylov subspace
+		std::valarray<T> w, z;
+		std::vector<T> H, cs, sn, g, y; // Hessenberg matrix (column-major), Givens rotations, rhs
+
+	public:
+
+		T tol = 1e-10; // relative residual tolerance
+		std::size_t max_iter = 1000; // max number of matrix-vector products
+		std::size_t restart = 30; // dimension of the Krylov subspace before restarting
+
+		template <typename MatVec, typename Precond = identity>
+		result<T> solve(MatVec&& matvec, const std::valarray<T>& b, std::valarray<T>& x, Precond&& precond = {})
+		// solve A x = b, where x contains the initial guess
+		{
+			using std::sqrt;
+			using std::abs;
+			using std::hypot;
+			using std::size_t;
+
+			const size_t n = b.size(), m = restart > 0 ? restart : 1;
+			if (V.size() != m+1)
+				V.resize(m+1);
+			for (auto& vi : V)
+				if (vi.size() != n)
+					vi.resize(n);
+			if (w.size() != n)
+				w.resize(n);
+			if (z.size() != n)
+				z.resize(n);
+			H.assign((m+1)*m, 0);
+			cs.assign(m, 0);
+			sn.assign(m, 0);
+			g.assign(m+1, 0);
+			y.assign(m, 0);
+
+			result<T> res;
+			const T b_norm = norm(b);
+			if (b_norm == 0)
+			{
+				x = 0;
+				res.converged = true;
+				return res;
+			}
+
+			for (;;)
+			{
+				// r = b - A x
+				matvec(static_cast<const std::valarray<T>&>(x), w);
+				++res.iterations;
+				V[0] = b - w;
+				T beta = norm(V[0]);
+				res.residual = beta / b_norm;
+				if (res.residual <= tol || res.iterations >= max_iter)
+					break;
+				V[0] /= beta;
+				std::fill(g.begin(), g.end(), T(0));
+				g[0] = beta;
+
+				size_t j = 0;
+				for (; j < m && res.iterations < max_iter; )
+				{
+					precond(static_cast<const std::valarray<T>&>(V[j]), z);
+					matvec(static_cast<const std::valarray<T>&>(z), w);
+					++res.iterations;
+					// modified Gram-Schmidt
+					T* h = &H[j*(m+1)];
+					for (size_t i = 0; i <= j; ++i)
+					{
+						h[i] = dot(w, V[i]);
+						w -= h[i] * V[i];
+					}
+					h[j+1] = norm(w);
+					if (h[j+1] != 0)
+						V[j+1] = w / h[j+1];
+					// apply the previous rotations and compute the new one
+					for (size_t i = 0; i < j; ++i)
+					{
+						T tmp = cs[i]*h[i] + sn[i]*h[i+1];
+						h[i+1] = -sn[i]*h[i] + cs[i]*h[i+1];
+						h[i] = tmp;
+					}
+					T d = hypot(h[j], h[j+1]);
+					cs[j] = d != 0 ? h[j] / d : 1;
+					sn[j] = d != 0 ? h[j+1] / d : 0;
+					h[j] = d;
+					h[j+1] = 0;
+					g[j+1] = -sn[j]*g[j];
+					g[j] = cs[j]*g[j];
+					++j;
+					res.residual = abs(g[j]) / b_norm;
+					if (res.residual <= tol || d == 0)
+						break;
+				}
+
+				// x += M^-1 V y, where H y = g
+				for (size_t i = j; i --> 0; )
+				{
+					T sum = g[i];
+					for (size_t k = i+1; k < j; ++k)
+						sum -= H[k*(m+1) + i] * y[k];
+					y[i] = H[i*(m+1) + i] != 0 ? sum / H[i*(m+1) + i] : 0;
+				}
+				w = 0;
+				for (size_t i = 0; i < j; ++i)
+					w += y[i] * V[i];
+				precond(static_cast<const std::valarray<T>&>(w), z);
+				x += z;
+				if (j == 0)
+					break;
+			}
+			res.converged = res.residual <= tol;
+			return res;
+		}
+	};
+} // namespace krylov
+
+#endif // SEK_KRYLOV
@@ -0,0 +1,230 @@
+//  Stochastic enzyme kinetics: Gillespie algorithm advancing several trajectories in lockstep
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_LOCKSTEP
+#define SEK_LOCKSTEP
+
+#include <array>
+#include <vector>
+#include <cmath> // log
+#include <cstdint> // uint32_t, uint64_t
+#include <concepts> // floating_point
+#include <type_traits> // type_identity_t
+
+#include "gillespie.hpp"
+#include "random.hpp"
+#include "thread_pool.hpp"
+
+namespace gillespie
+{
+	template <typename Model, std::size_t K = 8>
+	requires (K > 0)
+	class lockstep_ensemble
+	// Direct method applied to K trajectories of the same model at once.
+	// The populations, times and propensities of the trajectories are stored as structures of arrays
+	// (one array of K lanes per species/channel) and every stage of a step (propensities, random
+	// numbers, waiting times, channel selection) is a loop over the lanes, which the compiler can
+	// vectorize. A lane whose trajectory is finished is masked and refilled with the next trajectory.
+	// The i-th trajectory uses the random stream (seed, i) exactly as `gillespie::step` does, so the
+	// results are bitwise identical to `parallel_ensemble` whatever the number of lanes and threads.
+	{
+	public:
+
+		static constexpr std::size_t N_s = Model::num_species;
+		static constexpr std::size_t N_r = Model::num_rc;
+		using T = decltype(Model::t);
+
+		Model model; // parameters of the model (its state is not used)
+
+	private:
+
+		std::array<std::array<long long, K>, N_s> x{}, x_prev{}; // population numbers
+		std::array<T, K> t{}, a_tot{}, r2{}, tau{};
+		std::array<std::array<T, K>, N_r> a{}; // propensity functions
+		std::array<std::array<std::uint32_t, K>, 4> ctr{}; // Philox counters (block index, stream index)
+		std::array<std::size_t, K> steps{}, k{}; // number of steps and next sampling time of each lane
+		std::array<bool, K> active{}, reacted{};
+
+		void propensities() noexcept
+		{
+			for (std::size_t l = 0; l < K; ++l)
+			{
+				physics::vec<long long, N_s> y;
+				for (std::size_t s = 0; s < N_s; ++s)
+					y[s] = x[s][l];
+				std::array<T, N_r> a_r;
+				model.propensities(y, a_r);
+				for (std::size_t i = 0; i < N_r; ++i)
+					a[i][l] = a_r[i];
+			}
+			for (std::size_t l = 0; l < K; ++l)
+				a_tot[l] = 0;
+			for (std::size_t i = 0; i < N_r; ++i)
+				for (std::size_t l = 0; l < K; ++l)
+					a_tot[l] += a[i][l];
+		}
+
+		void draw(const std::array<std::uint32_t, 2>& key, T t_final) noexcept
+		// waiting times and uniform numbers for the channel selection (one Philox block per step)
+		{
+			using std::log;
+
+			std::array<std::array<std::uint32_t, K>, 4> w = ctr;
+			prng::philox4x32::blocks(w, key);
+			for (std::size_t l = 0; l < K; ++l)
+			{
+				T r1 = prng::canonical<T>(w[0][l], w[1][l]);
+				r2[l] = prng::canonical<T>(w[2][l], w[3][l]);
+				tau[l] = -log(r1)/a_tot[l];
+				reacted[l] = active[l] && a_tot[l] != 0 && !(t[l] + tau[l] > t_final && t_final > 0);
+			}
+			for (std::size_t l = 0; l < K; ++l)
+			{
+				ctr[0][l] += 1;
+				ctr[1][l] += ctr[0][l] == 0;
+			}
+		}
+
+		void fire() noexcept
+		// select and perform a reaction on the lanes that reacted
+		{
+			const auto& nu = model.stoichiometry();
+			x_prev = x;
+			for (std::size_t l = 0; l < K; ++l)
+			{
+				if (!reacted[l])
+					continue;
+				std::size_t j;
+				T a_accum = 0;
+				for (j = 0; j < N_r-1; ++j)
+				{
+					a_accum += a[j][l];
+					if (a_accum > r2[l]*a_tot[l])
+						break;
+				}
+				t[l] += tau[l];
+				for (std::size_t s = 0; s < N_s; ++s)
+					x[s][l] += nu[j][s];
+			}
+		}
+
+		void sample(std::size_t l, ensemble_stats<N_s, T>& stats, bool previous)
+		// accumulate the state of lane l (or its state before the last step) at the current sampling time
+		{
+			physics::vec<long long, N_s> y;
+			for (std::size_t s = 0; s < N_s; ++s)
+				y[s] = previous ? x_prev[s][l] : x[s][l];
+			stats.add(k[l], y);
+			++k[l];
+		}
+
+	public:
+
+		explicit lockstep_ensemble(const Model& model)
+			: model(model)
+		// constructor
+		//	model: the Gillespie model to simulate (it is copied)
+		{}
+
+		void ensemble(ensemble_stats<N_s, T>& stats, const physics::vec<long long, N_s>& x0, std::size_t first,
+			std::size_t n_trajectories, std::uint64_t seed, std::size_t max_steps = Model::default_max_steps())
+		// simulate the trajectories first, ..., first+n_trajectories-1 starting from state x0 at time 0,
+		// where the i-th trajectory uses the random stream (seed, i), and accumulate them inside stats
+		// (see `gillespie::trajectory`)
+		{
+			const std::array<std::uint32_t, 2> key = {std::uint32_t(seed), std::uint32_t(seed >> 32)};
+			const std::size_t n_t = stats.t.size();
+			const T t_final = n_t ? stats.t[n_t-1] : 0;
+			std::size_t next = first, last = first + n_trajectories, n_active = 0;
+
+			auto finish = [&](std::size_t l)
+			{
+				for (; k[l] < n_t; )
+					sample(l, stats, false);
+				++stats.n;
+				active[l] = false;
+				--n_active;
+			};
+			auto refill = [&](std::size_t l)
+			// start the next trajectories on lane l until one of them needs a step
+			{
+				while (!active[l] && next < last)
+				{
+					std::uint64_t stream = next++;
+					ctr[0][l] = 0;
+					ctr[1][l] = 0;
+					ctr[2][l] = std::uint32_t(stream);
+					ctr[3][l] = std::uint32_t(stream >> 32);
+					for (std::size_t s = 0; s < N_s; ++s)
+						x[s][l] = x0[s];
+					t[l] = 0;
+					steps[l] = 0;
+					k[l] = 0;
+					active[l] = true;
+					++n_active;
+					for (; k[l] < n_t && stats.t[k[l]] <= t[l]; )
+						sample(l, stats, false);
+					if (k[l] == n_t || max_steps == 0)
+						finish(l);
+				}
+			};
+
+			for (std::size_t l = 0; l < K; ++l)
+			{
+				active[l] = false;
+				refill(l);
+			}
+			while (n_active > 0)
+			{
+				propensities();
+				draw(key, t_final);
+				fire();
+				for (std::size_t l = 0; l < K; ++l)
+				{
+					if (!active[l])
+						continue;
+					for (; k[l] < n_t && (stats.t[k[l]] < t[l] || !reacted[l]); )
+						sample(l, stats, reacted[l]);
+					if (!reacted[l] || ++steps[l] >= max_steps || k[l] == n_t)
+					{
+						finish(l);
+						refill(l);
+					}
+				}
+			}
+		}
+	};
+
+	template <std::size_t K = 8, typename Model, std::size_t N_s, std::floating_point T>
+	void parallel_lockstep_ensemble(parallel::thread_pool& pool, const Model& model, ensemble_stats<N_s, T>& stats,
+		const std::type_identity_t<physics::vec<long long, N_s>>& x0, std::size_t n_trajectories, std::uint64_t seed,
+		std::size_t max_steps = Model::default_max_steps())
+	// same as `parallel_ensemble`, with a `lockstep_ensemble` of K lanes on each thread of pool
+	{
+		std::vector<lockstep_ensemble<Model, K>> engines(pool.size(), lockstep_ensemble<Model, K>(model));
+		std::vector<ensemble_stats<N_s, T>> partial(pool.size(), ensemble_stats<N_s, T>(stats.t, stats.n_bins));
+
+		pool.parallel_for(n_trajectories, 64*K, [&](std::size_t id, std::size_t begin, std::size_t end)
+		{
+			engines[id].ensemble(partial[id], x0, begin, end - begin, seed, max_steps);
+		});
+
+		for (const auto& p : partial)
+			stats.merge(p);
+	}
+} // namespace gillespie
+
+#endif // SEK_LOCKSTEP
@@ -0,0 +1,119 @@
+//  Stochastic enzyme kinetics: propensity lookup tables
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_LOOKUP
+#define SEK_LOOKUP
+
+#include <concepts> // floating_point
+#include <vector>
+#include <array>
+
+// The models with a single species and a bounded population number (like the QSSA models) compute
+// their propensity functions once for every population number and then read them from a table.
+// The table remembers the parameters of the model it was built with: when they are changed, the models
+// fall back to computing the propensity functions, until the table is rebuilt by `tabulate`
+// (which is done by `cme::step`, by `gillespie::step` and once at the start of each simulation loop
+// of `gillespie`, like `simulate` and `sample`: the parameters must not be changed by the observers
+// called during the loop). The tabulated values are computed with the same expressions, so the
+// results are bitwise identical with and without the table.
+// The Gillespie algorithm selects the reactions with the cumulative sums, and the CME time derivative
+// reads the propensity functions of each channel as contiguous columns.
+
+namespace lookup
+{
+	template <std::size_t N_r, std::size_t N_p, std::floating_point T = double>
+	class propensity_table
+	// propensity functions of N_r reaction channels, as functions of a population number y in [0, n),
+	// with their cumulative sums, for a model with N_p parameters
+	{
+		std::vector<T> a; // a[i*n + y]: propensity function of the channel i (contiguous in y)
+		std::vector<T> cum; // cum[y*N_r + i] = a[y] + ... + a[i*n + y] (contiguous in i)
+		std::array<T, N_p> key{}; // parameters of the tabulated model
+		long long n = 0;
+
+	public:
+
+		bool valid(const std::array<T, N_p>& params) const noexcept
+		// return whether the table has been built with the parameters params
+		{
+			return n != 0 && params == key;
+		}
+
+		template <typename F>
+		void build(long long n, const std::array<T, N_p>& params, F&& f)
+		// tabulate the propensity functions for the population numbers 0, ..., n-1
+		//	params: parameters of the model
+		//	f(y, a): computes the propensity functions a (std::array<T, N_r>) at the population number y
+		{
+			a.resize(N_r * n);
+			cum.resize(n * N_r);
+			for (long long y = 0; y < n; ++y)
+			{
+				std::array<T, N_r> a_y;
+				f(y, a_y);
+				T sum = 0;
+				for (std::size_t i = 0; i < N_r; ++i)
+				{
+					sum += a_y[i];
+					a[i*n + y] = a_y[i];
+					cum[y*N_r + i] = sum;
+				}
+			}
+			key = params;
+			this->n = n;
+		}
+
+		void clear() noexcept
+		// invalidate the table (the models compute the propensity functions until it is rebuilt)
+		{
+			n = 0;
+		}
+
+		bool propensities(long long y, const std::array<T, N_p>& params, std::array<T, N_r>& a_y) const noexcept
+		// read the N_r propensity functions at the population number y into a_y, and return
+		// false if y is not tabulated or the table has been built with other parameters
+		{
+			if (y < 0 || y >= n || params != key)
+				return false;
+			for (std::size_t i = 0; i < N_r; ++i)
+				a_y[i] = a[i*n + y];
+			return true;
+		}
+
+		const T* column(std::size_t i, const std::array<T, N_p>& params) const noexcept
+		// return the propensity function of the channel i for all the population numbers,
+		// or nullptr if the table has been built with other parameters
+		{
+			return i < N_r && valid(params) ? &a[i*n] : nullptr;
+		}
+
+		const T* cumulative(long long y, const std::array<T, N_p>& params) const noexcept
+		// return the N_r cumulative sums of the propensity functions at the population number y,
+		// or nullptr if y is not tabulated or the table has been built with other parameters
+		{
+			return y >= 0 && y < n && params == key ? &cum[y*N_r] : nullptr;
+		}
+
+		const T* cumulative(long long y) const noexcept
+		// same as above, without comparing the parameters (valid after `build` with the current ones),
+		// for the Gillespie loops that check them once per simulation
+		{
+			return y >= 0 && y < n ? &cum[y*N_r] : nullptr;
+		}
+	};
+} // namespace lookup
+
+#endif // SEK_LOOKUP
@@ -0,0 +1,285 @@
+//  Stochastic enzyme kinetics: mixed-precision CME integration
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_MIXED
+#define SEK_MIXED
+
+#include <array>
+#include <vector>
+#include <cmath> // abs
+#include <cstdint> // uint16_t, uint32_t
+#include <concepts> // floating_point, invocable
+#include <stdexcept> // invalid_argument
+#include <bit> // bit_cast
+
+#include "cme.hpp"
+#include "runge_kutta.hpp"
+
+// The probabilities and the Runge-Kutta stages are stored with a reduced precision S (float by default),
+// which halves the memory traffic of the time derivative and of the stage combinations, while the
+// derivative of each state, the combinations and the reductions are computed with the precision T of
+// the system. The rounding error of every update of the state is kept in a compensation array and added
+// back at the next step (compensated summation), so that the small increments of the probabilities are
+// not lost. The summations of this file must not be compiled with -ffast-math (-Ofast), which
+// reassociates the operations and cancels the compensation.
+
+#ifdef __FAST_MATH__
+#error "mixed.hpp requires IEEE arithmetic: do not compile it with -ffast-math (-Ofast)"
+#endif
+
+namespace mixed
+{
+	struct bfloat16
+	// brain floating point number (the upper half of a float: 8 exponent bits, 7 mantissa bits),
+	// used for compressed snapshots of the probabilities
+	{
+		std::uint16_t bits = 0;
+
+		bfloat16() = default;
+
+		explicit bfloat16(float x) noexcept
+		// round to the nearest bfloat16, ties to even (NaNs stay NaNs)
+		{
+			std::uint32_t u = std::bit_cast<std::uint32_t>(x);
+			if ((u & 0x7fffffff) > 0x7f800000)
+				bits = std::uint16_t((u >> 16) | 0x40);
+			else
+				bits = std::uint16_t((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+		}
+
+		explicit operator float() const noexcept
+		{
+			return std::bit_cast<float>(std::uint32_t(bits) << 16);
+		}
+	};
+
+	template <std::floating_point T = double>
+	class kahan_sum
+	// compensated summation (Neumaier's variant of Kahan's algorithm)
+	{
+		T sum = 0, c = 0;
+
+	public:
+
+		void add(T x) noexcept
+		{
+			using std::abs;
+
+			T s = sum + x;
+			if (abs(sum) >= abs(x))
+				c += (sum - s) + x;
+			else
+				c += (x - s) + sum;
+			sum = s;
+		}
+
+		T value() const noexcept
+		{
+			return sum + c;
+		}
+	};
+
+	template <typename System, std::size_t Stages, std::floating_point S = float>
+	class compact_cme
+	// explicit Runge-Kutta integration of a CME system with the probabilities and the stages stored
+	// with precision S (see the top of this file). The interface is the same as `offload::device_cme`:
+	// the state of the system is only updated by `download`.
+	{
+		using T = decltype(System::t);
+
+		System& sys;
+		std::size_t n;
+		std::vector<S> p, c, k, y; // probabilities, their compensations, stages, intermediate state
+		T mass0; // total probability at the last upload
+
+		// the same non-zero coefficients as `runge_kutta::runge_kutta`
+		std::array<std::array<T, Stages>, Stages> coef{};
+		std::array<std::array<std::size_t, Stages>, Stages> coef_j{};
+		std::array<std::size_t, Stages> n_coef{};
+
+		void combine(S* out, std::size_t row, T dt) const noexcept
+		// out = p + dt * sum_j coef[row][j] k[j], computed with precision T (the intermediate
+		// states are only used by the stages, so the compensations are not needed)
+		{
+			const std::size_t m = n_coef[row];
+			const S* kp[Stages];
+			for (std::size_t q = 0; q < m; ++q)
+				kp[q] = &k[coef_j[row][q]*n];
+			for (std::size_t e = 0; e < n; ++e)
+			{
+				T sum = 0;
+				for (std::size_t q = 0; q < m; ++q)
+					sum += coef[row][q] * T(kp[q][e]) * dt;
+				out[e] = S(sum + T(p[e]));
+			}
+		}
+
+		void update(T dt) noexcept
+		// p + c += dt * sum_j b_j k[j], keeping the rounding error of p in c
+		{
+			const std::size_t row = Stages-1, m = n_coef[row];
+			const S* kp[Stages];
+			for (std::size_t q = 0; q < m; ++q)
+				kp[q] = &k[coef_j[row][q]*n];
+			for (std::size_t e = 0; e < n; ++e)
+			{
+				T sum = 0;
+				for (std::size_t q = 0; q < m; ++q)
+					sum += coef[row][q] * T(kp[q][e]) * dt;
+				T x = (sum + T(c[e])) + T(p[e]);
+				p[e] = S(x);
+				c[e] = S(x - T(p[e]));
+			}
+		}
+
+	public:
+
+		T t; // time of the stored state
+
+		compact_cme(System& sys, const runge_kutta::runge_kutta<Stages, T>& integ)
+			: sys(sys), n(sys.size()), p(n), c(n), k(Stages*n), y(Stages > 1 ? n : 0), t(sys.t)
+		// constructor: copy the current probabilities of sys with precision S
+		//	sys: the system (it must outlive this object)
+		//	integ: explicit Runge-Kutta method (only its tableau is used)
+		{
+			for (std::size_t row = 0; row < Stages; ++row)
+			{
+				bool last = row == Stages-1;
+				std::size_t n_j = last ? Stages : row+1;
+				for (std::size_t j = 0; j < n_j; ++j)
+				{
+					T a = integ.pars[row*Stages + j + !last];
+					if (a != 0)
+					{
+						coef[row][n_coef[row]] = a;
+						coef_j[row][n_coef[row]++] = j;
+					}
+				}
+			}
+			upload();
+		}
+
+		void step(T dt)
+		// a single step
+		{
+			sys.derivative(p.data(), k.data());
+			for (std::size_t i = 1; i < Stages; ++i)
+			{
+				combine(y.data(), i-1, dt);
+				sys.derivative(y.data(), k.data() + i*n);
+			}
+			update(dt);
+			t += dt;
+		}
+
+		void download()
+		// copy the probabilities (with their compensations) and time into the system
+		{
+			for (std::size_t i = 0; i < n; ++i)
+				sys.p[i] = T(p[i]) + T(c[i]);
+			sys.t = t;
+			sys.invalidate_stats();
+		}
+
+		void upload()
+		// copy the probabilities and time of the system (e.g. after changing them)
+		{
+			if (sys.size() != n)
+				throw std::invalid_argument("The state space of the system has changed.");
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				p[i] = S(sys.p[i]);
+				c[i] = S(sys.p[i] - T(p[i]));
+			}
+			t = sys.t;
+			mass0 = total();
+		}
+
+		T total() const noexcept
+		// total probability of the stored state, with compensated summation
+		{
+			kahan_sum<T> sum;
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				sum.add(T(p[i]));
+				sum.add(T(c[i]));
+			}
+			return sum.value();
+		}
+
+		T drift() const noexcept
+		// change of the total probability since the last upload (0 for an exact integration of a closed system)
+		{
+			return total() - mass0;
+		}
+
+		std::vector<bfloat16> snapshot() const
+		// compressed copy of the probabilities (about 3 significant digits)
+		{
+			std::vector<bfloat16> out(n);
+			for (std::size_t i = 0; i < n; ++i)
+				out[i] = bfloat16(float(T(p[i]) + T(c[i])));
+			return out;
+		}
+
+		void restore(const std::vector<bfloat16>& snap)
+		// replace the probabilities with a snapshot (the time is unchanged)
+		{
+			if (snap.size() != n)
+				throw std::invalid_argument("The snapshot has a different number of states.");
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				p[i] = S(float(snap[i]));
+				c[i] = 0;
+			}
+		}
+
+		std::size_t simulate(T dt, T t_final)
+		// simulate until t >= t_final (see `cme::simulate`) and download the final state
+		// return the number of steps
+		{
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+				step(dt);
+			download();
+			return i;
+		}
+
+		template <typename Obs>
+		requires std::invocable<Obs&, const System&>
+		std::size_t simulate(T dt, T t_final, Obs&& obs, std::size_t n_sampling = 1)
+		// simulate until t >= t_final, and call obs(sys) at the sampling points after downloading
+		// the state (initial and final states are included), see `cme::simulate`
+		// return the number of steps
+		{
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+			{
+				if (i % n_sampling == 0)
+				{
+					download();
+					obs(static_cast<const System&>(sys));
+				}
+				step(dt);
+			}
+			download();
+			obs(static_cast<const System&>(sys));
+			return i;
+		}
+	};
+} // namespace mixed
+
+#endif // SEK_MIXED
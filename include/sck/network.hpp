@@ -0,0 +1,262 @@
+//  Stochastic enzyme kinetics: reaction networks defined at runtime
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_NETWORK
+#define SEK_NETWORK
+
+#include <concepts> // floating_point
+#include <vector>
+#include <array>
+#include <string> // to_string
+#include <stdexcept> // invalid_argument
+#include <algorithm> // max
+#include <cmath> // sqrt
+
+#include "tensor.hpp"
+
+// A network is described at runtime by its stoichiometric vectors and rate laws, whose arguments are
+// linear forms of the population numbers c + sum_s w[s] x[s] (so that conserved species can be
+// eliminated, e.g. the free enzyme ET - C). The supported rate laws are:
+//	mass_action:        k * f1(x) * f2(x)                               (elementary reactions up to
+//	                                                                     second order; use c = 1, w = 0
+//	                                                                     for missing factors, and
+//	                                                                     x_A, x_A - 1 with k/2 for 2A)
+//	michaelis_menten:   k * E(x) * S(x) / (K + S(x))                    (sQSSA)
+//	tqssa:              k * 2 E S / (E + S + K + sqrt((E + S + K)^2 - 4 E S))
+// where negative factors are replaced by 0. The description is compiled into a `kernel_table` with
+// compile-time numbers of species and reaction channels, whose kernels are grouped by rate law so that
+// each group is evaluated by a loop without branches.
+
+namespace network
+{
+	enum class law : unsigned char {mass_action, michaelis_menten, tqssa};
+
+	template <std::floating_point T = double>
+	struct linear_form
+	// c + sum_s w[s] x[s]
+	{
+		std::vector<T> w; // weights of the species (missing ones are 0)
+		T c = 0; // constant term
+	};
+
+	template <std::floating_point T = double>
+	struct reaction
+	{
+		std::vector<long long> nu; // stoichiometric vector
+		law kind = law::mass_action;
+		T k = 0; // rate constant (mass action) or catalysis rate constant (kcat)
+		T K = 0; // Michaelis-Menten constant (michaelis_menten, tqssa)
+		std::vector<linear_form<T>> factors; // mass action: up to 2 factors; otherwise: {E, S}
+	};
+
+	template <std::floating_point T = double>
+	struct description
+	{
+		std::size_t n_species = 0;
+		std::vector<reaction<T>> reactions;
+		std::vector<linear_form<T>> constraints; // the states for which any of them is negative are not compatible
+
+		void validate() const
+		// throw std::invalid_argument if the description is inconsistent
+		{
+			auto check_form = [this](const linear_form<T>& f, const std::string& where)
+			{
+				if (f.w.size() > n_species)
+					throw std::invalid_argument(where + " has more weights than species.");
+			};
+			if (n_species == 0 || reactions.empty())
+				throw std::invalid_argument("A reaction network needs at least one species and one reaction.");
+			for (std::size_t j = 0; j < reactions.size(); ++j)
+			{
+				const auto& r = reactions[j];
+				const std::string where = "Reaction " + std::to_string(j);
+				if (r.nu.size() != n_species)
+					throw std::invalid_argument(where + " must have " + std::to_string(n_species) + " stoichiometric coefficients.");
+				if (!(r.k >= 0))
+					throw std::invalid_argument(where + " has a negative rate constant.");
+				if (r.kind == law::mass_action ? r.factors.size() > 2 : r.factors.size() != 2)
+					throw std::invalid_argument(where + " has a wrong number of factors for its rate law.");
+				if (r.kind != law::mass_action && !(r.K > 0))
+					throw std::invalid_argument(where + " must have a positive Michaelis-Menten constant.");
+				for (const auto& f : r.factors)
+					check_form(f, where);
+			}
+			for (const auto& f : constraints)
+				check_form(f, "A constraint");
+		}
+	};
+
+	template <std::size_t N_s, std::size_t N_r, std::floating_point T = double>
+	class kernel_table
+	// propensity functions of a network compiled for N_s species and N_r reaction channels
+	{
+		using form = std::array<T, N_s+1>; // weights followed by the constant term
+
+		std::array<std::size_t, N_r> channel; // reaction channel of each kernel
+		std::array<std::size_t, N_r> kernel_of; // kernel of each reaction channel
+		std::array<law, N_r> kind;
+		std::array<T, N_r> k, K;
+		std::array<std::array<form, 2>, N_r> f; // factors (mass action) or {E, S}
+		std::size_t end_ma = 0, end_mm = 0; // kernels: [0, end_ma) mass action, [end_ma, end_mm) MM, [end_mm, N_r) tQSSA
+		std::vector<form> cons;
+		std::array<physics::vec<long long, N_s>, N_r> nu;
+		std::array<std::array<bool, N_s>, N_r> reads;
+
+		static form compile(const linear_form<T>& lf) noexcept
+		{
+			form out{};
+			for (std::size_t s = 0; s < lf.w.size(); ++s)
+				out[s] = lf.w[s];
+			out[N_s] = lf.c;
+			return out;
+		}
+
+		static T eval(const form& w, const physics::vec<long long, N_s>& y) noexcept
+		// value of a linear form (negative values are replaced by 0)
+		{
+			T sum = w[N_s];
+			for (std::size_t s = 0; s < N_s; ++s)
+				sum += w[s] * y[s];
+			return std::max(sum, T(0));
+		}
+
+		T kernel(std::size_t q, const physics::vec<long long, N_s>& y) const noexcept
+		// propensity of the q-th kernel
+		{
+			using std::sqrt;
+
+			T f1 = eval(f[q][0], y), f2 = eval(f[q][1], y);
+			switch (kind[q])
+			{
+				case law::mass_action:
+					return k[q] * (f1 * f2);
+				case law::michaelis_menten:
+					return k[q] * (f1 * f2) / (f2 + K[q]);
+				default:
+				{
+					T b = f1 + f2 + K[q];
+					T c = 2 * f1 * f2;
+					return k[q] * c / (b + sqrt(std::max(b*b - 2*c, T(0))));
+				}
+			}
+		}
+
+	public:
+
+		explicit kernel_table(const description<T>& d)
+		// constructor: compile the description (it must have N_s species and N_r reactions)
+		{
+			d.validate();
+			if (d.n_species != N_s || d.reactions.size() != N_r)
+				throw std::invalid_argument("The network has " + std::to_string(d.n_species) + " species and "
+					+ std::to_string(d.reactions.size()) + " reactions instead of " + std::to_string(N_s)
+					+ " and " + std::to_string(N_r) + ".");
+			const linear_form<T> one{{}, 1};
+			std::size_t q = 0;
+			for (law l : {law::mass_action, law::michaelis_menten, law::tqssa})
+			{
+				for (std::size_t j = 0; j < N_r; ++j)
+				{
+					const auto& r = d.reactions[j];
+					if (r.kind != l)
+						continue;
+					channel[q] = j;
+					kernel_of[j] = q;
+					kind[q] = l;
+					k[q] = r.k;
+					K[q] = r.K;
+					for (std::size_t i = 0; i < 2; ++i)
+						f[q][i] = compile(i < r.factors.size() ? r.factors[i] : one);
+					++q;
+				}
+				if (l == law::mass_action)
+					end_ma = q;
+				else if (l == law::michaelis_menten)
+					end_mm = q;
+			}
+			for (std::size_t j = 0; j < N_r; ++j)
+			{
+				for (std::size_t s = 0; s < N_s; ++s)
+				{
+					nu[j][s] = d.reactions[j].nu[s];
+					const auto& fj = f[kernel_of[j]];
+					reads[j][s] = fj[0][s] != 0 || fj[1][s] != 0;
+				}
+			}
+			for (const auto& c : d.constraints)
+				cons.push_back(compile(c));
+		}
+
+		const std::array<physics::vec<long long, N_s>, N_r>& stoichiometry() const noexcept
+		{
+			return nu;
+		}
+
+		const std::array<std::array<bool, N_s>, N_r>& depends_on() const noexcept
+		// species read by each propensity function
+		{
+			return reads;
+		}
+
+		void propensities(const physics::vec<long long, N_s>& y, std::array<T, N_r>& a) const noexcept
+		// propensity functions of all reaction channels
+		//	y: population numbers
+		//	a: propensity functions (output)
+		{
+			using std::sqrt;
+
+			for (std::size_t q = 0; q < end_ma; ++q)
+				a[channel[q]] = k[q] * (eval(f[q][0], y) * eval(f[q][1], y));
+			for (std::size_t q = end_ma; q < end_mm; ++q)
+			{
+				T E = eval(f[q][0], y), S = eval(f[q][1], y);
+				a[channel[q]] = k[q] * (E * S) / (S + K[q]);
+			}
+			for (std::size_t q = end_mm; q < N_r; ++q)
+			{
+				T E = eval(f[q][0], y), S = eval(f[q][1], y);
+				T b = E + S + K[q];
+				T c = 2 * E * S;
+				a[channel[q]] = k[q] * c / (b + sqrt(std::max(b*b - 2*c, T(0))));
+			}
+		}
+
+		T propensity(const physics::vec<long long, N_s>& y, std::size_t j) const noexcept
+		// propensity function of the j-th reaction channel
+		{
+			return kernel(kernel_of[j], y);
+		}
+
+		bool compatible(const physics::vec<long long, N_s>& y) const noexcept
+		// return whether no constraint is negative (and no population is negative)
+		{
+			for (std::size_t s = 0; s < N_s; ++s)
+				if (y[s] < 0)
+					return false;
+			for (const auto& c : cons)
+			{
+				T sum = c[N_s];
+				for (std::size_t s = 0; s < N_s; ++s)
+					sum += c[s] * y[s];
+				if (sum < 0)
+					return false;
+			}
+			return true;
+		}
+	};
+} // namespace network
+
+#endif // SEK_NETWORK
@@ -0,0 +1,311 @@
+//  Stochastic enzyme kinetics: Next Reaction Method
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_NEXT_REACTION
+#define SEK_NEXT_REACTION
+
+#include <random> // uniform_real_distribution
+#include <array>
+#include <vector>
+#include <cmath> // log
+#include <limits> // numeric_limits
+#include <utility> // swap
+#include <cstdint> // uint64_t
+
+#include "gillespie.hpp"
+#include "random.hpp"
+#include "counters.hpp"
+
+namespace gillespie
+{
+	template <std::size_t N, std::floating_point T = double>
+	class indexed_heap
+	// binary min-heap of the keys of N items, which can be updated in logarithmic time
+	{
+		std::array<T, N> key;
+		std::array<std::size_t, N> heap; // heap[k]: item at the k-th node
+		std::array<std::size_t, N> pos; // pos[i]: node of the i-th item
+
+		bool less(std::size_t k1, std::size_t k2) const noexcept
+		{
+			return key[heap[k1]] < key[heap[k2]];
+		}
+
+		void swap_nodes(std::size_t k1, std::size_t k2) noexcept
+		{
+			std::swap(heap[k1], heap[k2]);
+			pos[heap[k1]] = k1;
+			pos[heap[k2]] = k2;
+		}
+
+		void sift_up(std::size_t k) noexcept
+		{
+			while (k > 0 && less(k, (k-1)/2))
+			{
+				swap_nodes(k, (k-1)/2);
+				k = (k-1)/2;
+			}
+		}
+
+		void sift_down(std::size_t k) noexcept
+		{
+			for (;;)
+			{
+				std::size_t c = 2*k + 1;
+				if (c >= N)
+					return;
+				if (c+1 < N && less(c+1, c))
+					++c;
+				if (!less(c, k))
+					return;
+				swap_nodes(k, c);
+				k = c;
+			}
+		}
+
+	public:
+
+		void assign(const std::array<T, N>& keys) noexcept
+		// build the heap from all the keys
+		{
+			key = keys;
+			for (std::size_t i = 0; i < N; ++i)
+				heap[i] = pos[i] = i;
+			for (std::size_t k = N/2; k --> 0; )
+				sift_down(k);
+		}
+
+		void update(std::size_t i, T new_key) noexcept
+		// change the key of the i-th item
+		{
+			T old_key = key[i];
+			key[i] = new_key;
+			if (new_key < old_key)
+				sift_up(pos[i]);
+			else
+				sift_down(pos[i]);
+		}
+
+		std::size_t top() const noexcept
+		// item with the smallest key
+		{
+			return heap[0];
+		}
+
+		T operator[](std::size_t i) const noexcept
+		{
+			return key[i];
+		}
+	};
+
+	template <typename Model>
+	class next_reaction
+	// Next Reaction Method (Gibson-Bruck), an exact stochastic simulation algorithm which is
+	// equivalent to `gillespie::step` (direct method).
+	// M. A. Gibson, J. Bruck, "Efficient Exact Stochastic Simulation of Chemical Systems with Many Species and Many Channels", J. Phys. Chem. A, 2000
+	// Each reaction channel keeps an absolute putative firing time inside an indexed priority queue.
+	// After an event, only the propensity functions which depend on the species changed by the
+	// reaction are recomputed (see `Model::depends_on`), one channel at a time with
+	// `Model::channel_propensity` (or all of them with `Model::propensities` if it is not provided),
+	// and the putative times of the other affected channels are rescaled, so that only one random
+	// number is drawn per event.
+	// The model keeps the state (model.x, model.t), which can be changed between steps.
+	{
+	public:
+
+		static constexpr std::size_t N_s = Model::num_species;
+		static constexpr std::size_t N_r = Model::num_rc;
+		using T = decltype(Model::t);
+
+		Model model;
+
+	private:
+
+		prng::philox4x32 gen; // random number generator (counter-based)
+		std::uniform_real_distribution<T> u_dist = std::uniform_real_distribution<T>(0, 1);
+
+		std::array<std::vector<std::size_t>, N_r> dep; // dep[j]: channels to update after reaction j
+		std::array<T, N_r> a_r, a_new; // current and updated propensities
+		indexed_heap<N_r, T> tau; // putative firing times
+		physics::vec<long long, N_s> x_last; // state at which a_r and tau are valid
+		T t_last = 0;
+		bool valid = false;
+
+		static constexpr T inf = std::numeric_limits<T>::infinity();
+
+		T exp_sample()
+		// exponentially distributed random number with unit rate
+		{
+			using std::log;
+			return -log(1 - u_dist(gen));
+		}
+
+		void build_dependency_graph()
+		{
+			std::array<std::array<bool, N_s>, N_r> reads;
+			if constexpr (requires { model.depends_on(); })
+				reads = model.depends_on();
+			else
+				for (auto& r : reads)
+					r.fill(true); // every propensity function may depend on every species
+
+			const auto& nu = model.stoichiometry();
+			for (std::size_t j = 0; j < N_r; ++j)
+				for (std::size_t i = 0; i < N_r; ++i)
+				{
+					bool affected = i == j;
+					for (std::size_t s = 0; s < N_s && !affected; ++s)
+						affected = nu[j][s] != 0 && reads[i][s];
+					if (affected)
+						dep[j].push_back(i);
+				}
+		}
+
+		void update_propensities(std::size_t j)
+		// recompute the propensity functions affected by reaction j (all of them if the model does not
+		// provide `channel_propensity`)
+		{
+			if constexpr (requires { model.channel_propensity(model.x, j); })
+			{
+				for (std::size_t i : dep[j])
+					a_new[i] = model.channel_propensity(model.x, i);
+				instrument::add(instrument::counter::channel_evaluations, dep[j].size());
+			}
+			else
+			{
+				model.calc_propensities(a_new);
+				instrument::add(instrument::counter::propensity_evaluations);
+			}
+		}
+
+	public:
+
+		explicit next_reaction(const Model& model)
+			: model(model)
+		// constructor
+		//	model: the Gillespie model to simulate (it is copied)
+		{
+			build_dependency_graph();
+		}
+
+		static constexpr std::size_t default_max_steps() noexcept
+		{
+			return Model::default_max_steps();
+		}
+
+		void seed(std::uint64_t seed, std::uint64_t stream = 0) noexcept
+		// select the random sequence identified by (seed, stream) and rewind it
+		{
+			gen.seed(seed, stream);
+			valid = false;
+		}
+
+		void reset()
+		// recompute all the propensity functions and draw new putative times
+		// (it is called automatically when the state of the model has been changed)
+		{
+			model.calc_propensities(a_r);
+			std::array<T, N_r> tau_0;
+			for (std::size_t i = 0; i < N_r; ++i)
+				tau_0[i] = a_r[i] > 0 ? model.t + exp_sample() / a_r[i] : inf;
+			tau.assign(tau_0);
+			x_last = model.x;
+			t_last = model.t;
+			valid = true;
+		}
+
+		const std::vector<std::size_t>& dependencies(std::size_t j) const noexcept
+		// return the channels whose propensity functions are updated after reaction j
+		{
+			return dep[j];
+		}
+
+		bool step(T t_final = 0)
+		// a single step of the Next Reaction Method
+		// return whether a reaction has been performed successfully before time t_final or not
+		// set t_final to 0 or negative number for infinity
+		{
+			if (!valid || model.t != t_last || model.x != x_last)
+				reset();
+
+#ifdef SEK_DEBUG
+			model.check_state();
+#endif
+			std::size_t mu = tau.top();
+			T t_next = tau[mu];
+			if (t_next == inf || (t_next > t_final && t_final > 0))
+			{
+				instrument::add(instrument::counter::null_steps);
+				return false; // no reaction is possible, or it would be performed after t_final
+			}
+
+			model.t = t_next;
+			model.x += model.stoichiometry()[mu];
+			instrument::fire(mu);
+
+			update_propensities(mu);
+			for (std::size_t i : dep[mu])
+			{
+				T a_old = a_r[i];
+				a_r[i] = a_new[i];
+				if (a_r[i] <= 0)
+					tau.update(i, inf);
+				else if (i != mu && a_old > 0)
+					tau.update(i, t_next + (a_old / a_r[i]) * (tau[i] - t_next)); // rescale the waiting time
+				else
+					tau.update(i, t_next + exp_sample() / a_r[i]);
+			}
+			x_last = model.x;
+			t_last = model.t;
+
+			return true;
+		}
+
+		void simulate(T t_final = 0, std::size_t max_steps = default_max_steps())
+		// simulate for max_steps steps or until t >= t_final
+		// set t_final to 0 or negative number for infinity
+		// if the total propensity gets to zero, the simulation will be terminated
+		{
+			for (std::size_t i = 0; i < max_steps && (model.t <= t_final || t_final <= 0); ++i)
+				if (!step(t_final))
+					break;
+		}
+
+		void simulate(list_of_states<N_s, T>& states, T t_final = 0, std::size_t max_steps = default_max_steps(), std::size_t n_sampling = 1)
+		// simulate for max_steps steps or until t >= t_final, and save the states inside a list (initial and final state are included)
+		// set t_final to 0 or negative number for infinity
+		// n_sampling is the number of steps for each sampling point
+		// if the total propensity gets to zero, the simulation will be terminated
+		{
+			std::size_t n_states = states.t.size();
+			for (std::size_t i = 0; i < max_steps && (model.t <= t_final || t_final <= 0); ++i)
+			{
+				if (i % n_sampling == 0)
+				{
+					states.x.push_back(model.x);
+					states.t.push_back(model.t);
+				}
+				if (!step(t_final))
+					break;
+			}
+			states.x.push_back(model.x);
+			states.t.push_back(model.t);
+			instrument::add(instrument::counter::bytes_sampled, (states.t.size() - n_states) * (sizeof(model.x) + sizeof(T)));
+		}
+	};
+} // namespace gillespie
+
+#endif // SEK_NEXT_REACTION
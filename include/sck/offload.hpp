@@ -0,0 +1,379 @@
+//  Stochastic enzyme kinetics: offloading of SSA ensembles and CME integration to an accelerator
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_OFFLOAD
+#define SEK_OFFLOAD
+
+#include <array>
+#include <vector>
+#include <valarray>
+#include <cmath> // log
+#include <cstdint> // uint32_t, uint64_t
+#include <concepts> // floating_point, invocable
+#include <stdexcept> // invalid_argument, length_error
+#include <type_traits> // type_identity_t, is_trivially_copyable_v, remove_const_t
+#include <limits> // numeric_limits
+
+#include "gillespie.hpp"
+#include "cme.hpp"
+#include "runge_kutta.hpp"
+#include "random.hpp"
+
+// The kernels of this file are OpenMP target regions, enabled by defining SEK_OFFLOAD_DEVICE and
+// compiling with OpenMP offloading for the accelerator, e.g.
+//	g++ ... -fopenmp -foffload=nvptx-none -DSEK_OFFLOAD_DEVICE          (NVIDIA, GCC)
+//	clang++ ... -fopenmp --offload-arch=gfx90a -DSEK_OFFLOAD_DEVICE      (AMD, Clang)
+// Without SEK_OFFLOAD_DEVICE (or without an available device) the same loops run on the host,
+// so the results can be checked against the CPU solvers on any machine.
+// The models are polymorphic and cannot be mapped to the device: the device trajectories use
+// the propensity kernel of the model instead (`model.kernel()`, a trivially copyable object with the
+// parameters and the member function `propensities`), while the host trajectories use the model itself.
+
+#ifdef SEK_OFFLOAD_DEVICE
+#define SEK_OMP(directive) _Pragma(#directive)
+#else
+#define SEK_OMP(directive)
+#endif
+
+namespace offload
+{
+#ifdef SEK_OFFLOAD_DEVICE
+	inline constexpr bool device = true;
+#else
+	inline constexpr bool device = false;
+#endif
+
+	template <typename Model>
+	inline constexpr bool supported = !device || requires (const Model& m) { m.kernel(); };
+	// whether `ensemble` can simulate the trajectories of Model (on the device, Model needs a kernel)
+
+	template <typename Model, std::size_t N_s, std::floating_point T>
+	void ensemble(const Model& model, gillespie::ensemble_stats<N_s, T>& stats,
+		const std::type_identity_t<physics::vec<long long, N_s>>& x0, std::size_t n_trajectories, std::uint64_t seed,
+		std::size_t max_steps = Model::default_max_steps())
+	// simulate n_trajectories independent trajectories of model with one device thread each, and
+	// accumulate them inside stats (the histograms are binned on the device with atomic updates).
+	// The i-th trajectory uses the random stream (seed, i) exactly as `gillespie::step` does, so the
+	// statistics are bitwise identical to `gillespie::parallel_ensemble`.
+	{
+		using std::log;
+
+		constexpr std::size_t N_r = Model::num_rc;
+		const std::size_t n_t = stats.t.size();
+		const T t_final = n_t ? stats.t[n_t-1] : 0;
+		const std::array<std::size_t, N_s> n_bins = stats.n_bins;
+		std::array<std::size_t, N_s> hist_off;
+		std::size_t n_hist = 0;
+		for (std::size_t s = 0; s < N_s; ++s)
+		{
+			hist_off[s] = n_hist;
+			n_hist += n_t*n_bins[s];
+		}
+
+		std::vector<long long> sum(n_t*N_s, 0), sum_sq(n_t*N_s, 0), hist(n_hist, 0);
+		long long* d_sum = sum.data();
+		long long* d_sum_sq = sum_sq.data();
+		long long* d_hist = hist.data();
+		const T* t_grid = stats.t.data();
+#ifdef SEK_OFFLOAD_DEVICE
+		static_assert(supported<Model>, "The model must provide kernel() to run on the device.");
+		const auto m = model.kernel(); // propensity functions without the virtual members and the lookup tables
+		static_assert(std::is_trivially_copyable_v<std::remove_const_t<decltype(m)>>,
+			"The kernel of the model must be trivially copyable to be mapped to the device.");
+#else
+		const Model& m = model;
+#endif
+		const std::array<physics::vec<long long, N_s>, N_r> nu = model.stoichiometry();
+		const physics::vec<long long, N_s> x_init = x0;
+		const std::array<std::uint32_t, 2> key = {std::uint32_t(seed), std::uint32_t(seed >> 32)};
+
+		SEK_OMP(omp target teams distribute parallel for map(to: m, nu, x_init, key, n_bins, hist_off, t_grid[0:n_t]) \
+			map(tofrom: d_sum[0:n_t*N_s], d_sum_sq[0:n_t*N_s], d_hist[0:n_hist]))
+		for (std::size_t i = 0; i < n_trajectories; ++i)
+		{
+			physics::vec<long long, N_s> x = x_init, x_prev;
+			T t = 0;
+			std::array<std::uint32_t, 4> ctr = {0, 0, std::uint32_t(i), std::uint32_t(std::uint64_t(i) >> 32)};
+			std::size_t k = 0;
+
+			auto add = [&](const physics::vec<long long, N_s>& y)
+			// accumulate y at the k-th sampling time
+			{
+				for (std::size_t s = 0; s < N_s; ++s)
+				{
+					SEK_OMP(omp atomic)
+					d_sum[k*N_s + s] += y[s];
+					SEK_OMP(omp atomic)
+					d_sum_sq[k*N_s + s] += y[s]*y[s];
+					if (y[s] >= 0 && std::size_t(y[s]) < n_bins[s])
+					{
+						SEK_OMP(omp atomic)
+						++d_hist[hist_off[s] + k*n_bins[s] + y[s]];
+					}
+				}
+				++k;
+			};
+
+			for (; k < n_t && t_grid[k] <= t; )
+				add(x);
+			for (std::size_t step = 0; step < max_steps && k < n_t; ++step)
+			{
+				// same as `gillespie::step`
+				std::array<T, N_r> a_r;
+				m.propensities(x, a_r);
+				T a_tot = 0;
+				for (std::size_t j = 0; j < N_r; ++j)
+					a_tot += a_r[j];
+
+				bool reacted = a_tot != 0;
+				if (reacted)
+				{
+					std::array<std::uint32_t, 4> w = prng::philox4x32::block(ctr, key);
+					if (++ctr[0] == 0)
+						++ctr[1];
+					T r1 = prng::canonical<T>(w[0], w[1]);
+					T r2 = prng::canonical<T>(w[2], w[3]);
+					T tau = -log(r1)/a_tot;
+					reacted = !(t + tau > t_final && t_final > 0);
+					if (reacted)
+					{
+						std::size_t j;
+						T a_accum = 0;
+						for (j = 0; j < N_r-1; ++j)
+						{
+							a_accum += a_r[j];
+							if (a_accum > r2*a_tot)
+								break;
+						}
+						x_prev = x;
+						t += tau;
+						x += nu[j];
+					}
+				}
+				for (; k < n_t && (t_grid[k] < t || !reacted); )
+					add(reacted ? x_prev : x);
+				if (!reacted)
+					break;
+			}
+			for (; k < n_t; )
+				add(x);
+		}
+
+		for (std::size_t i = 0; i < n_t*N_s; ++i)
+		{
+			stats.sum[i] += sum[i];
+			stats.sum_sq[i] += sum_sq[i];
+		}
+		for (std::size_t s = 0; s < N_s; ++s)
+			for (std::size_t i = 0; i < n_t*n_bins[s]; ++i)
+				stats.hist[s][i] += hist[hist_off[s] + i];
+		stats.n += n_trajectories;
+	}
+
+	template <typename System, std::size_t Stages>
+	class device_cme
+	// CME of a host system integrated with an explicit Runge-Kutta method on the device.
+	// The assembled transition-rate matrix, the probabilities and the stage buffers stay in device
+	// memory; the probabilities are copied back into the host system only by `download` (called
+	// at the sampling points of `simulate` and at the end).
+	// Every stage is the same sequence of operations as `runge_kutta::runge_kutta::step`.
+	{
+		using T = decltype(System::t);
+
+		System& sys;
+		std::size_t n, nnz;
+		std::vector<std::size_t> row_ptr;
+		std::vector<std::uint32_t> col;
+		std::vector<T> val, p, k, y; // k: Stages buffers of n elements
+		std::array<std::array<T, Stages>, Stages> coef{};
+		std::array<std::array<std::size_t, Stages>, Stages> coef_j{};
+		std::array<std::size_t, Stages> n_coef{};
+
+		void multiply(const T* x, T* out) noexcept
+		// out = A x on the device
+		{
+			const std::size_t* d_row_ptr = row_ptr.data();
+			const std::uint32_t* d_col = col.data();
+			const T* d_val = val.data();
+			const std::size_t n_rows = n;
+			[[maybe_unused]] const std::size_t n_x = n;
+			[[maybe_unused]] const std::size_t n_nz = nnz;
+
+			SEK_OMP(omp target teams distribute parallel for map(alloc: d_row_ptr[0:n_rows+1], d_col[0:n_nz], d_val[0:n_nz], x[0:n_x], out[0:n_rows]))
+			for (std::size_t i = 0; i < n_rows; ++i)
+			{
+				T sum = 0;
+				for (std::size_t q = d_row_ptr[i]; q < d_row_ptr[i+1]; ++q)
+					sum += d_val[q] * x[d_col[q]];
+				out[i] = sum;
+			}
+		}
+
+		void combine(T* out, const T* x, std::size_t row, T dt) noexcept
+		// out = x + dt * sum_j coef[row][j] k[j] on the device (out and x may coincide)
+		{
+			const std::size_t m = n_coef[row];
+			const std::array<T, Stages> c = coef[row];
+			const std::array<std::size_t, Stages> c_j = coef_j[row];
+			const T* d_k = k.data();
+			const std::size_t n_e = n;
+			[[maybe_unused]] const std::size_t n_k = Stages*n;
+
+			SEK_OMP(omp target teams distribute parallel for map(to: c, c_j) map(alloc: d_k[0:n_k], x[0:n_e], out[0:n_e]))
+			for (std::size_t e = 0; e < n_e; ++e)
+			{
+				T sum = 0;
+				for (std::size_t q = 0; q < m; ++q)
+					sum += c[q] * d_k[c_j[q]*n_e + e] * dt;
+				out[e] = sum + x[e];
+			}
+		}
+
+	public:
+
+		T t; // time of the device state
+
+		device_cme(System& sys, const runge_kutta::runge_kutta<Stages, T>& integ)
+			: sys(sys), n(sys.size()), t(sys.t)
+		// constructor: assemble the transition-rate matrix of sys (if needed) and copy it to the
+		// device with the current probabilities of sys
+		//	sys: the host system (it must outlive this object)
+		//	integ: explicit Runge-Kutta method (only its tableau is used)
+		{
+			if (!sys.assembled())
+				sys.assemble_generator();
+			const auto& g = sys.generator_matrix();
+			if (n > std::numeric_limits<std::uint32_t>::max() || g.val.size() > std::numeric_limits<std::uint32_t>::max())
+				throw std::length_error("The transition-rate matrix is too large for 32-bit column indices.");
+			row_ptr = g.row_ptr;
+			col.assign(g.col.begin(), g.col.end());
+			val = g.val;
+			nnz = val.size();
+			p.assign(std::begin(sys.p), std::end(sys.p));
+			k.resize(Stages*n);
+			y.resize(n);
+
+			// the same non-zero coefficients as `runge_kutta::runge_kutta`
+			for (std::size_t row = 0; row < Stages; ++row)
+			{
+				bool last = row == Stages-1;
+				std::size_t n_j = last ? Stages : row+1;
+				for (std::size_t j = 0; j < n_j; ++j)
+				{
+					T a = integ.pars[row*Stages + j + !last];
+					if (a != 0)
+					{
+						coef[row][n_coef[row]] = a;
+						coef_j[row][n_coef[row]++] = j;
+					}
+				}
+			}
+
+			[[maybe_unused]] std::size_t* d_row_ptr = row_ptr.data();
+			[[maybe_unused]] std::uint32_t* d_col = col.data();
+			[[maybe_unused]] T* d_val = val.data();
+			[[maybe_unused]] T* d_p = p.data();
+			[[maybe_unused]] T* d_k = k.data();
+			[[maybe_unused]] T* d_y = y.data();
+			[[maybe_unused]] std::size_t n_k = Stages*n;
+			SEK_OMP(omp target enter data map(to: d_row_ptr[0:n+1], d_col[0:nnz], d_val[0:nnz], d_p[0:n]) map(alloc: d_k[0:n_k], d_y[0:n]))
+		}
+
+		device_cme(const device_cme&) = delete;
+		device_cme& operator=(const device_cme&) = delete;
+
+		~device_cme()
+		{
+			[[maybe_unused]] std::size_t* d_row_ptr = row_ptr.data();
+			[[maybe_unused]] std::uint32_t* d_col = col.data();
+			[[maybe_unused]] T* d_val = val.data();
+			[[maybe_unused]] T* d_p = p.data();
+			[[maybe_unused]] T* d_k = k.data();
+			[[maybe_unused]] T* d_y = y.data();
+			[[maybe_unused]] std::size_t n_k = Stages*n;
+			SEK_OMP(omp target exit data map(delete: d_row_ptr[0:n+1], d_col[0:nnz], d_val[0:nnz], d_p[0:n], d_k[0:n_k], d_y[0:n]))
+		}
+
+		void step(T dt) noexcept
+		// a single step on the device
+		{
+			multiply(p.data(), k.data());
+			for (std::size_t i = 1; i < Stages; ++i)
+			{
+				combine(y.data(), p.data(), i-1, dt);
+				multiply(y.data(), k.data() + i*n);
+			}
+			combine(p.data(), p.data(), Stages-1, dt);
+			t += dt;
+		}
+
+		void download()
+		// copy the device probabilities and time into the host system
+		{
+			[[maybe_unused]] T* d_p = p.data();
+			SEK_OMP(omp target update from(d_p[0:n]))
+			std::copy(p.begin(), p.end(), std::begin(sys.p));
+			sys.t = t;
+			sys.invalidate_stats();
+		}
+
+		void upload()
+		// copy the probabilities and time of the host system into the device (e.g. after changing them)
+		{
+			if (sys.size() != n)
+				throw std::invalid_argument("The state space of the system has changed.");
+			std::copy(std::begin(sys.p), std::end(sys.p), p.begin());
+			t = sys.t;
+			[[maybe_unused]] T* d_p = p.data();
+			SEK_OMP(omp target update to(d_p[0:n]))
+		}
+
+		std::size_t simulate(T dt, T t_final)
+		// simulate until t >= t_final (see `cme::simulate`) and download the final state
+		// return the number of steps
+		{
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+				step(dt);
+			download();
+			return i;
+		}
+
+		template <typename Obs>
+		requires std::invocable<Obs&, const System&>
+		std::size_t simulate(T dt, T t_final, Obs&& obs, std::size_t n_sampling = 1)
+		// simulate until t >= t_final, and call obs(sys) at the sampling points after downloading
+		// the state (initial and final states are included), see `cme::simulate`
+		// return the number of steps
+		{
+			std::size_t i;
+			for (i = 0; t <= t_final; ++i)
+			{
+				if (i % n_sampling == 0)
+				{
+					download();
+					obs(static_cast<const System&>(sys));
+				}
+				step(dt);
+			}
+			download();
+			obs(static_cast<const System&>(sys));
+			return i;
+		}
+	};
+} // namespace offload
+
+#endif // SEK_OFFLOAD
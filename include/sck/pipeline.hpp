@@ -0,0 +1,386 @@
+//  Stochastic enzyme kinetics: asynchronous output pipelines
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_PIPELINE
+#define SEK_PIPELINE
+
+#include <concepts> // floating_point, invocable
+#include <atomic>
+#include <thread>
+#include <exception> // exception_ptr, current_exception, rethrow_exception
+#include <functional> // invoke
+#include <utility> // forward, exchange
+#include <type_traits> // decay_t, remove_cvref_t, is_same_v
+#include <vector>
+#include <array>
+#include <algorithm> // copy
+#include <stdexcept> // invalid_argument, length_error, runtime_error
+
+#include "tensor.hpp"
+
+// The simulators write their sampled states (frames) into a bounded ring buffer, and a consumer thread
+// processes them concurrently (histograms, compression, files, Python callbacks), so that the simulation
+// is not interrupted by the output and the memory does not grow with the number of frames.
+// The frames are allocated once and written in place. When the ring is full the simulation waits for a
+// free slot (backpressure), so the capacity should cover the bursts of the consumer: a consumer which is
+// slower on average than the simulation limits its speed (see `stalls`).
+
+namespace pipeline
+{
+	template <typename Frame>
+	class spsc_ring
+	// bounded lock-free queue of frames between a single producer and a single consumer.
+	// The producer writes into the next free slot (`acquire`) and publishes it (`publish`), the consumer
+	// reads the oldest published slot (`front`) and releases it (`pop`). Both wait with atomic waits
+	// when the ring is full or empty. The lowest bit of each index is a flag (closed by the producer,
+	// abandoned by the consumer), so that setting a flag also wakes the other side.
+	{
+		std::vector<Frame> slots;
+		alignas(64) std::atomic<std::size_t> head{0}; // 2 * (published frames) + closed
+		alignas(64) std::atomic<std::size_t> tail{0}; // 2 * (released frames) + abandoned
+
+	public:
+
+		spsc_ring(std::size_t capacity, const Frame& prototype)
+			: slots(capacity, prototype)
+		// constructor
+		//	capacity: number of slots
+		//	prototype: initial value of the slots (e.g. with the buffers already sized)
+		{
+			if (capacity == 0)
+				throw std::invalid_argument("The capacity of a ring must be positive.");
+		}
+
+		std::size_t capacity() const noexcept
+		{
+			return slots.size();
+		}
+
+		Frame* acquire(bool& waited) noexcept
+		// (producer) return the next free slot, waiting if the ring is full (waited is set accordingly),
+		// or nullptr if the consumer has abandoned the ring
+		{
+			const std::size_t h = head.load(std::memory_order_relaxed) >> 1;
+			std::size_t t = tail.load(std::memory_order_acquire);
+			waited = false;
+			while (!(t & 1) && h - (t >> 1) == slots.size())
+			{
+				waited = true;
+				tail.wait(t, std::memory_order_acquire);
+				t = tail.load(std::memory_order_acquire);
+			}
+			return (t & 1) ? nullptr : &slots[h % slots.size()];
+		}
+
+		void publish() noexcept
+		// (producer) make the slot returned by `acquire` available to the consumer
+		{
+			head.store(head.load(std::memory_order_relaxed) + 2, std::memory_order_release);
+			head.notify_one();
+		}
+
+		void close() noexcept
+		// (producer) no more frames will be published
+		{
+			head.fetch_or(1, std::memory_order_release);
+			head.notify_one();
+		}
+
+		const Frame* front() noexcept
+		// (consumer) return the oldest published frame, waiting if the ring is empty,
+		// or nullptr if the ring is closed and all the frames have been released
+		{
+			const std::size_t t = tail.load(std::memory_order_relaxed) >> 1;
+			std::size_t h = head.load(std::memory_order_acquire);
+			while ((h >> 1) == t)
+			{
+				if (h & 1)
+					return nullptr;
+				head.wait(h, std::memory_order_acquire);
+				h = head.load(std::memory_order_acquire);
+			}
+			return &slots[t % slots.size()];
+		}
+
+		void pop() noexcept
+		// (consumer) release the frame returned by `front`
+		{
+			tail.store(tail.load(std::memory_order_relaxed) + 2, std::memory_order_release);
+			tail.notify_one();
+		}
+
+		void abandon() noexcept
+		// (consumer) no more frames will be released: `acquire` returns nullptr from now on
+		{
+			tail.fetch_or(1, std::memory_order_release);
+			tail.notify_one();
+		}
+	};
+
+	template <typename Frame>
+	class async_consumer
+	// calls consume(frame) on its own thread for each frame pushed by the producer thread, in order.
+	// If consume throws, the frames are no longer consumed and the exception is rethrown to the producer
+	// by the next `push` (or by `close`).
+	{
+		spsc_ring<Frame> ring;
+		std::exception_ptr error;
+		std::size_t n_pushed = 0, n_stalls = 0;
+		bool closed = false;
+		std::thread worker; // last member: it starts after the ring is constructed
+
+		template <typename Consume>
+		void run(Consume& consume) noexcept
+		{
+			try
+			{
+				while (const Frame* f = ring.front())
+				{
+					std::invoke(consume, *f);
+					ring.pop();
+				}
+			}
+			catch (...)
+			{
+				error = std::current_exception(); // read by the producer after joining the thread
+				ring.abandon();
+			}
+		}
+
+	public:
+
+		template <typename Consume>
+		requires std::invocable<std::decay_t<Consume>&, const Frame&>
+		async_consumer(std::size_t capacity, const Frame& prototype, Consume&& consume)
+			: ring(capacity, prototype),
+			worker([this, consume = std::decay_t<Consume>(std::forward<Consume>(consume))]() mutable { run(consume); })
+		// constructor
+		//	capacity: number of frames of the ring buffer
+		//	prototype: initial value of the frames
+		//	consume(frame): function called on the consumer thread (it is copied, use std::ref to
+		//		pass a sink by reference)
+		{}
+
+		async_consumer(const async_consumer&) = delete;
+		async_consumer& operator=(const async_consumer&) = delete;
+
+		~async_consumer()
+		{
+			try
+			{
+				close();
+			}
+			catch (...)
+			{}
+		}
+
+		template <typename Fill>
+		requires std::invocable<Fill&, Frame&>
+		void push(Fill&& fill)
+		// write the next frame in place with fill(frame), waiting for a free slot if needed
+		{
+			if (closed)
+				throw std::runtime_error("The pipeline is closed.");
+			bool waited;
+			Frame* f = ring.acquire(waited);
+			if (!f)
+			{
+				close(); // rethrow the exception of the consumer
+				return;
+			}
+			n_stalls += waited;
+			fill(*f);
+			ring.publish();
+			++n_pushed;
+		}
+
+		void close()
+		// wait until all the frames have been consumed and stop the consumer thread.
+		// If consume has thrown, the exception is rethrown (once).
+		{
+			if (closed)
+				return;
+			closed = true;
+			ring.close();
+			worker.join();
+			if (error)
+				std::rethrow_exception(std::exchange(error, nullptr));
+		}
+
+		std::size_t size() const noexcept
+		// number of pushed frames
+		{
+			return n_pushed;
+		}
+
+		std::size_t stalls() const noexcept
+		// number of pushes which waited for a free slot
+		{
+			return n_stalls;
+		}
+	};
+} // namespace pipeline
+
+namespace cme
+{
+	template <std::size_t N_s, std::floating_point T = double>
+	struct frame
+	// probabilities of the whole box of a CME system at time t. It has the interface of the systems
+	// read by the sinks of trajectory.hpp, so that a frame can be written by `frame_file` or `frame_buffer`.
+	{
+		T t = 0;
+		std::vector<T> p;
+		std::array<std::size_t, N_s> n_max{};
+
+		frame() = default;
+
+		template <typename C>
+		requires (!std::is_same_v<std::remove_cvref_t<C>, frame>)
+		explicit frame(const C& c)
+			: t(c.t), p(c.box_size())
+		// constructor: a frame with the shape of the box of c (the probabilities are not copied)
+		{
+			for (std::size_t i = 0; i < N_s; ++i)
+				n_max[i] = c.get_shape_index(i);
+		}
+
+		std::size_t box_size() const noexcept
+		{
+			return p.size();
+		}
+
+		std::size_t get_shape_index(std::size_t i) const noexcept
+		{
+			return n_max[i];
+		}
+
+		void expand(const T* in, T* out) const
+		// the frame already holds the whole box
+		{
+			std::copy(in, in + p.size(), out);
+		}
+	};
+
+	template <std::size_t N_s, std::floating_point T = double>
+	class async_frames
+	// trajectory sink for `cme::simulate(integ, dt, t_final, obs, n_sampling)` which copies the frames
+	// into a ring buffer and passes them to a consumer running on another thread (see the top of this file)
+	{
+		pipeline::async_consumer<frame<N_s, T>> consumer;
+
+	public:
+
+		template <typename C, typename Consume>
+		async_frames(const C& sys, Consume&& consume, std::size_t capacity = 16)
+			: consumer(capacity, frame<N_s, T>(sys), std::forward<Consume>(consume))
+		// constructor
+		//	sys: the system to simulate (it sets the size of the frames)
+		//	consume(frame): called on the consumer thread with each frame (`cme::frame`), e.g.
+		//		std::ref(file) with a `frame_file` file
+		//	capacity: number of frames of the ring buffer
+		{}
+
+		template <typename C>
+		void operator()(const C& c)
+		// copy the probabilities and the time of c into the next frame
+		{
+			consumer.push([&c](frame<N_s, T>& f)
+			{
+				if (f.p.size() != c.box_size())
+					throw std::length_error("The frames of a pipeline must have the same size.");
+				f.t = c.t;
+				c.expand(&c.p[0], f.p.data());
+			});
+		}
+
+		void close()
+		// wait for the consumer to process all the frames (and rethrow its exception, if any)
+		{
+			consumer.close();
+		}
+
+		std::size_t size() const noexcept
+		// number of written frames
+		{
+			return consumer.size();
+		}
+
+		std::size_t stalls() const noexcept
+		// number of frames which waited for a free slot
+		{
+			return consumer.stalls();
+		}
+	};
+} // namespace cme
+
+namespace gillespie
+{
+	template <std::size_t N_s, std::floating_point T = double>
+	struct state_frame
+	// population numbers x at time t
+	{
+		T t = 0;
+		physics::vec<long long, N_s> x{};
+	};
+
+	template <std::size_t N_s, std::floating_point T = double>
+	class async_states
+	// observer for `gillespie::simulate(obs, t_final, max_steps, n_sampling)` which copies the states
+	// into a ring buffer and passes them to a consumer running on another thread (see the top of this file)
+	{
+		pipeline::async_consumer<state_frame<N_s, T>> consumer;
+
+	public:
+
+		template <typename Consume>
+		explicit async_states(Consume&& consume, std::size_t capacity = 1024)
+			: consumer(capacity, state_frame<N_s, T>{}, std::forward<Consume>(consume))
+		// constructor
+		//	consume(frame): called on the consumer thread with each state (`gillespie::state_frame`)
+		//	capacity: number of states of the ring buffer
+		{}
+
+		void operator()(T t, const physics::vec<long long, N_s>& x)
+		// copy the time and the state into the next frame
+		{
+			consumer.push([&](state_frame<N_s, T>& f)
+			{
+				f.t = t;
+				f.x = x;
+			});
+		}
+
+		void close()
+		// wait for the consumer to process all the states (and rethrow its exception, if any)
+		{
+			consumer.close();
+		}
+
+		std::size_t size() const noexcept
+		// number of written states
+		{
+			return consumer.size();
+		}
+
+		std::size_t stalls() const noexcept
+		// number of states which waited for a free slot
+		{
+			return consumer.stalls();
+		}
+	};
+} // namespace gillespie
+
+#endif // SEK_PIPELINE
@@ -0,0 +1,184 @@
+//  Stochastic enzyme kinetics: counter-based random number generators
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_RANDOM
+#define SEK_RANDOM
+
+#include <cstdint> // uint32_t, uint64_t
+#include <array>
+#include <limits> // numeric_limits
+#include <concepts> // floating_point
+
+namespace prng
+{
+	class philox4x32
+	// Philox4x32-10 counter-based random number generator
+	// J. K. Salmon, M. A. Moraes, R. O. Dror, D. E. Shaw, "Parallel random numbers: as easy as 1, 2, 3", SC11, 2011
+	// The output is a function of (key, counter) only, so each (seed, stream) pair
+	// gives an independent sequence of 2^66 numbers which can be set up in constant time.
+	// It satisfies the UniformRandomBitGenerator requirements.
+	{
+		std::array<std::uint32_t, 2> key;
+		std::array<std::uint32_t, 4> ctr; // ctr[0], ctr[1]: block index, ctr[2], ctr[3]: stream index
+		std::array<std::uint32_t, 4> out;
+		unsigned out_i = 4; // index of the next output word (4 means that a new block is needed)
+
+		static constexpr std::uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57; // multipliers
+		static constexpr std::uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85; // Weyl sequence key increments
+
+		static constexpr std::array<std::uint32_t, 4> round(const std::array<std::uint32_t, 4>& c, const std::array<std::uint32_t, 2>& k) noexcept
+		{
+			std::uint64_t p0 = std::uint64_t(M0) * c[0];
+			std::uint64_t p1 = std::uint64_t(M1) * c[2];
+			return {
+				std::uint32_t(p1 >> 32) ^ c[1] ^ k[0],
+				std::uint32_t(p1),
+				std::uint32_t(p0 >> 32) ^ c[3] ^ k[1],
+				std::uint32_t(p0)
+			};
+		}
+
+		void increment() noexcept
+		// increment the block index (the stream index is left untouched)
+		{
+			if (++ctr[0] == 0)
+				++ctr[1];
+		}
+
+	public:
+
+		using result_type = std::uint32_t;
+
+		static constexpr std::array<std::uint32_t, 4> block(std::array<std::uint32_t, 4> c, std::array<std::uint32_t, 2> k) noexcept
+		// the bijection (10 rounds) from a counter c to a block of 4 random words, given the key k
+		{
+			for (int r = 0; r < 9; ++r)
+			{
+				c = round(c, k);
+				k[0] += W0;
+				k[1] += W1;
+			}
+			return round(c, k);
+		}
+
+		explicit philox4x32(std::uint64_t seed = 0, std::uint64_t stream = 0) noexcept
+		// constructor
+		//	seed: the key of the generator
+		//	stream: the index of the independent sequence
+		{
+			this->seed(seed, stream);
+		}
+
+		void seed(std::uint64_t seed, std::uint64_t stream = 0) noexcept
+		// select the sequence identified by (seed, stream) and rewind it
+		{
+			key = {std::uint32_t(seed), std::uint32_t(seed >> 32)};
+			ctr = {0, 0, std::uint32_t(stream), std::uint32_t(stream >> 32)};
+			out_i = 4;
+		}
+
+		using state_type = std::array<std::uint32_t, 11>;
+
+		state_type state() const noexcept
+		// return the whole state of the generator (key, counter, current block, output index),
+		// e.g. to save it inside a checkpoint
+		{
+			return {key[0], key[1], ctr[0], ctr[1], ctr[2], ctr[3], out[0], out[1], out[2], out[3], out_i};
+		}
+
+		void state(const state_type& s) noexcept
+		// restore a state returned by `state()`
+		{
+			key = {s[0], s[1]};
+			ctr = {s[2], s[3], s[4], s[5]};
+			out = {s[6], s[7], s[8], s[9]};
+			out_i = s[10] < 4 ? s[10] : 4;
+		}
+
+		static constexpr result_type min() noexcept
+		{
+			return 0;
+		}
+
+		static constexpr result_type max() noexcept
+		{
+			return std::numeric_limits<result_type>::max();
+		}
+
+		result_type operator()() noexcept
+		{
+			if (out_i == 4)
+			{
+				out = block(ctr, key);
+				increment();
+				out_i = 0;
+			}
+			return out[out_i++];
+		}
+
+		template <std::size_t K>
+		static constexpr void blocks(std::array<std::array<std::uint32_t, K>, 4>& c, std::array<std::uint32_t, 2> k) noexcept
+		// apply `block` to K counters at once in place (structure of arrays: c[i][l] is the i-th word
+		// of the l-th counter), so that the compiler can map the K lanes onto SIMD registers
+		{
+			for (int r = 0; r < 10; ++r)
+			{
+				for (std::size_t l = 0; l < K; ++l)
+				{
+					std::uint64_t p0 = std::uint64_t(M0) * c[0][l];
+					std::uint64_t p1 = std::uint64_t(M1) * c[2][l];
+					std::uint32_t c1 = c[1][l], c3 = c[3][l];
+					c[0][l] = std::uint32_t(p1 >> 32) ^ c1 ^ k[0];
+					c[1][l] = std::uint32_t(p1);
+					c[2][l] = std::uint32_t(p0 >> 32) ^ c3 ^ k[1];
+					c[3][l] = std::uint32_t(p0);
+				}
+				k[0] += W0;
+				k[1] += W1;
+			}
+		}
+
+		void discard(unsigned long long n) noexcept
+		// advance the sequence by n numbers in constant time
+		{
+			unsigned long long words = out_i + n; // words counted from the start of the current block
+			if (words < 4)
+			{
+				out_i = unsigned(words);
+				return;
+			}
+			words -= 4; // the current block is consumed
+			std::uint64_t blocks = words / 4;
+			std::uint64_t b = ((std::uint64_t(ctr[1]) << 32) | ctr[0]) + blocks;
+			ctr[0] = std::uint32_t(b);
+			ctr[1] = std::uint32_t(b >> 32);
+			out_i = 4;
+			for (unsigned i = 0; i < words % 4; ++i)
+				operator()();
+		}
+	};
+	template <std::floating_point T>
+	constexpr T canonical(std::uint32_t lo, std::uint32_t hi) noexcept
+	// uniform real number in [0, 1) made of the most significant bits of the 64-bit word hi:lo
+	// (unlike std::generate_canonical, the result does not depend on the standard library)
+	{
+		constexpr int d = std::numeric_limits<T>::digits < 64 ? std::numeric_limits<T>::digits : 64;
+		std::uint64_t w = (std::uint64_t(hi) << 32) | lo;
+		return T(w >> (64 - d)) / T(std::uint64_t(1) << (d - 1)) / 2;
+	}
+} // namespace prng
+
+#endif // SEK_RANDOM
@@ -17,10 +17,21 @@
 #ifndef SEK_RUNGE_KUTTA
 #define SEK_RUNGE_KUTTA
 
-#include <concepts> // floating_point
+#include <concepts> // floating_point, invocable
 #include <functional> // function
 #include <valarray>
 #include <array>
+#include <algorithm> // min, max, swap_ranges
+#include <cmath> // abs, pow, sqrt
+#include <stdexcept> // runtime_error
+#include <utility> // swap
+#include <iterator> // begin, end
+#include <cstdint> // uint64_t
+#include <istream>
+#include <ostream>
+
+#include "checkpoint.hpp"
+#include "counters.hpp"
 
 template <std::floating_point T = double>
 struct integrator
@@ -37,7 +48,31 @@ namespace runge_kutta
 	// all explicit Runge-Kutta methods inherit from this class
 	// `Stages` is the number of stages of the method (number of force evaluations).
 	{
-		std::valarray<T> k[Stages], prev_x;
+		std::valarray<T> k[Stages], y;
+
+		// non-zero coefficients of the linear combination of the stages for each row of the tableau
+		// (rows 0, ..., Stages-2: intermediate states, row Stages-1: final state)
+		std::array<std::array<T, Stages>, Stages> coef;
+		std::array<std::array<std::size_t, Stages>, Stages> coef_j;
+		std::array<std::size_t, Stages> n_coef;
+
+		void combine(T* out, const T* x, std::size_t n, std::size_t row, T dt) const noexcept
+		// out = x + dt * sum_j coef[row][j] k[j], in a single pass over memory
+		// out and x may coincide
+		{
+			const std::size_t m = n_coef[row];
+			const T* kp[Stages];
+			for (std::size_t q = 0; q < m; ++q)
+				kp[q] = &k[coef_j[row][q]][0];
+			for (std::size_t e = 0; e < n; ++e)
+			{
+				T sum = 0;
+				// sum smaller contributes (in dt) first to minimize rounding errors
+				for (std::size_t q = 0; q < m; ++q)
+					sum += coef[row][q] * kp[q][e] * dt;
+				out[e] = sum + x[e];
+			}
+		}
 
 	public:
 
@@ -46,36 +81,71 @@ namespace runge_kutta
 
 		template <typename ... Ts>
 		requires (sizeof...(Ts) == Stages*Stages)
-		runge_kutta(Ts ... pars) : pars{T(pars)...} {}
+		runge_kutta(Ts ... pars) : pars{T(pars)...}
 		// constructor:
 		//	pars... is a variadic argument which contains the parameters for the explicit Runge-Kutta method.
+		{
+			using std::size_t;
+
+			for (size_t row = 0; row < Stages; ++row)
+			{
+				// intermediate rows start with the node c_i, the last row has only the weights b_j
+				bool last = row == Stages-1;
+				size_t n_j = last ? Stages : row+1;
+				n_coef[row] = 0;
+				for (size_t j = 0; j < n_j; ++j)
+				{
+					T a = this->pars[row*Stages + j + !last];
+					if (a != 0)
+					{
+						coef[row][n_coef[row]] = a;
+						coef_j[row][n_coef[row]++] = j;
+					}
+				}
+			}
+		}
 
 		virtual ~runge_kutta() = default;
 
-		void step(std::valarray<T>& x, T dt, std::function<const std::valarray<T>& (const std::valarray<T>&)> f)
+		template <typename F>
+		requires std::invocable<F&, const std::valarray<T>&, std::valarray<T>&>
+		void step(std::valarray<T>& x, T dt, F&& f)
 		//	x is the system state
 		//	dt is the integration step
-		//	f is the function that gives the derivative of x wrt time, i.e. f(x) = dx/dt
+		//	f(x, dxdt) is the function that writes the derivative of x wrt time into dxdt
+		// The stage buffers are kept between calls, so no memory is allocated after the first step,
+		// and every stage is a single fused pass over memory.
 		{
 			using std::size_t;
 
-			prev_x = x;
-			k[0] = f(x);
+			instrument::scoped_timer timer(instrument::timer::runge_kutta_step);
+			instrument::add(instrument::counter::stage_evaluations, Stages);
+			const size_t n = x.size();
+			for (size_t i = 0; i < Stages; ++i)
+				if (k[i].size() != n)
+					k[i].resize(n);
+			if (Stages > 1 && y.size() != n)
+				y.resize(n);
+
+			f(static_cast<const std::valarray<T>&>(x), k[0]);
 			for (size_t i = 1; i < Stages; ++i)
 			{
-				x = 0;
-				// sum smaller contributes (in dt) first to minimize rounding errors
-				for (size_t j = 0; j < i; ++j)
-					x += pars[(i-1)*Stages + j+1] * k[j] * dt;
-				x += prev_x;
-
-				k[i] = f(x);
+				combine(&y[0], &x[0], n, i-1, dt);
+				f(static_cast<const std::valarray<T>&>(y), k[i]);
 			}
+			combine(&x[0], &x[0], n, Stages-1, dt);
+		}
 
-			x = 0;
-			for (size_t i = 0; i < Stages; ++i)
-				x += pars[(Stages-1)*Stages + i] * k[i] * dt;
-			x += prev_x;
+		void step(std::valarray<T>& x, T dt, std::function<const std::valarray<T>& (const std::valarray<T>&)> f)
+		//	x is the system state
+		//	dt is the integration step
+		//	f is the function that gives the derivative of x wrt time, i.e. f(x) = dx/dt
+		{
+			instrument::add(instrument::counter::function_steps);
+			step(x, dt, [&f](const std::valarray<T>& x, std::valarray<T>& dxdt)
+			{
+				dxdt = f(x);
+			});
 		}
 	};
 
@@ -230,6 +300,351 @@ namespace runge_kutta
 	};
 
 	verner8() -> verner8<>;
+
+	template <std::size_t Stages, std::size_t Order, std::floating_point T = double>
+	class embedded_runge_kutta
+	// all adaptive explicit Runge-Kutta methods with an embedded error estimate inherit from this class
+	// `Stages` is the number of stages of the method (number of force evaluations per step).
+	// `Order` is the order of the embedded (lower-order) solution, which sets the step-size controller.
+	// The step size is chosen so that the estimated local error of each step satisfies
+	//	sqrt(mean_i (err_i / (atol + rtol*max(|x_i|, |x_new_i|)))^2) <= 1,
+	// rejected steps are repeated with a smaller step size, and the solution between accepted
+	// steps is recovered by cubic Hermite interpolation (dense output).
+	{
+		std::valarray<T> k[Stages], y, x0, f1;
+		const T* x1 = nullptr; // solution at the end of the last accepted step (valid inside observers)
+		T t0 = 0, h = 0; // start and size of the last accepted step
+		bool fsal; // the last stage is evaluated at the new solution ("first same as last")
+
+		// non-zero coefficients of the linear combination of the stages for each row of the tableau
+		// (rows 0, ..., Stages-2: intermediate states, row Stages-1: final state, row Stages: error estimate)
+		std::array<std::array<T, Stages>, Stages+1> coef;
+		std::array<std::array<std::size_t, Stages>, Stages+1> coef_j;
+		std::array<std::size_t, Stages+1> n_coef;
+
+		void combine(T* out, const T* x, std::size_t n, std::size_t row, T dt) const noexcept
+		// out = x + dt * sum_j coef[row][j] k[j], in a single pass over memory
+		{
+			const std::size_t m = n_coef[row];
+			const T* kp[Stages];
+			for (std::size_t q = 0; q < m; ++q)
+				kp[q] = &k[coef_j[row][q]][0];
+			for (std::size_t e = 0; e < n; ++e)
+			{
+				T sum = 0;
+				for (std::size_t q = 0; q < m; ++q)
+					sum += coef[row][q] * kp[q][e] * dt;
+				out[e] = sum + x[e];
+			}
+		}
+
+		T error_norm(const T* x, const T* x_new, std::size_t n, T dt) const noexcept
+		// weighted root mean square of the local error estimate
+		{
+			using std::abs;
+			using std::max;
+			using std::sqrt;
+
+			const std::size_t m = n_coef[Stages];
+			const T* kp[Stages];
+			for (std::size_t q = 0; q < m; ++q)
+				kp[q] = &k[coef_j[Stages][q]][0];
+			T sum_sq = 0;
+			for (std::size_t e = 0; e < n; ++e)
+			{
+				T err = 0;
+				for (std::size_t q = 0; q < m; ++q)
+					err += coef[Stages][q] * kp[q][e];
+				err *= dt / (atol + rtol * max(abs(x[e]), abs(x_new[e])));
+				sum_sq += err * err;
+			}
+			return sqrt(sum_sq / n);
+		}
+
+		T initial_step(const std::valarray<T>& x, const std::valarray<T>& dxdt) const noexcept
+		// step size guess (E. Hairer, S. P. Norsett, G. Wanner, "Solving Ordinary Differential Equations I", II.4)
+		{
+			using std::abs;
+			using std::sqrt;
+
+			T d0 = 0, d1 = 0;
+			for (std::size_t e = 0; e < x.size(); ++e)
+			{
+				T sc = atol + rtol * abs(x[e]);
+				d0 += (x[e]/sc) * (x[e]/sc);
+				d1 += (dxdt[e]/sc) * (dxdt[e]/sc);
+			}
+			d0 = sqrt(d0 / x.size());
+			d1 = sqrt(d1 / x.size());
+			return d0 < 1e-5 || d1 < 1e-5 ? T(1e-6) : T(.01) * d0 / d1;
+		}
+
+		T factor(T err) const noexcept
+		// step-size change factor for an error estimate err
+		{
+			using std::pow;
+			using std::min;
+			using std::max;
+
+			if (err == 0)
+				return fac_max;
+			return min(fac_max, max(fac_min, safety * pow(err, T(-1) / (Order+1))));
+		}
+
+	public:
+
+		// parameters of the Runge-Kutta method, with the same layout as `runge_kutta::pars`
+		const std::array<T, Stages*Stages> pars;
+		// weights of the error estimate (difference between the weights of the two solutions)
+		const std::array<T, Stages> err_pars;
+
+		T atol = 1e-12; // absolute tolerance
+		T rtol = 1e-6; // relative tolerance
+		T dt = 0; // proposed size of the next step (0 for an automatic guess)
+		T dt_min = 0; // minimum step size (an exception is thrown below it)
+		T safety = .9, fac_min = .2, fac_max = 5; // step-size controller parameters
+
+		std::size_t n_accepted = 0, n_rejected = 0, n_evals = 0; // statistics
+
+		template <typename ... Ts>
+		requires (sizeof...(Ts) == Stages*Stages + Stages)
+		embedded_runge_kutta(Ts ... pars)
+			: embedded_runge_kutta(std::array<long double, Stages*Stages + Stages>{(long double)pars...})
+		// constructor:
+		//	pars... contains the parameters of the explicit Runge-Kutta method (see `runge_kutta`)
+		//	followed by the weights of the error estimate.
+		{}
+
+		embedded_runge_kutta(const std::array<long double, Stages*Stages + Stages>& all)
+			: pars(take<Stages*Stages>(all, 0)), err_pars(take<Stages>(all, Stages*Stages))
+		{
+			using std::size_t;
+
+			for (size_t row = 0; row <= Stages; ++row)
+			{
+				// intermediate rows start with the node c_i, the last rows have only the weights
+				bool last = row >= Stages-1;
+				size_t n_j = last ? Stages : row+1;
+				n_coef[row] = 0;
+				for (size_t j = 0; j < n_j; ++j)
+				{
+					T a = row == Stages ? err_pars[j] : pars[row*Stages + j + !last];
+					if (a != 0)
+					{
+						coef[row][n_coef[row]] = a;
+						coef_j[row][n_coef[row]++] = j;
+					}
+				}
+			}
+			fsal = Stages > 1 && pars[(Stages-2)*Stages] == 1;
+			for (size_t j = 0; fsal && j < Stages; ++j)
+				fsal = (j < Stages-1 ? pars[(Stages-2)*Stages + j+1] : 0) == pars[(Stages-1)*Stages + j];
+		}
+
+		virtual ~embedded_runge_kutta() = default;
+
+		void reset_stats() noexcept
+		{
+			n_accepted = n_rejected = n_evals = 0;
+		}
+
+		void save(std::ostream& out) const
+		// write a checkpoint of the step-size controller (parameters, proposed step and statistics),
+		// which is the only state kept between calls of `integrate`
+		{
+			checkpoint::writer w(out, checkpoint::kind::integrator);
+			w.write(std::uint64_t(Stages));
+			w.write(std::uint64_t(sizeof(T)));
+			for (T v : {atol, rtol, dt, dt_min, safety, fac_min, fac_max})
+				w.write(v);
+			for (std::size_t v : {n_accepted, n_rejected, n_evals})
+				w.write(std::uint64_t(v));
+		}
+
+		void load(std::istream& in)
+		// restore a checkpoint written by `save`
+		{
+			checkpoint::reader r(in, checkpoint::kind::integrator);
+			r.expect(r.read<std::uint64_t>() == Stages, "number of stages");
+			r.expect(r.read<std::uint64_t>() == sizeof(T), "floating-point type");
+			for (T* v : {&atol, &rtol, &dt, &dt_min, &safety, &fac_min, &fac_max})
+				*v = r.read<T>();
+			for (std::size_t* v : {&n_accepted, &n_rejected, &n_evals})
+				*v = r.read<std::uint64_t>();
+		}
+
+		T dense_output_begin() const noexcept
+		// start of the last accepted step
+		{
+			return t0;
+		}
+
+		T dense_output_end() const noexcept
+		// end of the last accepted step
+		{
+			return t0 + h;
+		}
+
+		void dense_output(T t_s, T* out) const noexcept
+		// write into out the solution interpolated at t_s, inside the last accepted step
+		// (it can be called only by the observers of `integrate`)
+		{
+			T th = (t_s - t0) / h;
+			T th2 = th*th, th3 = th2*th;
+			T h00 = 2*th3 - 3*th2 + 1, h10 = (th3 - 2*th2 + th) * h;
+			T h01 = 3*th2 - 2*th3, h11 = (th3 - th2) * h;
+			const T *p0 = &x0[0], *d0 = &k[0][0], *d1 = &f1[0];
+			for (std::size_t e = 0; e < x0.size(); ++e)
+				out[e] = h00*p0[e] + h10*d0[e] + h01*x1[e] + h11*d1[e];
+		}
+
+		template <typename F, typename Obs>
+		requires std::invocable<F&, const std::valarray<T>&, std::valarray<T>&>
+		std::size_t integrate(std::valarray<T>& x, T& t, T t_final, F&& f, Obs&& obs)
+		// integrate from t to t_final
+		//	x is the system state
+		//	t is the time (updated)
+		//	f(x, dxdt) is the function that writes the derivative of x wrt time into dxdt
+		//	obs(integ) is called after every accepted step (see `dense_output`)
+		// return the number of accepted steps
+		{
+			using std::size_t;
+			using std::min;
+			using std::swap;
+
+			const size_t n = x.size();
+			if (n == 0 || t >= t_final)
+				return 0;
+			for (size_t i = 0; i < Stages; ++i)
+				if (k[i].size() != n)
+					k[i].resize(n);
+			for (auto* buf : {&y, &x0, &f1})
+				if (buf->size() != n)
+					buf->resize(n);
+
+			size_t evals0 = n_evals; // evaluations already added to the stage counter
+			f(static_cast<const std::valarray<T>&>(x), k[0]);
+			++n_evals;
+			if (dt <= 0)
+				dt = initial_step(x, k[0]);
+
+			size_t steps = 0;
+			while (t < t_final)
+			{
+				T h_try = min(dt, t_final - t);
+				bool last = h_try == t_final - t;
+
+				for (size_t i = 1; i < Stages; ++i)
+				{
+					combine(&y[0], &x[0], n, i-1, h_try);
+					f(static_cast<const std::valarray<T>&>(y), k[i]);
+				}
+				n_evals += Stages-1;
+				if (!fsal)
+					combine(&y[0], &x[0], n, Stages-1, h_try);
+
+				T err = error_norm(&x[0], &y[0], n, h_try);
+				if (!(err <= 1))
+				{
+					++n_rejected;
+					dt = h_try * min(T(1), factor(err));
+					if (!(dt > dt_min) || t + dt == t)
+						throw std::runtime_error("Step size underflow in the adaptive Runge-Kutta integrator.");
+					continue;
+				}
+
+				// accept: x0 = old solution, x = new solution
+				std::swap_ranges(std::begin(x), std::end(x), std::begin(y));
+				swap(x0, y);
+				if (fsal)
+					swap(f1, k[Stages-1]);
+				else
+				{
+					f(static_cast<const std::valarray<T>&>(x), f1);
+					++n_evals;
+				}
+
+				t0 = t;
+				h = h_try;
+				t = last ? t_final : t + h_try;
+				x1 = &x[0];
+				++steps;
+				++n_accepted;
+				obs(static_cast<const embedded_runge_kutta&>(*this));
+				x1 = nullptr;
+				instrument::add(instrument::counter::stage_evaluations, n_evals - evals0);
+				evals0 = n_evals;
+
+				swap(k[0], f1); // derivative at the new solution
+				T dt_new = h_try * factor(err);
+				if (!last || dt_new < dt)
+					dt = dt_new;
+			}
+			return steps;
+		}
+
+		template <typename F>
+		requires std::invocable<F&, const std::valarray<T>&, std::valarray<T>&>
+		std::size_t integrate(std::valarray<T>& x, T& t, T t_final, F&& f)
+		// integrate from t to t_final without observers
+		{
+			return integrate(x, t, t_final, f, [](const embedded_runge_kutta&){});
+		}
+
+	private:
+
+		template <std::size_t M>
+		static std::array<T, M> take(const std::array<long double, Stages*Stages + Stages>& all, std::size_t first) noexcept
+		{
+			std::array<T, M> a;
+			for (std::size_t i = 0; i < M; ++i)
+				a[i] = T(all[first + i]);
+			return a;
+		}
+	};
+
+	template <std::floating_point T = double>
+	struct dormand_prince : embedded_runge_kutta<7, 4, T>
+	// Dormand-Prince method (5th order with 4th order error estimate, 7 stages, first same as last)
+	// J. R. Dormand, P. J. Prince, "A family of embedded Runge-Kutta formulae", J. Comput. Appl. Math., 1980
+	{
+		dormand_prince() : embedded_runge_kutta<7, 4, T>
+			{
+				1/5.L, 1/5.L, 0, 0, 0, 0, 0,
+				3/10.L, 3/40.L, 9/40.L, 0, 0, 0, 0,
+				4/5.L, 44/45.L, -56/15.L, 32/9.L, 0, 0, 0,
+				8/9.L, 19372/6561.L, -25360/2187.L, 64448/6561.L, -212/729.L, 0, 0,
+				1, 9017/3168.L, -355/33.L, 46732/5247.L, 49/176.L, -5103/18656.L, 0,
+				1, 35/384.L, 0, 500/1113.L, 125/192.L, -2187/6784.L, 11/84.L,
+				35/384.L, 0, 500/1113.L, 125/192.L, -2187/6784.L, 11/84.L, 0,
+				// error weights
+				71/57600.L, 0, -71/16695.L, 71/1920.L, -17253/339200.L, 22/525.L, -1/40.L
+			}
+		{}
+	};
+
+	dormand_prince() -> dormand_prince<>;
+
+	template <std::floating_point T = double>
+	struct cash_karp : embedded_runge_kutta<6, 4, T>
+	// Cash-Karp method (5th order with 4th order error estimate, 6 stages)
+	// J. R. Cash, A. H. Karp, "A variable order Runge-Kutta method for initial value problems with rapidly varying right-hand sides", ACM Trans. Math. Softw., 1990
+	{
+		cash_karp() : embedded_runge_kutta<6, 4, T>
+			{
+				1/5.L, 1/5.L, 0, 0, 0, 0,
+				3/10.L, 3/40.L, 9/40.L, 0, 0, 0,
+				3/5.L, 3/10.L, -9/10.L, 6/5.L, 0, 0,
+				1, -11/54.L, 5/2.L, -70/27.L, 35/27.L, 0,
+				7/8.L, 1631/55296.L, 175/512.L, 575/13824.L, 44275/110592.L, 253/4096.L,
+				37/378.L, 0, 250/621.L, 125/594.L, 0, 512/1771.L,
+				// error weights
+				37/378.L - 2825/27648.L, 0, 250/621.L - 18575/48384.L, 125/594.L - 13525/55296.L, -277/14336.L, 512/1771.L - 1/4.L
+			}
+		{}
+	};
+
+	cash_karp() -> cash_karp<>;
 } // namespace runge_kutta
 
 #endif // SEK_RUNGE_KUTTA
@@ -0,0 +1,112 @@
+//  Stochastic enzyme kinetics: sparse matrices
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_SPARSE
+#define SEK_SPARSE
+
+#include <concepts> // floating_point, unsigned_integral
+#include <cstdint> // uint32_t
+#include <vector>
+#include <limits> // numeric_limits
+#include <stdexcept> // length_error
+
+namespace sparse
+{
+	template <std::floating_point T = double, std::unsigned_integral I = std::uint32_t>
+	struct csr_matrix
+	// sparse matrix in compressed sparse row (CSR) format
+	// T: underlying floating-point type
+	// I: column index type
+	{
+		std::size_t n_rows = 0, n_cols = 0;
+		std::vector<std::size_t> row_ptr; // row i has the elements in [row_ptr[i], row_ptr[i+1])
+		std::vector<I> col; // column indices (sorted within each row)
+		std::vector<T> val; // values
+
+		void clear() noexcept
+		// release the matrix
+		{
+			n_rows = n_cols = 0;
+			row_ptr = {};
+			col = {};
+			val = {};
+		}
+
+		void reset(std::size_t rows, std::size_t cols, std::size_t nnz_hint = 0)
+		// start building a new rows x cols matrix (rows are appended with push_back and end_row)
+		// nnz_hint is the expected number of non-zero elements
+		{
+			if (cols > 0 && cols-1 > std::numeric_limits<I>::max())
+				throw std::length_error("Too many columns for the index type of the sparse matrix.");
+			n_rows = rows;
+			n_cols = cols;
+			row_ptr.clear();
+			col.clear();
+			val.clear();
+			row_ptr.reserve(rows+1);
+			col.reserve(nnz_hint);
+			val.reserve(nnz_hint);
+			row_ptr.push_back(0);
+		}
+
+		void push_back(std::size_t j, T v)
+		// append the element v at column j of the current row
+		{
+			col.push_back(I(j));
+			val.push_back(v);
+		}
+
+		void end_row()
+		// close the current row
+		{
+			row_ptr.push_back(col.size());
+		}
+
+		bool empty() const noexcept
+		{
+			return n_rows == 0;
+		}
+
+		std::size_t nnz() const noexcept
+		// number of stored elements
+		{
+			return val.size();
+		}
+
+		template <typename X = T, typename Y = T>
+		void multiply(const X* x, Y* y, std::size_t row_begin, std::size_t row_end) const noexcept
+		// y[i] = sum_j A[i][j] x[j] for the rows i in [row_begin, row_end)
+		// x and y may be stored with another precision (the sums are computed with T)
+		{
+			for (std::size_t i = row_begin; i < row_end; ++i)
+			{
+				T sum = 0;
+				for (std::size_t k = row_ptr[i]; k < row_ptr[i+1]; ++k)
+					sum += val[k] * x[col[k]];
+				y[i] = Y(sum);
+			}
+		}
+
+		template <typename X = T, typename Y = T>
+		void multiply(const X* x, Y* y) const noexcept
+		// y = A x
+		{
+			multiply(x, y, 0, n_rows);
+		}
+	};
+} // namespace sparse
+
+#endif // SEK_SPARSE
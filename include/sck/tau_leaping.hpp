@@ -0,0 +1,291 @@
+//  Stochastic enzyme kinetics: tau-leaping
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_TAU_LEAPING
+#define SEK_TAU_LEAPING
+
+#include <random> // uniform_real_distribution, poisson_distribution
+#include <array>
+#include <cmath> // log, abs
+#include <limits> // numeric_limits
+#include <algorithm> // min, max
+#include <cstdint> // uint64_t
+
+#include "gillespie.hpp"
+#include "random.hpp"
+#include "counters.hpp"
+
+namespace gillespie
+{
+	template <typename Model>
+	class tau_leaping
+	// explicit tau-leaping with the step-size selection of Cao, Gillespie and Petzold, an approximate
+	// stochastic simulation algorithm which fires Poisson-distributed numbers of reactions per leap.
+	// Y. Cao, D. T. Gillespie, L. R. Petzold, "Efficient step size selection for the tau-leaping simulation method", J. Chem. Phys., 2006
+	// Reactions that can fire fewer than `n_critical` more times before leaving the states compatible
+	// with the constants of motion (see `Model::compatible`) are critical, and at most one critical
+	// reaction fires per leap. When the selected leap is shorter than a few mean SSA steps, a batch of
+	// exact SSA steps (direct method) is performed instead. Leaps which would give an incompatible
+	// state are repeated with half the step size.
+	// The model keeps the state (model.x, model.t), which can be changed between steps.
+	{
+	public:
+
+		static constexpr std::size_t N_s = Model::num_species;
+		static constexpr std::size_t N_r = Model::num_rc;
+		using T = decltype(Model::t);
+
+		Model model;
+
+		T epsilon = .03; // error control parameter (bound on the relative change of the propensities)
+		long long n_critical = 10; // threshold on the number of firings for critical reactions
+		T ssa_threshold = 10; // leaps shorter than ssa_threshold / a_tot are replaced by SSA steps
+		std::size_t n_ssa = 100; // number of SSA steps in a batch
+
+		std::size_t n_leaps = 0, n_ssa_steps = 0, n_rejected = 0; // statistics
+
+	private:
+
+		prng::philox4x32 gen; // random number generator (counter-based)
+		std::uniform_real_distribution<T> u_dist = std::uniform_real_distribution<T>(0, 1);
+		std::array<T, N_r> a_r;
+
+		static constexpr T inf = std::numeric_limits<T>::infinity();
+
+		bool valid_state(const physics::vec<long long, N_s>& y) const
+		{
+			for (std::size_t s = 0; s < N_s; ++s)
+				if (y[s] < 0)
+					return false;
+			return model.compatible(y);
+		}
+
+		long long firings_left(std::size_t j) const
+		// number of times (up to n_critical) reaction j can fire before leaving the valid states
+		{
+			const auto& nu = model.stoichiometry();
+			physics::vec<long long, N_s> y = model.x;
+			long long k = 0;
+			for (; k < n_critical; ++k)
+			{
+				y += nu[j];
+				if (!valid_state(y))
+					break;
+			}
+			return k;
+		}
+
+		bool ssa_step(T t_final)
+		// a single step of the direct method, using the propensities in a_r
+		{
+			using std::log;
+
+			T a_tot = 0;
+			for (std::size_t i = 0; i < N_r; ++i)
+				a_tot += a_r[i];
+			if (a_tot == 0)
+				return false;
+			T tau = -log(1 - u_dist(gen)) / a_tot;
+			if (model.t + tau > t_final && t_final > 0)
+				return false;
+			T r = u_dist(gen) * a_tot, a_accum = 0;
+			std::size_t j;
+			for (j = 0; j < N_r-1; ++j)
+			{
+				a_accum += a_r[j];
+				if (a_accum > r)
+					break;
+			}
+			model.t += tau;
+			model.x += model.stoichiometry()[j];
+			++n_ssa_steps;
+			return true;
+		}
+
+		T leap_size(const std::array<bool, N_r>& critical) const
+		// largest leap that keeps the expected relative change of the populations below epsilon
+		{
+			using std::abs;
+			using std::max;
+			using std::min;
+
+			const auto& nu = model.stoichiometry();
+			T tau = inf;
+			for (std::size_t s = 0; s < N_s; ++s)
+			{
+				T mu = 0, sigma2 = 0;
+				bool changed = false;
+				for (std::size_t j = 0; j < N_r; ++j)
+					if (!critical[j] && nu[j][s] != 0)
+					{
+						mu += nu[j][s] * a_r[j];
+						sigma2 += T(nu[j][s]*nu[j][s]) * a_r[j];
+						changed = true;
+					}
+				if (!changed)
+					continue;
+				// g = 2: the propensity functions are at most of second order in the populations
+				T bound = max(epsilon * model.x[s] / 2, T(1));
+				if (mu != 0)
+					tau = min(tau, bound / abs(mu));
+				if (sigma2 != 0)
+					tau = min(tau, bound*bound / sigma2);
+			}
+			return tau;
+		}
+
+	public:
+
+		explicit tau_leaping(const Model& model)
+			: model(model)
+		// constructor
+		//	model: the Gillespie model to simulate (it is copied)
+		{}
+
+		static constexpr std::size_t default_max_steps() noexcept
+		{
+			return Model::default_max_steps();
+		}
+
+		void seed(std::uint64_t seed, std::uint64_t stream = 0) noexcept
+		// select the random sequence identified by (seed, stream) and rewind it
+		{
+			gen.seed(seed, stream);
+		}
+
+		bool step(T t_final = 0)
+		// a single leap (or a batch of SSA steps)
+		// return false if no reaction is possible or the next reaction is after time t_final, so that the
+		// simulation must stop (an SSA batch may have advanced the state before), true otherwise
+		// set t_final to 0 or negative number for infinity
+		{
+			using std::log;
+			using std::min;
+
+#ifdef SEK_DEBUG
+			model.check_state();
+#endif
+			model.calc_propensities(a_r);
+			T a_tot = 0, a_crit = 0;
+			std::array<bool, N_r> critical;
+			for (std::size_t j = 0; j < N_r; ++j)
+			{
+				a_tot += a_r[j];
+				critical[j] = a_r[j] > 0 && firings_left(j) < n_critical;
+				if (critical[j])
+					a_crit += a_r[j];
+			}
+			if (a_tot == 0)
+				return false; // no reaction is possible
+
+			T tau_noncrit = leap_size(critical);
+			if (tau_noncrit < ssa_threshold / a_tot)
+			{
+				// the leap would be too short to be convenient
+				for (std::size_t i = 0; i < n_ssa; ++i)
+				{
+					if (i > 0)
+						model.calc_propensities(a_r);
+					if (!ssa_step(t_final))
+						return false; // the next reaction is after t_final: drawing it again would bias the state
+				}
+				return true;
+			}
+
+			const T t_left = t_final > 0 ? t_final - model.t : inf;
+			if (t_left <= 0)
+				return false;
+			T tau_crit = a_crit > 0 ? -log(1 - u_dist(gen)) / a_crit : inf;
+			for (;;)
+			{
+				T tau = min({tau_noncrit, tau_crit, t_left});
+				physics::vec<long long, N_s> y = model.x;
+				const auto& nu = model.stoichiometry();
+
+				if (tau == tau_crit)
+				{
+					// a single critical reaction fires
+					T r = u_dist(gen) * a_crit, a_accum = 0;
+					std::size_t j_c = N_r;
+					for (std::size_t j = 0; j < N_r; ++j)
+						if (critical[j])
+						{
+							j_c = j;
+							a_accum += a_r[j];
+							if (a_accum > r)
+								break;
+						}
+					y += nu[j_c];
+				}
+				for (std::size_t j = 0; j < N_r; ++j)
+					if (!critical[j] && a_r[j] > 0)
+					{
+						std::poisson_distribution<long long> k_dist(a_r[j] * tau);
+						long long k = k_dist(gen);
+						if (k != 0)
+							y += k * nu[j];
+					}
+
+				if (valid_state(y))
+				{
+					model.x = y;
+					model.t = tau == t_left ? t_final : model.t + tau;
+					++n_leaps;
+					return true;
+				}
+				// reject the leap: retry with half the step size
+				++n_rejected;
+				tau_noncrit = tau / 2;
+				if (tau == tau_crit)
+					tau_crit = -log(1 - u_dist(gen)) / a_crit; // the critical reaction is not fired
+			}
+		}
+
+		void simulate(T t_final = 0, std::size_t max_steps = default_max_steps())
+		// simulate for max_steps steps (leaps or SSA batches) or until t >= t_final
+		// set t_final to 0 or negative number for infinity
+		// if the total propensity gets to zero, the simulation will be terminated
+		{
+			for (std::size_t i = 0; i < max_steps && (model.t < t_final || t_final <= 0); ++i)
+				if (!step(t_final))
+					break;
+		}
+
+		void simulate(list_of_states<N_s, T>& states, T t_final = 0, std::size_t max_steps = default_max_steps(), std::size_t n_sampling = 1)
+		// simulate for max_steps steps or until t >= t_final, and save the states inside a list (initial and final state are included)
+		// set t_final to 0 or negative number for infinity
+		// n_sampling is the number of steps for each sampling point
+		// if the total propensity gets to zero, the simulation will be terminated
+		{
+			std::size_t n_states = states.t.size();
+			for (std::size_t i = 0; i < max_steps && (model.t < t_final || t_final <= 0); ++i)
+			{
+				if (i % n_sampling == 0)
+				{
+					states.x.push_back(model.x);
+					states.t.push_back(model.t);
+				}
+				if (!step(t_final))
+					break;
+			}
+			states.x.push_back(model.x);
+			states.t.push_back(model.t);
+			instrument::add(instrument::counter::bytes_sampled, (states.t.size() - n_states) * (sizeof(model.x) + sizeof(T)));
+		}
+	};
+} // namespace gillespie
+
+#endif // SEK_TAU_LEAPING
@@ -19,7 +19,7 @@
 #ifndef PHYSICS_TENSOR_H
 #define PHYSICS_TENSOR_H
 
-#include <concepts> // floating_point, integral, convertible_to
+#include <concepts> // floating_point, integral, convertible_to, invocable
 #include <valarray>
 #include <array>
 #include <utility> // make_index_sequence, index_sequence, swap
@@ -44,6 +44,31 @@ namespace physics
 		return detail_::make_filled_impl<R, T>(scal, std::make_index_sequence<N>{});
 	}
 
+	// maximum number of elements of the tensors whose element-wise operations are unrolled
+	inline constexpr std::size_t unroll_limit = 16;
+
+	namespace detail_
+	{
+		template <typename F, std::size_t ... Is>
+		constexpr void for_each_index_impl(F& f, std::index_sequence<Is...>)
+		{
+			(f(Is), ...);
+		}
+	}
+	template <std::size_t N, std::invocable<std::size_t> F>
+	constexpr void for_each_index(F&& f)
+	// call f(i) for i = 0, ..., N-1.
+	// The calls are unrolled if N <= unroll_limit, so that the element-wise operations of small tensors
+	// (like the population numbers and the stoichiometric vectors) are straight-line code that the
+	// compilers pack into SIMD instructions, without relying on loop optimizations. Otherwise it is a loop.
+	{
+		if constexpr (N <= unroll_limit)
+			detail_::for_each_index_impl(f, std::make_index_sequence<N>{});
+		else
+			for (std::size_t i = 0; i < N; ++i)
+				f(i);
+	}
+
 	template <typename T, std::size_t ... Ns>
 	requires ((Ns * ...) >= 1)
 	struct tensor;
@@ -164,8 +189,7 @@ namespace physics
 		// template copy constructor
 		// it copies another tensor with different scalar type (`S`) but same shape (`Ns...`)
 		{
-			for (std::size_t i = 0; i < (Ns * ...); ++i)
-				(*this)[i] = other[i];
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] = other[i]; });
 		}
 
 		template <std::convertible_to<std::size_t> ... Ts>
@@ -241,141 +265,153 @@ namespace physics
 		// negate operator
 		{
 			tensor res;
-			for (std::size_t i = 0; i < (Ns * ...); ++i)
-				res[i] = -(*this)[i];
+			for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = -(*this)[i]; });
 			return res;
 		}
 		constexpr tensor& operator+=(const tensor& other)
 		// add-assignment operator with an`other` tensor
 		{
-			for (std::size_t i = 0; i < (Ns * ...); ++i)
-				(*this)[i] += other[i];
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] += other[i]; });
 			return *this;
 		}
 		constexpr tensor& operator-=(const tensor& other)
 		// subtract-assignment operator with an`other` tensor
 		{
-			for (std::size_t i = 0; i < (Ns * ...); ++i)
-				(*this)[i] -= other[i];
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] -= other[i]; });
 			return *this;
 		}
 		constexpr tensor& operator*=(const tensor& other)
 		// (element-wise) multiply-assignment operator with an`other` tensor
 		{
-			for (std::size_t i = 0; i < (Ns * ...); ++i)
-				(*this)[i] *= other[i];
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] *= other[i]; });
 			return *this;
 		}
 		constexpr tensor& operator/=(const tensor& other)
 		// (element-wise) divide-assignment operator with an`other` tensor
 		{
-			for (std::size_t i = 0; i < (Ns * ...); ++i)
-				(*this)[i] /= other[i];
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] /= other[i]; });
 			return *this;
 		}
 		constexpr tensor& operator+=(T scal)
 		// add-assignment operator with a `scal`ar
 		{
-			for (auto& e : *this)
-				e += scal;
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] += scal; });
 			return *this;
 		}
 		constexpr tensor& operator-=(T scal)
 		// subtract-assignment operator with a `scal`ar
 		{
-			for (auto& e : *this)
-				e -= scal;
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] -= scal; });
 			return *this;
 		}
 		constexpr tensor& operator*=(T scal)
 		// multiply-assignment operator with a `scal`ar
 		{
-			for (auto& e : *this)
-				e *= scal;
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] *= scal; });
 			return *this;
 		}
 		constexpr tensor& operator/=(T scal)
 		// divide-assignment operator with a `scal`ar
 		{
-			for (auto& e : *this)
-				e /= scal;
+			for_each_index<(Ns * ...)>([&](std::size_t i) { (*this)[i] /= scal; });
 			return *this;
 		}
 	};
 
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator+(tensor<T, Ns...> lhs, const tensor<T, Ns...>& rhs)
+	constexpr tensor<T, Ns...> operator+(const tensor<T, Ns...>& lhs, const tensor<T, Ns...>& rhs)
 	// add operator between two `tensor`s
+	// (the result is written directly, without copying lhs first)
 	{
-		return lhs += rhs;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] + rhs[i]; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator-(tensor<T, Ns...> lhs, const tensor<T, Ns...>& rhs)
+	constexpr tensor<T, Ns...> operator-(const tensor<T, Ns...>& lhs, const tensor<T, Ns...>& rhs)
 	// subtract operator between two `tensor`s
+	// (the result is written directly, without copying lhs first)
 	{
-		return lhs -= rhs;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] - rhs[i]; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator*(tensor<T, Ns...> lhs, const tensor<T, Ns...>& rhs)
+	constexpr tensor<T, Ns...> operator*(const tensor<T, Ns...>& lhs, const tensor<T, Ns...>& rhs)
 	// (element-wise) multiply operator between two `tensor`s
+	// (the result is written directly, without copying lhs first)
 	{
-		return lhs *= rhs;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] * rhs[i]; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator/(tensor<T, Ns...> lhs, const tensor<T, Ns...>& rhs)
+	constexpr tensor<T, Ns...> operator/(const tensor<T, Ns...>& lhs, const tensor<T, Ns...>& rhs)
 	// (element-wise) divide operator between two `tensor`s
+	// (the result is written directly, without copying lhs first)
 	{
-		return lhs /= rhs;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] / rhs[i]; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator+(tensor<T, Ns...> lhs, typename tensor<T, Ns...>::value_type scal)
+	constexpr tensor<T, Ns...> operator+(const tensor<T, Ns...>& lhs, typename tensor<T, Ns...>::value_type scal)
 	// add operator between a tensor and a scalar
 	{
-		return lhs += scal;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] + scal; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator+(typename tensor<T, Ns...>::value_type scal, tensor<T, Ns...> rhs)
+	constexpr tensor<T, Ns...> operator+(typename tensor<T, Ns...>::value_type scal, const tensor<T, Ns...>& rhs)
 	// add operator between a scalar and a tensor
 	{
 		return rhs + scal;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator-(tensor<T, Ns...> lhs, typename tensor<T, Ns...>::value_type scal)
+	constexpr tensor<T, Ns...> operator-(const tensor<T, Ns...>& lhs, typename tensor<T, Ns...>::value_type scal)
 	// subtract operator between a tensor and a scalar
 	{
-		return lhs -= scal;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] - scal; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator-(typename tensor<T, Ns...>::value_type scal, tensor<T, Ns...> rhs)
+	constexpr tensor<T, Ns...> operator-(typename tensor<T, Ns...>::value_type scal, const tensor<T, Ns...>& rhs)
 	// subtract operator between a scalar and a tensor
 	{
-		return -(rhs - scal);
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = -(rhs[i] - scal); });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator*(tensor<T, Ns...> lhs, typename tensor<T, Ns...>::value_type scal)
+	constexpr tensor<T, Ns...> operator*(const tensor<T, Ns...>& lhs, typename tensor<T, Ns...>::value_type scal)
 	// multiply operator between a tensor and a scalar
 	{
-		return lhs *= scal;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] * scal; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator*(typename tensor<T, Ns...>::value_type scal, tensor<T, Ns...> rhs)
+	constexpr tensor<T, Ns...> operator*(typename tensor<T, Ns...>::value_type scal, const tensor<T, Ns...>& rhs)
 	// multiply operator between a scalar and a tensor
 	{
 		return rhs * scal;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator/(tensor<T, Ns...> lhs, typename tensor<T, Ns...>::value_type scal)
+	constexpr tensor<T, Ns...> operator/(const tensor<T, Ns...>& lhs, typename tensor<T, Ns...>::value_type scal)
 	// divide operator between a tensor and a scalar
 	{
-		return lhs /= scal;
+		tensor<T, Ns...> res;
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = lhs[i] / scal; });
+		return res;
 	}
 	template <typename T, std::size_t ... Ns>
-	constexpr tensor<T, Ns...> operator/(typename tensor<T, Ns...>::value_type scal, tensor<T, Ns...> rhs)
+	constexpr tensor<T, Ns...> operator/(typename tensor<T, Ns...>::value_type scal, const tensor<T, Ns...>& rhs)
 	// (element-wise) divide operator between a scalar and a tensor
 	{
 		tensor<T, Ns...> res;
-		for (std::size_t i = 0; i < (Ns * ...); ++i)
-			res[i] = scal / rhs[i];
+		for_each_index<(Ns * ...)>([&](std::size_t i) { res[i] = scal / rhs[i]; });
 		return res;
 	}
 
@@ -0,0 +1,210 @@
+//  Stochastic enzyme kinetics: thread pool with work-stealing parallel loops
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_THREAD_POOL
+#define SEK_THREAD_POOL
+
+#include <thread>
+#include <mutex> // mutex, lock_guard, unique_lock
+#include <condition_variable>
+#include <functional> // function
+#include <exception> // exception_ptr, current_exception, rethrow_exception
+#include <atomic>
+#include <memory> // unique_ptr
+#include <vector>
+#include <algorithm> // min
+
+namespace parallel
+{
+	class thread_pool
+	// a fixed set of worker threads that execute parallel loops.
+	// The calling thread takes part in the work, so a pool of size 1 spawns no threads.
+	// Parallel loops cannot be nested inside each other on the same pool.
+	{
+		struct alignas(64) range
+		// the remaining work of a thread (padded to avoid false sharing)
+		{
+			std::mutex m;
+			std::size_t begin = 0, end = 0;
+		};
+
+		std::vector<std::thread> workers;
+		std::mutex m, run_m;
+		std::condition_variable cv_job, cv_done;
+		std::function<void(std::size_t)> job;
+		std::size_t generation = 0, n_running = 0;
+		bool stop = false;
+
+		void worker_loop(std::size_t id)
+		{
+			std::size_t seen = 0;
+			for (;;)
+			{
+				{
+					std::unique_lock lock(m);
+					cv_job.wait(lock, [&]{ return stop || generation != seen; });
+					if (stop)
+						return;
+					seen = generation;
+				}
+				job(id);
+				{
+					std::lock_guard lock(m);
+					if (--n_running == 0)
+						cv_done.notify_one();
+				}
+			}
+		}
+
+		void run(std::function<void(std::size_t)> f)
+		// call f(thread_id) on every thread of the pool and wait for all of them to finish
+		// f must not throw
+		{
+			std::lock_guard run_lock(run_m);
+			if (workers.empty())
+			{
+				f(0);
+				return;
+			}
+			{
+				std::lock_guard lock(m);
+				job = std::move(f);
+				n_running = workers.size();
+				++generation;
+			}
+			cv_job.notify_all();
+			job(0);
+			std::unique_lock lock(m);
+			cv_done.wait(lock, [&]{ return n_running == 0; });
+		}
+
+	public:
+
+		explicit thread_pool(std::size_t n_threads = 0)
+		// constructor
+		//	n_threads: total number of threads (0 for the number of hardware threads)
+		{
+			if (n_threads == 0)
+				n_threads = std::thread::hardware_concurrency();
+			for (std::size_t i = 1; i < n_threads; ++i)
+				workers.emplace_back(&thread_pool::worker_loop, this, i);
+		}
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		~thread_pool()
+		{
+			{
+				std::lock_guard lock(m);
+				stop = true;
+			}
+			cv_job.notify_all();
+			for (auto& w : workers)
+				w.join();
+		}
+
+		std::size_t size() const noexcept
+		// return the number of threads, including the calling one
+		{
+			return workers.size() + 1;
+		}
+
+		template <typename F>
+		void parallel_for(std::size_t n, std::size_t chunk, F&& f)
+		// call f(thread_id, begin, end) on disjoint subranges of [0, n) with at most `chunk`
+		// indices each, until the whole range is covered. thread_id is in [0, size()).
+		// The range is initially split evenly between the threads; a thread that runs out
+		// of work steals half of the remaining work of another thread.
+		// If f throws, the remaining work is abandoned and the first exception is rethrown.
+		{
+			const std::size_t n_thr = std::min(size(), n);
+			if (chunk == 0)
+				chunk = 1;
+			if (n_thr <= 1)
+			{
+				for (std::size_t b = 0; b < n; b += chunk)
+					f(std::size_t(0), b, std::min(b + chunk, n));
+				return;
+			}
+
+			std::unique_ptr<range[]> ranges(new range[size()]);
+			for (std::size_t i = 0; i < n_thr; ++i)
+			{
+				ranges[i].begin = n*i / n_thr;
+				ranges[i].end = n*(i+1) / n_thr;
+			}
+			std::atomic<bool> failed = false;
+			std::exception_ptr error;
+			std::mutex error_m;
+
+			run([&](std::size_t id)
+			{
+				try
+				{
+					while (!failed.load(std::memory_order_relaxed))
+					{
+						std::size_t b, e;
+						{
+							std::lock_guard lock(ranges[id].m);
+							b = ranges[id].begin;
+							e = std::min(b + chunk, ranges[id].end);
+							ranges[id].begin = e;
+						}
+						if (b < e)
+						{
+							f(id, b, e);
+							continue;
+						}
+						// steal the upper half of the remaining work of another thread
+						bool stolen = false;
+						for (std::size_t k = 1; k < size() && !stolen; ++k)
+						{
+							range& victim = ranges[(id + k) % size()];
+							{
+								std::lock_guard lock(victim.m);
+								if (victim.begin < victim.end)
+								{
+									b = victim.end - (victim.end - victim.begin + 1) / 2;
+									e = victim.end;
+									victim.end = b;
+									stolen = true;
+								}
+							}
+						}
+						if (!stolen)
+							break;
+						std::lock_guard lock(ranges[id].m);
+						ranges[id].begin = b;
+						ranges[id].end = e;
+					}
+				}
+				catch (...)
+				{
+					std::lock_guard lock(error_m);
+					if (!error)
+						error = std::current_exception();
+					failed = true;
+				}
+			});
+
+			if (error)
+				std::rethrow_exception(error);
+		}
+	};
+} // namespace parallel
+
+#endif // SEK_THREAD_POOL
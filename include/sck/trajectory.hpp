@@ -0,0 +1,172 @@
+//  Stochastic enzyme kinetics: trajectory sinks for the chemical master equation
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_TRAJECTORY
+#define SEK_TRAJECTORY
+
+#include <concepts> // floating_point
+#include <cstdint> // uint64_t
+#include <fstream> // ofstream
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm> // copy
+#include <stdexcept> // length_error, runtime_error
+
+// The sinks are observers for `cme::simulate(integ, dt, t_final, obs, n_sampling)`: each call writes
+// a frame with the probabilities of the whole box (reduced state spaces are expanded), so that the
+// frames have a fixed size and the trajectory is never reallocated.
+
+namespace cme
+{
+	template <std::floating_point T = double>
+	class frame_buffer
+	// trajectory sink which writes the frames into a preallocated buffer, owned by the caller
+	{
+		T* data;
+		T* times;
+		std::size_t n_frames, stride, n = 0;
+
+	public:
+
+		frame_buffer(T* data, T* times, std::size_t n_frames, std::size_t stride)
+			: data(data), times(times), n_frames(n_frames), stride(stride)
+		// constructor
+		//	data: buffer of n_frames frames, the k-th one starts at data + k*stride
+		//	times: buffer of n_frames times
+		//	n_frames: max number of frames
+		//	stride: distance between the frames (number of elements), at least the box size
+		{}
+
+		template <typename C>
+		void operator()(const C& c)
+		// write the probabilities and the time of c as the next frame
+		{
+			if (n == n_frames)
+				throw std::length_error("The frame buffer is full.");
+			if (stride < c.box_size())
+				throw std::length_error("The frames of the buffer are smaller than the state space.");
+			c.expand(&c.p[0], data + n*stride);
+			times[n] = c.t;
+			++n;
+		}
+
+		std::size_t size() const noexcept
+		// number of written frames
+		{
+			return n;
+		}
+	};
+
+	template <std::size_t N_s, std::floating_point T = double>
+	class frame_file
+	// trajectory sink which streams the frames to a binary file, that can be memory-mapped.
+	// Layout (native byte order):
+	//	header: char magic[8] = "SEKTRAJ", uint64 version, uint64 sizeof(T), uint64 N_s,
+	//		uint64 n_frames, uint64 n_max[N_s]
+	//	frames: n_frames records of (T t, T p[n_max[0]]...[n_max[N_s-1]]), p in row-major order
+	// n_frames is updated by `close` (called by the destructor).
+	{
+		std::ofstream out;
+		std::vector<T> frame;
+		std::size_t n = 0;
+		bool header = false;
+
+		static constexpr char magic[8] = "SEKTRAJ";
+
+		void write_u64(std::uint64_t v)
+		{
+			out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+		}
+
+	public:
+
+		static constexpr std::uint64_t version = 1;
+		static constexpr std::size_t header_size = 8 * (5 + N_s); // bytes
+		static constexpr std::size_t n_frames_offset = 32; // bytes
+
+		explicit frame_file(const std::string& path)
+			: out(path, std::ios::binary | std::ios::trunc)
+		// constructor
+		//	path: file to create (it is overwritten)
+		{
+			if (!out)
+				throw std::runtime_error("Cannot open the trajectory file '" + path + "'.");
+		}
+
+		frame_file(const frame_file&) = delete;
+		frame_file& operator=(const frame_file&) = delete;
+
+		~frame_file()
+		{
+			try
+			{
+				close();
+			}
+			catch (...)
+			{}
+		}
+
+		template <typename C>
+		void operator()(const C& c)
+		// write the probabilities and the time of c as the next frame
+		{
+			if (!header)
+			{
+				out.write(magic, sizeof(magic));
+				write_u64(version);
+				write_u64(sizeof(T));
+				write_u64(N_s);
+				write_u64(0); // n_frames
+				for (std::size_t i = 0; i < N_s; ++i)
+					write_u64(c.get_shape_index(i));
+				frame.resize(1 + c.box_size());
+				header = true;
+			}
+			if (frame.size() != 1 + c.box_size())
+				throw std::length_error("The frames of a trajectory file must have the same size.");
+			frame[0] = c.t;
+			c.expand(&c.p[0], frame.data() + 1);
+			out.write(reinterpret_cast<const char*>(frame.data()), frame.size() * sizeof(T));
+			if (!out)
+				throw std::runtime_error("Cannot write the trajectory file.");
+			++n;
+		}
+
+		std::size_t size() const noexcept
+		// number of written frames
+		{
+			return n;
+		}
+
+		void close()
+		// write the number of frames into the header and close the file
+		{
+			if (!out.is_open())
+				return;
+			if (header)
+			{
+				out.seekp(n_frames_offset);
+				write_u64(n);
+			}
+			out.close();
+			if (out.fail())
+				throw std::runtime_error("Cannot write the trajectory file.");
+		}
+	};
+} // namespace cme
+
+#endif // SEK_TRAJECTORY
@@ -23,6 +23,11 @@ g++ -shared -static -std=c++20 -Wall -Wextra -pedantic -O3 -fmax-errors=1 -DMS_W
 
 #include <optional>
 #include <vector>
+#include <string> // to_string
+#include <stdexcept> // invalid_argument, runtime_error
+#include <cstdint> // uint64_t
+#include <fstream> // ifstream, ofstream
+#include <functional> // ref
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
@@ -30,79 +35,417 @@ g++ -shared -static -std=c++20 -Wall -Wextra -pedantic -O3 -fmax-errors=1 -DMS_W
 
 #include "../include/sck/cme.hpp"
 #include "../include/sck/runge_kutta.hpp"
+#include "../include/sck/implicit.hpp"
+#include "../include/sck/trajectory.hpp"
+#include "../include/sck/offload.hpp"
+#include "../include/sck/mixed.hpp"
+#include "../include/sck/pipeline.hpp"
+#include "network_pybind.hpp"
+#include "sweep_pybind.hpp"
+#include "counters_pybind.hpp"
 
 using namespace cme;
 namespace py = pybind11;
 
+template <typename Class>
+py::tuple states_arrays(const Class& self, list_of_states<>* states)
+// return the states saved in a list as a tuple of NumPy arrays (probabilities on the whole box, times)
+// the arrays take the ownership of the list
+{
+	std::size_t n = self.size(), n_box = self.box_size(), n_frames = states->t.size();
+	if (self.reduced())
+	{
+		// frames are stored on the reduced state space: expand them to the whole box
+		std::vector<double> p_box(n_frames * n_box);
+		for (std::size_t k = 0; k < n_frames; ++k)
+			self.expand(states->p.data() + k*n, p_box.data() + k*n_box);
+		states->p = std::move(p_box);
+	}
+
+	py::capsule free_when_done(
+		states,
+		[](void* f)
+		{
+			delete reinterpret_cast<list_of_states<>*>(f);
+		}
+	);
+	std::array<long long, Class::num_species+1> shape, stride;
+	shape[0] = n_frames;
+	for (std::size_t i = 1; i < Class::num_species+1; ++i)
+		shape[i] = self.get_shape_index(i-1);
+	stride[Class::num_species] = sizeof(double);
+	for (std::size_t i = Class::num_species; i --> 0; )
+		stride[i] = stride[i+1]*shape[i+1];
+	return py::make_tuple<py::return_value_policy::take_ownership>(
+			py::array_t<double>(
+				shape,
+				stride,
+				states->p.data(),
+				free_when_done
+			),
+			py::array_t<double>(
+				{(long long)states->t.size()},
+				{(long long)sizeof(double)},
+				states->t.data(),
+				free_when_done
+			)
+		);
+}
+
+template <typename Integ, typename Class>
+std::optional<py::tuple> simulate_integ(Class& self, Integ& integ, double dt, double t_final, std::size_t n_sampling, bool noreturn)
+{
+	if (noreturn)
+	{
+		self.simulate(integ, dt, t_final);
+		return {};
+	}
+	else
+	{
+		list_of_states<>* states = new list_of_states<>();
+
+		self.simulate(integ, *states, dt, t_final, n_sampling);
+		return states_arrays(self, states);
+	}
+}
+
+template <typename Class>
+py::tuple marginals_arrays(const Class& self, const std::array<std::vector<double>, Class::num_species>& marg, const std::vector<double>& t)
+// return the marginal distributions of the frames as a tuple (see `simulate_marginals_integ`)
+{
+	constexpr std::size_t N_s = Class::num_species;
+
+	py::list marginals;
+	for (std::size_t s = 0; s < N_s; ++s)
+	{
+		std::size_t n_max = self.get_shape_index(s);
+		py::array_t<double> m({t.size(), n_max});
+		std::copy(marg[s].begin(), marg[s].end(), m.mutable_data());
+		marginals.append(m);
+	}
+	return py::make_tuple(marginals, py::array_t<double>({t.size()}, {sizeof(double)}, t.data()));
+}
+
+template <typename Integ, typename Class>
+py::tuple simulate_marginals_integ(Class& self, Integ& integ, double dt, double t_final, std::size_t n_sampling)
+// simulate and return only the marginal distributions at the sampling points, as a tuple
+// (list of arrays with shape (n_frames, n_max[s]) for each species s, times)
+{
+	std::array<std::vector<double>, Class::num_species> marg;
+	std::vector<double> t;
+	self.simulate(integ, dt, t_final, [&](const Class& c)
+	{
+		for (std::size_t s = 0; s < Class::num_species; ++s)
+			marg[s].insert(marg[s].end(), std::begin(c.marginal(s)), std::end(c.marginal(s)));
+		t.push_back(c.t);
+	}, n_sampling);
+	return marginals_arrays(self, marg, t);
+}
+
+template <typename Integ, typename Class>
+std::size_t simulate_file_integ(Class& self, Integ& integ, double dt, double t_final, const std::string& path, std::size_t n_sampling,
+	std::size_t capacity)
+// simulate and stream the frames to a trajectory file (see `load_trajectory`), written by another thread
+// through a ring buffer of capacity frames if capacity > 0
+// return the number of frames
+{
+	py::gil_scoped_release release;
+	frame_file<Class::num_species> file(path);
+	if (capacity > 0)
+	{
+		async_frames<Class::num_species> writer(self, std::ref(file), capacity);
+		self.simulate(integ, dt, t_final, writer, n_sampling);
+		writer.close();
+	}
+	else
+		self.simulate(integ, dt, t_final, file, n_sampling);
+	file.close();
+	return file.size();
+}
+
+template <typename Integ, typename Class>
+std::size_t simulate_async_integ(Class& self, Integ& integ, double dt, double t_final, const py::function& callback,
+	std::size_t n_sampling, std::size_t capacity)
+// simulate without the GIL and call callback(t, p) on another thread for each frame, where p is an array
+// with shape (n_max...) (the frames wait in a ring buffer of capacity frames)
+// return the number of frames
+{
+	constexpr std::size_t N_s = Class::num_species;
+
+	std::vector<py::ssize_t> shape(N_s);
+	for (std::size_t s = 0; s < N_s; ++s)
+		shape[s] = self.get_shape_index(s);
+	py::gil_scoped_release release;
+	async_frames<N_s> sink(self, [&callback, &shape](const frame<N_s>& f)
+	{
+		// the callback is kept by the caller: the consumer thread only holds the GIL while calling it
+		py::gil_scoped_acquire acquire;
+		py::array_t<double> p(shape);
+		std::copy(f.p.begin(), f.p.end(), p.mutable_data());
+		callback(f.t, p);
+	}, capacity);
+	self.simulate(integ, dt, t_final, sink, n_sampling);
+	sink.close();
+	return sink.size();
+}
+
+template <typename Integ, typename Class>
+std::size_t simulate_buffer_integ(Class& self, Integ& integ, double dt, double t_final,
+	py::array_t<double, py::array::c_style> p_out, py::array_t<double, py::array::c_style> t_out, std::size_t n_sampling)
+// simulate and write the frames into preallocated arrays with shapes (n_frames, n_max...) and (n_frames,)
+// return the number of frames
+{
+	if (p_out.ndim() < 1 || std::size_t(p_out.size()) != std::size_t(p_out.shape(0)) * self.box_size() || t_out.size() < p_out.shape(0))
+		throw std::invalid_argument("The output arrays must have shapes (n_frames, n_max...) and (n_frames,).");
+	frame_buffer<> buffer(p_out.mutable_data(), t_out.mutable_data(), p_out.shape(0), self.box_size());
+	{
+		py::gil_scoped_release release;
+		self.simulate(integ, dt, t_final, buffer, n_sampling);
+	}
+	return buffer.size();
+}
+
 template <typename Integ, typename Class>
 void class_integ(py::class_<Class>& c)
 {
-	auto simulate_integ = [](Class& self, Integ& integ, double dt, double t_final, std::size_t n_sampling, bool noreturn)
-		-> std::optional<py::tuple>
+	c.def("step", &Class::template step<Integ>, py::arg("integ"), py::arg("dt"));
+	c.def("simulate",
+		simulate_integ<Integ, Class>,
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("n_sampling") = 1,
+		py::arg("noreturn") = false);
+	c.def("simulate_marginals",
+		simulate_marginals_integ<Integ, Class>,
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("n_sampling") = 1);
+	c.def("simulate_fsp",
+		[](Class& self, Integ& integ, double dt, double t_final, double tol, std::size_t n_update, std::size_t depth)
+		{
+			py::gil_scoped_release release;
+			return self.simulate_fsp(integ, dt, t_final, tol, n_update, depth);
+		},
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("tol"),
+		py::arg("n_update") = 10,
+		py::arg("depth") = 1);
+	c.def("simulate_to_file",
+		simulate_file_integ<Integ, Class>,
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("path"),
+		py::arg("n_sampling") = 1,
+		py::arg("capacity") = 0);
+	c.def("simulate_async",
+		simulate_async_integ<Integ, Class>,
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("callback"),
+		py::arg("n_sampling") = 1,
+		py::arg("capacity") = 16);
+	c.def("simulate_into",
+		simulate_buffer_integ<Integ, Class>,
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("p_out").noconvert(),
+		py::arg("t_out").noconvert(),
+		py::arg("n_sampling") = 1);
+}
+
+template <typename Integ, typename Class>
+void class_device(py::class_<Class>& c)
+// integration on the offloading device with an explicit Runge-Kutta method (see `offload::device_cme`)
+{
+	c.def("simulate_device",
+		[](Class& self, const Integ& integ, double dt, double t_final, std::size_t n_sampling)
 		{
-			if (noreturn)
+			std::array<std::vector<double>, Class::num_species> marg;
+			std::vector<double> t;
 			{
-				self.simulate(integ, dt, t_final);
-				return {};
+				py::gil_scoped_release release;
+				offload::device_cme device(self, integ);
+				device.simulate(dt, t_final, [&](const Class& c)
+				{
+					for (std::size_t s = 0; s < Class::num_species; ++s)
+						marg[s].insert(marg[s].end(), std::begin(c.marginal(s)), std::end(c.marginal(s)));
+					t.push_back(c.t);
+				}, n_sampling);
 			}
-			else
+			return marginals_arrays(self, marg, t);
+		},
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("n_sampling") = 1);
+}
+
+template <typename Integ, typename Class>
+void class_mixed(py::class_<Class>& c)
+// integration with the probabilities and stages stored in single precision (see `mixed::compact_cme`)
+{
+	c.def("simulate_float",
+		[](Class& self, const Integ& integ, double dt, double t_final, std::size_t n_sampling)
+		{
+			std::array<std::vector<double>, Class::num_species> marg;
+			std::vector<double> t;
+			double drift;
 			{
-				list_of_states<>* states = new list_of_states<>();
-
-				self.simulate(integ, *states, dt, t_final, n_sampling);
-
-				py::capsule free_when_done(
-					states,
-					[](void* f)
-					{
-						delete reinterpret_cast<list_of_states<>*>(f);
-					}
-				);
-				std::array<long long, Class::num_species+1> shape, stride;
-				shape[0] = states->p.size() / self.p.size();
-				for (std::size_t i = 1; i < Class::num_species+1; ++i)
-					shape[i] = self.get_shape_index(i-1);
-				stride[Class::num_species] = sizeof(double);
-				for (std::size_t i = Class::num_species; i --> 0; )
-					stride[i] = stride[i+1]*shape[i+1];
-				return py::make_tuple<py::return_value_policy::take_ownership>(
-						py::array_t<double>(
-							shape,
-							stride,
-							states->p.data(),
-							free_when_done
-						),
-						py::array_t<double>(
-							{(long long)states->t.size()},
-							{(long long)sizeof(double)},
-							states->t.data(),
-							free_when_done
-						)
-					);
+				py::gil_scoped_release release;
+				mixed::compact_cme compact(self, integ);
+				compact.simulate(dt, t_final, [&](const Class& c)
+				{
+					for (std::size_t s = 0; s < Class::num_species; ++s)
+						marg[s].insert(marg[s].end(), std::begin(c.marginal(s)), std::end(c.marginal(s)));
+					t.push_back(c.t);
+				}, n_sampling);
+				drift = compact.drift();
 			}
-		};
-	auto simulate_no_integ = [simulate_integ](Class& self, double dt, double t_final, std::size_t n_sampling, bool noreturn)
-		-> std::optional<py::tuple>
+			py::tuple out = marginals_arrays(self, marg, t);
+			return py::make_tuple(out[0], out[1], drift);
+		},
+		py::arg("integ"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("n_sampling") = 1);
+}
+
+template <typename Integ, typename Class>
+void class_explicit(py::class_<Class>& c)
+// methods specific to explicit Runge-Kutta methods
+{
+	class_device<Integ>(c);
+	class_mixed<Integ>(c);
+}
+
+template <typename Integ, typename Class>
+void class_adaptive(py::class_<Class>& c)
+{
+	c.def("integrate",
+		[](Class& self, Integ& integ, double t_final)
 		{
-			runge_kutta::ralston4<> default_integ;
-			return simulate_integ(self, default_integ, dt, t_final, n_sampling, noreturn);
-		};
-	c.def("step", Class::template step<Integ>, py::arg("integ"), py::arg("dt"));
-	c.def("simulate",
-		simulate_integ,
+			return self.integrate(integ, t_final);
+		},
+		py::arg("integ"),
+		py::arg("t_final"));
+	c.def("integrate",
+		[](Class& self, Integ& integ, const std::vector<double>& t_grid)
+		{
+			list_of_states<>* states = new list_of_states<>();
+
+			self.integrate(integ, *states, t_grid);
+			return states_arrays(self, states);
+		},
 		py::arg("integ"),
+		py::arg("t_grid"));
+}
+
+template <typename Class>
+void class_defs(py::class_<Class>& c)
+{
+	class_integ<integrator<>>(c);
+	class_integ<implicit::backward_euler<>>(c);
+	class_integ<implicit::sdirk2<>>(c);
+	class_integ<implicit::sdirk3<>>(c);
+	class_explicit<runge_kutta::euler<>>(c);
+	class_explicit<runge_kutta::midpoint<>>(c);
+	class_explicit<runge_kutta::heun2<>>(c);
+	class_explicit<runge_kutta::ralston2<>>(c);
+	class_explicit<runge_kutta::rk4<>>(c);
+	class_explicit<runge_kutta::rk4_3_8<>>(c);
+	class_explicit<runge_kutta::ralston4<>>(c);
+	class_explicit<runge_kutta::butcher6<>>(c);
+	class_explicit<runge_kutta::verner8<>>(c);
+	c.def("simulate",
+		[](Class& self, double dt, double t_final, std::size_t n_sampling, bool noreturn)
+		{
+			runge_kutta::ralston4<> default_integ;
+			return simulate_integ<integrator<>>(self, default_integ, dt, t_final, n_sampling, noreturn);
+		},
 		py::arg("dt"),
 		py::arg("t_final"),
 		py::arg("n_sampling") = 1,
 		py::arg("noreturn") = false);
-	c.def("simulate",
-		simulate_no_integ,
+	c.def("simulate_marginals",
+		[](Class& self, double dt, double t_final, std::size_t n_sampling)
+		{
+			runge_kutta::ralston4<> default_integ;
+			return simulate_marginals_integ<integrator<>>(self, default_integ, dt, t_final, n_sampling);
+		},
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("n_sampling") = 1);
+	c.def("simulate_to_file",
+		[](Class& self, double dt, double t_final, const std::string& path, std::size_t n_sampling, std::size_t capacity)
+		{
+			runge_kutta::ralston4<> default_integ;
+			return simulate_file_integ<integrator<>>(self, default_integ, dt, t_final, path, n_sampling, capacity);
+		},
 		py::arg("dt"),
 		py::arg("t_final"),
+		py::arg("path"),
 		py::arg("n_sampling") = 1,
-		py::arg("noreturn") = false);
+		py::arg("capacity") = 0);
+	c.def("simulate_async",
+		[](Class& self, double dt, double t_final, const py::function& callback, std::size_t n_sampling, std::size_t capacity)
+		{
+			runge_kutta::ralston4<> default_integ;
+			return simulate_async_integ<integrator<>>(self, default_integ, dt, t_final, callback, n_sampling, capacity);
+		},
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("callback"),
+		py::arg("n_sampling") = 1,
+		py::arg("capacity") = 16);
+	c.def("simulate_into",
+		[](Class& self, double dt, double t_final, py::array_t<double, py::array::c_style> p_out,
+			py::array_t<double, py::array::c_style> t_out, std::size_t n_sampling)
+		{
+			runge_kutta::ralston4<> default_integ;
+			return simulate_buffer_integ<integrator<>>(self, default_integ, dt, t_final, p_out, t_out, n_sampling);
+		},
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("p_out").noconvert(),
+		py::arg("t_out").noconvert(),
+		py::arg("n_sampling") = 1);
+	class_adaptive<runge_kutta::dormand_prince<>>(c);
+	class_adaptive<runge_kutta::cash_karp<>>(c);
+	c.def("propagate",
+		[](Class& self, double dt, double tol)
+		{
+			py::gil_scoped_release release;
+			return self.propagate(dt, tol);
+		},
+		py::arg("dt"),
+		py::arg("tol") = 1e-10);
+	c.def("propagate",
+		[](Class& self, const std::vector<double>& t_grid, double tol)
+		{
+			list_of_states<>* states = new list_of_states<>();
+
+			double err;
+			{
+				py::gil_scoped_release release;
+				err = self.propagate(*states, t_grid, tol);
+			}
+			py::tuple arrays = states_arrays(self, states);
+			return py::make_tuple(arrays[0], arrays[1], err);
+		},
+		py::arg("t_grid"),
+		py::arg("tol") = 1e-10);
 	c.def_property("p",
 		[](const Class& self)
+		// probabilities without copying (a copy if the state space is reduced): after writing
+		// through this view, the cached statistics (mean, sd, nth_moment, marginal) are stale
+		// until invalidate_stats() is called, whereas assigning to p invalidates them
 		{
 			std::array<long long, Class::num_species> shape, stride;
 			for (std::size_t i = 0; i < Class::num_species; ++i)
@@ -110,6 +453,13 @@ void class_integ(py::class_<Class>& c)
 			stride[Class::num_species-1] = sizeof(double);
 			for (std::size_t i = Class::num_species-1; i --> 0; )
 				stride[i] = stride[i+1]*shape[i+1];
+			if (self.reduced())
+			{
+				// return a copy of the probabilities of the whole box
+				py::array_t<double> p_box(shape, stride);
+				self.expand(&self.p[0], p_box.mutable_data());
+				return p_box;
+			}
 			return py::array_t<double>(
 				shape,
 				stride,
@@ -118,23 +468,102 @@ void class_integ(py::class_<Class>& c)
 		},
 		[](Class& self, py::array_t<double, py::array::c_style | py::array::forcecast> py_array)
 		{
-			self.p = std::valarray<double>(py_array.data(), py_array.size());
-		});
+			if (self.reduced() && std::size_t(py_array.size()) == self.box_size())
+				self.compress(py_array.data(), &self.p[0]);
+			else if (std::size_t(py_array.size()) == self.size())
+				self.p = std::valarray<double>(py_array.data(), py_array.size());
+			else
+				throw std::invalid_argument("The probabilities must have " + std::to_string(self.box_size()) + " elements.");
+			self.invalidate_stats();
+		},
+		"probabilities of the states in the box, not copied unless the state space is reduced (call invalidate_stats() after writing through them)");
 	c.def_readwrite("t", &Class::t);
-}
-
-template <typename Class>
-void class_defs(py::class_<Class>& c)
-{
-	class_integ<integrator<>>(c);
-	c.def("mean", Class::mean, py::arg("s_i"));
-	c.def("msq", Class::msq, py::arg("s_i"));
-	c.def("sd", Class::sd, py::arg("s_i"));
-	c.def("nth_moment", Class::nth_moment, py::arg("s_i"), py::arg("n"));
+	c.def("invalidate_stats", &Class::invalidate_stats,
+		"discard the cached statistics, after writing the probabilities through the view returned by p");
+	c.def("mean", &Class::mean, py::arg("s_i"));
+	c.def("msq", &Class::msq, py::arg("s_i"));
+	c.def("sd", &Class::sd, py::arg("s_i"));
+	c.def("nth_moment", &Class::nth_moment, py::arg("s_i"), py::arg("n"));
+	c.def("marginal",
+		[](const Class& self, std::size_t s_i)
+		{
+			const auto& m = self.marginal(s_i);
+			return py::array_t<double>({m.size()}, {sizeof(double)}, std::begin(m));
+		},
+		py::arg("s_i"));
+	c.def("assemble_generator", &Class::assemble_generator);
+	c.def("clear_generator", &Class::clear_generator);
+	c.def_property_readonly("assembled", &Class::assembled);
+	c.def_property("n_threads", &Class::get_threads, &Class::set_threads);
+	c.def("reduce_state_space", &Class::reduce_state_space);
+	c.def("fsp_start", &Class::fsp_start, py::arg("y0"));
+	c.def("fsp_update", &Class::fsp_update, py::arg("tol"), py::arg("depth") = 1);
+	c.def_property_readonly("lost_mass", &Class::lost_mass);
+	c.def("save",
+		[](const Class& self, const std::string& path)
+		{
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			if (!out)
+				throw std::runtime_error("Cannot open the checkpoint file '" + path + "'.");
+			self.save(out);
+		},
+		py::arg("path"));
+	c.def("load",
+		[](Class& self, const std::string& path)
+		{
+			std::ifstream in(path, std::ios::binary);
+			if (!in)
+				throw std::runtime_error("Cannot open the checkpoint file '" + path + "'.");
+			self.load(in);
+		},
+		py::arg("path"));
+	c.def("stationary",
+		[](Class& self, double tol, std::size_t max_iter, std::size_t restart)
+		{
+			krylov::result<> res;
+			{
+				py::gil_scoped_release release;
+				res = self.stationary(tol, max_iter, restart);
+			}
+			return py::make_tuple(res.converged, res.iterations, res.residual);
+		},
+		py::arg("tol") = 1e-10,
+		py::arg("max_iter") = 10000,
+		py::arg("restart") = 50);
+	c.def_property_readonly("reduced", &Class::reduced);
+	c.def_property_readonly("n_states", &Class::size);
 }
 
 PYBIND11_MODULE(cme, m)
 {
+	def_counters(m);
+
+	m.def("load_trajectory",
+		[](const std::string& path)
+		{
+			// memory-map a trajectory file written by simulate_to_file (see `cme::frame_file`)
+			py::module_ np = py::module_::import("numpy");
+			if (std::string(py::bytes(np.attr("fromfile")(path, py::arg("dtype") = "S8", py::arg("count") = 1)[py::int_(0)])) != "SEKTRAJ")
+				throw std::invalid_argument("'" + path + "' is not a trajectory file.");
+			py::object header = np.attr("fromfile")(path, py::arg("dtype") = np.attr("uint64"), py::arg("count") = 5);
+			std::uint64_t version = header[py::int_(1)].cast<std::uint64_t>();
+			std::uint64_t elem_size = header[py::int_(2)].cast<std::uint64_t>();
+			std::uint64_t n_s = header[py::int_(3)].cast<std::uint64_t>();
+			std::uint64_t n_frames = header[py::int_(4)].cast<std::uint64_t>();
+			if (version != 1 || elem_size != sizeof(double))
+				throw std::invalid_argument("Unsupported trajectory file version or floating-point type.");
+			py::object n_max = np.attr("fromfile")(path, py::arg("dtype") = np.attr("uint64"), py::arg("count") = 5 + n_s)[py::slice(5, 5 + n_s, 1)];
+			py::tuple shape = py::tuple(n_max.attr("tolist")());
+
+			py::list fields;
+			fields.append(py::make_tuple("t", "f8"));
+			fields.append(py::make_tuple("p", "f8", shape));
+			py::object frames = np.attr("memmap")(path, py::arg("dtype") = np.attr("dtype")(fields), py::arg("mode") = "r",
+				py::arg("offset") = 8 * (5 + n_s), py::arg("shape") = py::make_tuple(n_frames));
+			return py::make_tuple(frames[py::str("p")], frames[py::str("t")]);
+		},
+		py::arg("path"),
+		"open a trajectory file as read-only NumPy memory maps (probabilities, times) without copying");
 	py::class_<single_substrate<>> c_single_substrate(m, "single_substrate");
 	c_single_substrate.def(py::init<double, double, double, long long, long long>(),
 		py::arg("kf"), py::arg("kb"), py::arg("kcat"), py::arg("ET"), py::arg("ST"));
@@ -213,15 +642,72 @@ PYBIND11_MODULE(cme, m)
 	py::enum_<goldbeter_koshland_sqssa<>::reaction_channels>(c_goldbeter_koshland_sqssa, "reaction_channels")
 		.value("e", goldbeter_koshland_sqssa<>::reaction_channels::e)
 		.value("d", goldbeter_koshland_sqssa<>::reaction_channels::d);
-}
-
-
-
-
-
-
-
-
-
-
 
+	for_each_network_size([&m]<std::size_t N_s, std::size_t N_r>()
+	{
+		using Class = reaction_network<N_s, N_r>;
+		py::class_<Class> c(m, network_class_name(N_s, N_r).c_str());
+		c.def(py::init([](const std::array<long long, N_s>& n_max, const py::list& reactions, const py::list& constraints)
+			{
+				return Class(to_description(reactions, constraints), n_max);
+			}),
+			py::arg("n_max"), py::arg("reactions"), py::arg("constraints") = py::list());
+		class_defs(c);
+	});
+	m.def("reaction_network",
+		[m](const py::list& n_max, const py::list& reactions, const py::list& constraints)
+		{
+			return m.attr(network_class_of(reactions).c_str())(n_max, reactions, constraints);
+		},
+		py::arg("n_max"),
+		py::arg("reactions"),
+		py::arg("constraints") = py::list(),
+		"chemical master equation applied to a reaction network defined at runtime");
+
+	m.def("sweep",
+		[](const std::string& kind, sweep_real_array kf, sweep_real_array kb, sweep_real_array kcat,
+			sweep_int_array ET, sweep_int_array ST, double dt, double t_final, std::size_t n_sampling, std::size_t n_threads)
+		// integrate the CME of each point of a sweep (see sweep_pybind.hpp) from zero populations with ralston4:
+		// return the mean and the standard deviation of the products P with shape (n_points, n_frames), and the times
+		{
+			sweep_points points(kf, kb, kcat, ET, ST);
+			return with_sweep_model<single_substrate, single_substrate_tqssa, single_substrate_sqssa>(kind, [&]<typename Model>()
+			{
+				std::vector<std::vector<double>> mean(points.n), sd(points.n);
+				std::vector<double> t;
+				{
+					py::gil_scoped_release release;
+					parallel::thread_pool pool(n_threads);
+					runge_kutta::ralston4<> integ;
+					parallel_sweep(pool, points.n, [&](std::size_t k) { return points.make<Model>(k); },
+						[&](std::size_t k, Model& c) { return points.assign(k, c); }, integ, dt, t_final,
+						[&](std::size_t k, const Model& c)
+						{
+							mean[k].push_back(c.mean(Model::P));
+							sd[k].push_back(c.sd(Model::P));
+							if (k == 0)
+								t.push_back(c.t);
+						}, n_sampling);
+				}
+				// the points have the same time steps, hence the same number of frames
+				py::array_t<double> py_mean({points.n, t.size()}), py_sd({points.n, t.size()});
+				for (std::size_t k = 0; k < points.n; ++k)
+				{
+					std::copy(mean[k].begin(), mean[k].end(), py_mean.mutable_data(k));
+					std::copy(sd[k].begin(), sd[k].end(), py_sd.mutable_data(k));
+				}
+				return py::make_tuple(py_mean, py_sd, py::array_t<double>({t.size()}, {sizeof(double)}, t.data()));
+			});
+		},
+		py::arg("kind"),
+		py::arg("kf"),
+		py::arg("kb"),
+		py::arg("kcat"),
+		py::arg("ET"),
+		py::arg("ST"),
+		py::arg("dt"),
+		py::arg("t_final"),
+		py::arg("n_sampling") = 1,
+		py::arg("n_threads") = 0,
+		"chemical master equation of a sweep over the parameters of the single-substrate models on a thread pool");
+}
@@ -0,0 +1,57 @@
+//  Stochastic enzyme kinetics: instrumentation python binding helpers
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_COUNTERS_PYBIND
+#define SEK_COUNTERS_PYBIND
+
+#include <vector>
+#include <cstdint> // uint64_t
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include "../include/sck/counters.hpp"
+
+// The instrumentation is compiled into the bindings by adding -DSEK_INSTRUMENT to their compilation
+// command. Every module has its own counters: e.g. the stages of an integrator of the `runge_kutta`
+// module are counted by `runge_kutta.counters()`, even when it integrates a system of the `cme` module.
+
+inline void def_counters(pybind11::module_& m)
+// define `counters()` and `reset_counters()` in the module m: `counters()` returns a dict with the
+// counters summed over all threads, the reactions performed by each channel ('firings') and the
+// timers ('timers': name -> (calls, seconds)), all zero unless the module is compiled with SEK_INSTRUMENT
+{
+	m.def("counters",
+		[]()
+		{
+			instrument::report r = instrument::snapshot();
+			pybind11::dict out, timers;
+			out["enabled"] = instrument::enabled;
+			for (std::size_t i = 0; i < instrument::num_counters; ++i)
+				out[instrument::counter_names[i]] = r.counts[i];
+			std::size_t n_channels = instrument::max_channels;
+			while (n_channels > 0 && r.firings[n_channels-1] == 0)
+				--n_channels;
+			out["firings"] = std::vector<std::uint64_t>(r.firings.begin(), r.firings.begin() + n_channels);
+			for (std::size_t i = 0; i < instrument::num_timers; ++i)
+				timers[instrument::timer_names[i]] = pybind11::make_tuple(r.calls[i], r.ns[i] * 1e-9);
+			out["timers"] = timers;
+			return out;
+		});
+	m.def("reset_counters", instrument::reset);
+}
+
+#endif // SEK_COUNTERS_PYBIND
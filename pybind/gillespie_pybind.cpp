@@ -23,12 +23,22 @@ g++ -shared -static -std=c++20 -Wall -Wextra -pedantic -O3 -fmax-errors=1 -DMS_W
 
 #include <optional>
 #include <vector>
+#include <string> // to_string
+#include <stdexcept> // invalid_argument, runtime_error
+#include <cstdint> // uint64_t
+#include <fstream> // ifstream, ofstream
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
 
 #include "../include/sck/gillespie.hpp"
+#include "../include/sck/lockstep.hpp"
+#include "../include/sck/offload.hpp"
+#include "../include/sck/pipeline.hpp"
+#include "network_pybind.hpp"
+#include "sweep_pybind.hpp"
+#include "counters_pybind.hpp"
 
 using namespace gillespie;
 namespace py = pybind11;
@@ -36,7 +46,7 @@ namespace py = pybind11;
 template <typename Class>
 void class_defs(py::class_<Class>& c)
 {
-	c.def("step", Class::step, py::arg("t_final") = 0.);
+	c.def("step", &Class::step, py::arg("t_final") = 0.);
 	c.def("simulate",
 		[](Class& self, double t_final, std::size_t max_steps, std::size_t n_sampling, bool noreturn) -> std::optional<py::tuple>
 		{
@@ -78,6 +88,204 @@ void class_defs(py::class_<Class>& c)
 		py::arg("max_steps") = Class::default_max_steps(),
 		py::arg("n_sampling") = 1,
 		py::arg("noreturn") = false);
+	c.def("simulate_async",
+		[](Class& self, const py::function& callback, double t_final, std::size_t max_steps, std::size_t n_sampling, std::size_t capacity)
+		{
+			// simulate without the GIL and call callback(t, x) on another thread at the sampling points,
+			// where x is an array with the population numbers (the states wait in a ring buffer of capacity states)
+			constexpr std::size_t N_s = Class::num_species;
+
+			py::gil_scoped_release release;
+			async_states<N_s> sink([&callback](const state_frame<N_s>& f)
+			{
+				// the callback is kept by the caller: the consumer thread only holds the GIL while calling it
+				py::gil_scoped_acquire acquire;
+				py::array_t<long long> x(N_s);
+				std::copy(f.x.begin(), f.x.end(), x.mutable_data());
+				callback(f.t, x);
+			}, capacity);
+			self.simulate(sink, t_final, max_steps, n_sampling);
+			sink.close();
+			return sink.size();
+		},
+		py::arg("callback"),
+		py::arg("t_final") = 0.,
+		py::arg("max_steps") = Class::default_max_steps(),
+		py::arg("n_sampling") = 1,
+		py::arg("capacity") = 1024);
+	c.def("sample",
+		[](Class& self, const std::vector<double>& t_grid, std::size_t max_steps)
+		{
+			list_of_states<Class::num_species>* states = new list_of_states<Class::num_species>();
+
+			self.simulate(*states, t_grid, max_steps);
+
+			py::capsule free_when_done(
+				states,
+				[](void* f)
+				{
+					delete reinterpret_cast<list_of_states<Class::num_species>*>(f);
+				}
+			);
+			return py::make_tuple<py::return_value_policy::take_ownership>(
+					py::array_t<long long>(
+						{(long long)states->x.size(), (long long)Class::num_species},
+						{(long long)(Class::num_species*sizeof(long long)), (long long)sizeof(long long)},
+						reinterpret_cast<long long*>(states->x.data()),
+						free_when_done
+					),
+					py::array_t<double>(
+						{states->t.size()},
+						{sizeof(double)},
+						states->t.data(),
+						free_when_done
+					)
+				);
+		},
+		py::arg("t_grid"),
+		py::arg("max_steps") = Class::default_max_steps());
+	c.def("ensemble",
+		[](Class& self, py::array_t<long long, py::array::c_style | py::array::forcecast> x0, std::size_t n_trajectories,
+			const std::vector<double>& t_grid, const std::vector<std::size_t>& n_bins, std::size_t max_steps,
+			std::uint64_t seed, std::size_t n_threads, bool lockstep, bool device)
+		{
+			constexpr std::size_t N_s = Class::num_species;
+			if (std::size_t(x0.size()) != N_s)
+				throw std::invalid_argument("The initial state must have " + std::to_string(N_s) + " elements.");
+			if (n_bins.size() != 0 && n_bins.size() != 1 && n_bins.size() != N_s)
+				throw std::invalid_argument("n_bins must be empty, a single value or one value per species.");
+
+			physics::vec<long long, N_s> x_init;
+			std::copy(x0.data(), x0.data() + N_s, x_init.begin());
+			std::array<std::size_t, N_s> bins{};
+			for (std::size_t s = 0; s < N_s && !n_bins.empty(); ++s)
+				bins[s] = n_bins[n_bins.size() == 1 ? 0 : s];
+
+			ensemble_stats<N_s> stats(t_grid, bins);
+			{
+				py::gil_scoped_release release;
+				parallel::thread_pool pool(n_threads);
+				if (device)
+				{
+					if constexpr (offload::supported<Class>)
+						offload::ensemble(self, stats, x_init, n_trajectories, seed, max_steps);
+					else
+						throw std::invalid_argument("This model cannot run on the offloading device.");
+				}
+				else if (lockstep)
+					parallel_lockstep_ensemble(pool, self, stats, x_init, n_trajectories, seed, max_steps);
+				else
+					parallel_ensemble(pool, self, stats, x_init, n_trajectories, seed, max_steps);
+			}
+
+			std::size_t n_t = t_grid.size();
+			py::array_t<double> mean({n_t, N_s}), msq({n_t, N_s});
+			auto m = mean.mutable_unchecked<2>();
+			auto m2 = msq.mutable_unchecked<2>();
+			for (std::size_t k = 0; k < n_t; ++k)
+				for (std::size_t s = 0; s < N_s; ++s)
+				{
+					m(k, s) = stats.mean(k, s);
+					m2(k, s) = stats.msq(k, s);
+				}
+			py::list hists;
+			for (std::size_t s = 0; s < N_s; ++s)
+			{
+				py::array_t<long long> h({n_t, bins[s]});
+				std::copy(stats.hist[s].begin(), stats.hist[s].end(), h.mutable_data());
+				hists.append(h);
+			}
+			return py::make_tuple(
+					py::array_t<double>({n_t}, {sizeof(double)}, t_grid.data()),
+					mean,
+					msq,
+					hists
+				);
+		},
+		py::arg("x0"),
+		py::arg("n_trajectories"),
+		py::arg("t_grid"),
+		py::arg("n_bins") = std::vector<std::size_t>{},
+		py::arg("max_steps") = Class::default_max_steps(),
+		py::arg("seed") = 0,
+		py::arg("n_threads") = 0,
+		py::arg("lockstep") = false,
+		py::arg("device") = false);
+	c.def("simulate_until",
+		[](Class& self, py::array_t<long long, py::array::c_style | py::array::forcecast> target, double t_final, std::size_t max_steps)
+		{
+			constexpr std::size_t N_s = Class::num_species;
+			if (std::size_t(target.size()) != N_s)
+				throw std::invalid_argument("The target state must have " + std::to_string(N_s) + " elements.");
+
+			physics::vec<long long, N_s> y;
+			std::copy(target.data(), target.data() + N_s, y.begin());
+			return self.simulate_until(y, t_final, max_steps);
+		},
+		py::arg("target"),
+		py::arg("t_final") = 0.,
+		py::arg("max_steps") = Class::default_max_steps());
+	c.def("hitting_times",
+		[](Class& self, py::array_t<long long, py::array::c_style | py::array::forcecast> x0,
+			py::array_t<long long, py::array::c_style | py::array::forcecast> target, std::size_t n_trajectories,
+			double t_final, std::size_t max_steps, std::uint64_t seed, std::size_t n_threads)
+		{
+			constexpr std::size_t N_s = Class::num_species;
+			if (std::size_t(x0.size()) != N_s || std::size_t(target.size()) != N_s)
+				throw std::invalid_argument("The initial and target states must have " + std::to_string(N_s) + " elements.");
+
+			physics::vec<long long, N_s> x_init, y;
+			std::copy(x0.data(), x0.data() + N_s, x_init.begin());
+			std::copy(target.data(), target.data() + N_s, y.begin());
+
+			std::vector<double>* times = new std::vector<double>();
+			{
+				py::gil_scoped_release release;
+				parallel::thread_pool pool(n_threads);
+				*times = parallel_hitting_times(pool, self, x_init, n_trajectories, seed,
+					[&y](const physics::vec<long long, N_s>& x) { return x == y; }, t_final, max_steps);
+			}
+
+			py::capsule free_when_done(
+				times,
+				[](void* f)
+				{
+					delete reinterpret_cast<std::vector<double>*>(f);
+				}
+			);
+			return py::array_t<double>(
+					{times->size()},
+					{sizeof(double)},
+					times->data(),
+					free_when_done
+				);
+		},
+		py::arg("x0"),
+		py::arg("target"),
+		py::arg("n_trajectories"),
+		py::arg("t_final") = 0.,
+		py::arg("max_steps") = Class::default_max_steps(),
+		py::arg("seed") = 0,
+		py::arg("n_threads") = 0);
+	c.def("seed", &Class::seed, py::arg("seed"), py::arg("stream") = 0);
+	c.def("save",
+		[](const Class& self, const std::string& path)
+		{
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			if (!out)
+				throw std::runtime_error("Cannot open the checkpoint file '" + path + "'.");
+			self.save(out);
+		},
+		py::arg("path"));
+	c.def("load",
+		[](Class& self, const std::string& path)
+		{
+			std::ifstream in(path, std::ios::binary);
+			if (!in)
+				throw std::runtime_error("Cannot open the checkpoint file '" + path + "'.");
+			self.load(in);
+		},
+		py::arg("path"));
 	c.def_property("x",
 		[](const Class& self)
 		{
@@ -96,6 +304,8 @@ void class_defs(py::class_<Class>& c)
 
 PYBIND11_MODULE(gillespie, m)
 {
+	def_counters(m);
+
 	py::class_<single_substrate<>> c_single_substrate(m, "single_substrate");
 	c_single_substrate.def(py::init<double, double, double, long long, long long>(),
 		py::arg("kf"), py::arg("kb"), py::arg("kcat"), py::arg("ET"), py::arg("ST"));
@@ -174,15 +384,69 @@ PYBIND11_MODULE(gillespie, m)
 	py::enum_<goldbeter_koshland_sqssa<>::reaction_channels>(c_goldbeter_koshland_sqssa, "reaction_channels")
 		.value("e", goldbeter_koshland_sqssa<>::reaction_channels::e)
 		.value("d", goldbeter_koshland_sqssa<>::reaction_channels::d);
-}
-
-
-
-
-
-
-
-
-
-
 
+	for_each_network_size([&m]<std::size_t N_s, std::size_t N_r>()
+	{
+		using Class = reaction_network<N_s, N_r>;
+		py::class_<Class> c(m, network_class_name(N_s, N_r).c_str());
+		c.def(py::init([](const py::list& reactions, const py::list& constraints)
+			{
+				return Class(to_description(reactions, constraints));
+			}),
+			py::arg("reactions"), py::arg("constraints") = py::list());
+		class_defs(c);
+	});
+	m.def("reaction_network",
+		[m](const py::list& reactions, const py::list& constraints)
+		{
+			return m.attr(network_class_of(reactions).c_str())(reactions, constraints);
+		},
+		py::arg("reactions"),
+		py::arg("constraints") = py::list(),
+		"Gillespie algorithm applied to a reaction network defined at runtime");
+
+	m.def("sweep",
+		[](const std::string& kind, sweep_real_array kf, sweep_real_array kb, sweep_real_array kcat,
+			sweep_int_array ET, sweep_int_array ST, const std::vector<double>& t_grid, std::size_t n_trajectories,
+			std::size_t max_steps, std::uint64_t seed, std::size_t n_threads)
+		// ensemble of each point of a sweep (see sweep_pybind.hpp), starting from zero populations:
+		// return the mean and the standard deviation of the products P, with shape (n_points, len(t_grid))
+		{
+			sweep_points points(kf, kb, kcat, ET, ST);
+			return with_sweep_model<single_substrate, single_substrate_tqssa, single_substrate_sqssa>(kind, [&]<typename Model>()
+			{
+				constexpr std::size_t N_s = Model::num_species;
+				std::vector<ensemble_stats<N_s>> stats(points.n, ensemble_stats<N_s>(t_grid));
+				physics::vec<long long, N_s> x0;
+				x0 = 0;
+				{
+					py::gil_scoped_release release;
+					parallel::thread_pool pool(n_threads);
+					parallel_sweep(pool, points.n, [&](std::size_t k) { return points.make<Model>(k); },
+						stats, x0, n_trajectories, seed, max_steps);
+				}
+				py::array_t<double> mean({points.n, t_grid.size()}), sd({points.n, t_grid.size()});
+				auto m = mean.mutable_unchecked<2>();
+				auto s = sd.mutable_unchecked<2>();
+				for (std::size_t k = 0; k < points.n; ++k)
+					for (std::size_t j = 0; j < t_grid.size(); ++j)
+					{
+						m(k, j) = stats[k].mean(j, Model::P);
+						s(k, j) = stats[k].sd(j, Model::P);
+					}
+				return py::make_tuple(mean, sd);
+			});
+		},
+		py::arg("kind"),
+		py::arg("kf"),
+		py::arg("kb"),
+		py::arg("kcat"),
+		py::arg("ET"),
+		py::arg("ST"),
+		py::arg("t_grid"),
+		py::arg("n_trajectories"),
+		py::arg("max_steps") = single_substrate<>::default_max_steps(),
+		py::arg("seed") = 0,
+		py::arg("n_threads") = 0,
+		"ensembles of a sweep over the parameters of the single-substrate models on a thread pool");
+}
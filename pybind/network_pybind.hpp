@@ -0,0 +1,116 @@
+//  Stochastic enzyme kinetics: reaction networks python binding helpers
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_NETWORK_PYBIND
+#define SEK_NETWORK_PYBIND
+
+#include <vector>
+#include <string> // to_string
+#include <utility> // pair, index_sequence, make_index_sequence
+#include <stdexcept> // invalid_argument
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include "../include/sck/network.hpp"
+
+// From Python, a network is a list of reactions, each one a dict with the keys
+//	nu: stoichiometric vector (list of int)
+//	law: "mass_action" (default), "michaelis_menten" or "tqssa"
+//	k: rate constant
+//	K: Michaelis-Menten constant (MM and tQSSA only)
+//	factors: list of linear forms (weights, constant), see `network::reaction`
+// and an optional list of constraints (weights, constant). The networks are compiled for every
+// number of species up to network_max_species and of reactions up to network_max_rc, as the
+// classes reaction_network_<N_s>_<N_r>; the function `reaction_network` picks the right one.
+
+constexpr std::size_t network_max_species = 4;
+constexpr std::size_t network_max_rc = 6;
+
+inline std::string network_class_name(std::size_t n_species, std::size_t n_rc)
+{
+	return "reaction_network_" + std::to_string(n_species) + "_" + std::to_string(n_rc);
+}
+
+inline network::linear_form<> to_linear_form(pybind11::handle h)
+{
+	auto [w, c] = pybind11::cast<std::pair<std::vector<double>, double>>(h);
+	return {std::move(w), c};
+}
+
+inline network::description<> to_description(const pybind11::list& reactions, const pybind11::list& constraints)
+// convert the Python description of a network (the number of species is the length of the stoichiometric vectors)
+{
+	namespace py = pybind11;
+
+	network::description<> d;
+	for (py::handle h : reactions)
+	{
+		py::dict r = py::cast<py::dict>(h);
+		network::reaction<> rc;
+		rc.nu = py::cast<std::vector<long long>>(r["nu"]);
+		rc.k = py::cast<double>(r["k"]);
+		if (r.contains("K"))
+			rc.K = py::cast<double>(r["K"]);
+		if (r.contains("law"))
+		{
+			std::string law = py::cast<std::string>(r["law"]);
+			if (law == "mass_action")
+				rc.kind = network::law::mass_action;
+			else if (law == "michaelis_menten")
+				rc.kind = network::law::michaelis_menten;
+			else if (law == "tqssa")
+				rc.kind = network::law::tqssa;
+			else
+				throw std::invalid_argument("Unknown rate law '" + law + "'.");
+		}
+		if (r.contains("factors"))
+			for (py::handle f : r["factors"])
+				rc.factors.push_back(to_linear_form(f));
+		d.reactions.push_back(std::move(rc));
+	}
+	if (!d.reactions.empty())
+		d.n_species = d.reactions[0].nu.size();
+	for (py::handle h : constraints)
+		d.constraints.push_back(to_linear_form(h));
+	return d;
+}
+
+inline std::string network_class_of(const pybind11::list& reactions)
+// name of the class compiled for the sizes of a network
+{
+	namespace py = pybind11;
+
+	std::size_t n_rc = reactions.size();
+	std::size_t n_species = n_rc ? py::len(py::cast<py::dict>(reactions[0])["nu"]) : 0;
+	if (n_species == 0 || n_species > network_max_species || n_rc == 0 || n_rc > network_max_rc)
+		throw std::invalid_argument("Reaction networks are compiled for 1 to " + std::to_string(network_max_species)
+			+ " species and 1 to " + std::to_string(network_max_rc) + " reactions (got "
+			+ std::to_string(n_species) + " and " + std::to_string(n_rc) + ").");
+	return network_class_name(n_species, n_rc);
+}
+
+template <typename F>
+void for_each_network_size(F&& f)
+// call f.template operator()<N_s, N_r>() for every compiled size
+{
+	[&]<std::size_t... I>(std::index_sequence<I...>)
+	{
+		(f.template operator()<I / network_max_rc + 1, I % network_max_rc + 1>(), ...);
+	}(std::make_index_sequence<network_max_species * network_max_rc>{});
+}
+
+#endif // SEK_NETWORK_PYBIND
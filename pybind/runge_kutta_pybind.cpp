@@ -21,16 +21,72 @@ g++ -shared -static -std=c++20 -Wall -Wextra -pedantic -O3 -fmax-errors=1 -DMS_W
 
 */
 
+#include <string>
+#include <fstream> // ifstream, ofstream
+#include <stdexcept> // runtime_error
+
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
 #include "../include/sck/runge_kutta.hpp"
+#include "../include/sck/implicit.hpp"
+#include "counters_pybind.hpp"
 
 using namespace runge_kutta;
 namespace py = pybind11;
 
+template <typename Class>
+void class_embedded(py::class_<Class>& c)
+{
+	c.def(py::init());
+	c.def_readwrite("atol", &Class::atol);
+	c.def_readwrite("rtol", &Class::rtol);
+	c.def_readwrite("dt", &Class::dt);
+	c.def_readwrite("dt_min", &Class::dt_min);
+	c.def_readwrite("safety", &Class::safety);
+	c.def_readwrite("fac_min", &Class::fac_min);
+	c.def_readwrite("fac_max", &Class::fac_max);
+	c.def_readonly("n_accepted", &Class::n_accepted);
+	c.def_readonly("n_rejected", &Class::n_rejected);
+	c.def_readonly("n_evals", &Class::n_evals);
+	c.def("reset_stats", &Class::reset_stats);
+	c.def("save",
+		[](const Class& self, const std::string& path)
+		{
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			if (!out)
+				throw std::runtime_error("Cannot open the checkpoint file '" + path + "'.");
+			self.save(out);
+		},
+		py::arg("path"));
+	c.def("load",
+		[](Class& self, const std::string& path)
+		{
+			std::ifstream in(path, std::ios::binary);
+			if (!in)
+				throw std::runtime_error("Cannot open the checkpoint file '" + path + "'.");
+			self.load(in);
+		},
+		py::arg("path"));
+}
+
+template <typename Class>
+void class_implicit(py::class_<Class>& c)
+{
+	c.def(py::init());
+	c.def_property("tol",
+		[](const Class& self) { return self.solver.tol; },
+		[](Class& self, double tol) { self.solver.tol = tol; });
+	c.def_property("max_iter",
+		[](const Class& self) { return self.solver.max_iter; },
+		[](Class& self, std::size_t max_iter) { self.solver.max_iter = max_iter; });
+	c.def_readwrite("n_iterations", &Class::n_iterations);
+}
+
 PYBIND11_MODULE(runge_kutta, m)
 {
+	def_counters(m);
+
 	py::class_<integrator<>>(m, "integrator");
 
 	py::class_<euler<>, integrator<>>(m, "euler")
@@ -59,6 +115,21 @@ PYBIND11_MODULE(runge_kutta, m)
 
 	py::class_<verner8<>, integrator<>>(m, "verner8")
 		.def(py::init());
+
+	py::class_<dormand_prince<>> c_dormand_prince(m, "dormand_prince");
+	class_embedded(c_dormand_prince);
+
+	py::class_<cash_karp<>> c_cash_karp(m, "cash_karp");
+	class_embedded(c_cash_karp);
+
+	py::class_<implicit::backward_euler<>> c_backward_euler(m, "backward_euler");
+	class_implicit(c_backward_euler);
+
+	py::class_<implicit::sdirk2<>> c_sdirk2(m, "sdirk2");
+	class_implicit(c_sdirk2);
+
+	py::class_<implicit::sdirk3<>> c_sdirk3(m, "sdirk3");
+	class_implicit(c_sdirk3);
 }
 
 
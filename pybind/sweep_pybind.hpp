@@ -0,0 +1,128 @@
+//  Stochastic enzyme kinetics: parameter sweeps python binding helpers
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEK_SWEEP_PYBIND
+#define SEK_SWEEP_PYBIND
+
+#include <string>
+#include <stdexcept> // invalid_argument
+#include <type_traits> // is_constructible_v
+#include <concepts> // floating_point
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+// From Python, a sweep is a model kind and NumPy arrays with the parameters of each point
+//	kind: "exact" (single_substrate), "tqssa" (single_substrate_tqssa) or "sqssa" (single_substrate_sqssa)
+//	kf, kb, kcat, ET, ST: parameters of single_substrate (the QSSA models use kM = (kb + kcat) / kf)
+// The arrays must have the same length (the number of points), and arrays of length 1 are broadcast,
+// so that exact and QSSA models can be compared on the same points. The points are simulated on a
+// thread pool with the GIL released, and the results are stacked into arrays of shape (n_points, ...).
+
+using sweep_real_array = pybind11::array_t<double, pybind11::array::c_style | pybind11::array::forcecast>;
+using sweep_int_array = pybind11::array_t<long long, pybind11::array::c_style | pybind11::array::forcecast>;
+
+class sweep_points
+// parameters of the points of a sweep
+{
+	sweep_real_array kf, kb, kcat;
+	sweep_int_array ET, ST;
+	const double *p_kf, *p_kb, *p_kcat;
+	const long long *p_ET, *p_ST;
+
+	template <typename A>
+	static std::size_t length(const A& a, const char* name)
+	{
+		if (a.ndim() != 1 || a.size() == 0)
+			throw std::invalid_argument(std::string("The parameter '") + name + "' must be a non-empty 1-D array.");
+		return a.size();
+	}
+
+	template <typename V>
+	V at(const V* p, const pybind11::ssize_t size, std::size_t k) const noexcept
+	{
+		return p[size == 1 ? 0 : k];
+	}
+
+public:
+
+	std::size_t n = 1; // number of points
+
+	sweep_points(sweep_real_array kf, sweep_real_array kb, sweep_real_array kcat, sweep_int_array ET, sweep_int_array ST)
+		: kf(kf), kb(kb), kcat(kcat), ET(ET), ST(ST),
+		p_kf(kf.data()), p_kb(kb.data()), p_kcat(kcat.data()), p_ET(ET.data()), p_ST(ST.data())
+	// constructor (the arrays are read without the GIL afterwards)
+	{
+		for (std::size_t m : {length(kf, "kf"), length(kb, "kb"), length(kcat, "kcat"), length(ET, "ET"), length(ST, "ST")})
+		{
+			if (m != 1 && n != 1 && m != n)
+				throw std::invalid_argument("The parameters of a sweep must have the same length (or length 1).");
+			if (m != 1)
+				n = m;
+		}
+	}
+
+	template <typename Model>
+	Model make(std::size_t k) const
+	// model of the k-th point (thread-safe)
+	{
+		double kf_k = at(p_kf, kf.size(), k), kb_k = at(p_kb, kb.size(), k), kcat_k = at(p_kcat, kcat.size(), k);
+		long long ET_k = at(p_ET, ET.size(), k), ST_k = at(p_ST, ST.size(), k);
+		if constexpr (std::is_constructible_v<Model, double, double, double, long long, long long>)
+			return Model(kf_k, kb_k, kcat_k, ET_k, ST_k);
+		else
+			return Model((kb_k + kcat_k) / kf_k, kcat_k, ET_k, ST_k);
+	}
+
+	template <typename Model>
+	bool assign(std::size_t k, Model& model) const
+	// set the parameters of the k-th point in model, or return false if its shape is different (thread-safe)
+	{
+		double kf_k = at(p_kf, kf.size(), k), kb_k = at(p_kb, kb.size(), k), kcat_k = at(p_kcat, kcat.size(), k);
+		long long ET_k = at(p_ET, ET.size(), k), ST_k = at(p_ST, ST.size(), k);
+		if constexpr (std::is_constructible_v<Model, double, double, double, long long, long long>)
+		{
+			if (model.ET != ET_k || model.ST != ST_k)
+				return false;
+			model.kappa = {kf_k, kb_k, kcat_k};
+		}
+		else
+		{
+			if (model.ST != ST_k)
+				return false;
+			model.kM = (kb_k + kcat_k) / kf_k;
+			model.kcat = kcat_k;
+			model.ET = ET_k;
+		}
+		return true;
+	}
+};
+
+template <template <std::floating_point> class Exact, template <std::floating_point> class TQSSA,
+	template <std::floating_point> class SQSSA, typename F>
+decltype(auto) with_sweep_model(const std::string& kind, F&& f)
+// call f.template operator()<Model>() with the model class of kind
+{
+	if (kind == "exact")
+		return f.template operator()<Exact<double>>();
+	else if (kind == "tqssa")
+		return f.template operator()<TQSSA<double>>();
+	else if (kind == "sqssa")
+		return f.template operator()<SQSSA<double>>();
+	throw std::invalid_argument("Unknown model kind '" + kind + "' (expected 'exact', 'tqssa' or 'sqssa').");
+}
+
+#endif // SEK_SWEEP_PYBIND
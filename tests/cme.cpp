@@ -17,17 +17,34 @@
 /*
 
 Compilation (GCC/MinGW):
-g++ tests/cme.cpp -o cme -std=c++20 -Wall -Wextra -pedantic -Ofast -fmax-errors=1
+g++ tests/cme.cpp -o cme -std=c++20 -Wall -Wextra -pedantic -Ofast -fmax-errors=1 -pthread
 
 */
 
 #include <iostream> // cout
 #include <cassert>
 #include <cmath> // fabs
+#include <algorithm> // max
+#include <vector>
+#include <fstream> // ifstream
+#include <filesystem> // temp_directory_path, remove
+#include <cstdint> // uint64_t
+#include <cstring> // memcmp
+#include <sstream> // stringstream, ostringstream
+#include <stdexcept> // runtime_error, invalid_argument
+#include <thread> // sleep_for
+#include <chrono> // milliseconds
+#include <functional> // ref
+#include <atomic>
 
 #include "../include/sck/runge_kutta.hpp"
+#include "../include/sck/implicit.hpp"
 #include "../include/sck/cme.hpp"
 #include "../include/sck/gillespie.hpp"
+#include "../include/sck/trajectory.hpp"
+#include "../include/sck/offload.hpp"
+#include "../include/sck/counters.hpp"
+#include "../include/sck/pipeline.hpp"
 
 void test_cme_tqssa()
 // Test at high enzyme concentration that tQSSA agrees
@@ -104,10 +121,861 @@ void test_cme_gillespie_tqssa()
 	assert(fabs(cme_mean_prod - gillespie_mean_prod) / gillespie_mean_prod < .001);
 }
 
+void test_cme_generator()
+// Test that the assembled transition-rate matrix gives the same
+// time evolution as the direct evaluation of the propensity functions, and
+// that the diagonal follows the parameters when the matrix is assembled again.
+// The test passes if the probabilities agree within 1e-12 absolute error and
+// the diagonal is the same as a system built with the new parameters
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	double t = .5, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	cme::goldbeter_koshland sys2(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys2.p = sys1.p;
+
+	sys2.assemble_generator();
+	assert(sys2.assembled());
+
+	sys1.simulate(integ, dt, t);
+	sys2.simulate(integ, dt, t);
+
+	double max_diff = 0;
+	for (std::size_t i = 0; i < sys1.p.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys1.p[i] - sys2.p[i]));
+
+	std::cout << "max diff: " << max_diff << '\n';
+
+	assert(max_diff < 1e-12);
+
+	sys2.diagonal();
+	sys2.kappa[sys2.fe] = 2*kfe;
+	sys2.assemble_generator();
+	cme::goldbeter_koshland sys3(2*kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	for (std::size_t i = 0; i < sys2.size(); ++i)
+		assert(sys2.diagonal()[i] == sys3.diagonal()[i]);
+}
+
+void test_cme_threads()
+// Test that the time derivative does not depend on the number of threads,
+// both with and without the assembled transition-rate matrix.
+// The test passes if the derivatives are exactly equal
+{
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 20, DT = 15, ST = 30;
+
+	cme::goldbeter_koshland sys(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	for (std::size_t i = 0; i < sys.p.size(); ++i)
+		sys.p[i] = 1. / (i+1);
+
+	std::valarray<double> dp1(sys.p.size()), dp3(sys.p.size());
+	for (bool assembled : {false, true})
+	{
+		if (assembled)
+			sys.assemble_generator();
+		sys.set_threads(1);
+		sys.derivative(sys.p, dp1);
+		sys.set_threads(3);
+		assert(sys.get_threads() == 3);
+		sys.derivative(sys.p, dp3);
+		assert((dp1 == dp3).min());
+	}
+}
+
+void test_cme_reduced()
+// Test that the state space reduced by the conservation law gives the same
+// time evolution as the whole box, both with and without the assembled matrix.
+// The test passes if the expanded probabilities agree within 1e-12 absolute error
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	double t = .5, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	cme::goldbeter_koshland sys2(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys2.p = sys1.p;
+
+	sys2.reduce_state_space();
+	assert(sys2.reduced() && sys2.size() < sys2.box_size());
+	assert(sys2.get_index(sys2.get_pop(sys2.size()-1)) == sys2.size()-1);
+	assert(sys2.get_index({ST, ET, DT}) == sys2.size());
+
+	sys1.simulate(integ, dt, t);
+	sys2.simulate(integ, dt, t/2);
+	sys2.clear_generator();
+	sys2.simulate(integ, dt, t);
+
+	std::valarray<double> p2(sys2.box_size());
+	sys2.expand(&sys2.p[0], &p2[0]);
+
+	double max_diff = 0;
+	for (std::size_t i = 0; i < sys1.p.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys1.p[i] - p2[i]));
+
+	std::cout << "states: " << sys2.size() << " / " << sys2.box_size() << '\n';
+	std::cout << "max diff: " << max_diff << '\n';
+
+	assert(max_diff < 1e-12);
+	assert(fabs(sys1.mean(sys1.SP) - sys2.mean(sys2.SP)) < 1e-12);
+}
+
+void test_cme_fused_step()
+// Test that the allocation-free Runge-Kutta step, called with a templated derivative,
+// gives the same time evolution as the step through the virtual integrator interface.
+// The test passes if the probabilities are exactly equal
+{
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	double t = .1, dt = 1e-3;
+
+	runge_kutta::verner8 integ1, integ2;
+	integrator<>& integ2_ref = integ2;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	cme::goldbeter_koshland sys2(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys2.p = sys1.p;
+
+	sys1.simulate(integ1, dt, t);
+	sys2.simulate(integ2_ref, dt, t);
+
+	assert((sys1.p == sys2.p).min());
+}
+
+void test_cme_adaptive()
+// Test the adaptive Runge-Kutta integrators with dense output against
+// a fixed-step integration with a small time step.
+// The test passes if the probabilities on the time grid agree within 1e-6 absolute error
+// and the adaptive integrators need fewer steps
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	std::vector<double> t_grid{0, .05, .2, .35, 1};
+	double dt = 1e-4;
+
+	cme::goldbeter_koshland sys(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys.p = 0;
+	sys.p[sys.get_index({ST/2, 0, 0})] = 1;
+	const std::valarray<double> p0 = sys.p;
+
+	// reference solution
+	runge_kutta::rk4 integ;
+	std::vector<std::valarray<double>> p_ref;
+	std::size_t n_fixed = 0;
+	for (double t_s : t_grid)
+	{
+		while (sys.t < t_s - dt/2)
+		{
+			sys.step(integ, dt);
+			++n_fixed;
+		}
+		p_ref.push_back(sys.p);
+	}
+
+	runge_kutta::dormand_prince dp;
+	runge_kutta::cash_karp ck;
+	for (int i = 0; i < 2; ++i)
+	{
+		sys.p = p0;
+		sys.t = 0;
+		cme::list_of_states states;
+		if (i == 0)
+		{
+			dp.rtol = 1e-8;
+			sys.integrate(dp, states, t_grid);
+		}
+		else
+		{
+			ck.rtol = 1e-8;
+			sys.integrate(ck, states, t_grid);
+		}
+		std::size_t n_steps = i == 0 ? dp.n_accepted + dp.n_rejected : ck.n_accepted + ck.n_rejected;
+		assert(states.t == t_grid);
+		assert(sys.t == t_grid.back());
+
+		double max_diff = 0;
+		for (std::size_t k = 0; k < t_grid.size(); ++k)
+			for (std::size_t j = 0; j < p0.size(); ++j)
+				max_diff = std::max(max_diff, fabs(states.p[k*p0.size() + j] - p_ref[k][j]));
+
+		std::cout << "steps: " << n_steps << " / " << n_fixed << ", max diff: " << max_diff << '\n';
+
+		assert(max_diff < 1e-6);
+		assert(n_steps < n_fixed / 10);
+	}
+}
+
+void test_cme_implicit()
+// Test the implicit integrators on a stiff single-substrate reaction (fast binding)
+// against the adaptive Dormand-Prince method with a tight tolerance.
+// The test passes if the probabilities agree within 1e-4 absolute error
+// using a time step far beyond the stability limit of the explicit methods
+{
+	using std::fabs;
+
+	double kf = 1000, kb = 10, kcat = 1;
+	long long ET = 5, ST = 20;
+	double t = 1, dt = 1e-2;
+
+	cme::single_substrate sys1(kf, kb, kcat, ET, ST), sys2(kf, kb, kcat, ET, ST);
+	runge_kutta::dormand_prince ref;
+	ref.rtol = 1e-10;
+	sys1.integrate(ref, t);
+
+	implicit::sdirk3 integ;
+	sys2.assemble_generator();
+	sys2.simulate(integ, dt, t - dt/2);
+
+	double max_diff = 0;
+	for (std::size_t i = 0; i < sys1.p.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys1.p[i] - sys2.p[i]));
+
+	std::cout << "steps: " << ref.n_accepted << " / " << std::size_t(t/dt + .5)
+		<< ", Krylov iterations: " << integ.n_iterations << ", max diff: " << max_diff << '\n';
+
+	assert(fabs(sys1.t - sys2.t) < 1e-9);
+	assert(max_diff < 1e-4);
+}
+
+void test_cme_stationary()
+// Test the direct solver of the stationary distribution against
+// a long integration with an adaptive integrator.
+// The test passes if the distributions agree within 1e-8 absolute error
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	cme::goldbeter_koshland sys2(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys2.p = sys1.p;
+
+	runge_kutta::dormand_prince integ;
+	integ.rtol = 1e-10;
+	integ.atol = 1e-14;
+	sys1.integrate(integ, 200);
+
+	sys2.reduce_state_space();
+	krylov::result res = sys2.stationary(1e-12);
+	std::valarray<double> p2(sys2.box_size());
+	sys2.expand(&sys2.p[0], &p2[0]);
+
+	double max_diff = 0;
+	for (std::size_t i = 0; i < sys1.p.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys1.p[i] - p2[i]));
+
+	std::cout << "iterations: " << res.iterations << ", residual: " << res.residual << ", max diff: " << max_diff << '\n';
+
+	assert(res.converged);
+	assert(max_diff < 1e-8);
+}
+
+void test_cme_propagate()
+// Test the uniformization propagator against the adaptive Dormand-Prince method,
+// for a few output times far apart from each other, also when a parameter of
+// a system without the assembled matrix changes between two intervals.
+// The test passes if the probabilities agree within 1e-8 absolute error
+// and the error bounds are below the tolerance
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	std::vector<double> t_grid{0, .5, 3, 10};
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	cme::goldbeter_koshland sys2(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys2.p = sys1.p;
+
+	runge_kutta::dormand_prince integ;
+	integ.rtol = 1e-11;
+	integ.atol = 1e-15;
+	cme::list_of_states states1, states2;
+	sys1.integrate(integ, states1, t_grid);
+
+	sys2.assemble_generator();
+	double err = sys2.propagate(states2, t_grid, 1e-10);
+
+	double max_diff = 0;
+	for (std::size_t i = 0; i < states1.p.size(); ++i)
+		max_diff = std::max(max_diff, fabs(states1.p[i] - states2.p[i]));
+
+	std::cout << "error bound: " << err << ", max diff: " << max_diff << '\n';
+
+	assert(states2.t == t_grid);
+	assert(sys2.t == t_grid.back());
+	assert(err <= 1e-10);
+	assert(max_diff < 1e-8);
+
+	cme::single_substrate_tqssa sys3(1., 1., 10, 30);
+	sys3.p = 0;
+	sys3.p[0] = 1;
+	sys3.propagate(.01);
+	cme::single_substrate_tqssa sys4 = sys3;
+	sys3.kcat = sys4.kcat = 50;
+	err = sys3.propagate(1.);
+	sys4.integrate(integ, sys3.t);
+
+	max_diff = 0;
+	for (std::size_t i = 0; i < sys3.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys3.p[i] - sys4.p[i]));
+
+	std::cout << "after the parameter change, error bound: " << err << ", max diff: " << max_diff << '\n';
+
+	assert(err <= 1e-10);
+	assert(max_diff < 1e-8);
+}
+
+void test_cme_marginals()
+// Test the marginal distributions and the moments against direct sums over
+// all the states, on the whole box and on the reduced state space, and the
+// observers of the simulation.
+// The test passes if they agree within 1e-12 absolute error and the observer
+// is called at every sampling point
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	double dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	cme::goldbeter_koshland sys2(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys2.p = sys1.p;
+	sys2.reduce_state_space();
+
+	std::vector<double> means;
+	std::size_t n_steps = sys1.simulate(integ, dt, .2, [&](const auto& c) { means.push_back(c.mean(c.SP)); }, 50);
+	sys2.simulate(integ, dt, .2);
+	assert(means.size() == (n_steps+49)/50 + 1 && means.front() == ST/2);
+	assert(fabs(means.back() - sys1.mean(sys1.SP)) < 1e-15);
+
+	double max_diff = 0;
+	for (const auto* sys : {&sys1, &sys2})
+		for (std::size_t s = 0; s < sys->num_species; ++s)
+		{
+			std::valarray<double> pm(0., sys->marginal(s).size());
+			double m3 = 0;
+			for (std::size_t i = 0; i < sys->size(); ++i)
+			{
+				long long y = sys->get_pop(i)[s];
+				pm[y] += sys->p[i];
+				m3 += sys->p[i] * y*y*y;
+			}
+			for (std::size_t y = 0; y < pm.size(); ++y)
+				max_diff = std::max(max_diff, fabs(pm[y] - sys->marginal(s)[y]));
+			max_diff = std::max(max_diff, fabs(m3 - sys->nth_moment(s, 3)));
+			max_diff = std::max(max_diff, fabs(sys1.nth_moment(s, 5) - sys2.nth_moment(s, 5)));
+		}
+
+	std::cout << "max diff: " << max_diff << '\n';
+
+	assert(max_diff < 1e-12);
+}
+
+void test_cme_trajectory_sinks()
+// Test that the frames written into a preallocated buffer and into a file
+// are the same as the list of states of the simulation, on a reduced state space.
+// The test passes if all the frames, times and header fields match exactly
+{
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	double t = .1, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys1.reduce_state_space();
+	cme::goldbeter_koshland sys2 = sys1, sys3 = sys1;
+
+	cme::list_of_states states;
+	sys1.simulate(integ, states, dt, t, 10);
+	const std::size_t n_frames = states.t.size(), n = sys1.size(), n_box = sys1.box_size();
+
+	std::vector<double> data((n_frames+1) * n_box), times(n_frames+1);
+	cme::frame_buffer<> buffer(data.data(), times.data(), n_frames+1, n_box);
+	sys2.simulate(integ, dt, t, buffer, 10);
+
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "sek_test_trajectory.bin";
+	{
+		cme::frame_file<3> file(path.string());
+		sys3.simulate(integ, dt, t, file, 10);
+	}
+
+	std::ifstream in(path, std::ios::binary);
+	char magic[8];
+	std::uint64_t header[4 + 3];
+	in.read(magic, 8);
+	in.read(reinterpret_cast<char*>(header), sizeof(header));
+	assert(std::memcmp(magic, "SEKTRAJ", 8) == 0);
+	assert(header[0] == 1 && header[1] == sizeof(double) && header[2] == 3 && header[3] == n_frames);
+	assert(header[4] == std::uint64_t(ST+1) && header[5] == std::uint64_t(ET+1) && header[6] == std::uint64_t(DT+1));
+
+	std::cout << "frames: " << n_frames << " x " << n_box << '\n';
+
+	assert(buffer.size() == n_frames);
+	std::vector<double> p_box(n_box), record(1 + n_box);
+	for (std::size_t k = 0; k < n_frames; ++k)
+	{
+		sys1.expand(states.p.data() + k*n, p_box.data());
+		in.read(reinterpret_cast<char*>(record.data()), record.size() * sizeof(double));
+		assert(times[k] == states.t[k] && record[0] == states.t[k]);
+		assert(std::equal(p_box.begin(), p_box.end(), data.begin() + k*n_box));
+		assert(std::equal(p_box.begin(), p_box.end(), record.begin() + 1));
+	}
+	in.close();
+	std::filesystem::remove(path);
+}
+
+void test_cme_checkpoint()
+// Test that a simulation restored from a checkpoint continues exactly as the
+// original one, on a reduced state space with an adaptive integrator.
+// The test passes if the final probabilities, times and integrator statistics
+// are bitwise equal, and an incompatible checkpoint is rejected
+{
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 6;
+	double t = 1;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	cme::goldbeter_koshland sys2(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	runge_kutta::dormand_prince integ1, integ2;
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys1.reduce_state_space();
+
+	sys1.integrate(integ1, t/2);
+	std::stringstream buf(std::ios::in | std::ios::out | std::ios::binary);
+	sys1.save(buf);
+	integ1.save(buf);
+	sys1.integrate(integ1, t);
+
+	sys2.load(buf);
+	integ2.load(buf);
+	assert(sys2.reduced() && sys2.assembled() && sys2.size() == sys1.size());
+	sys2.integrate(integ2, t);
+
+	std::cout << "checkpoint: " << buf.str().size() << " bytes\n";
+
+	assert(sys1.t == sys2.t && integ1.n_accepted == integ2.n_accepted && integ1.dt == integ2.dt);
+	for (std::size_t i = 0; i < sys1.size(); ++i)
+		assert(sys1.p[i] == sys2.p[i]);
+
+	cme::goldbeter_koshland sys3(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST+1);
+	buf.seekg(0);
+	bool rejected = false;
+	try
+	{
+		sys3.load(buf);
+	}
+	catch (const std::runtime_error&)
+	{
+		rejected = true;
+	}
+	assert(rejected);
+}
+
+void test_cme_fsp()
+// Test the Finite State Projection against the integration on the whole box
+// for a moving products front.
+// The test passes if the 1-norm of the difference is within the lost
+// probability plus 1e-9, the lost probability is below 1e-5 and the active set
+// is smaller than a third of the box
+{
+	using std::fabs;
+
+	double kf = .1, kb = .1, kcat = 1;
+	long long ET = 10, ST = 200;
+	double t = 2, dt = 1e-3, tol = 1e-12;
+
+	runge_kutta::rk4 integ;
+
+	cme::single_substrate sys1(kf, kb, kcat, ET, ST), sys2 = sys1;
+	sys1.p = 0;
+	sys1.p[0] = 1;
+	sys1.assemble_generator();
+	sys1.simulate(integ, dt, t);
+
+	sys2.fsp_start({0, 0});
+	sys2.assemble_generator();
+	std::size_t max_size = 0, i;
+	double lost = 0;
+	for (i = 0; sys2.t <= t; ++i)
+	{
+		if (i % 10 == 0)
+		{
+			lost += sys2.fsp_update(tol, 8);
+			max_size = std::max(max_size, sys2.size());
+		}
+		sys2.step(integ, dt);
+	}
+
+	std::valarray<double> p2(sys2.box_size());
+	sys2.expand(&sys2.p[0], &p2[0]);
+	double diff = 0;
+	for (std::size_t j = 0; j < p2.size(); ++j)
+		diff += fabs(sys1.p[j] - p2[j]);
+
+	std::cout << "states: " << max_size << " / " << sys2.box_size() << ", lost: " << sys2.lost_mass()
+		<< " (truncated " << lost << "), diff: " << diff << '\n';
+
+	assert(sys1.t == sys2.t);
+	assert(diff <= sys2.lost_mass() + 1e-9 && sys2.lost_mass() < 1e-5 && lost <= sys2.lost_mass());
+	assert(max_size < sys2.box_size() / 3);
+
+	bool rejected = false;
+	try
+	{
+		sys2.simulate_fsp(integ, dt, 2*t, tol, 0);
+	}
+	catch (const std::invalid_argument&)
+	{
+		rejected = true;
+	}
+	assert(rejected && sys2.t <= t + dt);
+}
+
+void test_cme_reaction_network()
+// Test networks defined at runtime against the built-in single-substrate
+// model and its tQSSA, with a reduced state space.
+// The test passes if the probabilities agree within 1e-12 absolute error
+{
+	using std::fabs;
+
+	double kf = 10, kb = 9, kcat = 1, kM = (kb + kcat) / kf;
+	long long ET = 4, ST = 10;
+	double t = .5, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	network::description<> d;
+	d.n_species = 2;
+	//               C   P
+	d.reactions = {
+		{{ 1, 0}, network::law::mass_action, kf,   0, {{{-1,  0}, double(ET)}, {{-1, -1}, double(ST)}}},
+		{{-1, 0}, network::law::mass_action, kb,   0, {{{ 1,  0}, 0}}},
+		{{-1, 1}, network::law::mass_action, kcat, 0, {{{ 1,  0}, 0}}}
+	};
+	d.constraints = {{{-1, -1}, double(ST)}};
+
+	network::description<> d_tqssa;
+	d_tqssa.n_species = 1;
+	//                     P
+	d_tqssa.reactions = {{{1}, network::law::tqssa, kcat, kM, {{{0}, double(ET)}, {{-1}, double(ST)}}}};
+
+	cme::single_substrate sys1(kf, kb, kcat, ET, ST);
+	cme::reaction_network<2, 3> sys2(d, {ET+1, ST+1});
+	cme::single_substrate_tqssa sys3(kM, kcat, ET, ST);
+	cme::reaction_network<1, 1> sys4(d_tqssa, {ST+1});
+	sys1.p = 0;
+	sys1.p[0] = 1;
+	sys2.p = sys1.p;
+	sys3.p = 0;
+	sys3.p[0] = 1;
+	sys4.p = sys3.p;
+	sys1.reduce_state_space();
+	sys2.reduce_state_space();
+	assert(sys1.size() == sys2.size());
+
+	sys1.simulate(integ, dt, t);
+	sys2.simulate(integ, dt, t);
+	sys3.simulate(integ, dt, t);
+	sys4.simulate(integ, dt, t);
+
+	double max_diff = 0;
+	for (std::size_t i = 0; i < sys1.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys1.p[i] - sys2.p[i]));
+	for (std::size_t i = 0; i < sys3.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys3.p[i] - sys4.p[i]));
+
+	std::cout << "max diff: " << max_diff << '\n';
+
+	assert(max_diff < 1e-12);
+}
+
+void test_cme_offload()
+// Test that the CME integrated on the device by the offloading backend agrees
+// with the CPU integration (on the host if no device is available).
+// The test passes if the probabilities agree within 1e-14 absolute error and the
+// sampling points are the same
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 8;
+	double t = .5, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys1.reduce_state_space();
+	cme::goldbeter_koshland sys2 = sys1;
+
+	std::vector<double> t1, t2;
+	std::size_t steps1 = sys1.simulate(integ, dt, t, [&](const auto& c) { t1.push_back(c.t); }, 100);
+	std::size_t steps2;
+	{
+		offload::device_cme device(sys2, integ);
+		steps2 = device.simulate(dt, t, [&](const auto& c) { t2.push_back(c.t); }, 100);
+	}
+
+	double max_diff = 0;
+	for (std::size_t i = 0; i < sys1.size(); ++i)
+		max_diff = std::max(max_diff, fabs(sys1.p[i] - sys2.p[i]));
+
+	std::cout << "max diff: " << max_diff << '\n';
+
+	assert(steps1 == steps2 && t1 == t2 && sys1.t == sys2.t);
+	assert(max_diff < 1e-14);
+	assert(fabs(sys1.mean(sys1.SP) - sys2.mean(sys2.SP)) < 1e-12);
+}
+
+void test_cme_lookup()
+// Test that the 1-D models read from their lookup tables the same propensity functions
+// that they compute, and that the tables are rebuilt when the parameters change.
+// The test passes if the propensities and the probabilities match exactly
+{
+	long long ET = 10, DT = 8, ST = 30;
+	double t = .5, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	cme::goldbeter_koshland_tqssa sys1(1., 1.7, .8, 1.3, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[0] = 1;
+	cme::goldbeter_koshland_tqssa sys2 = sys1;
+	sys2.table.clear();
+	for (long long y = 0; y <= ST; ++y)
+	{
+		assert(sys1.a({y}, sys1.e) == sys2.a({y}, sys2.e));
+		assert(sys1.a({y}, sys1.d) == sys2.a({y}, sys2.d));
+	}
+
+	sys1.simulate(integ, dt, t);
+	sys2.kd = 1.5;
+	sys2.simulate(integ, dt, t);
+	cme::goldbeter_koshland_tqssa sys3(1., 1.7, .8, 1.5, ET, DT, ST);
+	sys3.p = 0;
+	sys3.p[0] = 1;
+	sys3.simulate(integ, dt, t);
+
+	assert(sys2.table.valid(sys2.parameters()));
+	for (std::size_t i = 0; i < sys2.size(); ++i)
+		assert(sys2.p[i] == sys3.p[i]);
+	assert(sys1.mean(sys1.SP_hat) != sys2.mean(sys2.SP_hat));
+}
+
+void test_cme_sweep()
+// Test that the integration of a parameter sweep on a thread pool agrees with the
+// integration of each point, when the models of each thread are reused in place.
+// The test passes if the means at all the sampling points match exactly, and if a
+// model is made only for the first point of each thread and when the shape changes
+{
+	std::size_t n_points = 5;
+	long long ET = 4, ST = 12;
+	double t = .5, dt = 1e-3;
+
+	auto make = [=](std::size_t k)
+	{
+		return cme::single_substrate_tqssa((9. + 1) / 10, .5 + k, ET + long(k), ST + (k == n_points-1));
+	};
+	std::atomic<std::size_t> n_made = 0;
+	auto counted_make = [&](std::size_t k)
+	{
+		++n_made;
+		return make(k);
+	};
+	auto assign = [=](std::size_t k, cme::single_substrate_tqssa<>& c)
+	{
+		if (c.ST != ST + (k == n_points-1))
+			return false;
+		c.kM = (9. + 1) / 10;
+		c.kcat = .5 + k;
+		c.ET = ET + long(k);
+		return true;
+	};
+
+	runge_kutta::rk4 integ;
+	parallel::thread_pool pool(3);
+	std::vector<std::vector<double>> means(n_points);
+	cme::parallel_sweep(pool, n_points, counted_make, assign, integ, dt, t, [&](std::size_t k, const auto& c)
+	{
+		means[k].push_back(c.mean(c.P));
+	}, 50);
+	assert(n_made <= pool.size() + 1);
+
+	for (std::size_t k = 0; k < n_points; ++k)
+	{
+		auto sys = make(k);
+		std::vector<double> point;
+		sys.simulate(integ, dt, t, [&](const auto& c) { point.push_back(c.mean(c.P)); }, 50);
+		assert(means[k] == point);
+	}
+	assert(means[0].back() != means[n_points-2].back());
+}
+
+void test_cme_counters()
+// Test that the instrumentation counts the evaluations of the time derivative, the Runge-Kutta stages
+// and the sampled bytes (all the counters are zero unless SEK_INSTRUMENT is defined).
+// The test passes if the counters are consistent with the integration
+{
+	using instrument::counter;
+
+	runge_kutta::rk4 integ;
+	cme::goldbeter_koshland_tqssa sys(1., 1.7, .8, 1.3, 10, 8, 30);
+	sys.p = 0;
+	sys.p[0] = 1;
+	cme::list_of_states states;
+
+	instrument::reset();
+	std::size_t steps = sys.simulate(integ, states, 1e-2, .5, 5);
+
+	instrument::report r = instrument::snapshot();
+	if constexpr (instrument::enabled)
+	{
+		assert(r[counter::rhs_evaluations] == 4*steps && r[counter::stage_evaluations] == 4*steps);
+		assert(r[counter::function_steps] == 0);
+		assert(r[counter::bytes_sampled] == (states.p.size() + states.t.size()) * sizeof(double));
+		assert(r.n_calls(instrument::timer::runge_kutta_step) == steps);
+		assert(r.n_calls(instrument::timer::cme_derivative) == 4*steps);
+		assert(r.n_calls(instrument::timer::cme_simulate) == 1);
+		assert(r.seconds(instrument::timer::cme_simulate) >= r.seconds(instrument::timer::runge_kutta_step));
+	}
+	else
+		assert(r[counter::rhs_evaluations] == 0 && r[counter::bytes_sampled] == 0);
+}
+
+void test_cme_async()
+// Test that the frames processed by a consumer thread through a ring buffer are the same as
+// the list of states of the simulation, also when the ring is full, and that the consumer can
+// write a trajectory file, and that an exception of the consumer stops the simulation.
+// The test passes if the frames and the files match exactly
+{
+	long long ET = 4, DT = 3, ST = 6;
+	double t = .1, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	cme::goldbeter_koshland sys1(10., 8.3, 1.7, 10., 8.3, 1.7, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	sys1.reduce_state_space();
+	cme::goldbeter_koshland sys2 = sys1, sys3 = sys1, sys4 = sys1, sys5 = sys1;
+
+	cme::list_of_states states;
+	sys1.simulate(integ, states, dt, t, 10);
+	const std::size_t n_frames = states.t.size(), n = sys1.size(), n_box = sys1.box_size();
+
+	// a slow consumer with a small ring: the simulation waits for free slots
+	std::vector<double> p_async, t_async;
+	cme::async_frames<3> sink(sys2, [&](const cme::frame<3>& f)
+	{
+		if (t_async.size() < 3)
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		p_async.insert(p_async.end(), f.p.begin(), f.p.end());
+		t_async.push_back(f.t);
+	}, 2);
+	sys2.simulate(integ, dt, t, sink, 10);
+	sink.close();
+	assert(sink.size() == n_frames && sink.stalls() > 0);
+	assert(t_async == states.t);
+	std::vector<double> p_box(n_box);
+	for (std::size_t k = 0; k < n_frames; ++k)
+	{
+		sys1.expand(states.p.data() + k*n, p_box.data());
+		assert(std::equal(p_box.begin(), p_box.end(), p_async.begin() + k*n_box));
+	}
+
+	// the frames are written to a file by the consumer thread
+	std::filesystem::path path1 = std::filesystem::temp_directory_path() / "sek_test_sync.bin";
+	std::filesystem::path path2 = std::filesystem::temp_directory_path() / "sek_test_async.bin";
+	{
+		cme::frame_file<3> file1(path1.string()), file2(path2.string());
+		sys3.simulate(integ, dt, t, file1, 10);
+		cme::async_frames<3> writer(sys4, std::ref(file2));
+		sys4.simulate(integ, dt, t, writer, 10);
+		writer.close();
+	}
+	std::ifstream in1(path1, std::ios::binary), in2(path2, std::ios::binary);
+	std::ostringstream bytes1, bytes2;
+	bytes1 << in1.rdbuf();
+	bytes2 << in2.rdbuf();
+	assert(bytes1.str() == bytes2.str() && bytes1.str().size() > n_frames * n_box * sizeof(double));
+	in1.close();
+	in2.close();
+	std::filesystem::remove(path1);
+	std::filesystem::remove(path2);
+
+	bool thrown = false;
+	try
+	{
+		cme::async_frames<3> failing(sys5, [](const cme::frame<3>& f)
+		{
+			if (f.t > .05)
+				throw std::runtime_error("consumer failure");
+		}, 2);
+		sys5.simulate(integ, dt, t, failing, 10);
+		failing.close();
+	}
+	catch (const std::runtime_error&)
+	{
+		thrown = true;
+	}
+	assert(thrown && sys5.t < t);
+}
+
 int main()
 {
 	test_cme_tqssa();
 	test_cme_gillespie_tqssa();
+	test_cme_generator();
+	test_cme_threads();
+	test_cme_reduced();
+	test_cme_fused_step();
+	test_cme_adaptive();
+	test_cme_implicit();
+	test_cme_stationary();
+	test_cme_propagate();
+	test_cme_marginals();
+	test_cme_trajectory_sinks();
+	test_cme_checkpoint();
+	test_cme_fsp();
+	test_cme_reaction_network();
+	test_cme_offload();
+	test_cme_lookup();
+	test_cme_sweep();
+	test_cme_counters();
+	test_cme_async();
 
 	return 0;
 }
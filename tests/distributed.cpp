@@ -0,0 +1,105 @@
+//  Stochastic enzyme kinetics: distributed-memory CME test
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/*
+
+Compilation (GCC/MinGW), single rank:
+g++ tests/distributed.cpp -o distributed -std=c++20 -Wall -Wextra -pedantic -O3 -fmax-errors=1 -pthread
+
+Compilation (MPI):
+mpicxx tests/distributed.cpp -o distributed -std=c++20 -Wall -Wextra -pedantic -O3 -fmax-errors=1 -pthread -DSEK_MPI
+mpirun -n 3 ./distributed
+
+*/
+
+#include <iostream> // cout
+#include <cassert>
+#include <cmath> // fabs
+#include <algorithm> // max
+#include <array>
+
+#include "../include/sck/runge_kutta.hpp"
+#include "../include/sck/cme.hpp"
+#include "../include/sck/distributed.hpp"
+
+void test_distributed_cme()
+// Test that the CME decomposed into slabs over the ranks agrees with the
+// serial solver on the whole box, including the reductions, also when the slabs
+// are initialized without storing the whole box.
+// The test passes if the gathered probabilities agree within 1e-14 absolute error
+// (exactly between the two initializations) and the normalization and moments within 1e-12
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 11;
+	double t = .2, dt = 1e-3;
+
+	runge_kutta::rk4 integ1, integ2, integ3;
+
+	cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	sys1.p = 0;
+	sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+	cme::goldbeter_koshland sys2 = sys1;
+
+	distributed::slab_cme slabs(sys2);
+	assert(sys2.p.size() == 0 && slabs.p.size() == slabs.slab_end() - slabs.slab_begin());
+
+	cme::goldbeter_koshland model(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST, cme::storage::none);
+	distributed::slab_cme slabs3(model, [&](const std::array<long long, 3>& y)
+	{
+		return y == std::array<long long, 3>{ST/2, 0, 0} ? 1. : 0.;
+	});
+	assert(model.p.size() == 0 && slabs3.p.size() == slabs.p.size());
+
+	sys1.simulate(integ1, dt, t);
+	slabs.simulate(integ2, dt, t);
+	slabs3.simulate(integ3, dt, t);
+
+	std::valarray<double> p = slabs.gather(), p3 = slabs3.gather();
+	double total = slabs.total(), mean = slabs.mean(sys1.SP), sd = slabs.sd(sys1.C);
+
+	distributed::communicator comm;
+	if (comm.rank() == 0)
+	{
+		double max_diff = 0;
+		for (std::size_t i = 0; i < sys1.p.size(); ++i)
+			max_diff = std::max(max_diff, fabs(sys1.p[i] - p[i]));
+
+		std::cout << "ranks: " << comm.size() << ", max diff: " << max_diff << '\n';
+
+		assert(sys1.t == slabs.t);
+		assert(max_diff < 1e-14);
+		for (std::size_t i = 0; i < p.size(); ++i)
+			assert(p3[i] == p[i]);
+		assert(fabs(total - sys1.p.sum()) < 1e-12);
+		assert(fabs(mean - sys1.mean(sys1.SP)) < 1e-12);
+		assert(fabs(sd - sys1.sd(sys1.C)) < 1e-12);
+	}
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char** argv)
+{
+#ifdef SEK_MPI
+	MPI_Init(&argc, &argv);
+#endif
+	test_distributed_cme();
+#ifdef SEK_MPI
+	MPI_Finalize();
+#endif
+
+	return 0;
+}
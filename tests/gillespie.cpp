@@ -17,15 +17,27 @@
 /*
 
 Compilation (GCC/MinGW):
-g++ tests/gillespie.cpp -o gillespie -std=c++20 -Wall -Wextra -pedantic -Ofast -fmax-errors=1
+g++ tests/gillespie.cpp -o gillespie -std=c++20 -Wall -Wextra -pedantic -Ofast -fmax-errors=1 -pthread
 
 */
 
 #include <iostream> // cout
 #include <cassert>
 #include <cmath> // fabs
+#include <array>
+#include <vector>
+#include <cstdint> // uint32_t
+#include <stdexcept> // domain_error, invalid_argument
+#include <sstream> // stringstream
+#include <type_traits> // is_trivially_copyable_v
 
 #include "../include/sck/gillespie.hpp"
+#include "../include/sck/next_reaction.hpp"
+#include "../include/sck/tau_leaping.hpp"
+#include "../include/sck/lockstep.hpp"
+#include "../include/sck/offload.hpp"
+#include "../include/sck/counters.hpp"
+#include "../include/sck/pipeline.hpp"
 
 void test_gillespie_tqssa_prod()
 // Test for a specific combination of parameters that tQSSA agrees
@@ -38,7 +50,7 @@ void test_gillespie_tqssa_prod()
 	std::size_t n = 10'000;
 	double kf = 10, kb = 9, kcat = 1, kM = (kb + kcat) / kf;
 	long long ET = 10, ST = 9;
-	double t = 2
+	double t = 2;
 	double P1 = 0, P2 = 0;
 
 	gillespie::single_substrate sys1(kf, kb, kcat, ET, ST);
@@ -107,10 +119,681 @@ void test_gillespie_tqssa_completion()
 	assert(fabs(t1 - t2) / t1 < .02); // not more than 2% relative error
 }
 
+void test_gillespie_ensemble()
+// Test that the ensemble statistics on a time grid agree with the
+// final states of independent simulations.
+// The test passes if the initial state is sampled exactly, histograms are
+// normalized and the average products population at the final time agree
+// within 1% relative error
+{
+	using std::fabs;
+
+	std::size_t n = 10'000;
+	double kM = 1, kcat = 1;
+	long long ET = 10, ST = 9;
+	double t = 2;
+	double P = 0;
+
+	gillespie::single_substrate_tqssa sys(kM, kcat, ET, ST);
+
+	gillespie::ensemble_stats<1> stats({0, t/2, t}, {std::size_t(ST+1)});
+	sys.ensemble(stats, 0, n);
+
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		sys.x = 0;
+		sys.t = 0;
+		sys.simulate(t);
+		P += sys.x[sys.P];
+	}
+	P /= n;
+
+	std::cout << stats.mean(2, sys.P) << " +/- " << stats.sd(2, sys.P) << '\n';
+	std::cout << P << '\n';
+
+	assert(stats.n == n);
+	assert(stats.mean(0, sys.P) == 0 && stats.hist[sys.P][0] == (long long)n);
+	for (std::size_t k = 0; k < stats.t.size(); ++k)
+	{
+		long long count = 0;
+		for (long long j = 0; j <= ST; ++j)
+			count += stats.hist[sys.P][k*(ST+1) + j];
+		assert(count == (long long)n);
+	}
+	assert(fabs(stats.mean(2, sys.P) - P) / P < .01); // not more than 1% relative error
+}
+
+void test_gillespie_parallel_ensemble()
+// Test the random number generator against known-answer vectors and
+// that parallel ensembles do not depend on the number of threads.
+// The test passes if the outputs match exactly
+{
+	using block = std::array<std::uint32_t, 4>;
+
+	assert((prng::philox4x32::block({0, 0, 0, 0}, {0, 0}) == block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+	assert((prng::philox4x32::block({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff})
+		== block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+
+	prng::philox4x32 gen1(42, 7), gen2(42, 7);
+	for (int i = 0; i < 11; ++i)
+		gen1();
+	gen2.discard(11);
+	assert(gen1() == gen2());
+
+	std::size_t n = 1'000;
+	double kf = 10, kb = 9, kcat = 1;
+	long long ET = 10, ST = 9;
+
+	gillespie::single_substrate sys(kf, kb, kcat, ET, ST);
+	gillespie::ensemble_stats<2> stats1({.5, 1, 2}, {std::size_t(ET+1), std::size_t(ST+1)}), stats4 = stats1;
+
+	parallel::thread_pool pool1(1), pool4(4);
+	gillespie::parallel_ensemble(pool1, sys, stats1, 0, n, 1234);
+	gillespie::parallel_ensemble(pool4, sys, stats4, 0, n, 1234);
+
+	std::cout << stats1.mean(2, sys.P) << " +/- " << stats1.sd(2, sys.P) << '\n';
+
+	assert(stats1.n == n && stats4.n == n);
+	assert(stats1.sum == stats4.sum && stats1.sum_sq == stats4.sum_sq && stats1.hist == stats4.hist);
+}
+
+void test_gillespie_static_dispatch()
+// Test that the propensity functions computed all at once by the models agree
+// with the virtual interface, and that incompatible states are detected.
+// The test passes if the propensities are exactly equal
+{
+	gillespie::goldbeter_koshland sys(10., 8.3, 1.7, 10., 8.3, 1.7, 20, 15, 30);
+	sys.x = {5, 3, 2};
+
+	std::array<double, sys.num_rc> a_r;
+	sys.calc_propensities(a_r);
+	const gillespie::gillespie<3, 6, double, gillespie::goldbeter_koshland<>>& base = sys;
+	double a_tot = 0;
+	for (std::size_t i = 0; i < sys.num_rc; ++i)
+	{
+		assert(a_r[i] == base.a(i));
+		a_tot += a_r[i];
+	}
+	assert(a_tot == sys.total_propensity());
+
+	assert(sys.compatible(sys.x));
+	sys.x = {5, 3, 30};
+	assert(!sys.compatible(sys.x));
+	bool thrown = false;
+	try
+	{
+		sys.check_state();
+	}
+	catch (const std::domain_error&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+}
+
+void test_gillespie_next_reaction()
+// Test that the Next Reaction Method agrees with the direct method
+// on the Goldbeter-Koshland switch.
+// The test passes if the dependency graph is the expected one, the
+// average populations at a certain time agree within 2% relative error and
+// (with SEK_INSTRUMENT) only the dependent channels are evaluated after each event
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 20, DT = 15, ST = 50;
+	double t = 1;
+	std::size_t n = 2000;
+
+	gillespie::goldbeter_koshland direct(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	gillespie::next_reaction nrm(direct);
+	assert(nrm.dependencies(direct.be) == std::vector<std::size_t>({direct.fe, direct.be, direct.e}));
+	assert(nrm.dependencies(direct.d) == std::vector<std::size_t>({direct.fe, direct.fd, direct.bd, direct.d}));
+
+	std::array<double, 3> mean_direct{}, mean_nrm{};
+	direct.seed(1);
+	nrm.seed(2);
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		direct.x = {ST/2, 0, 0};
+		direct.t = 0;
+		direct.simulate(t);
+		nrm.model.x = {ST/2, 0, 0};
+		nrm.model.t = 0;
+		nrm.simulate(t);
+		for (std::size_t s = 0; s < 3; ++s)
+		{
+			mean_direct[s] += double(direct.x[s]) / n;
+			mean_nrm[s] += double(nrm.model.x[s]) / n;
+		}
+	}
+
+	std::cout << "direct: " << mean_direct[0] << ", " << mean_direct[1] << ", " << mean_direct[2] << '\n';
+	std::cout << "NRM: " << mean_nrm[0] << ", " << mean_nrm[1] << ", " << mean_nrm[2] << '\n';
+
+	for (std::size_t s = 0; s < 3; ++s)
+		assert(fabs(mean_direct[s] - mean_nrm[s]) / mean_direct[s] < .02);
+
+	instrument::reset();
+	nrm.model.x = {ST/2, 0, 0};
+	nrm.model.t = 0;
+	nrm.simulate(t);
+	if constexpr (instrument::enabled)
+	{
+		instrument::report r = instrument::snapshot();
+		std::uint64_t n_evaluations = 0;
+		for (std::size_t j = 0; j < direct.num_rc; ++j)
+			n_evaluations += r.firings[j] * nrm.dependencies(j).size();
+		assert(r[instrument::counter::channel_evaluations] == n_evaluations);
+		assert(r[instrument::counter::propensity_evaluations] == 0);
+	}
+}
+
+void test_gillespie_tau_leaping()
+// Test that tau-leaping agrees with the exact direct method on the
+// Goldbeter-Koshland switch with high populations.
+// The test passes if the average populations at a certain time agree within
+// 2% relative error and the leaps are much fewer than the reactions
+{
+	using std::fabs;
+
+	double kfe = .01, kbe = 8.3, ke = 1.7, kfd = .01, kbd = 8.3, kd = 1.7;
+	long long ET = 1000, DT = 800, ST = 5000;
+	double t = .5;
+	std::size_t n = 200, n_reactions = 0;
+
+	gillespie::goldbeter_koshland direct(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+	gillespie::tau_leaping leap(direct);
+
+	std::array<double, 3> mean_direct{}, mean_leap{};
+	direct.seed(1);
+	leap.seed(2);
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		direct.x = {ST/2, 0, 0};
+		direct.t = 0;
+		for (; direct.step(t); ++n_reactions);
+		leap.model.x = {ST/2, 0, 0};
+		leap.model.t = 0;
+		leap.simulate(t);
+		for (std::size_t s = 0; s < 3; ++s)
+		{
+			mean_direct[s] += double(direct.x[s]) / n;
+			mean_leap[s] += double(leap.model.x[s]) / n;
+		}
+	}
+
+	std::cout << "direct: " << mean_direct[0] << ", " << mean_direct[1] << ", " << mean_direct[2]
+		<< " (" << n_reactions << " reactions)\n";
+	std::cout << "tau-leaping: " << mean_leap[0] << ", " << mean_leap[1] << ", " << mean_leap[2]
+		<< " (" << leap.n_leaps << " leaps, " << leap.n_ssa_steps << " SSA steps)\n";
+
+	for (std::size_t s = 0; s < 3; ++s)
+		assert(fabs(mean_direct[s] - mean_leap[s]) / mean_direct[s] < .02);
+	assert(leap.n_leaps + leap.n_ssa_steps < n_reactions / 10);
+}
+
+void test_gillespie_tau_leaping_batch()
+// Test that tau-leaping stops at t_final inside a batch of SSA steps.
+// With low populations every step is a batch of SSA steps, and the reaction
+// drawn after t_final must not be drawn again.
+// The test passes if the average population at t_final agrees with the
+// direct method within 4 standard errors
+{
+	using std::fabs;
+	using std::sqrt;
+
+	double kM = 1, kcat = 1;
+	long long ET = 10, ST = 100;
+	double t = 5;
+	std::size_t n = 20000;
+
+	gillespie::single_substrate_tqssa direct(kM, kcat, ET, ST);
+	gillespie::tau_leaping leap(direct);
+
+	double mean_direct = 0, mean_leap = 0, var_direct = 0;
+	direct.seed(3);
+	leap.seed(4);
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		direct.x = {0};
+		direct.t = 0;
+		while (direct.step(t));
+		leap.model.x = {0};
+		leap.model.t = 0;
+		leap.simulate(t);
+		mean_direct += double(direct.x[0]) / n;
+		mean_leap += double(leap.model.x[0]) / n;
+		var_direct += double(direct.x[0]) * double(direct.x[0]) / n;
+	}
+	var_direct -= mean_direct * mean_direct;
+
+	std::cout << "direct: " << mean_direct << ", tau-leaping: " << mean_leap
+		<< " (" << leap.n_leaps << " leaps, " << leap.n_ssa_steps << " SSA steps)\n";
+
+	assert(leap.n_leaps == 0);
+	assert(fabs(mean_direct - mean_leap) < 4 * sqrt(2 * var_direct / n));
+}
+
+void test_gillespie_sample()
+// Test the sampling on a time grid against the full list of states of a
+// simulation with the same random sequence.
+// The test passes if the list has one state per sampling time and each of
+// them is the last state of the full simulation not after the sampling time
+{
+	double kM = 1, kcat = 1;
+	long long ET = 10, ST = 100;
+	double t = 5;
+
+	gillespie::single_substrate_tqssa sys(kM, kcat, ET, ST);
+	std::vector<double> t_grid;
+	for (int k = 0; k <= 100; ++k)
+		t_grid.push_back(t*k/100);
+
+	gillespie::list_of_states<1> full, sampled;
+	sys.seed(7);
+	sys.x = 0;
+	sys.t = 0;
+	sys.simulate(full, t);
+	sys.seed(7);
+	sys.x = 0;
+	sys.t = 0;
+	sys.simulate(sampled, t_grid);
+
+	std::cout << full.t.size() << " steps, " << sampled.t.size() << " samples\n";
+
+	assert(sampled.t == t_grid && sampled.x.size() == t_grid.size());
+	std::size_t i = 0;
+	for (std::size_t k = 0; k < t_grid.size(); ++k)
+	{
+		while (i+1 < full.t.size() && full.t[i+1] <= t_grid[k])
+			++i;
+		assert(sampled.x[k] == full.x[i]);
+	}
+}
+
+void test_gillespie_hitting_times()
+// Test the completion times obtained with early termination against full
+// simulations, serially and in parallel.
+// The test passes if the times match exactly a simulation up to the
+// exhaustion of the substrate with the same random sequences, and do not
+// depend on the number of threads
+{
+	std::size_t n = 1'000;
+	double kf = 10, kb = 9, kcat = 1;
+	long long ET = 10, ST = 9;
+
+	gillespie::single_substrate sys(kf, kb, kcat, ET, ST);
+	auto completed = [&](const physics::vec<long long, 2>& y) { return y[sys.P] == ST; };
+
+	parallel::thread_pool pool1(1), pool4(4);
+	std::vector<double> times1 = gillespie::parallel_hitting_times(pool1, sys, 0, n, 99, completed);
+	std::vector<double> times4 = gillespie::parallel_hitting_times(pool4, sys, 0, n, 99, completed);
+
+	std::vector<double> times;
+	sys.seed(99, 0);
+	sys.hitting_times(times, 0, n, completed);
+
+	double t = 0;
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		sys.seed(99, i);
+		sys.x = 0;
+		sys.t = 0;
+		sys.simulate();
+		assert(sys.x[sys.P] == ST && times1[i] == sys.t);
+		t += sys.t;
+	}
+	std::cout << t / n << '\n';
+
+	assert(times1 == times4 && times.size() == n && times[0] == times1[0]);
+	sys.x = 0;
+	sys.t = 0;
+	assert(!sys.simulate_until({0, ST}, 1e-3) && sys.t < 1e-3);
+}
+
+void test_gillespie_checkpoint()
+// Test that a simulation restored from a checkpoint continues with the same
+// random sequence as the original one.
+// The test passes if the final states and times are equal
+{
+	double kf = 10, kb = 9, kcat = 1;
+	long long ET = 10, ST = 1000;
+
+	gillespie::single_substrate sys1(kf, kb, kcat, ET, ST), sys2 = sys1;
+	sys1.seed(5, 3);
+	sys1.x = 0;
+	sys1.t = 0;
+	sys1.simulate(0, 1001); // stop in the middle of a block of random numbers
+
+	std::stringstream buf(std::ios::in | std::ios::out | std::ios::binary);
+	sys1.save(buf);
+	sys1.simulate(0, 5000);
+
+	sys2.load(buf);
+	sys2.simulate(0, 5000);
+
+	std::cout << sys1.t << ' ' << sys2.t << '\n';
+
+	assert(sys1.x == sys2.x && sys1.t == sys2.t);
+}
+
+void test_gillespie_reaction_network()
+// Test a single-substrate network defined at runtime against the built-in
+// model, with the direct method and the Next Reaction Method.
+// The test passes if the trajectories with the same random sequence are equal,
+// the dependency graphs are equal and inconsistent networks are rejected
+{
+	double kf = 10, kb = 9, kcat = 1;
+	long long ET = 10, ST = 30;
+
+	network::description<> d;
+	d.n_species = 2;
+	//               C   P
+	d.reactions = {
+		{{ 1, 0}, network::law::mass_action, kf,   0, {{{-1,  0}, double(ET)}, {{-1, -1}, double(ST)}}},
+		{{-1, 0}, network::law::mass_action, kb,   0, {{{ 1,  0}, 0}}},
+		{{-1, 1}, network::law::mass_action, kcat, 0, {{{ 1,  0}, 0}}}
+	};
+	d.constraints = {{{-1, 0}, double(ET)}, {{-1, -1}, double(ST)}};
+
+	gillespie::single_substrate builtin(kf, kb, kcat, ET, ST);
+	gillespie::reaction_network<2, 3> net(d);
+	builtin.seed(3);
+	net.seed(3);
+	for (int i = 0; i < 20; ++i)
+	{
+		builtin.x = 0;
+		builtin.t = 0;
+		builtin.simulate(.5);
+		net.x = 0;
+		net.t = 0;
+		net.simulate(.5);
+		assert(builtin.x == net.x && builtin.t == net.t);
+	}
+	assert(!net.compatible({ET+1, 0}) && !net.compatible({0, ST+1}));
+
+	gillespie::next_reaction nrm_builtin(builtin);
+	gillespie::next_reaction nrm_net(net);
+	for (std::size_t j = 0; j < net.num_rc; ++j)
+		assert(nrm_builtin.dependencies(j) == nrm_net.dependencies(j));
+	nrm_builtin.seed(4);
+	nrm_net.seed(4);
+	nrm_builtin.model.x = 0;
+	nrm_net.model.x = 0;
+	nrm_builtin.simulate(1);
+	nrm_net.simulate(1);
+	assert(nrm_builtin.model.x == nrm_net.model.x && nrm_builtin.model.t == nrm_net.model.t);
+
+	bool thrown = false;
+	try
+	{
+		gillespie::reaction_network<2, 2> wrong(d);
+	}
+	catch (const std::invalid_argument&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+}
+
+void test_gillespie_lockstep()
+// Test that ensembles advanced in lockstep agree with the scalar ones, with
+// the Philox lanes and a limit on the number of steps.
+// The test passes if the statistics match exactly
+{
+	using block = std::array<std::uint32_t, 4>;
+
+	std::array<std::array<std::uint32_t, 3>, 4> c = {{{0, 0xffffffff, 5}, {0, 0xffffffff, 0}, {0, 0xffffffff, 7}, {0, 0xffffffff, 0}}};
+	prng::philox4x32::blocks(c, {0xffffffff, 0xffffffff});
+	assert((block{c[0][1], c[1][1], c[2][1], c[3][1]} == block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+	assert((block{c[0][2], c[1][2], c[2][2], c[3][2]} == prng::philox4x32::block({5, 0, 7, 0}, {0xffffffff, 0xffffffff})));
+	assert(prng::canonical<double>(0xffffffff, 0xffffffff) < 1 && prng::canonical<float>(0xffffffff, 0xffffffff) < 1);
+
+	std::size_t n = 1'000;
+	long long ET = 10, ST = 30;
+
+	gillespie::single_substrate_tqssa tqssa(1., 1., ET, ST);
+	gillespie::goldbeter_koshland gk(10., 8.3, 1.7, 10., 8.3, 1.7, ET, ET, ST);
+	gillespie::ensemble_stats<1> stats1({0, .5, 1, 2, 4}, {std::size_t(ST+1)}), stats2 = stats1;
+	gillespie::ensemble_stats<3> stats3({.1, .2, .4}, {std::size_t(ST+1), 0, 0}), stats4 = stats3;
+
+	parallel::thread_pool pool1(1), pool3(3);
+	gillespie::parallel_ensemble(pool3, tqssa, stats1, {0}, n, 99);
+	gillespie::parallel_lockstep_ensemble(pool1, tqssa, stats2, {0}, n, 99);
+	assert(stats1.n == n && stats2.n == n);
+	assert(stats1.sum == stats2.sum && stats1.sum_sq == stats2.sum_sq && stats1.hist == stats2.hist);
+
+	gillespie::parallel_ensemble(pool1, gk, stats3, {ST/2, 0, 0}, n, 7, 20);
+	gillespie::parallel_lockstep_ensemble<3>(pool3, gk, stats4, {ST/2, 0, 0}, n, 7, 20);
+	assert(stats3.n == n && stats4.n == n);
+	assert(stats3.sum == stats4.sum && stats3.sum_sq == stats4.sum_sq && stats3.hist == stats4.hist);
+
+	std::cout << stats2.mean(4, tqssa.P) << " +/- " << stats2.sd(4, tqssa.P) << '\n';
+}
+
+void test_gillespie_offload()
+// Test that the ensembles simulated by the offloading backend agree with the
+// CPU ones (on the host if no device is available).
+// The test passes if the statistics match exactly
+{
+	std::size_t n = 500;
+	long long ET = 10, DT = 8, ST = 30;
+
+	gillespie::goldbeter_koshland gk(10., 8.3, 1.7, 10., 8.3, 1.7, ET, DT, ST);
+	static_assert(std::is_trivially_copyable_v<decltype(gk.kernel())>); // it can be mapped to the device
+	gillespie::ensemble_stats<3> stats1({0, .1, .5, 1}, {std::size_t(ST+1), std::size_t(ET+1), 0}), stats2 = stats1;
+
+	parallel::thread_pool pool(2);
+	gillespie::parallel_ensemble(pool, gk, stats1, {ST/2, 0, 0}, n, 5);
+	offload::ensemble(gk, stats2, {ST/2, 0, 0}, n, 5);
+
+	assert(stats2.n == n);
+	assert(stats1.sum == stats2.sum && stats1.sum_sq == stats2.sum_sq && stats1.hist == stats2.hist);
+}
+
+void test_gillespie_lookup()
+// Test that the 1-D models read from their lookup tables the same propensity functions
+// that they compute, and that the tables are rebuilt when the parameters change.
+// The test passes if the propensities and the statistics match exactly
+{
+	std::size_t n = 1'000;
+	long long ET = 10, DT = 8, ST = 30;
+
+	gillespie::goldbeter_koshland_tqssa gk(1., 1.7, .8, 1.3, ET, DT, ST);
+	gillespie::goldbeter_koshland_tqssa plain = gk;
+	plain.table.clear();
+	for (long long y = 0; y <= ST; ++y)
+	{
+		std::array<double, 2> a1, a2;
+		gk.propensities({y}, a1);
+		plain.propensities({y}, a2);
+		assert(a1 == a2);
+	}
+
+	// the steps select the reactions with the cumulative tables, the lanes compute the propensities
+	gillespie::ensemble_stats<1> stats1({0, .5, 1, 2, 4}, {std::size_t(ST+1)}), stats2 = stats1;
+	parallel::thread_pool pool(2);
+	gillespie::parallel_ensemble(pool, gk, stats1, {0}, n, 3);
+	gillespie::parallel_lockstep_ensemble(pool, plain, stats2, {0}, n, 3);
+	assert(stats1.sum == stats2.sum && stats1.sum_sq == stats2.sum_sq && stats1.hist == stats2.hist);
+
+	gk.kME = 2;
+	assert(!gk.table.valid(gk.parameters()));
+	gk.step();
+	assert(gk.table.valid(gk.parameters()));
+	gk.kME = 3; // the simulation loops rebuild the table once, before the first step
+	gk.simulate(0, 10);
+	assert(gk.table.valid(gk.parameters()));
+}
+
+void test_gillespie_sweep()
+// Test that the ensembles of a parameter sweep agree with the ensembles of each point,
+// whatever the number of threads.
+// The test passes if the statistics match exactly
+{
+	std::size_t n = 300, n_points = 5;
+	long long ET = 10, ST = 30;
+	std::vector<double> t_grid = {0, .5, 1, 2, 4};
+
+	auto make = [=](std::size_t k)
+	{
+		return gillespie::single_substrate(10., 9., .5 + k, ET, ST - long(k));
+	};
+
+	parallel::thread_pool pool1(1), pool3(3);
+	std::vector<gillespie::ensemble_stats<2>> stats(n_points, gillespie::ensemble_stats<2>(t_grid, {0, std::size_t(ST+1)}));
+	gillespie::parallel_sweep(pool3, n_points, make, stats, {0, 0}, n, 11);
+	for (std::size_t k = 0; k < n_points; ++k)
+	{
+		gillespie::ensemble_stats<2> point(t_grid, {0, std::size_t(ST+1)});
+		gillespie::parallel_ensemble(pool1, make(k), point, {0, 0}, n, 11);
+		assert(stats[k].n == n);
+		assert(stats[k].sum == point.sum && stats[k].sum_sq == point.sum_sq && stats[k].hist == point.hist);
+	}
+	assert(stats[0].mean(4, 1) != stats[n_points-1].mean(4, 1));
+
+	stats.pop_back();
+	bool thrown = false;
+	try
+	{
+		gillespie::parallel_sweep(pool1, n_points, make, stats, {0, 0}, n, 11);
+	}
+	catch (const std::invalid_argument&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+}
+
+void test_gillespie_counters()
+// Test that the instrumentation counts the steps, the firings of each channel and the sampled bytes,
+// also for the threads of a pool (all the counters are zero unless SEK_INSTRUMENT is defined).
+// The test passes if the counters are consistent with the simulated trajectories
+{
+	using instrument::counter;
+
+	instrument::reset();
+	gillespie::single_substrate s(1., 1., .3, 5, 20);
+	gillespie::list_of_states<2> states;
+	s.seed(2);
+	s.simulate(states, 0, 1'000);
+
+	instrument::report r = instrument::snapshot();
+	if constexpr (instrument::enabled)
+	{
+		using gillespie::single_substrate;
+
+		std::uint64_t firings = r.firings[single_substrate<>::f] + r.firings[single_substrate<>::b] + r.firings[single_substrate<>::cat];
+		assert(r[counter::ssa_steps] == firings && firings == states.t.size() - 2);
+		assert(r[counter::null_steps] == 1); // all the substrate is converted before max_steps
+		assert(r.firings[single_substrate<>::cat] == std::uint64_t(s.x[single_substrate<>::P]));
+		assert(r[counter::propensity_evaluations] == r[counter::ssa_steps] + r[counter::null_steps]);
+		assert(r[counter::selection_comparisons] >= r[counter::ssa_steps]);
+		assert(r[counter::selection_comparisons] <= 2*r[counter::ssa_steps]);
+		assert(r[counter::bytes_sampled] == states.t.size() * (sizeof(states.x[0]) + sizeof(double)));
+		assert(r.n_calls(instrument::timer::gillespie_simulate) == 1);
+
+		// the counters of the threads of a pool are summed
+		gillespie::ensemble_stats<2> stats({0, 1, 2});
+		parallel::thread_pool pool(3);
+		gillespie::parallel_ensemble(pool, s, stats, {0, 0}, 30, 5);
+		instrument::report r2 = instrument::snapshot();
+		assert(r2[counter::ssa_steps] > r[counter::ssa_steps]);
+		assert(r2.n_calls(instrument::timer::gillespie_sample) == 30);
+		instrument::reset();
+		assert(instrument::snapshot()[counter::ssa_steps] == 0);
+	}
+	else
+		assert(r[counter::ssa_steps] == 0 && r.firings[0] == 0 && r.n_calls(instrument::timer::gillespie_simulate) == 0);
+}
+
+void test_gillespie_tensor()
+// Test the element-wise operations of the tensors, which are unrolled for small shapes
+// (like the population numbers) and loops for the larger ones.
+// The test passes if they agree with the operations on the elements
+{
+	using physics::vec;
+	using physics::mat;
+
+	static_assert(vec<long long, 2>{3, 5} - vec<long long, 2>{-1, 2} == vec<long long, 2>{4, 3});
+
+	vec<long long, 3> x{3, 5, 7}, nu{-1, 2, 0};
+	x += nu;
+	assert((x == vec<long long, 3>{2, 7, 7}));
+	assert((x - nu == vec<long long, 3>{3, 5, 7} && -nu == vec<long long, 3>{1, -2, 0}));
+	assert((2 * x - 1 == vec<long long, 3>{3, 13, 13} && 10 - x == vec<long long, 3>{8, 3, 3}));
+
+	mat<double, 5> a, b; // 25 elements: looped
+	static_assert(a.size() > physics::unroll_limit);
+	for (std::size_t i = 0; i < a.size(); ++i)
+	{
+		// exact operations, also with -Ofast
+		a[i] = .5 * i;
+		b[i] = 1 << (i % 4);
+	}
+	mat<double, 5> c = a * b + a / 2. - 1. / b;
+	for (std::size_t i = 0; i < a.size(); ++i)
+		assert(c[i] == a[i]*b[i] + a[i]/2 - 1/b[i]);
+	c -= a;
+	c /= b;
+	c *= 3.;
+	for (std::size_t i = 0; i < a.size(); ++i)
+		assert(c[i] == (a[i]*b[i] + a[i]/2 - 1/b[i] - a[i]) / b[i] * 3);
+}
+
+void test_gillespie_async()
+// Test that the states processed by a consumer thread through a ring buffer are the same
+// as the list of states of the simulation, with a ring much smaller than the trajectory.
+// The test passes if the histograms and the states match exactly
+{
+	gillespie::single_substrate s1(1., 1., .3, 10, 100), s2 = s1;
+	s1.seed(4);
+	s2.seed(4);
+
+	gillespie::list_of_states<2> states;
+	s1.simulate(states, 0, 10'000, 3);
+
+	std::vector<std::size_t> hist(11); // histogram of the complex consumed on the other thread
+	std::size_t n = 0, n_equal = 0;
+	gillespie::async_states<2> sink([&](const gillespie::state_frame<2>& f)
+	{
+		++hist[f.x[0]];
+		n_equal += n < states.t.size() && f.t == states.t[n] && f.x == states.x[n];
+		++n;
+	}, 16);
+	s2.simulate(sink, 0, 10'000, 3);
+	sink.close();
+
+	std::vector<std::size_t> hist_ref(11);
+	for (const auto& x : states.x)
+		++hist_ref[x[0]];
+	assert(sink.size() == states.t.size() && n == states.t.size() && n_equal == n);
+	assert(hist == hist_ref && states.t.size() > 16);
+	assert(s1.x == s2.x && s1.t == s2.t);
+}
+
 int main()
 {
 	test_gillespie_tqssa_prod();
 	test_gillespie_tqssa_completion();
+	test_gillespie_ensemble();
+	test_gillespie_parallel_ensemble();
+	test_gillespie_static_dispatch();
+	test_gillespie_next_reaction();
+	test_gillespie_tau_leaping();
+	test_gillespie_tau_leaping_batch();
+	test_gillespie_sample();
+	test_gillespie_hitting_times();
+	test_gillespie_checkpoint();
+	test_gillespie_reaction_network();
+	test_gillespie_lockstep();
+	test_gillespie_offload();
+	test_gillespie_lookup();
+	test_gillespie_sweep();
+	test_gillespie_counters();
+	test_gillespie_tensor();
+	test_gillespie_async();
 
 	return 0;
 }
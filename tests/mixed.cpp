@@ -0,0 +1,112 @@
+//  Stochastic enzyme kinetics: mixed-precision CME test
+//  Copyright (C) 2023 Alessandro Lo Cuoco (alessandro.locuoco@gmail.com)
+
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/*
+
+Compilation (GCC/MinGW), without -ffast-math (see `mixed.hpp`):
+g++ tests/mixed.cpp -o mixed -std=c++20 -Wall -Wextra -pedantic -O3 -fmax-errors=1 -pthread
+
+*/
+
+#include <iostream> // cout
+#include <cassert>
+#include <cmath> // fabs, ldexp
+#include <algorithm> // max
+
+#include "../include/sck/runge_kutta.hpp"
+#include "../include/sck/cme.hpp"
+#include "../include/sck/mixed.hpp"
+
+void test_mixed_kahan_sum()
+// Test that the compensated summation keeps the increments which are lost
+// by a plain summation.
+// The test passes if adding 1024 times 2^-60 to 1 gives exactly 1 + 2^-50
+{
+	using std::ldexp;
+
+	mixed::kahan_sum<double> sum;
+	double plain = 1;
+	sum.add(1);
+	for (int i = 0; i < 1024; ++i)
+	{
+		sum.add(ldexp(1., -60));
+		plain += ldexp(1., -60);
+	}
+
+	assert(plain == 1);
+	assert(sum.value() == 1 + ldexp(1., -50));
+}
+
+void test_mixed_cme()
+// Test that the CME integrated with probabilities and stages stored in single precision
+// agrees with the double-precision integration, both on the whole box and on a reduced
+// state space, and that bfloat16 snapshots are restored with their precision.
+// The test passes if the probabilities agree within 1e-8 absolute error, the drift of the
+// total probability is below 1e-7, the compensations are not all zero (some downloaded
+// probabilities are not floats) and the snapshots within 2^-8 relative error
+{
+	using std::fabs;
+
+	double kfe = 10, kbe = 8.3, ke = 1.7, kfd = 10, kbd = 8.3, kd = 1.7;
+	long long ET = 4, DT = 3, ST = 8;
+	double t = .5, dt = 1e-3;
+
+	runge_kutta::rk4 integ;
+
+	for (bool reduce : {false, true})
+	{
+		cme::goldbeter_koshland sys1(kfe, kbe, ke, kfd, kbd, kd, ET, DT, ST);
+		sys1.p = 0;
+		sys1.p[sys1.get_index({ST/2, 0, 0})] = 1;
+		if (reduce)
+			sys1.reduce_state_space();
+		cme::goldbeter_koshland sys2 = sys1;
+
+		std::size_t steps1 = sys1.simulate(integ, dt, t);
+		mixed::compact_cme compact(sys2, integ);
+		std::size_t steps2 = compact.simulate(dt, t);
+
+		double max_diff = 0;
+		std::size_t n_compensated = 0;
+		for (std::size_t i = 0; i < sys1.size(); ++i)
+		{
+			max_diff = std::max(max_diff, fabs(sys1.p[i] - sys2.p[i]));
+			n_compensated += sys2.p[i] != double(float(sys2.p[i]));
+		}
+
+		std::cout << "max diff: " << max_diff << ", drift: " << compact.drift()
+			<< ", compensated states: " << n_compensated << '\n';
+
+		assert(steps1 == steps2 && sys1.t == sys2.t);
+		assert(max_diff < 1e-8);
+		assert(fabs(compact.drift()) < 1e-7);
+		assert(n_compensated > 0);
+		assert(fabs(sys1.mean(sys1.SP) - sys2.mean(sys2.SP)) < 1e-6);
+
+		compact.restore(compact.snapshot());
+		compact.download();
+		for (std::size_t i = 0; i < sys1.size(); ++i)
+			assert(fabs(sys1.p[i] - sys2.p[i]) <= fabs(sys1.p[i]) / 256 + 1e-7);
+	}
+}
+
+int main()
+{
+	test_mixed_kahan_sum();
+	test_mixed_cme();
+
+	return 0;
+}